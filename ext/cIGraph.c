@@ -15,6 +15,7 @@ void cIGraph_mark(void *p){
   rb_gc_mark(((VALUE*)((igraph_t*)p)->attr)[0]);
   rb_gc_mark(((VALUE*)((igraph_t*)p)->attr)[1]);
   rb_gc_mark(((VALUE*)((igraph_t*)p)->attr)[2]);
+  rb_gc_mark(((VALUE*)((igraph_t*)p)->attr)[4]);
 }
 
 VALUE cIGraph_alloc(VALUE klass){
@@ -238,6 +239,11 @@ void Init_igraph(){
   rb_define_alloc_func(cIGraph, cIGraph_alloc);
   rb_define_method(cIGraph, "initialize",      cIGraph_initialize, -1);
   rb_define_method(cIGraph, "initialize_copy", cIGraph_init_copy,   1);
+  rb_define_method(cIGraph, "_dump",           cIGraph_dump,        1); /* in cIGraph_snapshot.c */
+  rb_define_singleton_method(cIGraph, "_load", cIGraph_load,        1); /* in cIGraph_snapshot.c */
+
+  rb_define_singleton_method(cIGraph, "threads",  cIGraph_get_threads, 0); /* in cIGraph_parallel.c */
+  rb_define_singleton_method(cIGraph, "threads=", cIGraph_set_threads, 1); /* in cIGraph_parallel.c */
 
   rb_include_module(cIGraph, rb_mEnumerable);
 
@@ -315,6 +321,12 @@ void Init_igraph(){
   rb_define_method(cIGraph, "delete_edge",   cIGraph_delete_edge,   2); /* in cIGraph_add_delete.c */
   rb_define_method(cIGraph, "delete_vertex", cIGraph_delete_vertex, 1); /* in cIGraph_add_delete.c */
 
+  rb_define_method(cIGraph, "open_log",    cIGraph_open_log,    1); /* in cIGraph_log.c */
+  rb_define_method(cIGraph, "sync_log",    cIGraph_sync_log,    0); /* in cIGraph_log.c */
+  rb_define_method(cIGraph, "compact_log", cIGraph_compact_log, 0); /* in cIGraph_log.c */
+  rb_define_method(cIGraph, "close_log",   cIGraph_close_log,   0); /* in cIGraph_log.c */
+  rb_define_singleton_method(cIGraph, "replay_log", cIGraph_replay_log, 1); /* in cIGraph_log.c */
+
   rb_define_method(cIGraph, "are_connected",  cIGraph_are_connected,2); /* in cIGraph_basic_properties.c */  
   rb_define_alias (cIGraph, "are_connected?", "are_connected");
 
@@ -338,6 +350,9 @@ void Init_igraph(){
   rb_define_method(cIGraph_shortestpaths, "average_path_length",    cIGraph_average_path_length,    2); /* in cIGraph_shortest_paths.c */  
   rb_define_method(cIGraph_shortestpaths, "diameter",               cIGraph_diameter,               2); /* in cIGraph_shortest_paths.c */
   rb_define_method(cIGraph_shortestpaths, "girth",                  cIGraph_girth,                  0); /* in cIGraph_shortest_paths.c */
+  rb_define_method(cIGraph_shortestpaths, "eccentricity",           cIGraph_eccentricity,           1); /* in cIGraph_eccentricity.c */
+  rb_define_method(cIGraph_shortestpaths, "radius",                 cIGraph_radius,                 0); /* in cIGraph_eccentricity.c */
+  rb_define_method(cIGraph_shortestpaths, "average_path_length_estimate", cIGraph_average_path_length_estimate, 3); /* in cIGraph_eccentricity.c */
 
   rb_define_method(cIGraph_shortestpaths, "dijkstra_shortest_paths", cIGraph_dijkstra_shortest_paths, 3); /* in cIGraph_dijkstra.c */
 
@@ -351,6 +366,10 @@ void Init_igraph(){
   rb_define_alias (cIGraph_neighborhoodm, "neighborhood_size", "neighbourhood_size");
   rb_define_alias (cIGraph_neighborhoodm, "neighborhood", "neighbourhood");
   rb_define_alias (cIGraph_neighborhoodm, "neighborhood_graphs", "neighbourhood_graphs");
+  rb_define_method(cIGraph_neighborhoodm, "approximate_neighbourhood_size",     cIGraph_approximate_neighborhood_size,     4); /* in cIGraph_vertex_neighbourhood.c */
+  rb_define_method(cIGraph_neighborhoodm, "approximate_neighbourhood_function", cIGraph_approximate_neighborhood_function, 3); /* in cIGraph_vertex_neighbourhood.c */
+  rb_define_alias (cIGraph_neighborhoodm, "approximate_neighborhood_size", "approximate_neighbourhood_size");
+  rb_define_alias (cIGraph_neighborhoodm, "approximate_neighborhood_function", "approximate_neighbourhood_function");
   rb_define_method(cIGraph_neighborhoodm, "connect_neighborhood", cIGraph_connect_neighborhood, 2); /* in cIGraph_generators_deterministic.c */
 
   /* Functions for splitting the graph into components */
@@ -372,6 +391,7 @@ void Init_igraph(){
   rb_define_method(cIGraph_closenessm, "pagerank",         cIGraph_pagerank,         5); /* in cIGraph_centrality.c */  
   rb_define_method(cIGraph_closenessm, "constraint",       cIGraph_constraint,      -1); /* in cIGraph_centrality.c */  
   rb_define_method(cIGraph_closenessm, "maxdegree",        cIGraph_maxdegree,        3); /* in cIGraph_centrality.c */    
+  rb_define_method(cIGraph_closenessm, "pagerank_tracker", cIGraph_pagerank_tracker, 4); /* in cIGraph_pagerank.c */
 
   /* Minimum spanning tree functions */
   cIGraph_spanning = rb_define_module_under(cIGraph, "Spanning");
@@ -387,6 +407,9 @@ void Init_igraph(){
   rb_define_method(cIGraph_transitivitym, "transitivity",          cIGraph_transitivity,          0); /* in cIGraph_transitivity.c */
   rb_define_method(cIGraph_transitivitym, "transitivity_local",    cIGraph_transitivity_local,    1); /* in cIGraph_transitivity.c */
   rb_define_method(cIGraph_transitivitym, "transitivity_avglocal", cIGraph_transitivity_avglocal, 0); /* in cIGraph_transitivity.c */
+  rb_define_method(cIGraph_transitivitym, "triangle_count",        cIGraph_triangle_count,        0); /* in cIGraph_transitivity.c */
+  rb_define_method(cIGraph_transitivitym, "local_triangle_count",  cIGraph_local_triangle_count,  1); /* in cIGraph_transitivity.c */
+  rb_define_method(cIGraph_transitivitym, "edge_triangle_count",   cIGraph_edge_triangle_count,   0); /* in cIGraph_transitivity.c */
 
   /* Functions for the Laplacian matrix. */
   cIGraph_spectral = rb_define_module_under(cIGraph, "Spectral");
@@ -415,10 +438,13 @@ void Init_igraph(){
   cIGraph_clique = rb_define_module_under(cIGraph, "Cliques");
   rb_include_module(cIGraph, cIGraph_clique);   
 
-  rb_define_method(cIGraph_clique, "cliques",         cIGraph_cliques,         2); /* in cIGraph_cliques.c */
+  rb_define_method(cIGraph_clique, "cliques",         cIGraph_cliques,        -1); /* in cIGraph_cliques.c */
   rb_define_method(cIGraph_clique, "largest_cliques", cIGraph_largest_cliques, 0); /* in cIGraph_cliques.c */ 
   rb_define_method(cIGraph_clique, "maximal_cliques", cIGraph_maximal_cliques, 0); /* in cIGraph_cliques.c */ 
   rb_define_method(cIGraph_clique, "clique_number",   cIGraph_clique_number,   0); /* in cIGraph_cliques.c */ 
+  rb_define_method(cIGraph_clique, "each_clique",         cIGraph_each_clique,         -1); /* in cIGraph_cliques.c */
+  rb_define_method(cIGraph_clique, "each_maximal_clique", cIGraph_each_maximal_clique, -1); /* in cIGraph_cliques.c */
+  rb_define_method(cIGraph_clique, "each_largest_clique", cIGraph_each_largest_clique, -1); /* in cIGraph_cliques.c */
 
   /* Independent vertex set finding functions */
   cIGraph_indyver = rb_define_module_under(cIGraph, "IndependentVertexSets");
@@ -443,9 +469,10 @@ void Init_igraph(){
   cIGraph_motifs = rb_define_module_under(cIGraph, "Motifs");
   rb_include_module(cIGraph, cIGraph_motifs);  
 
-  rb_define_method(cIGraph_motifs, "motifs_randesu",          cIGraph_motifs_randesu,          2); /* in cIGraph_motif.c */ 
-  rb_define_method(cIGraph_motifs, "motifs_randesu_no",       cIGraph_motifs_randesu_no,       2); /* in cIGraph_motif.c */ 
+  rb_define_method(cIGraph_motifs, "motifs_randesu",          cIGraph_motifs_randesu,          -1); /* in cIGraph_motif.c */ 
+  rb_define_method(cIGraph_motifs, "motifs_randesu_no",       cIGraph_motifs_randesu_no,       -1); /* in cIGraph_motif.c */ 
   rb_define_method(cIGraph_motifs, "motifs_randesu_estimate", cIGraph_motifs_randesu_estimate, 4); /* in cIGraph_motif.c */ 
+  rb_define_method(cIGraph_motifs, "motifs_randesu_adaptive", cIGraph_motifs_randesu_adaptive, -1); /* in cIGraph_motif.c */ 
 
   /* Graph sorting functions. */
   cIGraph_sorting = rb_define_module_under(cIGraph, "Sorting");
@@ -460,6 +487,7 @@ void Init_igraph(){
   #ifdef __APPLE__
   rb_define_singleton_method(cIGraph_fileread, "read_graph_edgelist", cIGraph_unavailable_method, -1);
   rb_define_singleton_method(cIGraph_fileread, "read_graph_graphml",  cIGraph_unavailable_method, -1);
+  rb_define_singleton_method(cIGraph_fileread, "read_graph_graphml_columns", cIGraph_unavailable_method, -1);
   rb_define_singleton_method(cIGraph_fileread, "read_graph_ncol",     cIGraph_unavailable_method, -1);
   rb_define_singleton_method(cIGraph_fileread, "read_graph_lgl",      cIGraph_unavailable_method, -1);
   rb_define_singleton_method(cIGraph_fileread, "read_graph_dimacs",   cIGraph_unavailable_method, -1);
@@ -469,6 +497,7 @@ void Init_igraph(){
   #else
   rb_define_singleton_method(cIGraph_fileread, "read_graph_edgelist", cIGraph_read_graph_edgelist, 2); /* in cIGraph_file.c */
   rb_define_singleton_method(cIGraph_fileread, "read_graph_graphml",  cIGraph_read_graph_graphml, 2);  /* in cIGraph_file.c */  
+  rb_define_singleton_method(cIGraph_fileread, "read_graph_graphml_columns", cIGraph_read_graph_graphml_columns, 2); /* in cIGraph_graphml.c */
   rb_define_singleton_method(cIGraph_fileread, "read_graph_ncol",     cIGraph_read_graph_ncol, 5);     /* in cIGraph_file.c */ 
   rb_define_singleton_method(cIGraph_fileread, "read_graph_lgl",      cIGraph_read_graph_lgl,  3);     /* in cIGraph_file.c */ 
   rb_define_singleton_method(cIGraph_fileread, "read_graph_dimacs",   cIGraph_read_graph_dimacs, 2);     /* in cIGraph_file.c */ 
@@ -476,6 +505,7 @@ void Init_igraph(){
   rb_define_singleton_method(cIGraph_fileread, "read_graph_gml",      cIGraph_read_graph_gml,  1);     /* in cIGraph_file.c */ 
   rb_define_singleton_method(cIGraph_fileread, "read_graph_pajek",    cIGraph_read_graph_pajek, 2);    /* in cIGraph_file.c */
   #endif
+  rb_define_singleton_method(cIGraph_fileread, "read_graph_snapshot", cIGraph_read_graph_snapshot, 1); /* in cIGraph_snapshot.c */
 
   /* Functions for writing graphs to files */
   cIGraph_filewrite = rb_define_module_under(cIGraph, "FileWrite");
@@ -498,6 +528,7 @@ void Init_igraph(){
   rb_define_method(cIGraph_filewrite, "write_graph_dimacs",   cIGraph_write_graph_dimacs, 4);    /* in cIGraph_file.c */ 
   rb_define_method(cIGraph_filewrite, "write_graph_pajek",    cIGraph_write_graph_pajek, 1);     /* in cIGraph_file.c */
   #endif
+  rb_define_method(cIGraph_filewrite, "write_graph_snapshot", cIGraph_write_graph_snapshot, 1); /* in cIGraph_snapshot.c */
 
   /* Graph layout functions */
   cIGraph_layout = rb_define_module_under(cIGraph, "Layout");
@@ -517,6 +548,12 @@ void Init_igraph(){
   rb_define_method(cIGraph_layout, "layout_fruchterman_reingold_3d", cIGraph_layout_fruchterman_reingold_3d, 5); /* in cIGraph_layout3d.c */
   rb_define_method(cIGraph_layout, "layout_kamada_kawai_3d",         cIGraph_layout_kamada_kawai_3d,         5); /* in cIGraph_layout3d.c */
 
+  rb_define_method(cIGraph_layout, "layout_fruchterman_reingold_bh",    cIGraph_layout_fruchterman_reingold_bh,    -1); /* in cIGraph_layout_force.c */
+  rb_define_method(cIGraph_layout, "layout_fruchterman_reingold_bh_3d", cIGraph_layout_fruchterman_reingold_bh_3d, -1); /* in cIGraph_layout_force.c */
+  rb_define_method(cIGraph_layout, "layout_multilevel",    cIGraph_layout_multilevel,    -1); /* in cIGraph_layout_multilevel.c */
+  rb_define_method(cIGraph_layout, "layout_multilevel_3d", cIGraph_layout_multilevel_3d, -1); /* in cIGraph_layout_multilevel.c */
+  rb_define_method(cIGraph_layout, "layout_incremental",   cIGraph_layout_incremental,   -1); /* in cIGraph_layout_incremental.c */
+
   rb_define_singleton_method(cIGraph_layout, "layout_merge_dla", cIGraph_layout_merge_dla, 2); /* in cIGraph_layout.c */
 
   /* Minimum cuts related functions */
@@ -545,7 +582,8 @@ void Init_igraph(){
   cIGraph_community = rb_define_module_under(cIGraph, "Community");
   rb_include_module(cIGraph, cIGraph_community);
   
-  rb_define_method(cIGraph_community, "modularity",   cIGraph_modularity,   1); /* in cIGraph_community.c */
+  rb_define_method(cIGraph_community, "modularity",   cIGraph_modularity,   -1); /* in cIGraph_community.c */
+  rb_define_method(cIGraph_community, "modularity_batch", cIGraph_modularity_batch, -1); /* in cIGraph_community.c */
   rb_define_method(cIGraph_community, "community_to_membership", cIGraph_community_to_membership, 3);  /* in cIGraph_community.c */
   rb_define_method(cIGraph_community, "community_spinglass", cIGraph_community_spinglass, 8);  /* in cIGraph_community.c */
   rb_define_method(cIGraph_community, "community_spinglass_single", cIGraph_community_spinglass_single, 5);  /* in cIGraph_community.c */
@@ -555,6 +593,10 @@ void Init_igraph(){
   rb_define_method(cIGraph_community, "community_edge_betweenness", cIGraph_community_edge_betweenness, 1);  /* in cIGraph_community.c */  
   rb_define_method(cIGraph_community, "community_eb_get_merges", cIGraph_community_eb_get_merges, 1);  /* in cIGraph_community.c */  
   rb_define_method(cIGraph_community, "community_fastgreedy", cIGraph_community_fastgreedy, 0);  /* in cIGraph_community.c */  
+  rb_define_method(cIGraph_community, "community_louvain", cIGraph_community_louvain, -1);  /* in cIGraph_louvain.c */
+  rb_define_method(cIGraph_community, "community_leiden", cIGraph_community_leiden, -1);  /* in cIGraph_louvain.c */
+  rb_define_method(cIGraph_community, "community_label_propagation", cIGraph_community_label_propagation, -1);  /* in cIGraph_label_propagation.c */
+  rb_define_method(cIGraph_community, "community_spinglass_replicas", cIGraph_community_spinglass_replicas, -1);  /* in cIGraph_spinglass.c */
 
   rb_define_const(cIGraph, "VERSION", rb_str_new2("0.9.1"));
 
@@ -605,6 +647,10 @@ void Init_igraph(){
   rb_define_const(cIGraph_community, "SPINCOMM_UPDATE_SIMPLE", INT2NUM(0));
   rb_define_const(cIGraph_community, "SPINCOMM_UPDATE_CONFIG", INT2NUM(1));  
 
+  rb_define_const(cIGraph_community, "LPA_SYNC",     INT2NUM(0));
+  rb_define_const(cIGraph_community, "LPA_SEMISYNC", INT2NUM(1));
+  rb_define_const(cIGraph_community, "LPA_ASYNC",    INT2NUM(2));
+
   /* This class wraps the igraph matrix type. It can be created from and 
    * converted to an Array of Ruby Arrays.
    */
@@ -628,4 +674,42 @@ void Init_igraph(){
 
   rb_define_method(cIGraphMatrix, "to_a", cIGraph_matrix_toa, 0); /* in cIGraph_matrix.c */
 
+  rb_define_method          (cIGraphMatrix, "pack",   cIGraph_matrix_pack,   -1); /* in cIGraph_matrix.c */
+  rb_define_singleton_method(cIGraphMatrix, "unpack", cIGraph_matrix_unpack, -1); /* in cIGraph_matrix.c */
+
+  rb_define_const(cIGraphMatrix, "FLOAT64",      INT2NUM(0));
+  rb_define_const(cIGraphMatrix, "FLOAT32",      INT2NUM(1));
+  rb_define_const(cIGraphMatrix, "ROW_MAJOR",    INT2NUM(0));
+  rb_define_const(cIGraphMatrix, "COLUMN_MAJOR", INT2NUM(1));
+
+  /* This class holds the PageRank of every vertex in a graph and can be
+   * brought up to date cheaply after the graph changes. See
+   * IGraph::Closeness#pagerank_tracker.
+   */
+  cIGraphPageRank = rb_define_class("IGraphPageRank", rb_cObject);
+  rb_undef_alloc_func(cIGraphPageRank);
+
+  rb_define_method(cIGraphPageRank, "refresh",    cIGraph_pagerank_refresh,    0); /* in cIGraph_pagerank.c */
+  rb_define_method(cIGraphPageRank, "iterations", cIGraph_pagerank_iterations, 0); /* in cIGraph_pagerank.c */
+  rb_define_method(cIGraphPageRank, "stale?",     cIGraph_pagerank_stale,      0); /* in cIGraph_pagerank.c */
+  rb_define_method(cIGraphPageRank, "graph",      cIGraph_pagerank_graph,      0); /* in cIGraph_pagerank.c */
+  rb_define_method(cIGraphPageRank, "[]",         cIGraph_pagerank_get,        1); /* in cIGraph_pagerank.c */
+  rb_define_method(cIGraphPageRank, "to_a",       cIGraph_pagerank_toa,        0); /* in cIGraph_pagerank.c */
+
+  /* This class holds the values of one attribute of every vertex or edge
+   * of a graph, as doubles or as Strings kept once each in a dictionary.
+   * See IGraph::FileRead.read_graph_graphml_columns.
+   */
+  cIGraphColumn = rb_define_class("IGraphColumn", rb_cObject);
+  rb_undef_alloc_func(cIGraphColumn);
+  rb_include_module(cIGraphColumn, rb_mEnumerable);
+
+  rb_define_method(cIGraphColumn, "type",       cIGraph_column_type,       0); /* in cIGraph_graphml.c */
+  rb_define_method(cIGraphColumn, "size",       cIGraph_column_size,       0); /* in cIGraph_graphml.c */
+  rb_define_alias (cIGraphColumn, "length",     "size");
+  rb_define_method(cIGraphColumn, "[]",         cIGraph_column_get,        1); /* in cIGraph_graphml.c */
+  rb_define_method(cIGraphColumn, "each",       cIGraph_column_each,       0); /* in cIGraph_graphml.c */
+  rb_define_method(cIGraphColumn, "to_a",       cIGraph_column_toa,        0); /* in cIGraph_graphml.c */
+  rb_define_method(cIGraphColumn, "dictionary", cIGraph_column_dictionary, 0); /* in cIGraph_graphml.c */
+
 }
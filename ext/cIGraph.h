@@ -8,6 +8,8 @@
 extern VALUE cIGraph;
 extern VALUE cIGraphError;
 extern VALUE cIGraphMatrix;
+extern VALUE cIGraphPageRank;
+extern VALUE cIGraphColumn;
 extern igraph_attribute_table_t cIGraph_attribute_table;
 
 //Error and warning handling functions
@@ -21,6 +23,104 @@ igraph_integer_t cIGraph_get_vertex_id(VALUE graph, VALUE v);
 VALUE cIGraph_get_vertex_object(VALUE graph, igraph_integer_t n);
 int cIGraph_vertex_arr_to_id_vec(VALUE graph, VALUE va, igraph_vector_t *nv);
 VALUE cIGraph_include(VALUE self, VALUE v);
+void cIGraph_touch(const igraph_t *graph);
+unsigned long cIGraph_generation(const igraph_t *graph);
+int *cIGraph_membership_unpack(VALUE membership, long int n, long int *len);
+
+//Compressed adjacency lists for the native kernels
+typedef struct {
+  long int n;
+  long int *offset;
+  int *nbr;
+} cIGraph_csr_t;
+
+int  cIGraph_csr_init(const igraph_t *graph, cIGraph_csr_t *csr,
+		      igraph_neimode_t mode, igraph_bool_t simple);
+void cIGraph_csr_destroy(cIGraph_csr_t *csr);
+
+//Running native kernels on worker threads
+int   cIGraph_thread_count(void);
+void  cIGraph_parallel(void *(*func)(void *), void *args, size_t size, int nthreads);
+void  cIGraph_without_gvl(void *(*func)(void *), void *data);
+void  cIGraph_without_gvl_wait(void *(*func)(void *), void *data, void (*wake)(void *));
+int   cIGraph_interrupted(void);
+VALUE cIGraph_get_threads(VALUE self);
+VALUE cIGraph_set_threads(VALUE self, VALUE n);
+
+//Reading and writing igraph's FILE based formats through Ruby IO objects
+int cIGraph_stream_read(VALUE io, int (*parse)(FILE *stream, void *arg), void *arg);
+int cIGraph_stream_write(VALUE io, int (*write)(FILE *stream, void *arg), void *arg, int native);
+
+//Files mapped into memory (or read into a buffer without mmap)
+typedef struct {
+  const char *data;
+  size_t len;
+  int mapped;
+} cIGraph_map_t;
+
+int  cIGraph_map_file(const char *path, cIGraph_map_t *map);
+void cIGraph_unmap_file(cIGraph_map_t *map);
+
+//gzip compressed data, inflated by cIGraph_map_file and the IO readers
+#define CIGRAPH_GZIP_P(data,len) ((len) >= 2 && ((const unsigned char*)(data))[0] == 0x1f && ((const unsigned char*)(data))[1] == 0x8b)
+int  cIGraph_gunzip(const char *data, size_t len, cIGraph_map_t *out);
+
+//Native readers for files given by path
+#define CIGRAPH_FORMAT_EDGELIST 0
+#define CIGRAPH_FORMAT_NCOL     1
+#define CIGRAPH_FORMAT_LGL      2
+VALUE cIGraph_parse_file(VALUE path, int format, VALUE predefnames, int names, int weights, int directed);
+
+typedef struct {
+  unsigned long long state;
+} cIGraph_rng_t;
+
+void  cIGraph_rng_seed(cIGraph_rng_t *rng, unsigned long long seed, int stream);
+unsigned long long cIGraph_rng_next(cIGraph_rng_t *rng);
+double   cIGraph_rng_unif(cIGraph_rng_t *rng);
+long int cIGraph_rng_integer(cIGraph_rng_t *rng, long int n);
+unsigned long long cIGraph_rng_seed_value(VALUE seed);
+
+//Weighted, undirected adjacency lists for the community kernels
+typedef struct {
+  long int n;
+  long int *offset;
+  int *nbr;
+  double *weight;
+  double *self;              //Weight of the loops at each vertex, doubled
+  double *k;                 //Weighted degree
+  double m2;                 //Sum of k, twice the total weight
+} cIGraph_wgraph_t;
+
+void cIGraph_wgraph_init(VALUE self, cIGraph_wgraph_t *g, VALUE weights);
+void cIGraph_wgraph_destroy(cIGraph_wgraph_t *g);
+long int cIGraph_wgraph_colour(cIGraph_wgraph_t *g, cIGraph_rng_t *rng,
+			      int *nodes, long int *coff);
+
+//Barnes-Hut force directed layouts
+typedef struct {
+  cIGraph_wgraph_t *g;
+  int dim;
+  double *pos[3];            //Coordinate columns, moved in place
+  const double *mass;        //Repulsion of each vertex, NULL for 1
+  const int *active;         //Vertices allowed to move, NULL for all
+  long int nactive;
+  const int *fixed;          //Others repelling them, NULL for all the rest
+  long int nfixed;
+  long int niter;
+  double theta;
+  double k;                  //Natural spring length
+  double temp;               //Longest move in the first iteration
+  int nthreads;
+  int failed;
+} cIGraph_force_t;
+
+void *cIGraph_force_run(void *arg);
+VALUE cIGraph_force_matrix(VALUE self, VALUE layout, int dim, double k, VALUE seed);
+
+//Caching native results on a graph until it changes
+VALUE cIGraph_cache_get(VALUE self, const char *name);
+VALUE cIGraph_cache_set(VALUE self, const char *name, VALUE obj);
 
 //IGraph allocation, destruction and intialization
 void Init_igraph(void);
@@ -29,6 +129,8 @@ void cIGraph_mark(void *p);
 VALUE cIGraph_alloc(VALUE klass);
 VALUE cIGraph_initialize(int argc, VALUE *argv, VALUE self);
 VALUE cIGraph_init_copy(VALUE copy, VALUE orig);
+VALUE cIGraph_dump(VALUE self, VALUE level);
+VALUE cIGraph_load(VALUE klass, VALUE str);
 
 //Graph generators
 VALUE cIGraph_adjacency(VALUE self, VALUE matrix, VALUE mode);
@@ -105,6 +207,24 @@ VALUE cIGraph_delete_vertices(VALUE self, VALUE vs);
 VALUE cIGraph_delete_vertex  (VALUE self, VALUE v);
 VALUE cIGraph_add_vertex     (VALUE self, VALUE v);
 
+//Write-ahead logs of the changes made to a graph
+#define CIGRAPH_LOG_DELETE_VERTICES 3
+#define CIGRAPH_LOG_DELETE_EDGES    4
+#define CIGRAPH_LOG_TO_DIRECTED     7
+#define CIGRAPH_LOG_TO_UNDIRECTED   8
+#define CIGRAPH_LOG_SIMPLIFY        9
+
+void cIGraph_log_add_vertices(const igraph_t *graph, long int nv, long int before);
+void cIGraph_log_add_edges   (const igraph_t *graph, const igraph_vector_t *edges, long int before);
+void cIGraph_log_set_edge    (const igraph_t *graph, long int eid, VALUE obj);
+int  cIGraph_log_replace     (igraph_t *graph, int op, const igraph_vector_t *ids, int arg);
+
+VALUE cIGraph_open_log   (VALUE self, VALUE path);
+VALUE cIGraph_sync_log   (VALUE self);
+VALUE cIGraph_compact_log(VALUE self);
+VALUE cIGraph_close_log  (VALUE self);
+VALUE cIGraph_replay_log (VALUE self, VALUE path);
+
 //Basic properties
 VALUE cIGraph_are_connected(VALUE self, VALUE from, VALUE to);
 
@@ -114,6 +234,10 @@ VALUE cIGraph_get_shortest_paths    (VALUE self, VALUE from, VALUE to, VALUE mod
 VALUE cIGraph_get_all_shortest_paths(VALUE self, VALUE from, VALUE to, VALUE mode); 
 VALUE cIGraph_average_path_length   (VALUE self, VALUE directed, VALUE unconn);
 VALUE cIGraph_diameter              (VALUE self, VALUE directed, VALUE unconn);
+VALUE cIGraph_eccentricity          (VALUE self, VALUE vs);
+VALUE cIGraph_radius                (VALUE self);
+VALUE cIGraph_average_path_length_estimate(VALUE self, VALUE directed, VALUE samples, VALUE seed);
+VALUE cIGraph_diameter_path         (VALUE self);
 VALUE cIGraph_girth                 (VALUE self);
 
 VALUE cIGraph_dijkstra_shortest_paths(VALUE self, VALUE from, VALUE weights, VALUE mode);
@@ -127,6 +251,8 @@ int igraph_dijkstra_shortest_paths(const igraph_t *graph,
 VALUE cIGraph_neighborhood_size  (VALUE self, VALUE from, VALUE order, VALUE mode);
 VALUE cIGraph_neighborhood       (VALUE self, VALUE from, VALUE order, VALUE mode);
 VALUE cIGraph_neighborhood_graphs(VALUE self, VALUE from, VALUE order, VALUE mode);
+VALUE cIGraph_approximate_neighborhood_size    (VALUE self, VALUE from, VALUE order, VALUE mode, VALUE precision);
+VALUE cIGraph_approximate_neighborhood_function(VALUE self, VALUE order, VALUE mode, VALUE precision);
 
 //Component functions
 VALUE cIGraph_subcomponent(VALUE self, VALUE v, VALUE mode);
@@ -142,14 +268,40 @@ VALUE cIGraph_pagerank        (VALUE self, VALUE vs, VALUE directed, VALUE niter
 VALUE cIGraph_constraint      (int argc, VALUE *argv, VALUE self);
 VALUE cIGraph_maxdegree       (VALUE self, VALUE vs, VALUE mode, VALUE loops);
 
+//Incremental PageRank
+void  cIGraph_pagerank_mark      (void *p);
+void  cIGraph_pagerank_free      (void *p);
+VALUE cIGraph_pagerank_tracker   (VALUE self, VALUE directed, VALUE niter, VALUE eps, VALUE damping);
+VALUE cIGraph_pagerank_refresh   (VALUE self);
+VALUE cIGraph_pagerank_iterations(VALUE self);
+VALUE cIGraph_pagerank_stale     (VALUE self);
+VALUE cIGraph_pagerank_graph     (VALUE self);
+VALUE cIGraph_pagerank_get       (VALUE self, VALUE v);
+VALUE cIGraph_pagerank_toa       (VALUE self);
+
 //Spanning trees
 VALUE cIGraph_minimum_spanning_tree_prim      (VALUE self, VALUE weights);
 VALUE cIGraph_minimum_spanning_tree_unweighted(VALUE self);
 
 //Transitivity
+typedef struct {
+  long int n;
+  long int m;
+  long int triangles;
+  long int *vtri;     //Triangles through each vertex
+  long int *degree;   //Degree in the simplified graph
+  long int *etri;     //Triangles through each edge, by edge id
+} cIGraph_triangles_t;
+
+cIGraph_triangles_t *cIGraph_triangles(VALUE self);
+void cIGraph_triangles_free(void *p);
+
 VALUE cIGraph_transitivity         (VALUE self);
 VALUE cIGraph_transitivity_local   (VALUE self, VALUE vs);
 VALUE cIGraph_transitivity_avglocal(VALUE self);
+VALUE cIGraph_triangle_count       (VALUE self);
+VALUE cIGraph_local_triangle_count (VALUE self, VALUE vs);
+VALUE cIGraph_edge_triangle_count  (VALUE self);
 
 //Directedness conversion
 VALUE cIGraph_to_directed  (VALUE self, VALUE mode);
@@ -173,10 +325,13 @@ VALUE cIGraph_cocitation   (VALUE self, VALUE vs);
 VALUE cIGraph_get_adjacency(VALUE self, VALUE mode);
 
 //Cliques
-VALUE cIGraph_cliques(VALUE self, VALUE min, VALUE max);
+VALUE cIGraph_cliques(int argc, VALUE *argv, VALUE self);
 VALUE cIGraph_largest_cliques(VALUE self);
 VALUE cIGraph_maximal_cliques(VALUE self);
 VALUE cIGraph_clique_number(VALUE self);
+VALUE cIGraph_each_clique        (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_each_maximal_clique(int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_each_largest_clique(int argc, VALUE *argv, VALUE self);
 
 //Independent vertex sets
 VALUE cIGraph_independent_vertex_sets(VALUE self, VALUE min, VALUE max);
@@ -192,10 +347,11 @@ VALUE cIGraph_isoclass_subgraph(VALUE self, VALUE vs);
 VALUE cIGraph_isoclass_create  (VALUE self, VALUE vn, VALUE iso, VALUE dir);
 
 //Motifs
-VALUE cIGraph_motifs_randesu         (VALUE self, VALUE size, VALUE cuts);
-VALUE cIGraph_motifs_randesu_no      (VALUE self, VALUE size, VALUE cuts);
+VALUE cIGraph_motifs_randesu         (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_motifs_randesu_no      (int argc, VALUE *argv, VALUE self);
 VALUE cIGraph_motifs_randesu_estimate(VALUE self, VALUE size, VALUE cuts, 
 				      VALUE samplen, VALUE samplev);
+VALUE cIGraph_motifs_randesu_adaptive(int argc, VALUE *argv, VALUE self);
 
 //File handling
 VALUE cIGraph_read_graph_edgelist (VALUE self, VALUE file, VALUE mode);
@@ -213,6 +369,19 @@ VALUE cIGraph_read_graph_gml      (VALUE self, VALUE file);
 VALUE cIGraph_write_graph_gml     (VALUE self, VALUE file);
 VALUE cIGraph_read_graph_pajek    (VALUE self, VALUE file);
 VALUE cIGraph_write_graph_pajek   (VALUE self, VALUE file);
+VALUE cIGraph_read_graph_snapshot (VALUE self, VALUE file);
+VALUE cIGraph_write_graph_snapshot(VALUE self, VALUE file);
+VALUE cIGraph_snapshot_read(const char *data, size_t len);
+
+//Streaming GraphML reader and the typed columns it fills
+VALUE cIGraph_read_graph_graphml_columns(VALUE self, VALUE file, VALUE index);
+void  cIGraph_column_free      (void *p);
+VALUE cIGraph_column_type      (VALUE self);
+VALUE cIGraph_column_size      (VALUE self);
+VALUE cIGraph_column_get       (VALUE self, VALUE row);
+VALUE cIGraph_column_each      (VALUE self);
+VALUE cIGraph_column_toa       (VALUE self);
+VALUE cIGraph_column_dictionary(VALUE self);
 
 //Layouts
 VALUE cIGraph_layout_random              (VALUE self);
@@ -266,6 +435,12 @@ VALUE cIGraph_layout_kamada_kawai_3d        (VALUE self,
 					     VALUE coolexp,
 					     VALUE kkconst);
 
+VALUE cIGraph_layout_fruchterman_reingold_bh   (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_layout_fruchterman_reingold_bh_3d(int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_layout_multilevel   (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_layout_multilevel_3d(int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_layout_incremental  (int argc, VALUE *argv, VALUE self);
+
 VALUE cIGraph_layout_merge_dla(VALUE self, VALUE graphs, VALUE layouts);
 
 //Min cuts
@@ -285,7 +460,8 @@ VALUE cIGraph_adhesion(VALUE self);
 VALUE cIGraph_cohesion(VALUE self);
 
 //Community
-VALUE cIGraph_modularity                         (VALUE self, VALUE groups);
+VALUE cIGraph_modularity                         (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_modularity_batch                   (int argc, VALUE *argv, VALUE self);
 VALUE cIGraph_community_to_membership            (VALUE self, VALUE merge, 
 						  VALUE steps, VALUE nodes);
 VALUE cIGraph_community_spinglass                (VALUE self, VALUE weights, 
@@ -314,6 +490,10 @@ VALUE cIGraph_community_edge_betweenness         (VALUE self,
 VALUE cIGraph_community_eb_get_merges            (VALUE self, 
 						  VALUE edges);
 VALUE cIGraph_community_fastgreedy               (VALUE self);
+VALUE cIGraph_community_louvain                  (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_community_leiden                   (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_community_label_propagation      (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_community_spinglass_replicas     (int argc, VALUE *argv, VALUE self);
 
 //Attributes
 int cIGraph_attribute_init(igraph_t *graph, 
@@ -394,6 +574,9 @@ VALUE cIGraph_matrix_scale(VALUE self, VALUE x);
 
 VALUE cIGraph_matrix_toa(VALUE self);
 
+VALUE cIGraph_matrix_pack  (int argc, VALUE *argv, VALUE self);
+VALUE cIGraph_matrix_unpack(int argc, VALUE *argv, VALUE klass);
+
 //Not implemented yet
 //VALUE cIGraph_add_rows(VALUE self, VALUE n);
 //VALUE cIGraph_add_cols(VALUE self, VALUE n);
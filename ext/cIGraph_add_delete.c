@@ -276,6 +276,7 @@ VALUE cIGraph_delete_edge(VALUE self, VALUE from, VALUE to){
 
   igraph_t *graph;
   igraph_integer_t eid = 0;
+  igraph_vector_t ids;
   int from_i;
   int to_i;
 
@@ -286,7 +287,15 @@ VALUE cIGraph_delete_edge(VALUE self, VALUE from, VALUE to){
 
   igraph_get_eid(graph,&eid,from_i,to_i,1);
 
-  igraph_delete_edges(graph,igraph_ess_1(eid));
+  //Deleting goes through the mutation log (if one is open)
+  IGRAPH_CHECK(igraph_vector_init(&ids,1));
+  IGRAPH_FINALLY(igraph_vector_destroy,&ids);
+  VECTOR(ids)[0] = eid;
+
+  cIGraph_log_replace(graph,CIGRAPH_LOG_DELETE_EDGES,&ids,0);
+
+  igraph_vector_destroy(&ids);
+  IGRAPH_FINALLY_CLEAN(1);
 
   return Qnil;
 
@@ -300,15 +309,22 @@ VALUE cIGraph_delete_edge(VALUE self, VALUE from, VALUE to){
 VALUE cIGraph_delete_vertex(VALUE self, VALUE v){
 
   igraph_t *graph;
-  igraph_vs_t vs;
+  igraph_vector_t ids;
+  int vid;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  igraph_vs_1(&vs, cIGraph_get_vertex_id(self,v));
+  //Raises if there is no such vertex, so before anything needs freeing
+  vid = cIGraph_get_vertex_id(self,v);
+
+  IGRAPH_CHECK(igraph_vector_init(&ids,1));
+  IGRAPH_FINALLY(igraph_vector_destroy,&ids);
+  VECTOR(ids)[0] = vid;
 
-  igraph_delete_vertices(graph,vs);
+  cIGraph_log_replace(graph,CIGRAPH_LOG_DELETE_VERTICES,&ids,0);
 
-  igraph_vs_destroy(&vs);
+  igraph_vector_destroy(&ids);
+  IGRAPH_FINALLY_CLEAN(1);
 
   return Qnil; 
 
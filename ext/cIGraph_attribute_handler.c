@@ -39,6 +39,7 @@ VALUE cIGraph_set_edge_attr(VALUE self, VALUE from, VALUE to, VALUE attr){
 
   idx = NUM2INT(cIGraph_get_eid(self, from, to, 1));
   rb_ary_store(e_ary,idx,attr);
+  cIGraph_log_set_edge(graph,idx,attr);
 
   return Qtrue;
 
@@ -83,22 +84,44 @@ igraph_attribute_table_t cIGraph_attribute_table = {
   cIGraph_get_string_edge_attr,
 };
 
+//Every structural change stamps the graph with a fresh value from this
+//counter so that cached native results can tell if they are out of date.
+static unsigned long cIGraph_generation_counter = 0;
+
+void cIGraph_touch(const igraph_t *graph){
+  ((VALUE*)graph->attr)[3] = (VALUE)(++cIGraph_generation_counter);
+}
+
+unsigned long cIGraph_generation(const igraph_t *graph){
+  return (unsigned long)((VALUE*)graph->attr)[3];
+}
+
 int cIGraph_attribute_init(igraph_t *graph, igraph_vector_ptr_t *attr) {
 
   VALUE* attrs;
   int i;
   VALUE key;
   VALUE value;
+  VALUE v_ary, e_ary, hsh;
 
-  attrs = (VALUE*)calloc(3, sizeof(VALUE));
+  attrs = (VALUE*)calloc(5, sizeof(VALUE));
 
   if(!attrs)
     IGRAPH_ERROR("Error allocating Arrays\n", IGRAPH_ENOMEM);
 
   //[0] is vertex array, [1] is edge array, [2] is graph attr
-  attrs[0] = rb_ary_new();
-  attrs[1] = rb_ary_new();
-  attrs[2] = rb_hash_new();
+  //[3] is the generation stamp (not a Ruby object, never marked)
+  //[4] is the mutation log, if one is open (see cIGraph_log.c)
+  //As in cIGraph_attribute_copy the objects are kept on the stack, since
+  //nothing marks attrs yet
+  v_ary = rb_ary_new();
+  e_ary = rb_ary_new();
+  hsh   = rb_hash_new();
+  attrs[0] = v_ary;
+  attrs[1] = e_ary;
+  attrs[2] = hsh;
+  attrs[3] = (VALUE)(++cIGraph_generation_counter);
+  attrs[4] = Qnil;
 
   if(attr){
     for(i=0;i<igraph_vector_ptr_size(attr);i++){
@@ -120,13 +143,17 @@ int cIGraph_attribute_init(igraph_t *graph, igraph_vector_ptr_t *attr) {
 	break;
       }
       if (value){
-	rb_hash_aset((VALUE)attrs[2],key,value);
+	rb_hash_aset(hsh,key,value);
       }
     }
   }
  
   graph->attr = attrs;
 
+  RB_GC_GUARD(v_ary);
+  RB_GC_GUARD(e_ary);
+  RB_GC_GUARD(hsh);
+
   return IGRAPH_SUCCESS;
 }
 
@@ -159,17 +186,29 @@ int cIGraph_attribute_copy(igraph_t *to, const igraph_t *from) {
   VALUE vertex_array = ((VALUE*)from->attr)[0];
   VALUE edge_array   = ((VALUE*)from->attr)[1];
   VALUE graph_attr   = ((VALUE*)from->attr)[2];
+  VALUE v_ary, e_ary, hsh;
 
-  attrs = ALLOC_N(VALUE, 3);
+  //Nothing marks attrs until the copy is wrapped, so the new objects are
+  //kept on the stack until they are all made
+  v_ary = rb_ary_dup(vertex_array);
+  e_ary = rb_ary_dup(edge_array);
+  hsh   = rb_hash_new();
+  rb_hash_foreach(graph_attr, replace_i, hsh);
 
-  attrs[0] = rb_ary_dup(vertex_array);
-  attrs[1] = rb_ary_dup(edge_array);
-  attrs[2] = rb_hash_new();
+  attrs = ALLOC_N(VALUE, 5);
 
-  rb_hash_foreach(graph_attr, replace_i, attrs[2]);
+  attrs[0] = v_ary;
+  attrs[1] = e_ary;
+  attrs[2] = hsh;
+  attrs[3] = (VALUE)(++cIGraph_generation_counter);
+  attrs[4] = Qnil;            //Copies are not logged
 
   to->attr = attrs;  
 
+  RB_GC_GUARD(v_ary);
+  RB_GC_GUARD(e_ary);
+  RB_GC_GUARD(hsh);
+
 #ifdef DEBUG
   printf("Leaving cIGraph_attribute_copy\n");
 #endif
@@ -187,6 +226,9 @@ int cIGraph_attribute_add_vertices(igraph_t *graph, long int nv, igraph_vector_p
   int i,j;
   VALUE vertex_array = ((VALUE*)graph->attr)[0];
   VALUE values;
+  long int before = RARRAY_LEN(vertex_array);
+
+  cIGraph_touch(graph);
 
   if(attr){
 
@@ -241,6 +283,8 @@ int cIGraph_attribute_add_vertices(igraph_t *graph, long int nv, igraph_vector_p
       rb_ary_push(vertex_array,INT2NUM(i));
     }
   }
+
+  cIGraph_log_add_vertices(graph,nv,before);
  
 #ifdef DEBUG
   printf("Leaving cIGraph_attribute_add_vertices\n");
@@ -265,6 +309,8 @@ void cIGraph_attribute_delete_vertices(igraph_t *graph,
  VALUE n_v_ary = rb_ary_new();
  VALUE n_e_ary = rb_ary_new();
 
+ cIGraph_touch(graph);
+
  for(i=0;i<igraph_vector_size(vidx);i++){
    if(VECTOR(*vidx)[i] != 0)
      rb_ary_store(n_v_ary,VECTOR(*vidx)[i]-1,rb_ary_entry(vertex_array,i));
@@ -296,6 +342,9 @@ int cIGraph_attribute_add_edges(igraph_t *graph,
   int i,j;
   VALUE edge_array = ((VALUE*)graph->attr)[1];
   VALUE values;
+  long int before = RARRAY_LEN(edge_array);
+
+  cIGraph_touch(graph);
 
   if(attr){
     //If the only record is of type PY_OBJ then use the values as attributes
@@ -338,6 +387,8 @@ int cIGraph_attribute_add_edges(igraph_t *graph,
     }
   }
 
+  cIGraph_log_add_edges(graph,edges,before);
+
 #ifdef DEBUG
   printf("Leaving cIGraph_attribute_add_edges\n");
 #endif
@@ -356,6 +407,8 @@ void cIGraph_attribute_delete_edges(igraph_t *graph, const igraph_vector_t *idx)
   VALUE edge_array = ((VALUE*)graph->attr)[1];
   VALUE n_e_ary = rb_ary_new();
 
+  cIGraph_touch(graph);
+
   for(i=0;i<igraph_vector_size(idx);i++){
    if(VECTOR(*idx)[i] != 0)
      rb_ary_store(n_e_ary,VECTOR(*idx)[i]-1,rb_ary_entry(edge_array,i));
@@ -382,6 +435,8 @@ int cIGraph_attribute_permute_edges(igraph_t *graph,
   VALUE edge_array = ((VALUE*)graph->attr)[1];
   VALUE n_e_ary = rb_ary_new();
 
+  cIGraph_touch(graph);
+
   for(i=0;i<igraph_vector_size(idx);i++){
     rb_ary_push(n_e_ary,rb_ary_entry(edge_array,VECTOR(*idx)[i]));
   }
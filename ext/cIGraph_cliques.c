@@ -2,106 +2,1067 @@
 #include "ruby.h"
 #include "cIGraph.h"
 
-/* call-seq:
- *   graph.cliques(min_size,max_size) -> Array
- *
- * Find all or some cliques in a graph
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* Native clique engine.
  *
- * Cliques are fully connected subgraphs of a graph.
+ * Vertices are put in degeneracy order (repeatedly removing a vertex of
+ * smallest remaining degree) and each vertex v starts its own subproblem:
+ * the cliques whose earliest vertex in that order is v. The candidates are
+ * v's later neighbours, of which there are at most the degeneracy of the
+ * graph, and its earlier neighbours are the vertices already tried. Maximal
+ * cliques are found with Bron-Kerbosch with pivoting within each
+ * subproblem. Subproblems with few enough vertices are searched with
+ * bitsets for the candidate sets; larger ones use sorted arrays whose
+ * buffers are reused from one clique to the next, so memory is bounded by
+ * the depth of the search rather than the number of cliques.
  *
- * If you are only interested in the size of the largest clique in the 
- * graph, use IGraph#clique_number instead. 
+ * The subproblems are handed out to the worker threads, highest core
+ * first. When streaming to a block the workers pass the cliques to the
+ * Ruby thread through a bounded queue. For the largest cliques the workers
+ * share the size of the best clique found so far and prune any branch that
+ * cannot reach it.
+ */
+
+#define CIGRAPH_CLIQUE_BITSET 256     //Largest subproblem searched with bitsets
+#define CIGRAPH_CLIQUE_QUEUE  65536   //Vertex ids buffered for the Ruby thread
+
+#define CIGRAPH_CLIQUES_ALL     0
+#define CIGRAPH_CLIQUES_MAXIMAL 1
+#define CIGRAPH_CLIQUES_LARGEST 2
+
+typedef unsigned long long cIGraph_clique_word_t;
+
+#define CIGRAPH_CLIQUE_WORDS ((CIGRAPH_CLIQUE_BITSET + 63) / 64)
+
+typedef struct {
+  int *p;                    //Candidates
+  int *x;                    //Already tried (maximal cliques only)
+  int *c;                    //Branches still to take
+  long int pcap;
+  long int xcap;
+  long int ccap;
+} cIGraph_clique_level_t;
+
+struct cIGraph_clique_shared_t;
+
+//One per worker thread
+typedef struct cIGraph_clique_enum_t {
+  struct cIGraph_clique_shared_t *s;
+  int *r;                    //Clique being built
+  int *out;                  //Clique being reported, sorted by id
+  cIGraph_clique_level_t *levels;
+  //Bitset search: local index -> vertex, vertex -> local index (or -1),
+  //local adjacency rows and the p, x and c sets of each level
+  int *local;
+  int *pos;
+  cIGraph_clique_word_t *adj;
+  cIGraph_clique_word_t *bits;
+  //Collected cliques, stored as size followed by the vertex ids
+  int *found;
+  long int nfound;
+  long int foundcap;
+  long int foundsize;
+  int failed;
+} cIGraph_clique_enum_t;
+
+//Shared by all of the workers
+typedef struct cIGraph_clique_shared_t {
+  cIGraph_csr_t csr;
+  int *order;                //Vertices in degeneracy order
+  int *rank;                 //Position of each vertex in order
+  long int nlevels;          //Largest degree + 2
+  int mode;
+  int collect;               //Keep cliques (rather than just the best size)
+  long int min;
+  long int max;
+  long int limit;
+  long int outlimit;         //Cliques to return (CIGRAPH_CLIQUES_LARGEST)
+  long int count;
+  long int best;             //Largest clique seen (CIGRAPH_CLIQUES_LARGEST)
+  long int next;             //Subproblems handed out so far
+  volatile int stop;
+  int nthreads;
+  cIGraph_clique_enum_t *workers;
+  //Called with each clique (out[0..size-1]), returns non-zero to stop
+  int (*report)(cIGraph_clique_enum_t *e, long int size);
+  VALUE self;
+  //Queue of cliques for the Ruby thread (size, then ids)
+  int *queue;
+  int *batch;
+  long int qcap;
+  long int qhead;
+  long int qlen;
+  long int nbatch;
+  int done;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock;
+  pthread_cond_t more;
+  pthread_cond_t room;
+  pthread_t driver;
+  int started;
+#endif
+} cIGraph_clique_shared_t;
+
+static int cIGraph_clique_grow(int **buf, long int *cap, long int size){
+
+  int *p;
+
+  if(size <= *cap)
+    return 1;
+
+  p = realloc(*buf, sizeof(int) * size);
+  if(!p)
+    return 0;
+
+  *buf = p;
+  *cap = size;
+
+  return 1;
+
+}
+
+//Makes sure level d can hold np candidates and nx tried vertices
+static int cIGraph_clique_reserve(cIGraph_clique_enum_t *e, long int d,
+				  long int np, long int nx){
+
+  cIGraph_clique_level_t *l = &e->levels[d];
+
+  if(!cIGraph_clique_grow(&l->p, &l->pcap, np+1) ||
+     !cIGraph_clique_grow(&l->x, &l->xcap, np+nx+1) ||
+     !cIGraph_clique_grow(&l->c, &l->ccap, np+1)){
+    e->failed   = 1;
+    e->s->stop  = 1;
+    return 0;
+  }
+
+  return 1;
+
+}
+
+//Intersects the sorted sets a and b into out (if not NULL), returns the size
+static long int cIGraph_clique_intersect(const int *a, long int na,
+					 const int *b, long int nb, int *out){
+
+  long int i = 0, j = 0, k = 0;
+
+  while(i < na && j < nb){
+    if(a[i] < b[j]){
+      i++;
+    } else if(a[i] > b[j]){
+      j++;
+    } else {
+      if(out)
+	out[k] = a[i];
+      k++;
+      i++;
+      j++;
+    }
+  }
+
+  return k;
+
+}
+
+static int cIGraph_clique_cmp(const void *a, const void *b){
+  int x = *(const int*)a;
+  int y = *(const int*)b;
+  return (x > y) - (x < y);
+}
+
+//Smallest clique still worth finding
+static long int cIGraph_clique_target(cIGraph_clique_enum_t *e){
+
+  cIGraph_clique_shared_t *s = e->s;
+  long int best;
+
+  if(s->mode != CIGRAPH_CLIQUES_LARGEST)
+    return s->min;
+
+  //Ties only matter when the cliques themselves are wanted
+  best = s->best + (s->collect ? 0 : 1);
+  return best > s->min ? best : s->min;
+
+}
+
+static void cIGraph_clique_found(cIGraph_clique_enum_t *e, long int size){
+
+  cIGraph_clique_shared_t *s = e->s;
+  long int c, old;
+
+  if(size < s->min || (s->max > 0 && size > s->max))
+    return;
+
+  if(s->mode == CIGRAPH_CLIQUES_LARGEST){
+    old = s->best;
+    while(size > old && !__sync_bool_compare_and_swap(&s->best, old, size))
+      old = s->best;
+    if(size < s->best || !s->collect)
+      return;
+  }
+
+  c = __sync_add_and_fetch(&s->count, 1);
+  if(s->limit > 0 && c > s->limit){
+    s->stop = 1;
+    return;
+  }
+
+  memcpy(e->out, e->r, sizeof(int) * size);
+  qsort(e->out, size, sizeof(int), cIGraph_clique_cmp);
+  if(s->report(e, size) || (s->limit > 0 && c >= s->limit))
+    s->stop = 1;
+
+}
+
+//Whether to give up, stopping the whole search once Ruby interrupts it
+static int cIGraph_clique_stopped(cIGraph_clique_enum_t *e){
+  if(!e->s->stop && cIGraph_interrupted())
+    e->s->stop = 1;
+  return e->s->stop;
+}
+
+/* Bron-Kerbosch with pivoting over sorted arrays. r[0..d-1] is the clique
+ * so far, level d holds its candidates p and the vertices x that would
+ * extend it but have already been explored.
+ */
+static void cIGraph_clique_bk(cIGraph_clique_enum_t *e, long int d, long int np, long int nx){
+
+  cIGraph_clique_level_t *l = &e->levels[d];
+  cIGraph_csr_t *csr = &e->s->csr;
+  long int i, j, k, nc, best, cnt, deg, degu;
+  int u, v;
+  const int *nu, *nv;
+
+  if(np == 0){
+    if(nx == 0)
+      cIGraph_clique_found(e, d);
+    return;
+  }
+
+  //Too small to reach the target, or every maximal clique below is too big
+  if(d + np < cIGraph_clique_target(e) || (e->s->max > 0 && d >= e->s->max))
+    return;
+
+  //Pivot on the vertex covering most of the candidates
+  u    = l->p[0];
+  best = -1;
+  for(i=0;i<np+nx;i++){
+    v   = i < np ? l->p[i] : l->x[i-np];
+    deg = csr->offset[v+1] - csr->offset[v];
+    if(deg <= best)
+      continue;
+    cnt = cIGraph_clique_intersect(l->p, np, csr->nbr+csr->offset[v], deg, NULL);
+    if(cnt > best){
+      best = cnt;
+      u    = v;
+    }
+  }
+
+  //Only branch on the candidates the pivot does not cover
+  nu   = csr->nbr + csr->offset[u];
+  degu = csr->offset[u+1] - csr->offset[u];
+  nc   = 0;
+  j    = 0;
+  for(i=0;i<np;i++){
+    while(j < degu && nu[j] < l->p[i])
+      j++;
+    if(j < degu && nu[j] == l->p[i])
+      continue;
+    l->c[nc++] = l->p[i];
+  }
+
+  for(k=0;k<nc;k++){
+
+    v   = l->c[k];
+    nv  = csr->nbr + csr->offset[v];
+    deg = csr->offset[v+1] - csr->offset[v];
+
+    if(!cIGraph_clique_reserve(e, d+1, np < deg ? np : deg, nx < deg ? nx : deg))
+      return;
+
+    e->r[d] = v;
+    cIGraph_clique_bk(e, d+1,
+		      cIGraph_clique_intersect(l->p, np, nv, deg, e->levels[d+1].p),
+		      cIGraph_clique_intersect(l->x, nx, nv, deg, e->levels[d+1].x));
+    if(cIGraph_clique_stopped(e))
+      return;
+
+    //Move v from the candidates to the tried vertices, keeping both sorted
+    for(i=0;l->p[i]!=v;i++);
+    memmove(l->p+i, l->p+i+1, sizeof(int) * (np-i-1));
+    np--;
+    for(i=nx;i>0 && l->x[i-1]>v;i--)
+      l->x[i] = l->x[i-1];
+    l->x[i] = v;
+    nx++;
+
+  }
+
+}
+
+static long int cIGraph_clique_popcount(const cIGraph_clique_word_t *a, long int w){
+
+  long int i, c = 0;
+
+  for(i=0;i<w;i++)
+    c += __builtin_popcountll(a[i]);
+
+  return c;
+
+}
+
+/* The same search on a subproblem of at most CIGRAPH_CLIQUE_BITSET
+ * vertices, with p, x and c held as bitsets over the local indices.
+ */
+static void cIGraph_clique_bk_bits(cIGraph_clique_enum_t *e, long int d, long int w){
+
+  cIGraph_clique_word_t *p = e->bits + d * 3 * CIGRAPH_CLIQUE_WORDS;
+  cIGraph_clique_word_t *x = p + CIGRAPH_CLIQUE_WORDS;
+  cIGraph_clique_word_t *c = x + CIGRAPH_CLIQUE_WORDS;
+  cIGraph_clique_word_t *np = p + 3 * CIGRAPH_CLIQUE_WORDS;
+  cIGraph_clique_word_t *nx = np + CIGRAPH_CLIQUE_WORDS;
+  cIGraph_clique_word_t any = 0, m;
+  const cIGraph_clique_word_t *row;
+  long int i, j, v, u, cnt, best, size;
+
+  for(i=0;i<w;i++)
+    any |= p[i];
+  if(!any){
+    for(i=0;i<w;i++)
+      any |= x[i];
+    if(!any)
+      cIGraph_clique_found(e, d);
+    return;
+  }
+
+  size = cIGraph_clique_popcount(p, w);
+  if(d + size < cIGraph_clique_target(e) || (e->s->max > 0 && d >= e->s->max))
+    return;
+
+  //Pivot on the vertex of p or x with most neighbours in p
+  u    = -1;
+  best = -1;
+  for(i=0;i<w;i++){
+    m = p[i] | x[i];
+    while(m){
+      v   = i*64 + __builtin_ctzll(m);
+      m  &= m - 1;
+      row = e->adj + v * CIGRAPH_CLIQUE_WORDS;
+      cnt = 0;
+      for(j=0;j<w;j++)
+	cnt += __builtin_popcountll(p[j] & row[j]);
+      if(cnt > best){
+	best = cnt;
+	u    = v;
+      }
+    }
+  }
+
+  row = e->adj + u * CIGRAPH_CLIQUE_WORDS;
+  for(i=0;i<w;i++)
+    c[i] = p[i] & ~row[i];
+
+  for(i=0;i<w;i++){
+    while(c[i]){
+      v     = i*64 + __builtin_ctzll(c[i]);
+      c[i] &= c[i] - 1;
+      row   = e->adj + v * CIGRAPH_CLIQUE_WORDS;
+      for(j=0;j<w;j++){
+	np[j] = p[j] & row[j];
+	nx[j] = x[j] & row[j];
+      }
+      e->r[d] = e->local[v];
+      cIGraph_clique_bk_bits(e, d+1, w);
+      if(cIGraph_clique_stopped(e))
+	return;
+      p[i] &= ~(1ULL << (v % 64));
+      x[i] |=  (1ULL << (v % 64));
+    }
+  }
+
+}
+
+/* All cliques: the candidates p are kept in increasing id order and a
+ * clique only grows by later candidates, so each is found exactly once.
  */
+static void cIGraph_clique_all(cIGraph_clique_enum_t *e, long int d, long int np){
+
+  cIGraph_clique_level_t *l = &e->levels[d];
+  cIGraph_csr_t *csr = &e->s->csr;
+  long int i, deg;
+  int v;
+
+  cIGraph_clique_found(e, d);
+  if(cIGraph_clique_stopped(e) || (e->s->max > 0 && d >= e->s->max))
+    return;
+
+  for(i=0;i<np;i++){
+
+    if(d + np - i < e->s->min)
+      return;
+
+    v   = l->p[i];
+    deg = csr->offset[v+1] - csr->offset[v];
+
+    if(!cIGraph_clique_reserve(e, d+1, np-i-1 < deg ? np-i-1 : deg, 0))
+      return;
+
+    e->r[d] = v;
+    cIGraph_clique_all(e, d+1,
+		       cIGraph_clique_intersect(l->p+i+1, np-i-1,
+						csr->nbr+csr->offset[v], deg,
+						e->levels[d+1].p));
+    if(cIGraph_clique_stopped(e))
+      return;
+
+  }
+
+}
+
+//Searches the cliques whose earliest vertex in degeneracy order is v
+static void cIGraph_clique_top(cIGraph_clique_enum_t *e, int v){
+
+  cIGraph_clique_shared_t *s = e->s;
+  cIGraph_csr_t *csr = &s->csr;
+  cIGraph_clique_level_t *l;
+  cIGraph_clique_word_t *p, *x, *row;
+  long int j, k, np, nx, deg, ns, w;
+  int u;
+
+  deg = csr->offset[v+1] - csr->offset[v];
+  if(deg + 1 < cIGraph_clique_target(e))
+    return;
+
+  e->r[0] = v;
+
+  if(s->mode != CIGRAPH_CLIQUES_ALL && deg <= CIGRAPH_CLIQUE_BITSET){
+
+    //Later neighbours first, then earlier ones
+    ns = 0;
+    for(j=csr->offset[v];j<csr->offset[v+1];j++){
+      if(s->rank[csr->nbr[j]] > s->rank[v])
+	e->local[ns++] = csr->nbr[j];
+    }
+    np = ns;
+    for(j=csr->offset[v];j<csr->offset[v+1];j++){
+      if(s->rank[csr->nbr[j]] < s->rank[v])
+	e->local[ns++] = csr->nbr[j];
+    }
+    if(np + 1 < cIGraph_clique_target(e))
+      return;
+
+    w = (ns + 63) / 64;
+    if(w == 0)
+      w = 1;
+    for(j=0;j<ns;j++)
+      e->pos[e->local[j]] = j;
+
+    memset(e->adj, 0, sizeof(cIGraph_clique_word_t) * CIGRAPH_CLIQUE_WORDS * (ns+1));
+    for(j=0;j<ns;j++){
+      row = e->adj + j * CIGRAPH_CLIQUE_WORDS;
+      for(k=csr->offset[e->local[j]];k<csr->offset[e->local[j]+1];k++){
+	u = csr->nbr[k];
+	if(e->pos[u] >= 0)
+	  row[e->pos[u] / 64] |= 1ULL << (e->pos[u] % 64);
+      }
+    }
+
+    for(j=0;j<ns;j++)
+      e->pos[e->local[j]] = -1;
+
+    p = e->bits + 3 * CIGRAPH_CLIQUE_WORDS;
+    x = p + CIGRAPH_CLIQUE_WORDS;
+    memset(p, 0, sizeof(cIGraph_clique_word_t) * 2 * CIGRAPH_CLIQUE_WORDS);
+    for(j=0;j<ns;j++){
+      if(j < np)
+	p[j / 64] |= 1ULL << (j % 64);
+      else
+	x[j / 64] |= 1ULL << (j % 64);
+    }
+
+    cIGraph_clique_bk_bits(e, 1, w);
+    return;
+
+  }
+
+  if(!cIGraph_clique_reserve(e, 1, deg, deg))
+    return;
+
+  l  = &e->levels[1];
+  np = nx = 0;
+  for(j=csr->offset[v];j<csr->offset[v+1];j++){
+    if(s->rank[csr->nbr[j]] > s->rank[v])
+      l->p[np++] = csr->nbr[j];
+    else
+      l->x[nx++] = csr->nbr[j];
+  }
+
+  if(s->mode == CIGRAPH_CLIQUES_ALL)
+    cIGraph_clique_all(e, 1, np);
+  else
+    cIGraph_clique_bk(e, 1, np, nx);
+
+}
+
+static void *cIGraph_clique_worker(void *arg){
+
+  cIGraph_clique_enum_t *e = arg;
+  cIGraph_clique_shared_t *s = e->s;
+  long int i;
+
+  //Highest cores first, where the large cliques are
+  while(!cIGraph_clique_stopped(e) && (i = __sync_fetch_and_add(&s->next, 1)) < s->csr.n)
+    cIGraph_clique_top(e, s->order[s->csr.n - 1 - i]);
+
+  return NULL;
+
+}
+
+//Orders the vertices by repeatedly taking one of smallest remaining degree
+static int cIGraph_clique_degeneracy(cIGraph_clique_shared_t *s){
+
+  cIGraph_csr_t *csr = &s->csr;
+  long int n = csr->n;
+  long int *bin, *pos, *deg;
+  long int i, j, d, md = 0, start, num, du, pu, pw, w;
+  int *vert = s->order;
+  int v, u;
+
+  deg = malloc(sizeof(long int) * (n+1));
+  pos = malloc(sizeof(long int) * (n+1));
+  for(i=0;i<n && deg;i++){
+    deg[i] = csr->offset[i+1] - csr->offset[i];
+    if(deg[i] > md)
+      md = deg[i];
+  }
+  bin = calloc(md+1, sizeof(long int));
+  if(!deg || !pos || !bin){
+    free(deg);
+    free(pos);
+    free(bin);
+    return 0;
+  }
+
+  //Bucket sort by degree (Batagelj and Zaversnik)
+  for(i=0;i<n;i++)
+    bin[deg[i]]++;
+  start = 0;
+  for(d=0;d<=md;d++){
+    num    = bin[d];
+    bin[d] = start;
+    start += num;
+  }
+  for(i=0;i<n;i++){
+    pos[i] = bin[deg[i]];
+    vert[pos[i]] = i;
+    bin[deg[i]]++;
+  }
+  for(d=md;d>0;d--)
+    bin[d] = bin[d-1];
+  bin[0] = 0;
+
+  for(i=0;i<n;i++){
+    v = vert[i];
+    for(j=csr->offset[v];j<csr->offset[v+1];j++){
+      u = csr->nbr[j];
+      if(deg[u] > deg[v]){
+	du = deg[u];
+	pu = pos[u];
+	pw = bin[du];
+	w  = vert[pw];
+	if(u != w){
+	  pos[u]  = pw;
+	  vert[pu] = w;
+	  pos[w]  = pu;
+	  vert[pw] = u;
+	}
+	bin[du]++;
+	deg[u]--;
+      }
+    }
+  }
+
+  for(i=0;i<n;i++)
+    s->rank[vert[i]] = i;
+
+  free(deg);
+  free(pos);
+  free(bin);
+
+  return 1;
+
+}
+
+static void cIGraph_clique_free(cIGraph_clique_shared_t *s){
+
+  cIGraph_clique_enum_t *e;
+  long int i;
+  int k;
+
+  if(s->workers){
+    for(k=0;k<s->nthreads;k++){
+      e = &s->workers[k];
+      if(e->levels){
+	for(i=0;i<s->nlevels;i++){
+	  free(e->levels[i].p);
+	  free(e->levels[i].x);
+	  free(e->levels[i].c);
+	}
+      }
+      free(e->levels);
+      free(e->r);
+      free(e->out);
+      free(e->local);
+      free(e->pos);
+      free(e->adj);
+      free(e->bits);
+      free(e->found);
+    }
+  }
+  free(s->workers);
+  free(s->order);
+  free(s->rank);
+  free(s->queue);
+  free(s->batch);
+  cIGraph_csr_destroy(&s->csr);
 
-VALUE cIGraph_cliques(VALUE self, VALUE min, VALUE max){
+}
+
+/* Sets up the shared state and one enumerator per thread. Raises on
+ * failure after releasing everything.
+ */
+static void cIGraph_clique_init(VALUE self, cIGraph_clique_shared_t *s, int mode,
+				long int min, long int max, VALUE limit){
 
   igraph_t *graph;
-  igraph_vector_ptr_t res;
-  igraph_vector_t *vec;
-  int i;
-  int j;
-  VALUE clique;
-  VALUE object;
-  VALUE cliques = rb_ary_new();
+  cIGraph_clique_enum_t *e;
+  long int i;
+  int k, ok;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  igraph_vector_ptr_init(&res,0);
+  memset(s,0,sizeof(cIGraph_clique_shared_t));
+  s->mode     = mode;
+  s->min      = min;
+  s->max      = max;
+  s->limit    = NIL_P(limit) ? 0 : NUM2LONG(limit);
+  //Smaller cliques found on the way do not count towards the limit
+  if(mode == CIGRAPH_CLIQUES_LARGEST){
+    s->outlimit = s->limit;
+    s->limit    = 0;
+  }
+  s->self     = self;
+  s->nthreads = cIGraph_thread_count();
 
-  igraph_cliques(graph, &res, NUM2INT(min), NUM2INT(max));
+  cIGraph_csr_init(graph,&s->csr,IGRAPH_ALL,1);
 
-  for(i=0; i<igraph_vector_ptr_size(&res); i++){
-    clique = rb_ary_new();
-    rb_ary_push(cliques,clique);
-    vec = VECTOR(res)[i];
-    for(j=0; j<igraph_vector_size(vec); j++){
-      vec = VECTOR(res)[i];
-      object = cIGraph_get_vertex_object(self,VECTOR(*vec)[j]);
-      rb_ary_push(clique,object);
+  //No clique is larger than the largest degree plus one
+  s->nlevels = 2;
+  for(i=0;i<s->csr.n;i++){
+    if(s->csr.offset[i+1] - s->csr.offset[i] + 2 > s->nlevels)
+      s->nlevels = s->csr.offset[i+1] - s->csr.offset[i] + 2;
+  }
+
+  s->order   = malloc(sizeof(int) * (s->csr.n+1));
+  s->rank    = malloc(sizeof(int) * (s->csr.n+1));
+  s->workers = calloc(s->nthreads, sizeof(cIGraph_clique_enum_t));
+  ok = s->order && s->rank && s->workers && cIGraph_clique_degeneracy(s);
+
+  for(k=0;ok && k<s->nthreads;k++){
+    e = &s->workers[k];
+    e->s      = s;
+    e->levels = calloc(s->nlevels, sizeof(cIGraph_clique_level_t));
+    e->r      = malloc(sizeof(int) * s->nlevels);
+    e->out    = malloc(sizeof(int) * s->nlevels);
+    e->local  = malloc(sizeof(int) * (CIGRAPH_CLIQUE_BITSET+1));
+    e->pos    = malloc(sizeof(int) * (s->csr.n+1));
+    e->adj    = malloc(sizeof(cIGraph_clique_word_t) * CIGRAPH_CLIQUE_WORDS * (CIGRAPH_CLIQUE_BITSET+1));
+    e->bits   = malloc(sizeof(cIGraph_clique_word_t) * CIGRAPH_CLIQUE_WORDS * 3 * (CIGRAPH_CLIQUE_BITSET+3));
+    ok = e->levels && e->r && e->out && e->local && e->pos && e->adj && e->bits;
+    for(i=0;ok && i<s->csr.n;i++)
+      e->pos[i] = -1;
+  }
+
+  if(!ok){
+    cIGraph_clique_free(s);
+    rb_raise(rb_eNoMemError, "Error allocating clique search buffers");
+  }
+
+}
+
+static int cIGraph_clique_failed(cIGraph_clique_shared_t *s){
+
+  int k;
+
+  for(k=0;k<s->nthreads;k++){
+    if(s->workers[k].failed)
+      return 1;
+  }
+
+  return 0;
+
+}
+
+static void *cIGraph_clique_run_all(void *arg){
+
+  cIGraph_clique_shared_t *s = arg;
+
+  cIGraph_parallel(cIGraph_clique_worker, s->workers, sizeof(cIGraph_clique_enum_t), s->nthreads);
+
+  return NULL;
+
+}
+
+/* Collecting */
+
+static int cIGraph_clique_collect(cIGraph_clique_enum_t *e, long int size){
+
+  if(e->s->mode == CIGRAPH_CLIQUES_LARGEST && size > e->foundsize){
+    e->nfound    = 0;
+    e->foundsize = size;
+  }
+
+  if(!cIGraph_clique_grow(&e->found, &e->foundcap, e->nfound + size + 1)){
+    e->failed = 1;
+    return 1;
+  }
+
+  e->found[e->nfound++] = (int)size;
+  memcpy(e->found + e->nfound, e->out, sizeof(int) * size);
+  e->nfound += size;
+
+  return 0;
+
+}
+
+static int cIGraph_clique_lex(const void *a, const void *b){
+
+  const int *x = *(int * const *)a;
+  const int *y = *(int * const *)b;
+  int i;
+
+  for(i=1;i<=x[0] && i<=y[0];i++){
+    if(x[i] != y[i])
+      return x[i] < y[i] ? -1 : 1;
+  }
+
+  return (x[0] > y[0]) - (x[0] < y[0]);
+
+}
+
+static VALUE cIGraph_clique_to_a(VALUE arg){
+
+  cIGraph_clique_shared_t *s = (cIGraph_clique_shared_t*)arg;
+  cIGraph_clique_enum_t *e;
+  VALUE cliques = rb_ary_new();
+  VALUE clique;
+  int **list;
+  long int n = 0, i, j;
+  int k;
+
+  for(k=0;k<s->nthreads;k++){
+    e = &s->workers[k];
+    for(i=0;i<e->nfound;i+=e->found[i]+1)
+      n++;
+  }
+
+  list = malloc(sizeof(int*) * (n+1));
+  if(!list)
+    rb_raise(rb_eNoMemError, "Error allocating clique list");
+
+  n = 0;
+  for(k=0;k<s->nthreads;k++){
+    e = &s->workers[k];
+    for(i=0;i<e->nfound;i+=e->found[i]+1){
+      if(s->mode != CIGRAPH_CLIQUES_LARGEST || e->found[i] == s->best)
+	list[n++] = e->found + i;
     }
   }
 
-  for(i=0;i<igraph_vector_ptr_size(&res);i++){
-    igraph_vector_destroy(VECTOR(res)[i]);
-    free(VECTOR(res)[i]);
+  //The threads finish in any order, sort so the result does not
+  qsort(list, n, sizeof(int*), cIGraph_clique_lex);
+  if(s->outlimit > 0 && n > s->outlimit)
+    n = s->outlimit;
+
+  for(i=0;i<n;i++){
+    clique = rb_ary_new();
+    for(j=1;j<=list[i][0];j++)
+      rb_ary_push(clique,cIGraph_get_vertex_object(s->self,list[i][j]));
+    if(rb_block_given_p())
+      rb_yield(clique);
+    else
+      rb_ary_push(cliques,clique);
   }
 
-  igraph_vector_ptr_destroy(&res);
+  free(list);
 
   return cliques;
-  
+
+}
+
+static VALUE cIGraph_clique_release(VALUE arg){
+  cIGraph_clique_free((cIGraph_clique_shared_t*)arg);
+  return Qnil;
+}
+
+/* Runs the whole search on the worker threads and returns the cliques
+ * found, sorted, as an Array (or yields them if there is a block).
+ */
+static VALUE cIGraph_clique_gather(VALUE self, int mode, long int min, long int max, VALUE limit){
+
+  cIGraph_clique_shared_t s;
+
+  cIGraph_clique_init(self,&s,mode,min,max,limit);
+  s.collect = 1;
+  s.report  = cIGraph_clique_collect;
+
+  cIGraph_without_gvl(cIGraph_clique_run_all, &s);
+
+  if(cIGraph_clique_failed(&s)){
+    cIGraph_clique_free(&s);
+    rb_raise(rb_eNoMemError, "Error allocating clique search buffers");
+  }
+
+  return rb_ensure(cIGraph_clique_to_a, (VALUE)&s, cIGraph_clique_release, (VALUE)&s);
+
+}
+
+/* Streaming */
+
+static void cIGraph_clique_yield_ids(VALUE self, const int *ids, long int size){
+
+  VALUE clique = rb_ary_new();
+  long int i;
+
+  for(i=0;i<size;i++)
+    rb_ary_push(clique,cIGraph_get_vertex_object(self,ids[i]));
+  rb_yield(clique);
+
+}
+
+//Single threaded: yield straight from the search
+static int cIGraph_clique_yield(cIGraph_clique_enum_t *e, long int size){
+  cIGraph_clique_yield_ids(e->s->self, e->out, size);
+  return 0;
+}
+
+static VALUE cIGraph_clique_run_here(VALUE arg){
+
+  cIGraph_clique_shared_t *s = (cIGraph_clique_shared_t*)arg;
+
+  cIGraph_clique_worker(&s->workers[0]);
+
+  if(cIGraph_clique_failed(s))
+    rb_raise(rb_eNoMemError, "Error allocating clique search buffers");
+
+  return Qnil;
+
+}
+
+#ifdef HAVE_PTHREAD_H
+
+//Worker side of the queue: waits for room, never for the Ruby thread
+static int cIGraph_clique_enqueue(cIGraph_clique_enum_t *e, long int size){
+
+  cIGraph_clique_shared_t *s = e->s;
+  long int i;
+
+  pthread_mutex_lock(&s->lock);
+  while(s->qlen + size + 1 > s->qcap && !s->stop)
+    pthread_cond_wait(&s->room, &s->lock);
+  if(!s->stop){
+    s->queue[(s->qhead + s->qlen++) % s->qcap] = (int)size;
+    for(i=0;i<size;i++)
+      s->queue[(s->qhead + s->qlen++) % s->qcap] = e->out[i];
+    pthread_cond_signal(&s->more);
+  }
+  pthread_mutex_unlock(&s->lock);
+
+  return 0;
+
+}
+
+static void *cIGraph_clique_driver(void *arg){
+
+  cIGraph_clique_shared_t *s = arg;
+
+  cIGraph_clique_run_all(s);
+
+  pthread_mutex_lock(&s->lock);
+  s->done = 1;
+  pthread_cond_broadcast(&s->more);
+  pthread_mutex_unlock(&s->lock);
+
+  return NULL;
+
+}
+
+//Ruby side of the queue: takes everything queued, run without the GVL
+static void *cIGraph_clique_dequeue(void *arg){
+
+  cIGraph_clique_shared_t *s = arg;
+
+  pthread_mutex_lock(&s->lock);
+  while(s->qlen == 0 && !s->done && !cIGraph_interrupted())
+    pthread_cond_wait(&s->more, &s->lock);
+  for(s->nbatch=0;s->nbatch<s->qlen;s->nbatch++)
+    s->batch[s->nbatch] = s->queue[(s->qhead + s->nbatch) % s->qcap];
+  s->qhead = (s->qhead + s->qlen) % s->qcap;
+  s->qlen  = 0;
+  pthread_cond_broadcast(&s->room);
+  pthread_mutex_unlock(&s->lock);
+
+  return NULL;
+
+}
+
+//Rouses cIGraph_clique_dequeue when Ruby interrupts it
+static void cIGraph_clique_wake(void *arg){
+
+  cIGraph_clique_shared_t *s = arg;
+
+  pthread_mutex_lock(&s->lock);
+  pthread_cond_broadcast(&s->more);
+  pthread_mutex_unlock(&s->lock);
+
+}
+
+static VALUE cIGraph_clique_consume(VALUE arg){
+
+  cIGraph_clique_shared_t *s = (cIGraph_clique_shared_t*)arg;
+  long int i;
+
+  if(pthread_create(&s->driver, NULL, cIGraph_clique_driver, s) != 0)
+    rb_raise(cIGraphError, "Unable to start clique search thread\n");
+  s->started = 1;
+
+  for(;;){
+    cIGraph_without_gvl_wait(cIGraph_clique_dequeue, s, cIGraph_clique_wake);
+    if(s->nbatch == 0)
+      break;
+    for(i=0;i<s->nbatch;i+=s->batch[i]+1)
+      cIGraph_clique_yield_ids(s->self, s->batch+i+1, s->batch[i]);
+  }
+
+  if(cIGraph_clique_failed(s))
+    rb_raise(rb_eNoMemError, "Error allocating clique search buffers");
+
+  return Qnil;
+
+}
+
+//Stops the workers (the block may have broken out early) and cleans up
+static VALUE cIGraph_clique_shutdown(VALUE arg){
+
+  cIGraph_clique_shared_t *s = (cIGraph_clique_shared_t*)arg;
+
+  if(s->started){
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->room);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->driver, NULL);
+  }
+
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->more);
+  pthread_cond_destroy(&s->room);
+  cIGraph_clique_free(s);
+
+  return Qnil;
+
+}
+
+#endif
+
+/* Runs the enumeration, yielding each clique as it is found. The buffers
+ * are released even if the block breaks out early or raises.
+ */
+static void cIGraph_clique_stream(VALUE self, int mode, long int min,
+				  long int max, VALUE limit){
+
+  cIGraph_clique_shared_t s;
+
+  cIGraph_clique_init(self,&s,mode,min,max,limit);
+
+#ifdef HAVE_PTHREAD_H
+  if(s.nthreads > 1){
+    s.qcap   = CIGRAPH_CLIQUE_QUEUE > 2*s.nlevels ? CIGRAPH_CLIQUE_QUEUE : 2*s.nlevels;
+    s.queue  = malloc(sizeof(int) * s.qcap);
+    s.batch  = malloc(sizeof(int) * s.qcap);
+    s.report = cIGraph_clique_enqueue;
+    if(!s.queue || !s.batch){
+      cIGraph_clique_free(&s);
+      rb_raise(rb_eNoMemError, "Error allocating clique queue");
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.more, NULL);
+    pthread_cond_init(&s.room, NULL);
+    rb_ensure(cIGraph_clique_consume, (VALUE)&s, cIGraph_clique_shutdown, (VALUE)&s);
+    return;
+  }
+#endif
+
+  s.report = cIGraph_clique_yield;
+  rb_ensure(cIGraph_clique_run_here, (VALUE)&s, cIGraph_clique_release, (VALUE)&s);
+
 }
 
 /* call-seq:
- *   graph.largest_cliques() -> Array
+ *   graph.cliques(min_size,max_size,limit=nil) -> Array
  *
- * Finds the largest clique(s) in a graph.
+ * Find all or some cliques in a graph
  *
- * A clique is largest (quite intuitively) if there is no other clique in 
- * the graph which contains more vertices.
+ * Cliques are fully connected subgraphs of a graph. Only those with
+ * between min_size and max_size vertices (0 for no limit) are returned,
+ * and no more than limit of them if limit is given.
+ *
+ * If you are only interested in the size of the largest clique in the
+ * graph, use IGraph#clique_number instead.
  *
- * Note that this is not neccessarily the same as a maximal clique, ie. 
- * the largest cliques are always maximal but a maximal clique is not always 
- * largest. 
+ * The search runs on the worker threads (see IGraph.threads). Each clique
+ * and the list are sorted by vertex id. Given a block each clique is
+ * yielded as it is found instead of being collected into an Array (see
+ * IGraph#each_clique).
  */
 
-VALUE cIGraph_largest_cliques(VALUE self){
+VALUE cIGraph_cliques(int argc, VALUE *argv, VALUE self){
 
-  igraph_t *graph;
-  igraph_vector_ptr_t res;
-  igraph_vector_t *vec;
-  int i;
-  int j;
-  VALUE clique;
-  VALUE object;
-  VALUE cliques = rb_ary_new();
+  VALUE min, max, limit;
 
-  Data_Get_Struct(self, igraph_t, graph);
+  if(rb_block_given_p())
+    return cIGraph_each_clique(argc,argv,self);
 
-  igraph_vector_ptr_init(&res,0);
+  rb_scan_args(argc,argv,"21", &min, &max, &limit);
 
-  igraph_largest_cliques(graph, &res);
+  return cIGraph_clique_gather(self,CIGRAPH_CLIQUES_ALL,NUM2LONG(min),NUM2LONG(max),limit);
 
-  for(i=0; i<igraph_vector_ptr_size(&res); i++){
-    clique = rb_ary_new();
-    rb_ary_push(cliques,clique);
-    vec = VECTOR(res)[i];
-    for(j=0; j<igraph_vector_size(vec); j++){
-      vec = VECTOR(res)[i];
-      object = cIGraph_get_vertex_object(self,VECTOR(*vec)[j]);
-      rb_ary_push(clique,object);
-    }
-  }
+}
 
-  for(i=0;i<igraph_vector_ptr_size(&res);i++){
-    igraph_vector_destroy(VECTOR(res)[i]);
-    free(VECTOR(res)[i]);
-  }
+/* call-seq:
+ *   graph.largest_cliques() -> Array
+ *
+ * Finds the largest clique(s) in a graph.
+ *
+ * A clique is largest (quite intuitively) if there is no other clique in
+ * the graph which contains more vertices.
+ *
+ * Note that this is not neccessarily the same as a maximal clique, ie.
+ * the largest cliques are always maximal but a maximal clique is not always
+ * largest.
+ *
+ * The search runs on the worker threads (see IGraph.threads), which share
+ * the size of the largest clique found so far to prune the search. Each
+ * clique and the list are sorted by vertex id. Given a block each clique
+ * is yielded instead of being collected into an Array.
+ */
 
-  igraph_vector_ptr_destroy(&res);
+VALUE cIGraph_largest_cliques(VALUE self){
+
+  return cIGraph_clique_gather(self,CIGRAPH_CLIQUES_LARGEST,0,0,Qnil);
 
-  return cliques;
-  
 }
 
 /* call-seq:
@@ -109,70 +1070,127 @@ VALUE cIGraph_largest_cliques(VALUE self){
  *
  * Find all maximal cliques of a graph
  *
- * A maximal clique is a clique which can't be extended any more by adding a 
- * new vertex to it. This is actually implemented by looking for a maximal 
- * independent vertex set in the complementer of the graph.
+ * A maximal clique is a clique which can't be extended any more by adding a
+ * new vertex to it.
+ *
+ * If you are only interested in the size of the largest clique in the
+ * graph, use IGraph#clique_number instead.
  *
- * If you are only interested in the size of the largest clique in the 
- * graph, use IGraph#clique_number instead. 
+ * The search runs on the worker threads (see IGraph.threads). Each clique
+ * and the list are sorted by vertex id. Given a block each clique is
+ * yielded as it is found instead of being collected into an Array (see
+ * IGraph#each_maximal_clique).
  */
 
 VALUE cIGraph_maximal_cliques(VALUE self){
 
-  igraph_t *graph;
-  igraph_vector_ptr_t res;
-  igraph_vector_t *vec;
-  int i;
-  int j;
-  VALUE clique;
-  VALUE object;
-  VALUE cliques = rb_ary_new();
+  if(rb_block_given_p())
+    return cIGraph_each_maximal_clique(0,NULL,self);
 
-  Data_Get_Struct(self, igraph_t, graph);
+  return cIGraph_clique_gather(self,CIGRAPH_CLIQUES_MAXIMAL,0,0,Qnil);
 
-  igraph_vector_ptr_init(&res,0);
+}
 
-  igraph_maximal_cliques(graph, &res);
+/* call-seq:
+ *   graph.clique_number() -> Integer
+ *
+ * Find the clique number of the graph
+ *
+ * The clique number of a graph is the size of the largest clique. The
+ * search runs on the worker threads and skips any branch that cannot beat
+ * the largest clique found so far.
+ */
 
-  for(i=0; i<igraph_vector_ptr_size(&res); i++){
-    clique = rb_ary_new();
-    rb_ary_push(cliques,clique);
-    vec = VECTOR(res)[i];
-    for(j=0; j<igraph_vector_size(vec); j++){
-      vec = VECTOR(res)[i];
-      object = cIGraph_get_vertex_object(self,VECTOR(*vec)[j]);
-      rb_ary_push(clique,object);
-    }
-  }
+VALUE cIGraph_clique_number(VALUE self){
+
+  cIGraph_clique_shared_t s;
+  long int best;
 
-  for(i=0;i<igraph_vector_ptr_size(&res);i++){
-    igraph_vector_destroy(VECTOR(res)[i]);
-    free(VECTOR(res)[i]);
+  cIGraph_clique_init(self,&s,CIGRAPH_CLIQUES_LARGEST,0,0,Qnil);
+  s.report = cIGraph_clique_collect;
+
+  cIGraph_without_gvl(cIGraph_clique_run_all, &s);
+
+  best = s.best;
+  if(cIGraph_clique_failed(&s)){
+    cIGraph_clique_free(&s);
+    rb_raise(rb_eNoMemError, "Error allocating clique search buffers");
   }
+  cIGraph_clique_free(&s);
 
-  igraph_vector_ptr_destroy(&res);
+  return LONG2NUM(best);
 
-  return cliques;
-  
 }
 
 /* call-seq:
- *   graph.clique_number() -> Integer
+ *   graph.each_clique(min_size,max_size,limit=nil){|clique| } -> nil
+ *   graph.each_clique(min_size,max_size,limit=nil) -> Enumerator
  *
- * Find the clique number of the graph
+ * Yields each clique of the graph with between min_size and max_size
+ * vertices (0 for no limit) as an Array of vertices, stopping after limit
+ * cliques if limit is given. Cliques are produced one at a time as they
+ * are found so memory use does not depend on how many there are. Without a
+ * block an Enumerator is returned, so e.g. each_clique(3,0).lazy.first(10)
+ * only searches as far as the tenth triangle or larger clique.
  *
- * The clique number of a graph is the size of the largest clique. 
+ * With more than one thread (see IGraph.threads) the search runs on the
+ * worker threads and the cliques are yielded in whatever order they are
+ * found.
  */
+VALUE cIGraph_each_clique(int argc, VALUE *argv, VALUE self){
 
-VALUE cIGraph_clique_number(VALUE self){
+  VALUE min, max, limit;
 
-  igraph_t *graph;
-  igraph_integer_t res;
+  RETURN_ENUMERATOR(self, argc, argv);
 
-  Data_Get_Struct(self, igraph_t, graph);
+  rb_scan_args(argc,argv,"21", &min, &max, &limit);
+
+  cIGraph_clique_stream(self,CIGRAPH_CLIQUES_ALL,NUM2LONG(min),NUM2LONG(max),limit);
+
+  return Qnil;
+
+}
+
+/* call-seq:
+ *   graph.each_maximal_clique(min_size=0,limit=nil){|clique| } -> nil
+ *   graph.each_maximal_clique(min_size=0,limit=nil) -> Enumerator
+ *
+ * Yields each maximal clique of the graph with at least min_size vertices
+ * as an Array of vertices, stopping after limit cliques if limit is given.
+ * See IGraph#each_clique.
+ */
+VALUE cIGraph_each_maximal_clique(int argc, VALUE *argv, VALUE self){
+
+  VALUE min, limit;
+
+  RETURN_ENUMERATOR(self, argc, argv);
+
+  rb_scan_args(argc,argv,"02", &min, &limit);
+
+  cIGraph_clique_stream(self,CIGRAPH_CLIQUES_MAXIMAL,NIL_P(min) ? 0 : NUM2LONG(min),0,limit);
+
+  return Qnil;
+
+}
+
+/* call-seq:
+ *   graph.each_largest_clique(limit=nil){|clique| } -> nil
+ *   graph.each_largest_clique(limit=nil) -> Enumerator
+ *
+ * Yields each of the largest cliques of the graph as an Array of vertices,
+ * stopping after limit cliques if limit is given. See
+ * IGraph#largest_cliques.
+ */
+VALUE cIGraph_each_largest_clique(int argc, VALUE *argv, VALUE self){
+
+  VALUE limit;
+
+  RETURN_ENUMERATOR(self, argc, argv);
+
+  rb_scan_args(argc,argv,"01", &limit);
+
+  cIGraph_clique_gather(self,CIGRAPH_CLIQUES_LARGEST,0,0,limit);
 
-  igraph_clique_number(graph, &res);
+  return Qnil;
 
-  return INT2NUM(res);
-  
 }
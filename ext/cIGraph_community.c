@@ -2,43 +2,308 @@
 #include "ruby.h"
 #include "cIGraph.h"
 
+#define CIGRAPH_MODULARITY_CHUNK 1024
+
+//Shared by the workers scoring a batch of partitions
+typedef struct {
+  cIGraph_wgraph_t *g;
+  const int *memb;        //Vertex major: memb[u*npart + p]
+  long int npart;
+  long int next;          //Next vertex block of the edge pass
+  long int nextp;         //Next partition of the degree pass
+  double *sqtot;          //Sum over communities of the squared degree totals
+} cIGraph_modularity_shared_t;
+
+typedef struct {
+  cIGraph_modularity_shared_t *s;
+  double *in;             //Weight inside communities, per partition
+  double *tot;            //Scratch community degree totals
+  int failed;
+} cIGraph_modularity_worker_t;
+
+static void *cIGraph_modularity_worker(void *arg){
+
+  cIGraph_modularity_worker_t *w = arg;
+  cIGraph_modularity_shared_t *s = w->s;
+  cIGraph_wgraph_t *g = s->g;
+  long int n = g->n, P = s->npart;
+  long int start, end, u, j, p;
+  const int *mu, *mv;
+  double sq;
+
+  //One pass over the adjacency lists scores every partition
+  while((start = __sync_fetch_and_add(&s->next, CIGRAPH_MODULARITY_CHUNK)) < n){
+    end = start + CIGRAPH_MODULARITY_CHUNK < n ? start + CIGRAPH_MODULARITY_CHUNK : n;
+    for(u=start;u<end;u++){
+      mu = s->memb + u*P;
+      for(p=0;p<P;p++)
+	w->in[p] += g->self[u];
+      for(j=g->offset[u];j<g->offset[u+1];j++){
+	mv = s->memb + (long int)g->nbr[j]*P;
+	for(p=0;p<P;p++)
+	  if(mu[p] == mv[p])
+	    w->in[p] += g->weight[j];
+      }
+    }
+  }
+
+  if(!w->tot){
+    w->tot = calloc(n+1, sizeof(double));
+    if(!w->tot){
+      w->failed = 1;
+      return NULL;
+    }
+  }
+
+  //Community degree totals, one partition at a time
+  while((p = __sync_fetch_and_add(&s->nextp, 1)) < P){
+    for(u=0;u<n;u++)
+      w->tot[s->memb[u*P + p]] += g->k[u];
+    sq = 0;
+    for(u=0;u<n;u++){
+      j = s->memb[u*P + p];
+      sq += w->tot[j] * w->tot[j];
+      w->tot[j] = 0;
+    }
+    s->sqtot[p] = sq;
+  }
+
+  return NULL;
+
+}
+
+/* Scores npart partitions of g, given vertex major in memb, into q. Runs
+ * without the GVL; returns non-zero if out of memory.
+ */
+static int cIGraph_modularity_run(cIGraph_wgraph_t *g, const int *memb,
+				  long int npart, double *q){
+
+  cIGraph_modularity_shared_t s;
+  cIGraph_modularity_worker_t *workers;
+  int nthreads = cIGraph_thread_count(), failed = 0, t;
+  long int p;
+  double in;
+
+  if(g->n < CIGRAPH_MODULARITY_CHUNK)
+    nthreads = 1;
+
+  s.g     = g;
+  s.memb  = memb;
+  s.npart = npart;
+  s.next  = 0;
+  s.nextp = 0;
+  s.sqtot = calloc(npart+1, sizeof(double));
+  workers = calloc(nthreads, sizeof(cIGraph_modularity_worker_t));
+  if(!s.sqtot || !workers){
+    free(s.sqtot);
+    free(workers);
+    return 1;
+  }
+  for(t=0;t<nthreads;t++){
+    workers[t].s  = &s;
+    workers[t].in = calloc(npart+1, sizeof(double));
+    if(!workers[t].in)
+      failed = 1;
+  }
+
+  if(!failed)
+    cIGraph_parallel(cIGraph_modularity_worker, workers,
+		     sizeof(cIGraph_modularity_worker_t), nthreads);
+
+  for(p=0;!failed && p<npart;p++){
+    in = 0;
+    for(t=0;t<nthreads;t++){
+      if(workers[t].failed)
+	failed = 1;
+      in += workers[t].in[p];
+    }
+    q[p] = in / g->m2 - s.sqtot[p] / (g->m2 * g->m2);
+  }
+
+  for(t=0;t<nthreads;t++){
+    free(workers[t].in);
+    free(workers[t].tot);
+  }
+  free(workers);
+  free(s.sqtot);
+
+  return failed;
+
+}
+
+typedef struct {
+  cIGraph_wgraph_t *g;
+  const int *memb;
+  long int npart;
+  double *q;
+  int failed;
+} cIGraph_modularity_job_t;
+
+static void *cIGraph_modularity_job(void *arg){
+  cIGraph_modularity_job_t *job = arg;
+  job->failed = cIGraph_modularity_run(job->g, job->memb, job->npart, job->q);
+  return NULL;
+}
+
+/* Reads one partition of the graph into column p of the vertex major
+ * buffer memb. Accepts an Array of Arrays of vertices (vertices in none of
+ * the groups go in the first one), or a membership vector as a packed
+ * String of native ints or an Array of Integers. vindex caches a Hash of
+ * vertex ids, built the first time it is needed.
+ */
+static void cIGraph_modularity_partition(VALUE self, VALUE groups, VALUE *vindex,
+					 int *memb, long int npart, long int p){
+
+  igraph_t *graph;
+  long int n, len, i, j;
+  int *m;
+  VALUE v_ary, group, idx;
+
+  Data_Get_Struct(self, igraph_t, graph);
+  n = (long int)igraph_vcount(graph);
+
+  if(TYPE(groups) == T_ARRAY &&
+     (RARRAY_LEN(groups) == 0 || TYPE(RARRAY_PTR(groups)[0]) == T_ARRAY)){
+    //Vertex objects to ids, built once rather than searched for each member
+    if(NIL_P(*vindex)){
+      *vindex = rb_hash_new();
+      v_ary   = ((VALUE*)graph->attr)[0];
+      for(i=0;i<n;i++)
+	rb_hash_aset(*vindex, rb_ary_entry(v_ary,i), LONG2FIX(i));
+    }
+    //Group numbers are membership ids, which must stay below n
+    if(RARRAY_LEN(groups) > n)
+      rb_raise(cIGraphError, "There must be no more groups than the %ld vertices\n", n);
+    for(i=0;i<n;i++)
+      memb[i*npart + p] = 0;
+    for(i=0;i<RARRAY_LEN(groups);i++){
+      group = rb_check_array_type(RARRAY_PTR(groups)[i]);
+      if(NIL_P(group))
+	rb_raise(cIGraphError, "Groups must be Arrays of vertices\n");
+      for(j=0;j<RARRAY_LEN(group);j++){
+	idx = rb_hash_aref(*vindex, RARRAY_PTR(group)[j]);
+	if(NIL_P(idx))
+	  rb_raise(cIGraphError, "Unable to find vertex\n");
+	memb[FIX2LONG(idx)*npart + p] = (int)i;
+      }
+    }
+    return;
+  }
+
+  m = cIGraph_membership_unpack(groups, n, &len);
+  for(i=0;i<n;i++){
+    if(i >= len || m[i] < 0 || m[i] >= n){
+      free(m);
+      rb_raise(cIGraphError, "Membership must give each vertex an id between 0 and %ld\n", n-1);
+    }
+    memb[i*npart + p] = m[i];
+  }
+  free(m);
+
+}
+
+static VALUE cIGraph_modularity_eval(VALUE self, VALUE partitions, VALUE weights){
+
+  igraph_t *graph;
+  cIGraph_wgraph_t g;
+  cIGraph_modularity_job_t job;
+  long int n, npart, i;
+  int *memb;
+  double *q;
+  VALUE vindex, buf, res;
+
+  Data_Get_Struct(self, igraph_t, graph);
+  n     = (long int)igraph_vcount(graph);
+  npart = RARRAY_LEN(partitions);
+
+  vindex = Qnil;
+
+  //Held in a String so that it is collected if a partition is rejected
+  buf  = rb_str_new(NULL, sizeof(int) * (n*npart + 1));
+  memb = (int*)RSTRING_PTR(buf);
+  for(i=0;i<npart;i++)
+    cIGraph_modularity_partition(self, RARRAY_PTR(partitions)[i], &vindex, memb, npart, i);
+
+  cIGraph_wgraph_init(self, &g, weights);
+
+  q = malloc(sizeof(double) * (npart + 1));
+  if(!q){
+    cIGraph_wgraph_destroy(&g);
+    rb_raise(rb_eNoMemError, "Error allocating modularity");
+  }
+
+  job.g     = &g;
+  job.memb  = memb;
+  job.npart = npart;
+  job.q     = q;
+  cIGraph_without_gvl(cIGraph_modularity_job, &job);
+
+  cIGraph_wgraph_destroy(&g);
+
+  if(job.failed){
+    free(q);
+    rb_raise(rb_eNoMemError, "Error allocating modularity");
+  }
+
+  res = rb_ary_new();
+  for(i=0;i<npart;i++)
+    rb_ary_push(res, rb_float_new(q[i]));
+
+  free(q);
+  RB_GC_GUARD(buf);
+
+  return res;
+
+}
+
 /* call-seq:
- *   graph.modularity(groups) -> Float
+ *   graph.modularity(groups,weights=nil) -> Float
  *
  * Calculate the modularity of a graph with respect to some vertex types. 
  * The modularity of a graph with respect to some division (or vertex types) 
  * measures how good the division is, or how separated are the different 
  * vertex types from each other.
  *
+ * groups is either an Array of Arrays of vertices, or a membership vector
+ * giving the group id (0 ... vcount-1) of each vertex, as a packed String
+ * of native ints such as the community_louvain results or as an Array of
+ * Integers. weights is an Array of edge weights or the name of an edge
+ * attribute holding them; edge directions are ignored.
+ *
  */
 
-VALUE cIGraph_modularity(VALUE self, VALUE groups){
+VALUE cIGraph_modularity(int argc, VALUE *argv, VALUE self){
 
-  igraph_t *graph;
-  igraph_real_t value;
-  igraph_vector_t membership;
+  VALUE groups, weights;
 
-  VALUE group;
+  rb_scan_args(argc,argv,"11", &groups, &weights);
 
-  int i,j;
+  return RARRAY_PTR(cIGraph_modularity_eval(self, rb_ary_new3(1,groups), weights))[0];
 
-  Data_Get_Struct(self, igraph_t, graph);
+}
 
-  igraph_vector_init(&membership,igraph_vcount(graph));
+/* call-seq:
+ *   graph.modularity_batch(partitions,weights=nil) -> Array
+ *
+ * Returns the modularity of the graph with respect to each of an Array of
+ * partitions, given in any of the forms modularity accepts. All of the
+ * partitions are scored together in a single pass over the edges, which
+ * is much faster than calling modularity on each when there are many of
+ * them.
+ *
+ */
 
-  for(i=0;i<RARRAY_LEN(groups);i++){
-    group = RARRAY_PTR(groups)[i];
-    for(j=0;j<RARRAY_LEN(group);j++){
-      igraph_vector_set(&membership,
-			cIGraph_get_vertex_id(self,RARRAY_PTR(group)[j]),i);
-    }
-  }
+VALUE cIGraph_modularity_batch(int argc, VALUE *argv, VALUE self){
 
-  igraph_modularity(graph,&membership,&value,NULL);
-  
-  igraph_vector_destroy(&membership);
+  VALUE partitions, weights;
+
+  rb_scan_args(argc,argv,"11", &partitions, &weights);
+
+  partitions = rb_check_array_type(partitions);
+  if(NIL_P(partitions))
+    rb_raise(cIGraphError, "Array of partitions expected\n");
 
-  return rb_float_new(value);
+  return cIGraph_modularity_eval(self, partitions, weights);
 
 }
 
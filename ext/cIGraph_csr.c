@@ -0,0 +1,291 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+/* Compressed adjacency lists used by the native kernels. The neighbours of
+ * vertex i are nbr[offset[i]] ... nbr[offset[i+1]-1]. Building one of these
+ * once lets the kernels walk the graph without going back through igraph
+ * (which is neither thread-safe nor cheap to call per vertex).
+ */
+
+static int cIGraph_csr_cmp(const void *a, const void *b){
+  int x = *(const int*)a;
+  int y = *(const int*)b;
+  return (x > y) - (x < y);
+}
+
+/* Builds the adjacency lists of graph. mode is one of IGRAPH_OUT, IGRAPH_IN
+ * or IGRAPH_ALL and is ignored for undirected graphs. If simple is true the
+ * lists are sorted, and loops and multiple edges are dropped.
+ */
+int cIGraph_csr_init(const igraph_t *graph, cIGraph_csr_t *csr,
+		     igraph_neimode_t mode, igraph_bool_t simple){
+
+  long int n = (long int)igraph_vcount(graph);
+  long int m = (long int)igraph_ecount(graph);
+  long int *fill;
+  long int i, j, k;
+  igraph_integer_t from, to;
+  int f, t;
+
+  if(!igraph_is_directed(graph))
+    mode = IGRAPH_ALL;
+
+  csr->n      = n;
+  csr->offset = calloc(n+1, sizeof(long int));
+  fill        = calloc(n+1, sizeof(long int));
+  csr->nbr    = malloc(sizeof(int) * (mode == IGRAPH_ALL ? 2*m : m) + 1);
+
+  if(!csr->offset || !fill || !csr->nbr){
+    free(fill);
+    cIGraph_csr_destroy(csr);
+    IGRAPH_ERROR("Error allocating adjacency lists\n", IGRAPH_ENOMEM);
+  }
+
+  //Count the degrees first...
+  for(i=0;i<m;i++){
+    igraph_edge(graph,i,&from,&to);
+    if(mode != IGRAPH_IN)
+      csr->offset[(long int)from+1]++;
+    if(mode != IGRAPH_OUT)
+      csr->offset[(long int)to+1]++;
+  }
+  for(i=0;i<n;i++){
+    csr->offset[i+1] += csr->offset[i];
+    fill[i] = csr->offset[i];
+  }
+
+  //...then drop each edge into its slot
+  for(i=0;i<m;i++){
+    igraph_edge(graph,i,&from,&to);
+    f = (int)from;
+    t = (int)to;
+    if(mode != IGRAPH_IN)
+      csr->nbr[fill[f]++] = t;
+    if(mode != IGRAPH_OUT)
+      csr->nbr[fill[t]++] = f;
+  }
+
+  free(fill);
+
+  if(simple){
+    //Sort each list and squeeze out loops and duplicates in place
+    k = 0;
+    for(i=0;i<n;i++){
+      long int start = csr->offset[i];
+      long int end   = csr->offset[i+1];
+      qsort(csr->nbr+start, end-start, sizeof(int), cIGraph_csr_cmp);
+      csr->offset[i] = k;
+      for(j=start;j<end;j++){
+	if(csr->nbr[j] == i)
+	  continue;
+	if(k > csr->offset[i] && csr->nbr[k-1] == csr->nbr[j])
+	  continue;
+	csr->nbr[k++] = csr->nbr[j];
+      }
+    }
+    csr->offset[n] = k;
+  }
+
+  return IGRAPH_SUCCESS;
+
+}
+
+void cIGraph_csr_destroy(cIGraph_csr_t *csr){
+  free(csr->offset);
+  free(csr->nbr);
+  csr->offset = NULL;
+  csr->nbr    = NULL;
+  csr->n      = 0;
+}
+
+/* Weighted adjacency lists with edge directions ignored, for the community
+ * kernels. Loops are left out of the lists and their weight is kept in
+ * self (twice, as in the adjacency matrix), and k holds the weighted
+ * degree of each vertex. weights is an Array with one weight per edge, the
+ * name of an edge attribute holding the weights (edges without it weigh
+ * 1), or nil or an empty Array for weight 1 throughout.
+ */
+void cIGraph_wgraph_init(VALUE self, cIGraph_wgraph_t *g, VALUE weights){
+
+  igraph_t *graph;
+  long int n, m, i;
+  long int *fill;
+  double *w = NULL;
+  igraph_integer_t from, to;
+  int f, t;
+  VALUE e_ary, val;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  n = (long int)igraph_vcount(graph);
+  m = (long int)igraph_ecount(graph);
+
+  if(SYMBOL_P(weights))
+    weights = rb_funcall(weights, rb_intern("to_s"), 0);
+
+  if(TYPE(weights) == T_STRING){
+    //Weights from an edge attribute
+    e_ary = ((VALUE*)graph->attr)[1];
+    w = malloc(sizeof(double) * (m+1));
+    if(!w)
+      rb_raise(rb_eNoMemError, "Error allocating weights");
+    for(i=0;i<m;i++){
+      val = rb_ary_entry(e_ary,i);
+      if(TYPE(val) == T_HASH)
+	val = rb_hash_aref(val,weights);
+      if(!NIL_P(val) && !rb_obj_is_kind_of(val,rb_cNumeric)){
+	free(w);
+	rb_raise(cIGraphError, "Weights must be numeric\n");
+      }
+      w[i] = NIL_P(val) ? 1 : NUM2DBL(val);
+    }
+  } else if(!NIL_P(weights) && RARRAY_LEN(weights) > 0){
+    if(RARRAY_LEN(weights) != m)
+      rb_raise(cIGraphError, "Weight vector length must agree with number of edges\n");
+    w = malloc(sizeof(double) * (m+1));
+    if(!w)
+      rb_raise(rb_eNoMemError, "Error allocating weights");
+    for(i=0;i<m;i++){
+      val = RARRAY_PTR(weights)[i];
+      if(!rb_obj_is_kind_of(val,rb_cNumeric)){
+	free(w);
+	rb_raise(cIGraphError, "Weights must be numeric\n");
+      }
+      w[i] = NUM2DBL(val);
+    }
+  }
+
+  for(i=0;w && i<m;i++){
+    if(w[i] < 0){
+      free(w);
+      rb_raise(cIGraphError, "Weights must not be negative\n");
+    }
+  }
+
+  memset(g,0,sizeof(cIGraph_wgraph_t));
+  g->n      = n;
+  g->offset = calloc(n+1, sizeof(long int));
+  g->nbr    = malloc(sizeof(int) * 2*m + 1);
+  g->weight = malloc(sizeof(double) * 2*m + 1);
+  g->self   = calloc(n+1, sizeof(double));
+  g->k      = calloc(n+1, sizeof(double));
+  fill      = calloc(n+1, sizeof(long int));
+
+  if(!g->offset || !g->nbr || !g->weight || !g->self || !g->k || !fill){
+    free(w);
+    free(fill);
+    cIGraph_wgraph_destroy(g);
+    rb_raise(rb_eNoMemError, "Error allocating adjacency lists");
+  }
+
+  for(i=0;i<m;i++){
+    igraph_edge(graph,i,&from,&to);
+    if(from != to){
+      g->offset[(long int)from+1]++;
+      g->offset[(long int)to+1]++;
+    }
+  }
+  for(i=0;i<n;i++){
+    g->offset[i+1] += g->offset[i];
+    fill[i] = g->offset[i];
+  }
+
+  for(i=0;i<m;i++){
+    igraph_edge(graph,i,&from,&to);
+    f = (int)from;
+    t = (int)to;
+    g->k[f] += w ? w[i] : 1;
+    g->k[t] += w ? w[i] : 1;
+    g->m2   += 2 * (w ? w[i] : 1);
+    if(f == t){
+      g->self[f] += 2 * (w ? w[i] : 1);
+      continue;
+    }
+    g->nbr[fill[f]]      = t;
+    g->weight[fill[f]++] = w ? w[i] : 1;
+    g->nbr[fill[t]]      = f;
+    g->weight[fill[t]++] = w ? w[i] : 1;
+  }
+
+  free(w);
+  free(fill);
+
+}
+
+void cIGraph_wgraph_destroy(cIGraph_wgraph_t *g){
+  free(g->offset);
+  free(g->nbr);
+  free(g->weight);
+  free(g->self);
+  free(g->k);
+  memset(g,0,sizeof(cIGraph_wgraph_t));
+}
+
+/* Greedy colouring of g in a random order, so that no two neighbours
+ * share a colour. Leaves the vertices grouped by colour in nodes, colour c
+ * being nodes[coff[c]] ... nodes[coff[c+1]-1], and returns the number of
+ * colours (or -1 if out of memory). coff must have room for g->n+1
+ * entries.
+ */
+long int cIGraph_wgraph_colour(cIGraph_wgraph_t *g, cIGraph_rng_t *rng,
+			      int *nodes, long int *coff){
+
+  long int n = g->n, i, j, p, c, ncol = 0, maxd = 0;
+  int *colour, *order, *mark, t;
+
+  for(i=0;i<n;i++)
+    if(g->offset[i+1] - g->offset[i] > maxd)
+      maxd = g->offset[i+1] - g->offset[i];
+
+  colour = malloc(sizeof(int) * (n+1));
+  order  = malloc(sizeof(int) * (n+1));
+  mark   = calloc(maxd+2, sizeof(int));
+  if(!colour || !order || !mark){
+    free(colour);
+    free(order);
+    free(mark);
+    return -1;
+  }
+
+  for(i=0;i<n;i++){
+    order[i]  = (int)i;
+    colour[i] = -1;
+  }
+  for(i=n-1;i>0;i--){
+    j = cIGraph_rng_integer(rng, i+1);
+    t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+
+  for(i=0;i<n;i++){
+    for(p=g->offset[order[i]];p<g->offset[order[i]+1];p++)
+      if(colour[g->nbr[p]] >= 0)
+	mark[colour[g->nbr[p]]] = (int)(i+1);
+    for(c=0;mark[c] == i+1;c++)
+      ;
+    colour[order[i]] = (int)c;
+    if(c+1 > ncol)
+      ncol = c+1;
+  }
+
+  //Counting sort by colour, keeping the random order within each
+  for(c=0;c<=ncol;c++)
+    coff[c] = 0;
+  for(i=0;i<n;i++)
+    coff[colour[i]+1]++;
+  for(c=0;c<ncol;c++){
+    coff[c+1] += coff[c];
+    mark[c] = (int)coff[c];
+  }
+  for(i=0;i<n;i++)
+    nodes[mark[colour[order[i]]]++] = order[i];
+
+  free(colour);
+  free(order);
+  free(mark);
+
+  return ncol;
+
+}
@@ -14,7 +14,7 @@ VALUE cIGraph_to_directed(VALUE self, VALUE mode){
   int ret;
 
   Data_Get_Struct(self, igraph_t, graph);
-  IGRAPH_CHECK(ret = igraph_to_directed(graph,pmode));
+  IGRAPH_CHECK(ret = cIGraph_log_replace(graph,CIGRAPH_LOG_TO_DIRECTED,NULL,pmode));
 
   return INT2NUM(ret);
 
@@ -32,7 +32,7 @@ VALUE cIGraph_to_undirected(VALUE self, VALUE mode){
   int ret;
 
   Data_Get_Struct(self, igraph_t, graph);
-  IGRAPH_CHECK(ret = igraph_to_undirected(graph,pmode));
+  IGRAPH_CHECK(ret = cIGraph_log_replace(graph,CIGRAPH_LOG_TO_UNDIRECTED,NULL,pmode));
 
   return INT2NUM(ret);
 
@@ -0,0 +1,709 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+/* Exact eccentricities, radius and diameter using a handful of breadth
+ * first searches rather than one from every vertex, plus a sampled estimate
+ * of the average path length.
+ *
+ * The diameter uses iFUB: a double sweep gives a lower bound and a vertex
+ * u near the middle of a long path. If some vertex at distance i from u has
+ * eccentricity above 2(i-1) it is the diameter, otherwise nothing further
+ * out than i can beat it, so only the vertices on the outer levels of the
+ * search from u need their own searches. Those run on the worker threads.
+ *
+ * Eccentricities and the radius use the bounds from each search:
+ * e(w) >= max(e(v)-d(v,w), d(v,w)) and e(w) <= e(v)+d(v,w). Searches start
+ * from the unresolved vertex with the largest upper or smallest lower bound
+ * until every vertex asked for has matching bounds.
+ *
+ * Edge directions are ignored throughout, and eccentricities are taken
+ * within each vertex's component.
+ */
+
+//Scratch space for one search
+typedef struct {
+  const cIGraph_csr_t *csr;
+  int *dist;
+  int *queue;
+  long int reached;
+} cIGraph_bfs_t;
+
+static int cIGraph_bfs_init(cIGraph_bfs_t *b, const cIGraph_csr_t *csr){
+
+  long int i;
+
+  b->csr     = csr;
+  b->reached = 0;
+  b->dist    = malloc(sizeof(int) * (csr->n+1));
+  b->queue   = malloc(sizeof(int) * (csr->n+1));
+  if(!b->dist || !b->queue){
+    free(b->dist);
+    free(b->queue);
+    b->dist  = NULL;
+    b->queue = NULL;
+    return 0;
+  }
+  for(i=0;i<csr->n;i++)
+    b->dist[i] = -1;
+
+  return 1;
+
+}
+
+static void cIGraph_bfs_destroy(cIGraph_bfs_t *b){
+  free(b->dist);
+  free(b->queue);
+}
+
+/* Searches from src, leaving the distances in dist and the vertices reached
+ * in queue (in order of distance). Returns the eccentricity of src. far gets
+ * the last vertex reached and sum the total distance, if not NULL.
+ */
+static long int cIGraph_bfs(cIGraph_bfs_t *b, int src, int *far, double *sum){
+
+  const cIGraph_csr_t *csr = b->csr;
+  long int head = 0, tail = 0, j;
+  double s = 0;
+  int u, w;
+
+  //Clear up after the last search
+  for(j=0;j<b->reached;j++)
+    b->dist[b->queue[j]] = -1;
+
+  b->dist[src] = 0;
+  b->queue[tail++] = src;
+
+  while(head < tail){
+    u = b->queue[head++];
+    s += b->dist[u];
+    for(j=csr->offset[u];j<csr->offset[u+1];j++){
+      w = csr->nbr[j];
+      if(b->dist[w] < 0){
+	b->dist[w] = b->dist[u] + 1;
+	b->queue[tail++] = w;
+      }
+    }
+  }
+
+  b->reached = tail;
+  if(far)
+    *far = b->queue[tail-1];
+  if(sum)
+    *sum = s;
+
+  return b->dist[b->queue[tail-1]];
+
+}
+
+/* Diameter (iFUB) */
+
+typedef struct {
+  cIGraph_bfs_t bfs;
+  const int *fringe;
+  long int nfringe;
+  long int *next;
+  long int best;
+  int from;
+  int to;
+} cIGraph_fringe_worker_t;
+
+static void *cIGraph_fringe_worker(void *arg){
+
+  cIGraph_fringe_worker_t *w = arg;
+  long int i, e;
+  int far;
+
+  while(!cIGraph_interrupted() && (i = __sync_fetch_and_add(w->next, 1)) < w->nfringe){
+    e = cIGraph_bfs(&w->bfs, w->fringe[i], &far, NULL);
+    if(e > w->best){
+      w->best = e;
+      w->from = w->fringe[i];
+      w->to   = far;
+    }
+  }
+
+  return NULL;
+
+}
+
+typedef struct {
+  cIGraph_csr_t *csr;
+  int nthreads;
+  int failed;
+  long int diameter;
+  int from;
+  int to;
+} cIGraph_diameter_job_t;
+
+static void *cIGraph_diameter_run(void *arg){
+
+  cIGraph_diameter_job_t *job = arg;
+  cIGraph_csr_t *csr = job->csr;
+  cIGraph_bfs_t main;
+  cIGraph_fringe_worker_t *workers = NULL;
+  char *seen = NULL;
+  long int n = csr->n;
+  long int lb, ecc, i, k, level, start, end, next;
+  int r, a, b, u, far, lbfrom, lbto;
+  long int j;
+
+  job->diameter = -1;
+
+  memset(&main,0,sizeof(main));
+  seen    = calloc(n+1, 1);
+  workers = calloc(job->nthreads, sizeof(cIGraph_fringe_worker_t));
+  if(!seen || !workers || !cIGraph_bfs_init(&main,csr))
+    goto fail;
+  for(k=0;k<job->nthreads;k++){
+    if(!cIGraph_bfs_init(&workers[k].bfs,csr))
+      goto fail;
+  }
+
+  for(r=0;r<n;r++){
+
+    if(seen[r])
+      continue;
+
+    //Double sweep: the furthest vertex a from r, then the furthest from a
+    cIGraph_bfs(&main, r, &a, NULL);
+    for(i=0;i<main.reached;i++)
+      seen[main.queue[i]] = 1;
+
+    lb     = cIGraph_bfs(&main, a, &b, NULL);
+    lbfrom = a;
+    lbto   = b;
+
+    //Start from the middle of the path between a and b
+    u = b;
+    while(main.dist[u] > lb/2){
+      for(j=csr->offset[u];j<csr->offset[u+1];j++){
+	if(main.dist[csr->nbr[j]] == main.dist[u] - 1){
+	  u = csr->nbr[j];
+	  break;
+	}
+      }
+    }
+
+    ecc = cIGraph_bfs(&main, u, &far, NULL);
+    if(ecc > lb){
+      lb     = ecc;
+      lbfrom = u;
+      lbto   = far;
+    }
+
+    //main.queue holds the component in order of distance from u, so each
+    //level is a contiguous block working back from the end
+    end = main.reached;
+    for(level=ecc;level>0 && 2*level>lb;level--){
+
+      start = end;
+      while(start > 0 && main.dist[main.queue[start-1]] == level)
+	start--;
+
+      next = 0;
+      for(k=0;k<job->nthreads;k++){
+	workers[k].fringe  = main.queue + start;
+	workers[k].nfringe = end - start;
+	workers[k].next    = &next;
+	workers[k].best    = -1;
+      }
+
+      cIGraph_parallel(cIGraph_fringe_worker, workers, sizeof(cIGraph_fringe_worker_t), job->nthreads);
+
+      for(k=0;k<job->nthreads;k++){
+	if(workers[k].best > lb){
+	  lb     = workers[k].best;
+	  lbfrom = workers[k].from;
+	  lbto   = workers[k].to;
+	}
+      }
+
+      //Anything closer to u than this level is within 2(level-1) of
+      //everything else
+      if(lb > 2*(level-1))
+	break;
+
+      end = start;
+
+    }
+
+    if(lb > job->diameter){
+      job->diameter = lb;
+      job->from     = lbfrom;
+      job->to       = lbto;
+    }
+
+  }
+
+  goto done;
+
+ fail:
+  job->failed = 1;
+
+ done:
+  if(workers){
+    for(k=0;k<job->nthreads;k++)
+      cIGraph_bfs_destroy(&workers[k].bfs);
+  }
+  cIGraph_bfs_destroy(&main);
+  free(workers);
+  free(seen);
+
+  return NULL;
+
+}
+
+/* Returns a longest geodesic of the graph, ignoring edge directions, as an
+ * Array of vertices. Used by IGraph#diameter.
+ */
+VALUE cIGraph_diameter_path(VALUE self){
+
+  igraph_t *graph;
+  cIGraph_csr_t csr;
+  cIGraph_diameter_job_t job;
+  cIGraph_bfs_t bfs;
+  VALUE path = rb_ary_new();
+  long int j;
+  int v;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  if(igraph_vcount(graph) == 0)
+    return path;
+
+  cIGraph_csr_init(graph,&csr,IGRAPH_ALL,0);
+
+  memset(&job,0,sizeof(job));
+  job.csr      = &csr;
+  job.nthreads = cIGraph_thread_count();
+
+  cIGraph_without_gvl(cIGraph_diameter_run, &job);
+
+  //One more search from one end to walk the path back from the other
+  if(job.failed || !cIGraph_bfs_init(&bfs,&csr)){
+    cIGraph_csr_destroy(&csr);
+    rb_raise(rb_eNoMemError, "Error allocating search buffers");
+  }
+
+  cIGraph_bfs(&bfs, job.from, NULL, NULL);
+
+  v = job.to;
+  rb_ary_unshift(path,cIGraph_get_vertex_object(self,v));
+  while(v != job.from){
+    for(j=csr.offset[v];j<csr.offset[v+1];j++){
+      if(bfs.dist[csr.nbr[j]] == bfs.dist[v] - 1){
+	v = csr.nbr[j];
+	break;
+      }
+    }
+    rb_ary_unshift(path,cIGraph_get_vertex_object(self,v));
+  }
+
+  cIGraph_bfs_destroy(&bfs);
+  cIGraph_csr_destroy(&csr);
+
+  return path;
+
+}
+
+/* Eccentricities and radius (bound pruning) */
+
+typedef struct {
+  cIGraph_csr_t *csr;
+  int *lower;
+  int *upper;
+  char *cand;                //Vertices still to be resolved
+  long int ncand;
+  int radius_only;
+  long int radius;
+  int failed;
+} cIGraph_ecc_job_t;
+
+static void *cIGraph_ecc_run(void *arg){
+
+  cIGraph_ecc_job_t *job = arg;
+  cIGraph_csr_t *csr = job->csr;
+  cIGraph_bfs_t bfs;
+  long int n = csr->n;
+  long int i, d, e, deg, bestdeg;
+  int v, w, high = 1;
+  int lo, hi;
+
+  if(!cIGraph_bfs_init(&bfs,csr)){
+    job->failed = 1;
+    return NULL;
+  }
+
+  job->radius = n;
+
+  for(i=0;i<n;i++){
+    job->lower[i] = 0;
+    job->upper[i] = n;
+    if(csr->offset[i+1] == csr->offset[i]){
+      job->upper[i] = 0;
+      job->radius   = 0;
+      if(job->cand[i]){
+	job->cand[i] = 0;
+	job->ncand--;
+      }
+    }
+  }
+
+  while(job->ncand > 0 && !cIGraph_interrupted()){
+
+    //Alternate between the candidate with the largest upper bound and the
+    //one with the smallest lower bound, preferring high degree on ties. The
+    //radius only needs the latter, and can drop anything that cannot get
+    //below the best eccentricity seen so far.
+    v = -1;
+    bestdeg = -1;
+    for(i=0;i<n;i++){
+      if(!job->cand[i])
+	continue;
+      if(job->radius_only && job->lower[i] >= job->radius){
+	job->cand[i] = 0;
+	job->ncand--;
+	continue;
+      }
+      deg = csr->offset[i+1] - csr->offset[i];
+      if(v < 0 ||
+	 (high && !job->radius_only &&
+	  (job->upper[i] > job->upper[v] ||
+	   (job->upper[i] == job->upper[v] && deg > bestdeg))) ||
+	 ((!high || job->radius_only) &&
+	  (job->lower[i] < job->lower[v] ||
+	   (job->lower[i] == job->lower[v] && deg > bestdeg)))){
+	v = i;
+	bestdeg = deg;
+      }
+    }
+    high = !high;
+
+    if(v < 0)
+      break;
+
+    e = cIGraph_bfs(&bfs, v, NULL, NULL);
+    if(e < job->radius)
+      job->radius = e;
+
+    for(i=0;i<bfs.reached;i++){
+      w  = bfs.queue[i];
+      d  = bfs.dist[w];
+      lo = (int)(e - d > d ? e - d : d);
+      hi = (int)(e + d);
+      if(lo > job->lower[w])
+	job->lower[w] = lo;
+      if(hi < job->upper[w])
+	job->upper[w] = hi;
+      if(job->cand[w] && job->lower[w] == job->upper[w]){
+	job->cand[w] = 0;
+	job->ncand--;
+	if(job->lower[w] < job->radius)
+	  job->radius = job->lower[w];
+      }
+    }
+
+  }
+
+  cIGraph_bfs_destroy(&bfs);
+
+  return NULL;
+
+}
+
+//Runs the bounding search with cand set, leaving the results in job
+static void cIGraph_ecc(VALUE self, cIGraph_ecc_job_t *job, cIGraph_csr_t *csr){
+
+  igraph_t *graph;
+  long int n;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  n = (long int)igraph_vcount(graph);
+
+  job->lower = malloc(sizeof(int) * (n+1));
+  job->upper = malloc(sizeof(int) * (n+1));
+  if(!job->lower || !job->upper){
+    free(job->lower);
+    free(job->upper);
+    free(job->cand);
+    rb_raise(rb_eNoMemError, "Error allocating eccentricity bounds");
+  }
+
+  IGRAPH_FINALLY(free, job->lower);
+  IGRAPH_FINALLY(free, job->upper);
+  IGRAPH_FINALLY(free, job->cand);
+  cIGraph_csr_init(graph,csr,IGRAPH_ALL,0);
+  IGRAPH_FINALLY_CLEAN(3);
+
+  job->csr = csr;
+
+  cIGraph_without_gvl(cIGraph_ecc_run, job);
+
+  cIGraph_csr_destroy(csr);
+
+  if(job->failed){
+    free(job->lower);
+    free(job->upper);
+    free(job->cand);
+    rb_raise(rb_eNoMemError, "Error allocating search buffers");
+  }
+
+}
+
+/* call-seq:
+ *   graph.eccentricity(vertices) -> Array
+ *
+ * Returns the eccentricity (the distance to the furthest reachable vertex)
+ * of each of the vertices in the vertices Array. Edge directions are
+ * ignored. Rather than searching from each vertex in turn the bounds from
+ * every search are shared, which usually settles most vertices without a
+ * search of their own.
+ */
+VALUE cIGraph_eccentricity(VALUE self, VALUE vs){
+
+  igraph_t *graph;
+  cIGraph_csr_t csr;
+  cIGraph_ecc_job_t job;
+  VALUE result = rb_ary_new();
+  VALUE ids;
+  long int i, id;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  //Looking the vertices up can raise, so do it before allocating anything
+  ids = rb_ary_new2(RARRAY_LEN(vs));
+  for(i=0;i<RARRAY_LEN(vs);i++)
+    rb_ary_push(ids,INT2NUM(cIGraph_get_vertex_id(self,RARRAY_PTR(vs)[i])));
+
+  memset(&job,0,sizeof(job));
+  job.cand = calloc((long int)igraph_vcount(graph)+1, 1);
+  if(!job.cand)
+    rb_raise(rb_eNoMemError, "Error allocating eccentricity bounds");
+
+  for(i=0;i<RARRAY_LEN(ids);i++){
+    id = NUM2LONG(RARRAY_PTR(ids)[i]);
+    if(!job.cand[id]){
+      job.cand[id] = 1;
+      job.ncand++;
+    }
+  }
+
+  cIGraph_ecc(self,&job,&csr);
+
+  for(i=0;i<RARRAY_LEN(ids);i++){
+    id = NUM2LONG(RARRAY_PTR(ids)[i]);
+    rb_ary_push(result,INT2NUM(job.lower[id]));
+  }
+
+  free(job.lower);
+  free(job.upper);
+  free(job.cand);
+
+  return result;
+
+}
+
+/* call-seq:
+ *   graph.radius -> Integer
+ *
+ * Returns the radius of the graph, the smallest eccentricity of any vertex.
+ * Edge directions are ignored. See IGraph#eccentricity.
+ */
+VALUE cIGraph_radius(VALUE self){
+
+  igraph_t *graph;
+  cIGraph_csr_t csr;
+  cIGraph_ecc_job_t job;
+  long int n;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  n = (long int)igraph_vcount(graph);
+  if(n == 0)
+    return INT2NUM(0);
+
+  memset(&job,0,sizeof(job));
+  job.radius_only = 1;
+  job.ncand       = n;
+  job.cand        = malloc(n);
+  if(!job.cand)
+    rb_raise(rb_eNoMemError, "Error allocating eccentricity bounds");
+  memset(job.cand,1,n);
+
+  cIGraph_ecc(self,&job,&csr);
+
+  free(job.lower);
+  free(job.upper);
+  free(job.cand);
+
+  return LONG2NUM(job.radius);
+
+}
+
+/* Sampled average path length */
+
+typedef struct {
+  cIGraph_bfs_t bfs;
+  const int *sources;
+  long int k;
+  long int *next;
+  double *sum;
+  double *cnt;
+} cIGraph_apl_worker_t;
+
+static void *cIGraph_apl_worker(void *arg){
+
+  cIGraph_apl_worker_t *w = arg;
+  long int i;
+
+  while(!cIGraph_interrupted() && (i = __sync_fetch_and_add(w->next, 1)) < w->k){
+    cIGraph_bfs(&w->bfs, w->sources[i], NULL, &w->sum[i]);
+    w->cnt[i] = w->bfs.reached - 1;
+  }
+
+  return NULL;
+
+}
+
+typedef struct {
+  cIGraph_csr_t *csr;
+  int *sources;
+  long int k;
+  double *sum;
+  double *cnt;
+  int nthreads;
+  int failed;
+} cIGraph_apl_job_t;
+
+static void *cIGraph_apl_run(void *arg){
+
+  cIGraph_apl_job_t *job = arg;
+  cIGraph_apl_worker_t *workers;
+  long int next = 0;
+  int i;
+
+  workers = calloc(job->nthreads, sizeof(cIGraph_apl_worker_t));
+  if(!workers){
+    job->failed = 1;
+    return NULL;
+  }
+
+  for(i=0;i<job->nthreads;i++){
+    workers[i].sources = job->sources;
+    workers[i].k       = job->k;
+    workers[i].next    = &next;
+    workers[i].sum     = job->sum;
+    workers[i].cnt     = job->cnt;
+    if(!cIGraph_bfs_init(&workers[i].bfs,job->csr))
+      job->failed = 1;
+  }
+
+  if(!job->failed)
+    cIGraph_parallel(cIGraph_apl_worker, workers, sizeof(cIGraph_apl_worker_t), job->nthreads);
+
+  for(i=0;i<job->nthreads;i++)
+    cIGraph_bfs_destroy(&workers[i].bfs);
+  free(workers);
+
+  return NULL;
+
+}
+
+/* call-seq:
+ *   graph.average_path_length_estimate(directed,samples,seed) -> Array
+ *
+ * Estimates the average geodesic length from searches started at samples
+ * randomly chosen vertices, counting only the pairs that are connected (as
+ * IGraph#average_path_length does with unconn true). directed is a boolean
+ * specifying whether to follow edge directions. seed seeds the choice of
+ * vertices; pass nil to take one from Kernel#rand.
+ *
+ * Returns [estimate, lower, upper] where lower and upper bound an
+ * approximate 95% confidence interval. If samples is at least the number of
+ * vertices every vertex is used and the result is exact.
+ */
+VALUE cIGraph_average_path_length_estimate(VALUE self, VALUE directed, VALUE samples, VALUE seed){
+
+  igraph_t *graph;
+  cIGraph_csr_t csr;
+  cIGraph_apl_job_t job;
+  cIGraph_rng_t rng;
+  long int n, i;
+  double s = 0, c = 0, r, var = 0, se = 0, x;
+  VALUE result = rb_ary_new();
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  n = (long int)igraph_vcount(graph);
+
+  memset(&job,0,sizeof(job));
+  job.k        = NUM2LONG(samples);
+  job.nthreads = cIGraph_thread_count();
+  if(job.k < 1)
+    rb_raise(cIGraphError, "At least one sample is needed\n");
+  if(job.k > n)
+    job.k = n;
+
+  job.sources = malloc(sizeof(int) * (job.k+1));
+  job.sum     = malloc(sizeof(double) * (job.k+1));
+  job.cnt     = malloc(sizeof(double) * (job.k+1));
+  if(!job.sources || !job.sum || !job.cnt){
+    free(job.sources);
+    free(job.sum);
+    free(job.cnt);
+    rb_raise(rb_eNoMemError, "Error allocating samples");
+  }
+
+  cIGraph_rng_seed(&rng, cIGraph_rng_seed_value(seed), 0);
+  for(i=0;i<job.k;i++)
+    job.sources[i] = job.k == n ? i : (int)cIGraph_rng_integer(&rng, n);
+
+  IGRAPH_FINALLY(free, job.sources);
+  IGRAPH_FINALLY(free, job.sum);
+  IGRAPH_FINALLY(free, job.cnt);
+  cIGraph_csr_init(graph,&csr,directed == Qtrue ? IGRAPH_OUT : IGRAPH_ALL,0);
+  IGRAPH_FINALLY_CLEAN(3);
+
+  job.csr = &csr;
+
+  cIGraph_without_gvl(cIGraph_apl_run, &job);
+
+  cIGraph_csr_destroy(&csr);
+
+  if(job.failed){
+    free(job.sources);
+    free(job.sum);
+    free(job.cnt);
+    rb_raise(rb_eNoMemError, "Error allocating search buffers");
+  }
+
+  //Ratio estimate of total distance over connected pairs, with the delta
+  //method for its standard error
+  for(i=0;i<job.k;i++){
+    s += job.sum[i];
+    c += job.cnt[i];
+  }
+  r = c > 0 ? s / c : 0;
+
+  if(job.k > 1 && job.k < n && c > 0){
+    for(i=0;i<job.k;i++){
+      x = job.sum[i] - r * job.cnt[i];
+      var += x * x;
+    }
+    var /= job.k - 1;
+    se = sqrt(var / job.k) / (c / job.k);
+  }
+
+  free(job.sources);
+  free(job.sum);
+  free(job.cnt);
+
+  rb_ary_push(result,rb_float_new(r));
+  rb_ary_push(result,rb_float_new(r - 1.96 * se));
+  rb_ary_push(result,rb_float_new(r + 1.96 * se));
+
+  return result;
+
+}
@@ -4,10 +4,250 @@
 
 #ifdef __APPLE__
 #else
+
+/* Arguments for the igraph readers, which cIGraph_stream_read calls with
+ * a FILE streaming the input from a Ruby IO.
+ */
+typedef struct {
+  igraph_t *graph;
+  igraph_bool_t directed;
+  igraph_bool_t names;
+  igraph_bool_t weights;
+  igraph_strvector_t *predefnames;
+  int index;
+  igraph_strvector_t *problem;
+  igraph_vector_t *label;
+  igraph_integer_t *source;
+  igraph_integer_t *target;
+  igraph_vector_t *capacity;
+} cIGraph_read_t;
+
+static int cIGraph_read_edgelist(FILE *stream, void *arg){
+  cIGraph_read_t *r = arg;
+  return igraph_read_graph_edgelist(r->graph, stream, 0, r->directed);
+}
+
+static int cIGraph_read_ncol(FILE *stream, void *arg){
+  cIGraph_read_t *r = arg;
+  return igraph_read_graph_ncol(r->graph, stream, r->predefnames, r->names, r->weights, r->directed);
+}
+
+static int cIGraph_read_lgl(FILE *stream, void *arg){
+  cIGraph_read_t *r = arg;
+  return igraph_read_graph_lgl(r->graph, stream, r->names, r->weights);
+}
+
+static int cIGraph_read_dimacs(FILE *stream, void *arg){
+  cIGraph_read_t *r = arg;
+  return igraph_read_graph_dimacs(r->graph, stream, r->problem, r->label, r->source, r->target, r->capacity, r->directed);
+}
+
+static int cIGraph_read_graphdb(FILE *stream, void *arg){
+  cIGraph_read_t *r = arg;
+  return igraph_read_graph_graphdb(r->graph, stream, r->directed);
+}
+
+static int cIGraph_read_graphml(FILE *stream, void *arg){
+  cIGraph_read_t *r = arg;
+  return igraph_read_graph_graphml(r->graph, stream, r->index);
+}
+
+static int cIGraph_read_gml(FILE *stream, void *arg){
+  cIGraph_read_t *r = arg;
+  return igraph_read_graph_gml(r->graph, stream);
+}
+
+static int cIGraph_read_pajek(FILE *stream, void *arg){
+  cIGraph_read_t *r = arg;
+  return igraph_read_graph_pajek(r->graph, stream);
+}
+
+/* Arguments for the writers, which cIGraph_stream_write calls with a FILE
+ * passing the output on to a Ruby IO.
+ */
+typedef struct {
+  igraph_t *graph;
+  const char *names;
+  const char *weights;
+  igraph_bool_t isolates;
+  igraph_integer_t source;
+  igraph_integer_t target;
+  igraph_vector_t *capacity;
+  long int *edges;
+  long int m;
+} cIGraph_write_t;
+
+//Appends the decimal digits of n to buf and returns the end
+static char *cIGraph_write_long(char *buf, long int n){
+
+  char digits[24];
+  int i = 0;
+  unsigned long int u = n < 0 ? -(unsigned long int)n : (unsigned long int)n;
+
+  if(n < 0)
+    *buf++ = '-';
+  do {
+    digits[i++] = '0' + u % 10;
+    u /= 10;
+  } while(u);
+  while(i)
+    *buf++ = digits[--i];
+
+  return buf;
+
+}
+
+/* Formats the edge list copied into w->edges the way
+ * igraph_write_graph_edgelist does. Touches no Ruby or igraph state, so
+ * it may run without the GVL.
+ */
+static int cIGraph_write_edgelist(FILE *stream, void *arg){
+
+  cIGraph_write_t *w = arg;
+  char line[4096];
+  char *p = line;
+  long int i;
+
+  for(i=0;i<w->m;i++){
+    if(p - line > (long int)sizeof(line) - 48){
+      if(fwrite(line, 1, p - line, stream) != (size_t)(p - line))
+	return IGRAPH_EFILE;
+      p = line;
+    }
+    p = cIGraph_write_long(p, w->edges[2*i]);
+    *p++ = ' ';
+    p = cIGraph_write_long(p, w->edges[2*i+1]);
+    *p++ = '\n';
+  }
+  if(fwrite(line, 1, p - line, stream) != (size_t)(p - line))
+    return IGRAPH_EFILE;
+
+  return 0;
+
+}
+
+static int cIGraph_write_ncol(FILE *stream, void *arg){
+  cIGraph_write_t *w = arg;
+  return igraph_write_graph_ncol(w->graph, stream, w->names, w->weights);
+}
+
+static int cIGraph_write_lgl(FILE *stream, void *arg){
+  cIGraph_write_t *w = arg;
+  return igraph_write_graph_lgl(w->graph, stream, w->names, w->weights, w->isolates);
+}
+
+static int cIGraph_write_dimacs(FILE *stream, void *arg){
+  cIGraph_write_t *w = arg;
+  return igraph_write_graph_dimacs(w->graph, stream, w->source, w->target, w->capacity);
+}
+
+static int cIGraph_write_graphml(FILE *stream, void *arg){
+  cIGraph_write_t *w = arg;
+  return igraph_write_graph_graphml(w->graph, stream);
+}
+
+static int cIGraph_write_gml(FILE *stream, void *arg){
+  cIGraph_write_t *w = arg;
+  return igraph_write_graph_gml(w->graph, stream, NULL, 0);
+}
+
+static int cIGraph_write_pajek(FILE *stream, void *arg){
+  cIGraph_write_t *w = arg;
+  return igraph_write_graph_pajek(w->graph, stream);
+}
+
+/* The ncol and lgl writers read names and weights from igraph attributes,
+ * so the vertex and edge objects are swapped for Hashes holding them
+ * while writing and put back afterwards, even if writing raises.
+ */
+typedef struct {
+  VALUE file;
+  cIGraph_write_t *w;
+  int (*write)(FILE *stream, void *arg);
+  VALUE v_ary;
+  VALUE e_ary;
+  int e;
+} cIGraph_write_attr_t;
+
+static VALUE cIGraph_write_attr_body(VALUE arg){
+  cIGraph_write_attr_t *a = (cIGraph_write_attr_t*)arg;
+  a->e = cIGraph_stream_write(a->file, a->write, a->w, 0);
+  return Qnil;
+}
+
+static VALUE cIGraph_write_attr_restore(VALUE arg){
+
+  cIGraph_write_attr_t *a = (cIGraph_write_attr_t*)arg;
+
+  if(!NIL_P(a->v_ary))
+    ((VALUE*)a->w->graph->attr)[0] = a->v_ary;
+  if(!NIL_P(a->e_ary))
+    ((VALUE*)a->w->graph->attr)[1] = a->e_ary;
+
+  return Qnil;
+
+}
+
+static int cIGraph_write_attr(VALUE file, VALUE names, VALUE weights, int (*write)(FILE *stream, void *arg), cIGraph_write_t *w){
+
+  cIGraph_write_attr_t a;
+  igraph_t *graph = w->graph;
+  VALUE new_v_ary;
+  VALUE new_e_ary;
+  VALUE vertex_h;
+  VALUE edge_h;
+  int i;
+
+  a.file  = file;
+  a.w     = w;
+  a.write = write;
+  a.v_ary = Qnil;
+  a.e_ary = Qnil;
+  a.e     = 0;
+
+  w->names   = names   ? "name"   : "0";
+  w->weights = weights ? "weight" : "0";
+
+  //Convert each object to it's String representation and each edge to
+  //it's Float
+  if(names){
+    new_v_ary = rb_ary_new();
+    for(i=0;i<RARRAY_LEN(((VALUE*)graph->attr)[0]);i++){
+      vertex_h = rb_hash_new();
+      rb_hash_aset(vertex_h, rb_str_new2("name"), StringValue(RARRAY_PTR(((VALUE*)graph->attr)[0])[i]));
+      rb_ary_push(new_v_ary, vertex_h);
+    }
+  }
+  if(weights){
+    new_e_ary = rb_ary_new();
+    for(i=0;i<RARRAY_LEN(((VALUE*)graph->attr)[1]);i++){
+      edge_h = rb_hash_new();
+      rb_hash_aset(edge_h, rb_str_new2("weight"), rb_funcall(RARRAY_PTR(((VALUE*)graph->attr)[1])[i],rb_intern("to_f"),0));
+      rb_ary_push(new_e_ary, edge_h);
+    }
+  }
+
+  if(names){
+    a.v_ary = ((VALUE*)graph->attr)[0];
+    ((VALUE*)graph->attr)[0] = new_v_ary;
+  }
+  if(weights){
+    a.e_ary = ((VALUE*)graph->attr)[1];
+    ((VALUE*)graph->attr)[1] = new_e_ary;
+  }
+
+  rb_ensure(cIGraph_write_attr_body, (VALUE)&a, cIGraph_write_attr_restore, (VALUE)&a);
+
+  return a.e;
+
+}
+
 /* call-seq:
  *   IGraph::FileRead.read_graph_edgelist(file,mode) -> IGraph
  *
- *  Reads an edge list from a File (or any IO) and creates a graph.
+ *  Reads an edge list from a File (or any IO) and creates a graph. Given
+ * the path of a file instead, the file is mapped into memory and parsed
+ * natively without holding the global VM lock.
  *
  * This format is simply a series of even number integers separated by
  * whitespace. The one edge (ie. two integers) per line format is thus not 
@@ -16,8 +256,7 @@
  */
 VALUE cIGraph_read_graph_edgelist(VALUE self, VALUE file, VALUE directed){
 
-  VALUE string;
-  FILE *stream;
+  cIGraph_read_t r;
   VALUE new_graph;
   VALUE v_ary;
   igraph_t *graph;
@@ -31,15 +270,16 @@ VALUE cIGraph_read_graph_edgelist(VALUE self, VALUE file, VALUE directed){
   if(directed)
     directed_b = 1;
 
+  if(TYPE(file) == T_STRING)
+    return cIGraph_parse_file(file, CIGRAPH_FORMAT_EDGELIST, Qnil, 0, 0, directed_b);
+
   new_graph = cIGraph_alloc(cIGraph);
   Data_Get_Struct(new_graph, igraph_t, graph);
 
-  string = rb_funcall(file, rb_intern("read"), 0);
-  stream = fmemopen(RSTRING_PTR(string),RSTRING_LEN(string), "r");
-
-  igraph_read_graph_edgelist(graph, stream, 0, directed_b);
-
-  fclose(stream);
+  memset(&r, 0, sizeof(r));
+  r.graph    = graph;
+  r.directed = directed_b;
+  cIGraph_stream_read(file, cIGraph_read_edgelist, &r);
 
   igraph_vs_all(&vs);
   igraph_vit_create(graph, vs, &vit);
@@ -62,7 +302,9 @@ VALUE cIGraph_read_graph_edgelist(VALUE self, VALUE file, VALUE directed){
 /* call-seq:
  *   graph.write_graph_edgelist(file) -> Integer
  *
- *  Writes an edge list to an IO
+ *  Writes an edge list to an IO. The output is passed on as it is
+ * formatted rather than built up in memory, and written to Files
+ * without holding the global VM lock.
  *
  * This format is simply a series of even number integers separated by
  * whitespace. The one edge (ie. two integers) per line format is thus not 
@@ -71,21 +313,29 @@ VALUE cIGraph_read_graph_edgelist(VALUE self, VALUE file, VALUE directed){
  */
 VALUE cIGraph_write_graph_edgelist(VALUE self, VALUE file){
 
-  char *buf;
-  size_t size;
-  FILE *stream;
+  cIGraph_write_t w;
   igraph_t *graph;
+  igraph_integer_t from, to;
+  VALUE edges;
+  long int i;
   int e;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  stream = open_memstream(&buf,&size);
-  e = igraph_write_graph_edgelist(graph, stream);
-  fflush(stream);
+  //The edges are copied so they can be formatted without the GVL
+  memset(&w, 0, sizeof(w));
+  w.m   = igraph_ecount(graph);
+  edges = rb_str_new(NULL, w.m * 2 * sizeof(long int));
+  w.edges = (long int*)RSTRING_PTR(edges);
+  for(i=0;i<w.m;i++){
+    igraph_edge(graph, i, &from, &to);
+    w.edges[2*i]   = (long int)from;
+    w.edges[2*i+1] = (long int)to;
+  }
 
-  rb_funcall(file, rb_intern("write"), 1, rb_str_new(buf,size));
+  e = cIGraph_stream_write(file, cIGraph_write_edgelist, &w, 1);
 
-  fclose(stream);
+  RB_GC_GUARD(edges);
 
   return e;
 
@@ -110,7 +360,8 @@ VALUE cIGraph_write_graph_edgelist(VALUE self, VALUE file){
  * contain multiple or loop edges, this is however not checked here, as 
  * igraph is happy with these. 
  *
- * file: A File or IO object to read from.
+ * file: A File or IO object to read from, or the path of a file which is
+ * then mapped into memory and parsed without holding the global VM lock.
  *
  * predefnames: Array of the symbolic names of the vertices in the file.
  * If empty then vertex ids will be assigned to vertex names in the order of 
@@ -129,8 +380,7 @@ VALUE cIGraph_write_graph_edgelist(VALUE self, VALUE file){
  */
 VALUE cIGraph_read_graph_ncol(VALUE self, VALUE file, VALUE predefnames, VALUE names, VALUE weights, VALUE directed){
 
-  VALUE string;
-  FILE *stream;
+  cIGraph_read_t r;
   VALUE new_graph;
   VALUE v_ary;
   VALUE e_ary;
@@ -153,6 +403,9 @@ VALUE cIGraph_read_graph_ncol(VALUE self, VALUE file, VALUE predefnames, VALUE n
   if(weights)
     weights_b = 1;
 
+  if(TYPE(file) == T_STRING)
+    return cIGraph_parse_file(file, CIGRAPH_FORMAT_NCOL, predefnames, names_b, weights_b, directed_b);
+
   new_graph = cIGraph_alloc(cIGraph);
   Data_Get_Struct(new_graph, igraph_t, graph);
 
@@ -162,16 +415,13 @@ VALUE cIGraph_read_graph_ncol(VALUE self, VALUE file, VALUE predefnames, VALUE n
     igraph_strvector_set(&names_vec, i, RSTRING_PTR(RARRAY_PTR(predefnames)[i]));
   }
 
-  string = rb_funcall(file, rb_intern("read"), 0);
-  stream = fmemopen(RSTRING_PTR(string),RSTRING_LEN(string), "r");
-
-  if (RARRAY_LEN(predefnames) == 0){
-    igraph_read_graph_ncol(graph, stream, NULL, names_b, weights_b, directed_b);
-  } else {
-    igraph_read_graph_ncol(graph, stream, &names_vec, names_b, weights_b, directed_b);
-  }
-
-  fclose(stream);
+  memset(&r, 0, sizeof(r));
+  r.graph       = graph;
+  r.directed    = directed_b;
+  r.names       = names_b;
+  r.weights     = weights_b;
+  r.predefnames = RARRAY_LEN(predefnames) == 0 ? NULL : &names_vec;
+  cIGraph_stream_read(file, cIGraph_read_ncol, &r);
 
   //Convert the Hash of names to Strings instead
   if(names){
@@ -218,69 +468,15 @@ VALUE cIGraph_read_graph_ncol(VALUE self, VALUE file, VALUE predefnames, VALUE n
  */
 VALUE cIGraph_write_graph_ncol(VALUE self, VALUE file, VALUE names, VALUE weights){
 
-  char *buf;
-  size_t size;
-  FILE *stream;
+  cIGraph_write_t w;
   igraph_t *graph;
-  int e, i;
-
-  VALUE v_ary = Qnil;
-  VALUE e_ary = Qnil;
-  VALUE new_v_ary;
-  VALUE new_e_ary;
-
-  VALUE vertex_h;
-  VALUE edge_h;
-
-  char *weights_b = "0";
-  char *names_b   = "0";
-
-  if(names)
-    names_b = "name";
-  
-  if(weights)
-    weights_b = "weight";
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  //Convert each object to it's String representation and each edge to
-  //it's Float
-  if(names){
-    v_ary = ((VALUE*)graph->attr)[0];
-    new_v_ary = rb_ary_new();
-    for(i=0;i<RARRAY_LEN(v_ary);i++){
-      vertex_h = rb_hash_new();
-      rb_hash_aset(vertex_h, rb_str_new2("name"), StringValue(RARRAY_PTR(v_ary)[i]));
-      rb_ary_push(new_v_ary, vertex_h);
-    }
-    ((VALUE*)graph->attr)[0] = new_v_ary;
-  }
-  if(weights){
-    e_ary = ((VALUE*)graph->attr)[1];
-    new_e_ary = rb_ary_new();
-    for(i=0;i<RARRAY_LEN(e_ary);i++){
-      edge_h = rb_hash_new();
-      rb_hash_aset(edge_h, rb_str_new2("weight"), rb_funcall(RARRAY_PTR(e_ary)[i],rb_intern("to_f"),0));
-     rb_ary_push(new_e_ary, edge_h);
-    }
-    ((VALUE*)graph->attr)[1] = new_e_ary;
-  }
-
-  stream = open_memstream(&buf,&size);
-  e = igraph_write_graph_ncol(graph, stream, names_b, weights_b);
-  fflush(stream);
-  rb_funcall(file, rb_intern("write"), 1, rb_str_new(buf,size));
-  fclose(stream);
+  memset(&w, 0, sizeof(w));
+  w.graph = graph;
 
-  //Replace initital vertices and edges
-  if(names){
-    ((VALUE*)graph->attr)[0] = v_ary;
-  }
-  if(weights){
-    ((VALUE*)graph->attr)[0] = e_ary;    
-  }  
-
-  return e;
+  return cIGraph_write_attr(file, names, weights, cIGraph_write_ncol, &w);
 
 }
 
@@ -309,7 +505,8 @@ VALUE cIGraph_write_graph_ncol(VALUE self, VALUE file, VALUE names, VALUE weight
  * LGL cannot handle loop and multiple edges or directed graphs, but in 
  * igraph it is not an error to have multiple and loop edges.
  *
- * file: A File or IO object to read from.
+ * file: A File or IO object to read from, or the path of a file which is
+ * then mapped into memory and parsed without holding the global VM lock.
  *
  * names: Logical value, if TRUE the symbolic names of the vertices will be 
  * added to the graph as a vertex attribute called $B!H(Bname$B!I(B.
@@ -319,8 +516,7 @@ VALUE cIGraph_write_graph_ncol(VALUE self, VALUE file, VALUE names, VALUE weight
  */
 VALUE cIGraph_read_graph_lgl(VALUE self, VALUE file, VALUE names, VALUE weights){
 
-  VALUE string;
-  FILE *stream;
+  cIGraph_read_t r;
   VALUE new_graph;
   VALUE v_ary;
   VALUE e_ary;
@@ -338,15 +534,17 @@ VALUE cIGraph_read_graph_lgl(VALUE self, VALUE file, VALUE names, VALUE weights)
   if(weights)
     weights_b = 1;
 
+  if(TYPE(file) == T_STRING)
+    return cIGraph_parse_file(file, CIGRAPH_FORMAT_LGL, Qnil, names_b, weights_b, 0);
+
   new_graph = cIGraph_alloc(cIGraph);
   Data_Get_Struct(new_graph, igraph_t, graph);
 
-  string = rb_funcall(file, rb_intern("read"), 0);
-  stream = fmemopen(RSTRING_PTR(string),RSTRING_LEN(string), "r");
-
-  igraph_read_graph_lgl(graph, stream, names_b, weights_b);
-
-  fclose(stream);
+  memset(&r, 0, sizeof(r));
+  r.graph   = graph;
+  r.names   = names_b;
+  r.weights = weights_b;
+  cIGraph_stream_read(file, cIGraph_read_lgl, &r);
 
   //Convert the Hash of names to Strings instead
   if(names){
@@ -394,74 +592,16 @@ VALUE cIGraph_read_graph_lgl(VALUE self, VALUE file, VALUE names, VALUE weights)
  */
 VALUE cIGraph_write_graph_lgl(VALUE self, VALUE file, VALUE names, VALUE weights, VALUE isolates){
 
-  char *buf;
-  size_t size;
-  FILE *stream;
+  cIGraph_write_t w;
   igraph_t *graph;
-  int e, i;
-
-  VALUE v_ary = Qnil;
-  VALUE e_ary = Qnil;
-  VALUE new_v_ary;
-  VALUE new_e_ary;
-
-  VALUE vertex_h;
-  VALUE edge_h;
-
-  char *weights_b = "0";
-  char *names_b   = "0";
-
-  igraph_bool_t isolates_b;
-
-  if(names)
-    names_b = "name";
-  
-  if(weights)
-    weights_b = "weight";
-
-  if(isolates)
-    isolates_b = 1;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  //Convert each object to it's String representation and each edge to
-  //it's Float
-  if(names){
-    v_ary = ((VALUE*)graph->attr)[0];
-    new_v_ary = rb_ary_new();
-    for(i=0;i<RARRAY_LEN(v_ary);i++){
-      vertex_h = rb_hash_new();
-      rb_hash_aset(vertex_h, rb_str_new2("name"), StringValue(RARRAY_PTR(v_ary)[i]));
-      rb_ary_push(new_v_ary, vertex_h);
-    }
-    ((VALUE*)graph->attr)[0] = new_v_ary;
-  }
-  if(weights){
-    e_ary = ((VALUE*)graph->attr)[1];
-    new_e_ary = rb_ary_new();
-    for(i=0;i<RARRAY_LEN(e_ary);i++){
-      edge_h = rb_hash_new();
-      rb_hash_aset(edge_h, rb_str_new2("weight"), rb_funcall(RARRAY_PTR(e_ary)[i],rb_intern("to_f"),0));
-     rb_ary_push(new_e_ary, edge_h);
-    }
-    ((VALUE*)graph->attr)[1] = new_e_ary;
-  }
-
-  stream = open_memstream(&buf,&size);
-  e = igraph_write_graph_lgl(graph, stream, names_b, weights_b, isolates);
-  fflush(stream);
-  rb_funcall(file, rb_intern("write"), 1, rb_str_new(buf,size));
-  fclose(stream);
-
-  //Replace initital vertices and edges
-  if(names){
-    ((VALUE*)graph->attr)[0] = v_ary;
-  }
-  if(weights){
-    ((VALUE*)graph->attr)[0] = e_ary;    
-  }  
+  memset(&w, 0, sizeof(w));
+  w.graph    = graph;
+  w.isolates = isolates ? 1 : 0;
 
-  return e;
+  return cIGraph_write_attr(file, names, weights, cIGraph_write_lgl, &w);
 
 }
 
@@ -494,8 +634,7 @@ VALUE cIGraph_write_graph_lgl(VALUE self, VALUE file, VALUE names, VALUE weights
  */
 VALUE cIGraph_read_graph_dimacs(VALUE self, VALUE file, VALUE directed){
 
-  VALUE string;
-  FILE *stream;
+  cIGraph_read_t r;
   VALUE new_graph;
 
   igraph_integer_t source;
@@ -526,12 +665,15 @@ VALUE cIGraph_read_graph_dimacs(VALUE self, VALUE file, VALUE directed){
   new_graph = cIGraph_alloc(cIGraph);
   Data_Get_Struct(new_graph, igraph_t, graph);
 
-  string = rb_funcall(file, rb_intern("read"), 0);
-  stream = fmemopen(RSTRING_PTR(string),RSTRING_LEN(string), "r");
-
-  igraph_read_graph_dimacs(graph, stream, &problem, &label, &source, &target, &capacity, directed_b);
-
-  fclose(stream);
+  memset(&r, 0, sizeof(r));
+  r.graph    = graph;
+  r.directed = directed_b;
+  r.problem  = &problem;
+  r.label    = &label;
+  r.source   = &source;
+  r.target   = &target;
+  r.capacity = &capacity;
+  cIGraph_stream_read(file, cIGraph_read_dimacs, &r);
 
   igraph_vs_all(&vs);
   igraph_vit_create(graph, vs, &vit);
@@ -562,6 +704,37 @@ VALUE cIGraph_read_graph_dimacs(VALUE self, VALUE file, VALUE directed){
 
 }
 
+/* The capacities are freed by rb_ensure rather than IGRAPH_FINALLY as
+ * the stream raises Ruby exceptions, which never free the finally stack.
+ */
+typedef struct {
+  VALUE file;
+  VALUE capacity;
+  cIGraph_write_t *w;
+  int e;
+} cIGraph_write_dimacs_t;
+
+static VALUE cIGraph_write_dimacs_body(VALUE arg){
+
+  cIGraph_write_dimacs_t *d = (cIGraph_write_dimacs_t*)arg;
+  long int i;
+
+  for(i=0;i<RARRAY_LEN(d->capacity);i++){
+    igraph_vector_push_back(d->w->capacity,NUM2DBL(RARRAY_PTR(d->capacity)[i]));
+  }
+
+  d->e = cIGraph_stream_write(d->file, cIGraph_write_dimacs, d->w, 0);
+
+  return Qnil;
+
+}
+
+static VALUE cIGraph_write_dimacs_free(VALUE arg){
+  cIGraph_write_dimacs_t *d = (cIGraph_write_dimacs_t*)arg;
+  igraph_vector_destroy(d->w->capacity);
+  return Qnil;
+}
+
 /* call-seq:
  *   graph.write_graph_dimacs(file,source,target,capacity) -> Integer
  *
@@ -582,29 +755,29 @@ VALUE cIGraph_read_graph_dimacs(VALUE self, VALUE file, VALUE directed){
  */
 VALUE cIGraph_write_graph_dimacs(VALUE self, VALUE file, VALUE source, VALUE target, VALUE capacity){
 
-  char *buf;
-  size_t size;
-  FILE *stream;
+  cIGraph_write_t w;
+  cIGraph_write_dimacs_t d;
   igraph_t *graph;
-  int e, i;
 
   igraph_vector_t capacity_v;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  igraph_vector_init(&capacity_v,0);
+  memset(&w, 0, sizeof(w));
+  w.graph    = graph;
+  w.source   = NUM2INT(source);
+  w.target   = NUM2INT(target);
+  w.capacity = &capacity_v;
 
-  for(i=0;i<RARRAY_LEN(capacity);i++){
-    igraph_vector_push_back(&capacity_v,NUM2DBL(RARRAY_PTR(capacity)[i]));
-  }
+  d.file     = file;
+  d.capacity = capacity;
+  d.w        = &w;
+  d.e        = 0;
 
-  stream = open_memstream(&buf,&size);
-  e = igraph_write_graph_dimacs(graph, stream, NUM2INT(source), NUM2INT(target), &capacity_v);
-  fflush(stream);
-  rb_funcall(file, rb_intern("write"), 1, rb_str_new(buf,size));
-  fclose(stream);
+  igraph_vector_init(&capacity_v,0);
+  rb_ensure(cIGraph_write_dimacs_body, (VALUE)&d, cIGraph_write_dimacs_free, (VALUE)&d);
 
-  return e;
+  return d.e;
 
 }
 
@@ -619,8 +792,7 @@ VALUE cIGraph_write_graph_dimacs(VALUE self, VALUE file, VALUE source, VALUE tar
  */
 VALUE cIGraph_read_graph_graphdb(VALUE self, VALUE file, VALUE directed){
 
-  VALUE string;
-  FILE *stream;
+  cIGraph_read_t r;
   VALUE new_graph;
 
   VALUE v_ary;
@@ -639,12 +811,10 @@ VALUE cIGraph_read_graph_graphdb(VALUE self, VALUE file, VALUE directed){
   new_graph = cIGraph_alloc(cIGraph);
   Data_Get_Struct(new_graph, igraph_t, graph);
 
-  string = rb_funcall(file, rb_intern("read"), 0);
-  stream = fmemopen(RSTRING_PTR(string),RSTRING_LEN(string), "r");
-
-  igraph_read_graph_graphdb(graph, stream, directed_b);
-
-  fclose(stream);
+  memset(&r, 0, sizeof(r));
+  r.graph    = graph;
+  r.directed = directed_b;
+  cIGraph_stream_read(file, cIGraph_read_graphdb, &r);
 
   igraph_vs_all(&vs);
   igraph_vit_create(graph, vs, &vit);
@@ -680,20 +850,17 @@ VALUE cIGraph_read_graph_graphdb(VALUE self, VALUE file, VALUE directed){
  */
 VALUE cIGraph_read_graph_graphml(VALUE self, VALUE file, VALUE index){
 
-  VALUE string;
-  FILE *stream;
+  cIGraph_read_t r;
   VALUE new_graph;
   igraph_t *graph;
 
   new_graph = cIGraph_alloc(cIGraph);
   Data_Get_Struct(new_graph, igraph_t, graph);
 
-  string = rb_funcall(file, rb_intern("read"), 0);
-  stream = fmemopen(RSTRING_PTR(string),RSTRING_LEN(string), "r");
-
-  igraph_read_graph_graphml(graph, stream, NUM2INT(index));
-
-  fclose(stream);
+  memset(&r, 0, sizeof(r));
+  r.graph = graph;
+  r.index = NUM2INT(index);
+  cIGraph_stream_read(file, cIGraph_read_graphml, &r);
 
   return new_graph;  
 
@@ -711,23 +878,15 @@ VALUE cIGraph_read_graph_graphml(VALUE self, VALUE file, VALUE index){
  */
 VALUE cIGraph_write_graph_graphml(VALUE self, VALUE file){
 
-  char *buf;
-  size_t size;
-  FILE *stream;
+  cIGraph_write_t w;
   igraph_t *graph;
-  int e;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  stream = open_memstream(&buf,&size);
-  e = igraph_write_graph_graphml(graph, stream);
-  fflush(stream);
-
-  rb_funcall(file, rb_intern("write"), 1, rb_str_new(buf,size));
+  memset(&w, 0, sizeof(w));
+  w.graph = graph;
 
-  fclose(stream);
-
-  return e;
+  return cIGraph_stream_write(file, cIGraph_write_graphml, &w, 0);
 
 }
 
@@ -744,20 +903,16 @@ VALUE cIGraph_write_graph_graphml(VALUE self, VALUE file){
  */
 VALUE cIGraph_read_graph_gml(VALUE self, VALUE file){
 
-  VALUE string;
-  FILE *stream;
+  cIGraph_read_t r;
   VALUE new_graph;
   igraph_t *graph;
 
   new_graph = cIGraph_alloc(cIGraph);
   Data_Get_Struct(new_graph, igraph_t, graph);
 
-  string = rb_funcall(file, rb_intern("read"), 0);
-  stream = fmemopen(RSTRING_PTR(string),RSTRING_LEN(string), "r");
-
-  igraph_read_graph_gml(graph, stream);
-
-  fclose(stream);
+  memset(&r, 0, sizeof(r));
+  r.graph = graph;
+  cIGraph_stream_read(file, cIGraph_read_gml, &r);
 
   return new_graph;  
 
@@ -772,23 +927,15 @@ VALUE cIGraph_read_graph_gml(VALUE self, VALUE file){
  */
 VALUE cIGraph_write_graph_gml(VALUE self, VALUE file){
 
-  char *buf;
-  size_t size;
-  FILE *stream;
+  cIGraph_write_t w;
   igraph_t *graph;
-  int e;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  stream = open_memstream(&buf,&size);
-  e = igraph_write_graph_gml(graph, stream, NULL, 0);
-  fflush(stream);
+  memset(&w, 0, sizeof(w));
+  w.graph = graph;
 
-  rb_funcall(file, rb_intern("write"), 1, rb_str_new(buf,size));
-
-  fclose(stream);
-
-  return e;
+  return cIGraph_stream_write(file, cIGraph_write_gml, &w, 0);
 
 }
 
@@ -803,20 +950,16 @@ VALUE cIGraph_write_graph_gml(VALUE self, VALUE file){
  */
 VALUE cIGraph_read_graph_pajek(VALUE self, VALUE file){
 
-  VALUE string;
-  FILE *stream;
+  cIGraph_read_t r;
   VALUE new_graph;
   igraph_t *graph;
 
   new_graph = cIGraph_alloc(cIGraph);
   Data_Get_Struct(new_graph, igraph_t, graph);
 
-  string = rb_funcall(file, rb_intern("read"), 0);
-  stream = fmemopen(RSTRING_PTR(string),RSTRING_LEN(string), "r");
-
-  IGRAPH_CHECK(igraph_read_graph_pajek(graph, stream));
-
-  fclose(stream);
+  memset(&r, 0, sizeof(r));
+  r.graph = graph;
+  cIGraph_stream_read(file, cIGraph_read_pajek, &r);
 
   return new_graph;  
 
@@ -829,23 +972,15 @@ VALUE cIGraph_read_graph_pajek(VALUE self, VALUE file){
  */
 VALUE cIGraph_write_graph_pajek(VALUE self, VALUE file){
 
-  char *buf;
-  size_t size;
-  FILE *stream;
+  cIGraph_write_t w;
   igraph_t *graph;
-  int e;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  stream = open_memstream(&buf,&size);
-  e = igraph_write_graph_pajek(graph, stream);
-  fflush(stream);
+  memset(&w, 0, sizeof(w));
+  w.graph = graph;
 
-  rb_funcall(file, rb_intern("write"), 1, rb_str_new(buf,size));
-
-  fclose(stream);
-
-  return e;
+  return cIGraph_stream_write(file, cIGraph_write_pajek, &w, 0);
 
 }
 #endif
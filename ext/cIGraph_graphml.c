@@ -0,0 +1,1248 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "ruby/encoding.h"
+#include "cIGraph.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* A streaming GraphML reader that puts the values of the data elements
+ * into typed native columns instead of a Hash per vertex and edge.
+ *
+ * The document comes through cIGraph_stream_read a buffer at a time and
+ * is scanned as a sequence of tags and text, the way a SAX parser would,
+ * so only the current tag and the current data value are held at once.
+ * Node ids are numbered in order of appearance (an edge may name a node
+ * before it is declared) and the edges go straight into the vector handed
+ * to a single igraph_add_edges.
+ *
+ * Every key declared for nodes or edges becomes an IGraphColumn with a row
+ * per vertex or edge: doubles for keys of type boolean, int, long, float
+ * and double, and for string keys a code per row into a dictionary that
+ * holds each distinct string once. The vertices and edges of the graph
+ * are their Integer rows, so they still find their values after other
+ * vertices or edges are deleted.
+ *
+ * Only as much XML as GraphML files use is understood: comments, CDATA,
+ * processing instructions and the DOCTYPE are skipped or kept as they
+ * should be, but the only entities are the five predefined ones and
+ * character references.
+ */
+
+//Bytes read from the stream at a time
+#define CIGRAPH_GRAPHML_CHUNK (1 << 16)
+
+//Attributes of a tag looked at, the rest are ignored
+#define CIGRAPH_GRAPHML_MAXATTRS 16
+
+//What each open element is
+#define CIGRAPH_GRAPHML_NONE    0
+#define CIGRAPH_GRAPHML_OTHER   1
+#define CIGRAPH_GRAPHML_ROOT    2
+#define CIGRAPH_GRAPHML_KEY     3
+#define CIGRAPH_GRAPHML_DEFAULT 4
+#define CIGRAPH_GRAPHML_GRAPH   5
+#define CIGRAPH_GRAPHML_NODE    6
+#define CIGRAPH_GRAPHML_EDGE    7
+#define CIGRAPH_GRAPHML_DATA    8
+#define CIGRAPH_GRAPHML_SKIP    9   //In a graph not being read
+
+//What a key is for
+#define CIGRAPH_GRAPHML_FOR_NODE  1
+#define CIGRAPH_GRAPHML_FOR_EDGE  2
+#define CIGRAPH_GRAPHML_FOR_GRAPH 4
+
+#define CIGRAPH_GRAPHML_DOUBLE 0
+#define CIGRAPH_GRAPHML_STRING 1
+
+VALUE cIGraphColumn;
+
+/* Distinct strings numbered in order of appearance. The strings are kept
+ * one after another in bytes, and the hash table is only needed while
+ * reading.
+ */
+typedef struct {
+  char *bytes;
+  size_t used;
+  size_t cap;
+  size_t *start;             //Where each string starts, count+1 of them
+  unsigned int *hash;
+  long int count;
+  long int entrycap;
+  long int *slots;           //String + 1, 0 for an empty slot
+  long int nslots;           //A power of two
+} cIGraph_dict_t;
+
+typedef struct {
+  int type;
+  long int size;
+  long int cap;
+  double *num;
+  int *code;                 //Into dict, -1 for none
+  double numdef;             //Values of rows nothing was given for
+  int codedef;
+  cIGraph_dict_t dict;
+} cIGraph_column_t;
+
+typedef struct {
+  char *id;
+  char *name;
+  int domain;                //CIGRAPH_GRAPHML_FOR_ bits
+  int type;
+  int boolean;
+  cIGraph_column_t *column[2];  //Of the node and edge values
+  VALUE name_str;
+} cIGraph_graphml_key_t;
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} cIGraph_graphml_buf_t;
+
+typedef struct {
+  VALUE file;
+  VALUE io;
+  int index;                 //Of the graph to read
+  char *buf;
+  const char *pos;
+  const char *end;
+  long int lines;            //Before buf
+  cIGraph_graphml_buf_t tag;
+  cIGraph_graphml_buf_t text;
+  int capture;               //Set while text goes into the data value
+  size_t plain;              //Length of the text already unescaped
+  char *attr[2*CIGRAPH_GRAPHML_MAXATTRS];
+  int nattr;
+  int *stack;                //Open elements
+  long int depth;
+  long int stackcap;
+  cIGraph_graphml_key_t *keys;
+  long int nkeys;
+  long int keycap;
+  cIGraph_graphml_key_t *key;   //Of the data element being read
+  int owner;                 //Element the data belongs to
+  long int row;              //...and its vertex or edge
+  long int graphs;           //Top level graphs seen so far
+  int directed;
+  int done;
+  int warned;
+  cIGraph_dict_t ids;        //Node ids
+  igraph_vector_t edges;
+  int edges_init;
+  long int nedges;
+  VALUE vcols;
+  VALUE ecols;
+  VALUE attrs;               //Graph attributes
+  VALUE defaults;            //...and the defaults of their keys
+  VALUE names;               //Keeps the names of the keys
+} cIGraph_graphml_t;
+
+//FNV-1a
+static unsigned int cIGraph_dict_hash(const char *s, size_t len){
+  unsigned int h = 2166136261U;
+  size_t i;
+  for(i=0;i<len;i++){
+    h ^= (unsigned char)s[i];
+    h *= 16777619U;
+  }
+  return h;
+}
+
+//Number of the string s, added if it is new. -1 if out of memory.
+static long int cIGraph_dict_intern(cIGraph_dict_t *d, const char *s, size_t len){
+
+  unsigned int h = cIGraph_dict_hash(s, len);
+  long int i, j, n, *slots;
+  size_t *start, cap;
+  unsigned int *hash;
+  char *bytes;
+
+  if(d->count * 2 >= d->nslots){
+    n = d->nslots ? d->nslots * 2 : 1024;
+    slots = calloc(n, sizeof(long int));
+    if(!slots)
+      return -1;
+    for(j=0;j<d->count;j++){
+      i = d->hash[j] & (n - 1);
+      while(slots[i])
+	i = (i + 1) & (n - 1);
+      slots[i] = j + 1;
+    }
+    free(d->slots);
+    d->slots  = slots;
+    d->nslots = n;
+  }
+
+  i = (long int)(h & (d->nslots - 1));
+  while((j = d->slots[i])){
+    j--;
+    if(d->hash[j] == h && d->start[j+1] - d->start[j] == len &&
+       memcmp(d->bytes + d->start[j], s, len) == 0)
+      return j;
+    i = (i + 1) & (d->nslots - 1);
+  }
+
+  if(d->count + 1 >= d->entrycap){
+    n     = d->entrycap ? d->entrycap * 2 : 256;
+    start = realloc(d->start, sizeof(size_t) * n);
+    if(!start)
+      return -1;
+    d->start = start;
+    hash = realloc(d->hash, sizeof(unsigned int) * n);
+    if(!hash)
+      return -1;
+    d->hash = hash;
+    if(d->entrycap == 0)
+      d->start[0] = 0;
+    d->entrycap = n;
+  }
+  if(d->used + len > d->cap){
+    cap = d->cap ? d->cap : 4096;
+    while(d->used + len > cap)
+      cap *= 2;
+    bytes = realloc(d->bytes, cap);
+    if(!bytes)
+      return -1;
+    d->bytes = bytes;
+    d->cap   = cap;
+  }
+
+  memcpy(d->bytes + d->used, s, len);
+  d->used += len;
+  d->start[d->count+1] = d->used;
+  d->hash[d->count]    = h;
+  d->slots[i]          = d->count + 1;
+
+  return d->count++;
+
+}
+
+//Drops what is only needed to add strings
+static void cIGraph_dict_seal(cIGraph_dict_t *d){
+  free(d->slots);
+  free(d->hash);
+  d->slots  = NULL;
+  d->hash   = NULL;
+  d->nslots = 0;
+}
+
+static void cIGraph_dict_free(cIGraph_dict_t *d){
+  cIGraph_dict_seal(d);
+  free(d->bytes);
+  free(d->start);
+  memset(d, 0, sizeof(cIGraph_dict_t));
+}
+
+static VALUE cIGraph_dict_get(cIGraph_dict_t *d, long int i){
+  return rb_enc_str_new(d->bytes + d->start[i], d->start[i+1] - d->start[i], rb_utf8_encoding());
+}
+
+void cIGraph_column_free(void *p){
+  cIGraph_column_t *c = p;
+  free(c->num);
+  free(c->code);
+  cIGraph_dict_free(&c->dict);
+  xfree(c);
+}
+
+static VALUE cIGraph_column_new(int type, cIGraph_column_t **out){
+
+  cIGraph_column_t *c;
+  VALUE obj;
+
+  obj = Data_Make_Struct(cIGraphColumn, cIGraph_column_t, 0, cIGraph_column_free, c);
+  c->type    = type;
+  c->numdef  = NAN;
+  c->codedef = -1;
+  *out = c;
+
+  return obj;
+
+}
+
+//Makes the column rows long, giving the new rows the default
+static int cIGraph_column_grow(cIGraph_column_t *c, long int rows){
+
+  long int cap, i;
+  void *grown;
+
+  if(rows <= c->size)
+    return 0;
+
+  if(rows > c->cap){
+    cap = c->cap ? c->cap : 1024;
+    while(cap < rows)
+      cap *= 2;
+    if(c->type == CIGRAPH_GRAPHML_DOUBLE){
+      grown = realloc(c->num, sizeof(double) * cap);
+      if(!grown)
+	return -1;
+      c->num = grown;
+    } else {
+      grown = realloc(c->code, sizeof(int) * cap);
+      if(!grown)
+	return -1;
+      c->code = grown;
+    }
+    c->cap = cap;
+  }
+
+  for(i=c->size;i<rows;i++){
+    if(c->type == CIGRAPH_GRAPHML_DOUBLE)
+      c->num[i] = c->numdef;
+    else
+      c->code[i] = c->codedef;
+  }
+  c->size = rows;
+
+  return 0;
+
+}
+
+/* The number in the NUL terminated text s, NaN if there is none. For
+ * boolean keys true and 1 are 1 and anything else 0.
+ */
+static double cIGraph_graphml_number(char *s, size_t len, int boolean){
+
+  char *end;
+  double d;
+
+  while(len > 0 && (s[len-1] == ' ' || s[len-1] == '\t' || s[len-1] == '\n' || s[len-1] == '\r'))
+    s[--len] = '\0';
+  while(*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+    s++;
+
+  if(boolean)
+    return strcasecmp(s, "true") == 0 || strcmp(s, "1") == 0 ? 1 : 0;
+  if(*s == '\0')
+    return NAN;
+
+  d = strtod(s, &end);
+
+  return *end == '\0' ? d : NAN;
+
+}
+
+static void cIGraph_graphml_error(cIGraph_graphml_t *p, const char *msg){
+
+  long int line = p->lines;
+  const char *c;
+
+  for(c=p->buf;c<p->pos;c++)
+    if(*c == '\n')
+      line++;
+
+  rb_raise(cIGraphError, "GraphML line %ld: %s", line, msg);
+
+}
+
+static void cIGraph_graphml_nomem(void){
+  rb_raise(rb_eNoMemError, "Error allocating GraphML reader");
+}
+
+static void cIGraph_graphml_put(cIGraph_graphml_buf_t *b, const char *s, size_t n){
+
+  size_t cap;
+  char *grown;
+
+  //One more for a NUL
+  if(b->len + n + 1 > b->cap){
+    cap = b->cap ? b->cap : 256;
+    while(b->len + n + 1 > cap)
+      cap *= 2;
+    grown = realloc(b->data, cap);
+    if(!grown)
+      cIGraph_graphml_nomem();
+    b->data = grown;
+    b->cap  = cap;
+  }
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+  b->data[b->len] = '\0';
+
+}
+
+//Reads the next buffer. 0 at the end of the input.
+static int cIGraph_graphml_fill(cIGraph_graphml_t *p, FILE *stream){
+
+  const char *c;
+  size_t n;
+
+  for(c=p->buf;c<p->end;c++)
+    if(*c == '\n')
+      p->lines++;
+
+  n = fread(p->buf, 1, CIGRAPH_GRAPHML_CHUNK, stream);
+  p->pos = p->buf;
+  p->end = p->buf + n;
+
+  return n > 0;
+
+}
+
+static int cIGraph_graphml_getc(cIGraph_graphml_t *p, FILE *stream){
+  if(p->pos == p->end && !cIGraph_graphml_fill(p, stream))
+    cIGraph_graphml_error(p, "Unexpected end of file");
+  return (unsigned char)*p->pos++;
+}
+
+/* Skips past the first '>' following at least n copies of ch, keeping
+ * what comes before them in the text if keep is set. Ends comments, CDATA
+ * sections and processing instructions.
+ */
+static void cIGraph_graphml_until(cIGraph_graphml_t *p, FILE *stream, int ch, int n, int keep){
+
+  int run = 0, c;
+  char b;
+
+  for(;;){
+    c = cIGraph_graphml_getc(p, stream);
+    if(c == '>' && run >= n)
+      break;
+    if(keep){
+      b = (char)c;
+      cIGraph_graphml_put(&p->text, &b, 1);
+    }
+    run = c == ch ? run + 1 : 0;
+  }
+  if(keep){
+    p->text.len -= n;
+    p->text.data[p->text.len] = '\0';
+  }
+
+}
+
+/* Replaces the character references and predefined entities in s with
+ * what they stand for and returns the new length. Anything else, including
+ * references to characters UTF-8 cannot hold, is left as it is.
+ */
+static size_t cIGraph_graphml_unescape(char *s, size_t len){
+
+  char *r = s, *w = s, *end = s + len, *semi, *digits, *last;
+  unsigned long int u;
+  long int n;
+  int hex;
+
+  if(!memchr(s, '&', len))
+    return len;
+
+  while(r < end){
+    if(*r != '&' || !(semi = memchr(r, ';', end - r))){
+      *w++ = *r++;
+      continue;
+    }
+    n = semi - r - 1;
+    if(n == 2 && memcmp(r+1, "lt", 2) == 0){
+      *w++ = '<';
+    } else if(n == 2 && memcmp(r+1, "gt", 2) == 0){
+      *w++ = '>';
+    } else if(n == 3 && memcmp(r+1, "amp", 3) == 0){
+      *w++ = '&';
+    } else if(n == 4 && memcmp(r+1, "quot", 4) == 0){
+      *w++ = '"';
+    } else if(n == 4 && memcmp(r+1, "apos", 4) == 0){
+      *w++ = '\'';
+    } else if(n >= 2 && r[1] == '#' &&
+	      (digits = r + ((hex = r[2] == 'x') ? 3 : 2)) < semi &&
+	      (hex ? isxdigit((unsigned char)*digits) : isdigit((unsigned char)*digits)) &&
+	      (u = strtoul(digits, &last, hex ? 16 : 10), last == semi) &&
+	      u > 0 && u <= 0x10FFFF && (u < 0xD800 || u > 0xDFFF)){
+      if(u < 0x80){
+	*w++ = (char)u;
+      } else if(u < 0x800){
+	*w++ = (char)(0xC0 | (u >> 6));
+	*w++ = (char)(0x80 | (u & 0x3F));
+      } else if(u < 0x10000){
+	*w++ = (char)(0xE0 | (u >> 12));
+	*w++ = (char)(0x80 | ((u >> 6) & 0x3F));
+	*w++ = (char)(0x80 | (u & 0x3F));
+      } else {
+	*w++ = (char)(0xF0 | ((u >> 18) & 0x07));
+	*w++ = (char)(0x80 | ((u >> 12) & 0x3F));
+	*w++ = (char)(0x80 | ((u >> 6) & 0x3F));
+	*w++ = (char)(0x80 | (u & 0x3F));
+      }
+    } else {
+      memmove(w, r, semi + 1 - r);
+      w += semi + 1 - r;
+    }
+    r = semi + 1;
+  }
+
+  return w - s;
+
+}
+
+//Unescapes the text captured since the last call
+static void cIGraph_graphml_plain(cIGraph_graphml_t *p){
+
+  p->text.len = p->plain +
+    cIGraph_graphml_unescape(p->text.data + p->plain, p->text.len - p->plain);
+  p->text.data[p->text.len] = '\0';
+  p->plain = p->text.len;
+
+}
+
+static int cIGraph_graphml_space(int c){
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Splits the tag in p->tag into its local name (returned) and attributes
+ * (in p->attr) and sets *empty if it closes itself.
+ */
+static char *cIGraph_graphml_split(cIGraph_graphml_t *p, int *empty){
+
+  char *s = p->tag.data, *end = p->tag.data + p->tag.len;
+  char *name, *local, *attr, quote;
+
+  while(end > s && cIGraph_graphml_space(end[-1]))
+    end--;
+  *empty = end > s && end[-1] == '/';
+  if(*empty)
+    end--;
+  *end = '\0';
+
+  name = s;
+  while(s < end && !cIGraph_graphml_space(*s))
+    s++;
+  if(s < end)
+    *s++ = '\0';
+  local = strrchr(name, ':');
+  local = local ? local + 1 : name;
+
+  p->nattr = 0;
+  for(;;){
+    while(s < end && cIGraph_graphml_space(*s))
+      s++;
+    if(s >= end)
+      break;
+    attr = s;
+    while(s < end && *s != '=' && !cIGraph_graphml_space(*s))
+      s++;
+    if(s < end && *s != '='){
+      *s++ = '\0';
+      while(s < end && cIGraph_graphml_space(*s))
+	s++;
+    }
+    if(s >= end || *s != '=')
+      cIGraph_graphml_error(p, "Malformed attribute");
+    *s++ = '\0';
+    while(s < end && cIGraph_graphml_space(*s))
+      s++;
+    if(s >= end || (*s != '"' && *s != '\''))
+      cIGraph_graphml_error(p, "Malformed attribute");
+    quote = *s++;
+    if(p->nattr < CIGRAPH_GRAPHML_MAXATTRS){
+      p->attr[2*p->nattr]   = attr;
+      p->attr[2*p->nattr+1] = s;
+      p->nattr++;
+    }
+    attr = s;
+    while(s < end && *s != quote)
+      s++;
+    if(s >= end)
+      cIGraph_graphml_error(p, "Malformed attribute");
+    attr[cIGraph_graphml_unescape(attr, s - attr)] = '\0';
+    s++;
+  }
+
+  return local;
+
+}
+
+//Value of the attribute called name of the current tag, NULL if none
+static const char *cIGraph_graphml_attr(cIGraph_graphml_t *p, const char *name){
+
+  int i;
+
+  for(i=0;i<p->nattr;i++)
+    if(strcmp(p->attr[2*i], name) == 0)
+      return p->attr[2*i+1];
+
+  return NULL;
+
+}
+
+//The column the values of a key for nodes (or edges) go into
+static cIGraph_column_t *cIGraph_graphml_column(cIGraph_graphml_t *p, VALUE cols, VALUE name, int type){
+
+  cIGraph_column_t *c;
+  VALUE obj;
+
+  //Keys sharing a name share the column
+  obj = rb_hash_aref(cols, name);
+  if(!NIL_P(obj)){
+    Data_Get_Struct(obj, cIGraph_column_t, c);
+    return c;
+  }
+
+  obj = cIGraph_column_new(type, &c);
+  rb_hash_aset(cols, name, obj);
+
+  return c;
+
+}
+
+static void cIGraph_graphml_key(cIGraph_graphml_t *p){
+
+  cIGraph_graphml_key_t *k, *grown;
+  const char *id, *domain, *name, *type;
+  long int n;
+
+  id     = cIGraph_graphml_attr(p, "id");
+  domain = cIGraph_graphml_attr(p, "for");
+  name   = cIGraph_graphml_attr(p, "attr.name");
+  type   = cIGraph_graphml_attr(p, "attr.type");
+
+  if(!id)
+    cIGraph_graphml_error(p, "Key without an id");
+  if(!name)
+    name = id;
+
+  if(p->nkeys == p->keycap){
+    n = p->keycap ? p->keycap * 2 : 16;
+    grown = realloc(p->keys, sizeof(cIGraph_graphml_key_t) * n);
+    if(!grown)
+      cIGraph_graphml_nomem();
+    p->keys   = grown;
+    p->keycap = n;
+  }
+  k = &p->keys[p->nkeys];
+  memset(k, 0, sizeof(cIGraph_graphml_key_t));
+  k->id   = strdup(id);
+  k->name = strdup(name);
+  if(!k->id || !k->name){
+    free(k->id);
+    free(k->name);
+    cIGraph_graphml_nomem();
+  }
+  p->nkeys++;
+
+  if(!domain || strcmp(domain, "all") == 0)
+    k->domain = CIGRAPH_GRAPHML_FOR_NODE | CIGRAPH_GRAPHML_FOR_EDGE | CIGRAPH_GRAPHML_FOR_GRAPH;
+  else if(strcmp(domain, "node") == 0)
+    k->domain = CIGRAPH_GRAPHML_FOR_NODE;
+  else if(strcmp(domain, "edge") == 0)
+    k->domain = CIGRAPH_GRAPHML_FOR_EDGE;
+  else if(strcmp(domain, "graph") == 0)
+    k->domain = CIGRAPH_GRAPHML_FOR_GRAPH;
+
+  k->type = CIGRAPH_GRAPHML_STRING;
+  if(type && (strcmp(type, "boolean") == 0 || strcmp(type, "int") == 0 ||
+	      strcmp(type, "long") == 0 || strcmp(type, "float") == 0 ||
+	      strcmp(type, "double") == 0))
+    k->type = CIGRAPH_GRAPHML_DOUBLE;
+  k->boolean = type && strcmp(type, "boolean") == 0;
+
+  k->name_str = rb_str_freeze(rb_enc_str_new(k->name, strlen(k->name), rb_utf8_encoding()));
+  rb_ary_push(p->names, k->name_str);
+  if(k->domain & CIGRAPH_GRAPHML_FOR_NODE)
+    k->column[0] = cIGraph_graphml_column(p, p->vcols, k->name_str, k->type);
+  if(k->domain & CIGRAPH_GRAPHML_FOR_EDGE)
+    k->column[1] = cIGraph_graphml_column(p, p->ecols, k->name_str, k->type);
+
+}
+
+//Ruby object for the value of key in the text read
+static VALUE cIGraph_graphml_value(cIGraph_graphml_t *p, cIGraph_graphml_key_t *k){
+  if(k->type == CIGRAPH_GRAPHML_DOUBLE)
+    return rb_float_new(cIGraph_graphml_number(p->text.data, p->text.len, k->boolean));
+  return rb_enc_str_new(p->text.data, p->text.len, rb_utf8_encoding());
+}
+
+//Puts the text read into row of c
+static void cIGraph_graphml_store(cIGraph_graphml_t *p, cIGraph_graphml_key_t *k, cIGraph_column_t *c, long int row){
+
+  long int code;
+
+  if(cIGraph_column_grow(c, row + 1))
+    cIGraph_graphml_nomem();
+
+  if(c->type == CIGRAPH_GRAPHML_DOUBLE){
+    c->num[row] = cIGraph_graphml_number(p->text.data, p->text.len, k->boolean);
+  } else {
+    if((code = cIGraph_dict_intern(&c->dict, p->text.data, p->text.len)) < 0)
+      cIGraph_graphml_nomem();
+    c->code[row] = (int)code;
+  }
+
+}
+
+//Sets the default of the key being declared
+static void cIGraph_graphml_default(cIGraph_graphml_t *p){
+
+  cIGraph_graphml_key_t *k = &p->keys[p->nkeys-1];
+  cIGraph_column_t *c;
+  long int code;
+  int i;
+
+  for(i=0;i<2;i++){
+    if(!(c = k->column[i]))
+      continue;
+    if(c->type == CIGRAPH_GRAPHML_DOUBLE){
+      c->numdef = cIGraph_graphml_number(p->text.data, p->text.len, k->boolean);
+    } else {
+      if((code = cIGraph_dict_intern(&c->dict, p->text.data, p->text.len)) < 0)
+	cIGraph_graphml_nomem();
+      c->codedef = (int)code;
+    }
+  }
+  if(k->domain & CIGRAPH_GRAPHML_FOR_GRAPH)
+    rb_hash_aset(p->defaults, k->name_str, cIGraph_graphml_value(p, k));
+
+}
+
+static void cIGraph_graphml_data(cIGraph_graphml_t *p){
+
+  cIGraph_graphml_key_t *k = p->key;
+
+  if(p->owner == CIGRAPH_GRAPHML_GRAPH)
+    rb_hash_aset(p->attrs, k->name_str, cIGraph_graphml_value(p, k));
+  else
+    cIGraph_graphml_store(p, k, k->column[p->owner == CIGRAPH_GRAPHML_EDGE], p->row);
+
+}
+
+//Number of the node called id
+static long int cIGraph_graphml_node(cIGraph_graphml_t *p, const char *id){
+
+  long int v = cIGraph_dict_intern(&p->ids, id, strlen(id));
+
+  if(v < 0)
+    cIGraph_graphml_nomem();
+  if(v > INT_MAX)
+    cIGraph_graphml_error(p, "Too many nodes");
+
+  return v;
+
+}
+
+static void cIGraph_graphml_push(cIGraph_graphml_t *p, int kind){
+
+  int *grown;
+  long int n;
+
+  if(p->depth == p->stackcap){
+    n = p->stackcap ? p->stackcap * 2 : 64;
+    grown = realloc(p->stack, sizeof(int) * n);
+    if(!grown)
+      cIGraph_graphml_nomem();
+    p->stack    = grown;
+    p->stackcap = n;
+  }
+  p->stack[p->depth++] = kind;
+
+  p->capture = kind == CIGRAPH_GRAPHML_DATA || kind == CIGRAPH_GRAPHML_DEFAULT;
+  if(p->capture)
+    p->text.len = p->plain = 0;
+
+}
+
+static void cIGraph_graphml_end(cIGraph_graphml_t *p){
+
+  int kind;
+
+  if(p->depth == 0)
+    cIGraph_graphml_error(p, "Unexpected end tag");
+  kind = p->stack[--p->depth];
+
+  if(kind == CIGRAPH_GRAPHML_DATA || kind == CIGRAPH_GRAPHML_DEFAULT){
+    if(!p->text.data)
+      cIGraph_graphml_put(&p->text, "", 0);
+    if(kind == CIGRAPH_GRAPHML_DATA)
+      cIGraph_graphml_data(p);
+    else
+      cIGraph_graphml_default(p);
+  }
+  if(kind == CIGRAPH_GRAPHML_GRAPH)
+    p->done = 1;
+
+  //Text of a data element around a child is still its value
+  p->capture = p->depth > 0 &&
+    (p->stack[p->depth-1] == CIGRAPH_GRAPHML_DATA || p->stack[p->depth-1] == CIGRAPH_GRAPHML_DEFAULT);
+
+}
+
+static void cIGraph_graphml_start(cIGraph_graphml_t *p){
+
+  int parent = p->depth ? p->stack[p->depth-1] : CIGRAPH_GRAPHML_NONE;
+  int kind = CIGRAPH_GRAPHML_OTHER, empty, domain;
+  const char *source, *target, *id, *edgedefault;
+  char *local;
+  long int i;
+
+  local = cIGraph_graphml_split(p, &empty);
+
+  if(parent == CIGRAPH_GRAPHML_SKIP){
+    kind = CIGRAPH_GRAPHML_SKIP;
+  } else if(parent == CIGRAPH_GRAPHML_NONE && strcmp(local, "graphml") == 0){
+    kind = CIGRAPH_GRAPHML_ROOT;
+  } else if(parent == CIGRAPH_GRAPHML_ROOT && strcmp(local, "key") == 0){
+    cIGraph_graphml_key(p);
+    kind = CIGRAPH_GRAPHML_KEY;
+  } else if(parent == CIGRAPH_GRAPHML_KEY && strcmp(local, "default") == 0){
+    kind = CIGRAPH_GRAPHML_DEFAULT;
+  } else if(strcmp(local, "graph") == 0){
+    kind = CIGRAPH_GRAPHML_SKIP;
+    if(parent != CIGRAPH_GRAPHML_ROOT){
+      IGRAPH_WARNING("nested graphs are not supported, ignoring nested graph");
+    } else if(p->graphs++ == p->index){
+      edgedefault = cIGraph_graphml_attr(p, "edgedefault");
+      p->directed = !edgedefault || strcmp(edgedefault, "undirected") != 0;
+      kind = CIGRAPH_GRAPHML_GRAPH;
+    }
+  } else if(parent == CIGRAPH_GRAPHML_GRAPH && strcmp(local, "node") == 0){
+    if(!(id = cIGraph_graphml_attr(p, "id")))
+      cIGraph_graphml_error(p, "Node without an id");
+    p->row = cIGraph_graphml_node(p, id);
+    kind = CIGRAPH_GRAPHML_NODE;
+  } else if(parent == CIGRAPH_GRAPHML_GRAPH && strcmp(local, "edge") == 0){
+    source = cIGraph_graphml_attr(p, "source");
+    target = cIGraph_graphml_attr(p, "target");
+    if(!source || !target)
+      cIGraph_graphml_error(p, "Edge without a source or target");
+    if(igraph_vector_push_back(&p->edges, cIGraph_graphml_node(p, source)) ||
+       igraph_vector_push_back(&p->edges, cIGraph_graphml_node(p, target)))
+      cIGraph_graphml_nomem();
+    p->row = p->nedges++;
+    kind = CIGRAPH_GRAPHML_EDGE;
+  } else if(strcmp(local, "data") == 0 &&
+	    (parent == CIGRAPH_GRAPHML_GRAPH || parent == CIGRAPH_GRAPHML_NODE || parent == CIGRAPH_GRAPHML_EDGE)){
+    domain = parent == CIGRAPH_GRAPHML_NODE ? CIGRAPH_GRAPHML_FOR_NODE :
+             parent == CIGRAPH_GRAPHML_EDGE ? CIGRAPH_GRAPHML_FOR_EDGE : CIGRAPH_GRAPHML_FOR_GRAPH;
+    id = cIGraph_graphml_attr(p, "key");
+    p->key = NULL;
+    for(i=0;id && i<p->nkeys;i++){
+      if((p->keys[i].domain & domain) && strcmp(p->keys[i].id, id) == 0){
+	p->key = &p->keys[i];
+	break;
+      }
+    }
+    if(p->key){
+      p->owner = parent;
+      kind = CIGRAPH_GRAPHML_DATA;
+    } else if(!p->warned){
+      //Once, rather than for every element of a large file
+      IGRAPH_WARNING("unknown attribute key in GraphML file, ignoring attribute");
+      p->warned = 1;
+    }
+  }
+
+  cIGraph_graphml_push(p, kind);
+  if(empty)
+    cIGraph_graphml_end(p);
+
+}
+
+//Reads a tag after the '<' into p->tag, without the closing '>'
+static void cIGraph_graphml_tag(cIGraph_graphml_t *p, FILE *stream){
+
+  const char *gt, *q;
+  int quote = 0;
+
+  p->tag.len = 0;
+  for(;;){
+    if(p->pos == p->end && !cIGraph_graphml_fill(p, stream))
+      cIGraph_graphml_error(p, "Unexpected end of file");
+    //Most tags end in the same buffer, without a quoted '>' in them
+    for(q=p->pos,gt=NULL;q<p->end;q++){
+      if(quote){
+	if(*q == quote)
+	  quote = 0;
+      } else if(*q == '"' || *q == '\''){
+	quote = *q;
+      } else if(*q == '>'){
+	gt = q;
+	break;
+      }
+    }
+    cIGraph_graphml_put(&p->tag, p->pos, (gt ? gt : p->end) - p->pos);
+    p->pos = gt ? gt + 1 : p->end;
+    if(gt)
+      break;
+  }
+
+}
+
+//Handles the markup following a '<'
+static void cIGraph_graphml_markup(cIGraph_graphml_t *p, FILE *stream){
+
+  int c, depth;
+
+  c = cIGraph_graphml_getc(p, stream);
+
+  if(c == '?'){
+    cIGraph_graphml_until(p, stream, '?', 1, 0);
+  } else if(c == '!'){
+    c = cIGraph_graphml_getc(p, stream);
+    if(c == '-'){
+      if(cIGraph_graphml_getc(p, stream) != '-')
+	cIGraph_graphml_error(p, "Malformed comment");
+      cIGraph_graphml_until(p, stream, '-', 2, 0);
+    } else if(c == '['){
+      for(depth=0;depth<6;depth++)
+	if(cIGraph_graphml_getc(p, stream) != "CDATA["[depth])
+	  cIGraph_graphml_error(p, "Malformed CDATA section");
+      //Taken as it is, with nothing to unescape
+      cIGraph_graphml_until(p, stream, ']', 2, p->capture);
+      p->plain = p->text.len;
+    } else {
+      //A DOCTYPE, with any internal subset in brackets
+      depth = c == '[';
+      while((c = cIGraph_graphml_getc(p, stream)) != '>' || depth > 0){
+	if(c == '[')
+	  depth++;
+	else if(c == ']')
+	  depth--;
+      }
+    }
+  } else if(c == '/'){
+    cIGraph_graphml_tag(p, stream);
+    cIGraph_graphml_end(p);
+  } else {
+    p->pos--;
+    cIGraph_graphml_tag(p, stream);
+    cIGraph_graphml_start(p);
+  }
+
+}
+
+static int cIGraph_graphml_parse(FILE *stream, void *arg){
+
+  cIGraph_graphml_t *p = arg;
+  const char *lt;
+
+  while(!p->done){
+    if(p->pos == p->end && !cIGraph_graphml_fill(p, stream))
+      break;
+    lt = memchr(p->pos, '<', p->end - p->pos);
+    if(p->capture){
+      cIGraph_graphml_put(&p->text, p->pos, (lt ? lt : p->end) - p->pos);
+      //A reference cannot hold a '<', so the text before one is complete
+      if(lt)
+	cIGraph_graphml_plain(p);
+    }
+    if(!lt){
+      p->pos = p->end;
+      continue;
+    }
+    p->pos = lt + 1;
+    cIGraph_graphml_markup(p, stream);
+  }
+
+  if(!p->done && p->graphs > p->index)
+    cIGraph_graphml_error(p, "Unexpected end of file");
+  if(!p->done)
+    rb_raise(cIGraphError, "GraphML file has no graph with index %d", p->index);
+
+  return 0;
+
+}
+
+static VALUE cIGraph_graphml_read(VALUE arg){
+
+  cIGraph_graphml_t *p = (cIGraph_graphml_t*)arg;
+  cIGraph_column_t *c;
+  VALUE new_graph, v_ary, e_ary, obj, keys;
+  igraph_t *graph;
+  igraph_vector_ptr_t v_attr, e_attr;
+  igraph_i_attribute_record_t v_rec, e_rec;
+  long int i, n, m;
+
+  p->buf = malloc(CIGRAPH_GRAPHML_CHUNK);
+  if(!p->buf)
+    cIGraph_graphml_nomem();
+  p->pos = p->end = p->buf;
+
+  igraph_vector_init(&p->edges, 0);
+  p->edges_init = 1;
+
+  cIGraph_stream_read(p->io, cIGraph_graphml_parse, p);
+
+  n = p->ids.count;
+  m = p->nedges;
+
+  //Rows nothing was given for take the default
+  keys = rb_funcall(p->vcols, rb_intern("values"), 0);
+  for(i=0;i<RARRAY_LEN(keys);i++){
+    Data_Get_Struct(RARRAY_PTR(keys)[i], cIGraph_column_t, c);
+    if(cIGraph_column_grow(c, n))
+      cIGraph_graphml_nomem();
+    cIGraph_dict_seal(&c->dict);
+  }
+  keys = rb_funcall(p->ecols, rb_intern("values"), 0);
+  for(i=0;i<RARRAY_LEN(keys);i++){
+    Data_Get_Struct(RARRAY_PTR(keys)[i], cIGraph_column_t, c);
+    if(cIGraph_column_grow(c, m))
+      cIGraph_graphml_nomem();
+    cIGraph_dict_seal(&c->dict);
+  }
+
+  //The node ids are a column of their own unless a key takes the name
+  obj = rb_str_freeze(rb_str_new2("id"));
+  if(NIL_P(rb_hash_aref(p->vcols, obj))){
+    rb_hash_aset(p->vcols, obj, cIGraph_column_new(CIGRAPH_GRAPHML_STRING, &c));
+    c->code = malloc(sizeof(int) * (n > 0 ? n : 1));
+    if(!c->code)
+      cIGraph_graphml_nomem();
+    for(i=0;i<n;i++)
+      c->code[i] = (int)i;
+    c->size = c->cap = n;
+    c->dict = p->ids;
+    memset(&p->ids, 0, sizeof(cIGraph_dict_t));
+    cIGraph_dict_seal(&c->dict);
+  }
+
+  new_graph = cIGraph_alloc(cIGraph);
+  Data_Get_Struct(new_graph, igraph_t, graph);
+  igraph_destroy(graph);
+  igraph_empty(graph, 0, p->directed);
+
+  //Each vertex and edge is the row of its values
+  v_ary = rb_ary_new2(n);
+  for(i=0;i<n;i++)
+    rb_ary_push(v_ary, LONG2NUM(i));
+  e_ary = rb_ary_new2(m);
+  for(i=0;i<m;i++)
+    rb_ary_push(e_ary, LONG2NUM(i));
+
+  v_rec.name  = "__RUBY__";
+  v_rec.type  = IGRAPH_ATTRIBUTE_PY_OBJECT;
+  v_rec.value = (void*)v_ary;
+  e_rec.name  = "__RUBY__";
+  e_rec.type  = IGRAPH_ATTRIBUTE_PY_OBJECT;
+  e_rec.value = (void*)e_ary;
+
+  igraph_vector_ptr_init(&v_attr, 0);
+  igraph_vector_ptr_init(&e_attr, 0);
+  igraph_vector_ptr_push_back(&v_attr, &v_rec);
+  igraph_vector_ptr_push_back(&e_attr, &e_rec);
+
+  igraph_add_vertices(graph, n, &v_attr);
+  if(m > 0)
+    igraph_add_edges(graph, &p->edges, &e_attr);
+
+  igraph_vector_ptr_destroy(&v_attr);
+  igraph_vector_ptr_destroy(&e_attr);
+
+  //Graph attributes, or the defaults of their keys
+  rb_funcall(p->defaults, rb_intern("update"), 1, p->attrs);
+  rb_funcall(((VALUE*)graph->attr)[2], rb_intern("update"), 1, p->defaults);
+
+  RB_GC_GUARD(v_ary);
+  RB_GC_GUARD(e_ary);
+
+  return rb_ary_new3(3, new_graph, p->vcols, p->ecols);
+
+}
+
+static VALUE cIGraph_graphml_release(VALUE arg){
+
+  cIGraph_graphml_t *p = (cIGraph_graphml_t*)arg;
+  long int i;
+
+  free(p->buf);
+  free(p->tag.data);
+  free(p->text.data);
+  free(p->stack);
+  for(i=0;i<p->nkeys;i++){
+    free(p->keys[i].id);
+    free(p->keys[i].name);
+  }
+  free(p->keys);
+  cIGraph_dict_free(&p->ids);
+  if(p->edges_init)
+    igraph_vector_destroy(&p->edges);
+
+  if(p->io != p->file)
+    rb_funcall(p->io, rb_intern("close"), 0);
+
+  return Qnil;
+
+}
+
+/* call-seq:
+ *   IGraph::FileRead.read_graph_graphml_columns(file,index) -> [IGraph,Hash,Hash]
+ *
+ * Reads a graph from a GraphML file, as read_graph_graphml does, but keeps
+ * the values of the data elements in an IGraphColumn for each key instead
+ * of a Hash for every vertex and edge. The file is read as a stream, so
+ * the memory needed does not depend on the size of the file beyond the
+ * graph and its values, and large files load quickly.
+ *
+ * Returns the graph and two Hashes from the names of the node and edge
+ * keys to their columns. Vertices and edges are the Integers 0, 1, ... in
+ * the order they appear in the file, which are also their rows in the
+ * columns. The node ids are the column 'id' (unless there is a key of that
+ * name) and the graph's data are its attributes.
+ *
+ * file: IO object or the path of a file to read from, which may be gzip
+ * compressed
+ *
+ * index: If the file contains more than one graph the one with this index
+ * (starting from zero) is read
+ *
+ *   g, vertex, edge = IGraph::FileRead.read_graph_graphml_columns(file,0)
+ *   vertex['color'][g.vertices.first] #=> 'green'
+ */
+VALUE cIGraph_read_graph_graphml_columns(VALUE self, VALUE file, VALUE index){
+
+  cIGraph_graphml_t p;
+  VALUE ret;
+
+  memset(&p, 0, sizeof(p));
+  p.file     = file;
+  p.index    = NUM2INT(index);
+  p.vcols    = rb_hash_new();
+  p.ecols    = rb_hash_new();
+  p.attrs    = rb_hash_new();
+  p.defaults = rb_hash_new();
+  p.names    = rb_ary_new();
+  p.lines    = 1;
+
+  if(TYPE(file) == T_STRING)
+    p.io = rb_funcall(rb_cFile, rb_intern("open"), 2, file, rb_str_new2("rb"));
+  else
+    p.io = file;
+
+  ret = rb_ensure(cIGraph_graphml_read, (VALUE)&p, cIGraph_graphml_release, (VALUE)&p);
+
+  RB_GC_GUARD(p.vcols);
+  RB_GC_GUARD(p.ecols);
+  RB_GC_GUARD(p.attrs);
+  RB_GC_GUARD(p.defaults);
+  RB_GC_GUARD(p.names);
+  RB_GC_GUARD(p.io);
+
+  return ret;
+
+}
+
+/* call-seq:
+ *   column.type -> Symbol
+ *
+ * Returns :double or :string, the type of the values in the column.
+ */
+VALUE cIGraph_column_type(VALUE self){
+
+  cIGraph_column_t *c;
+
+  Data_Get_Struct(self, cIGraph_column_t, c);
+
+  return ID2SYM(rb_intern(c->type == CIGRAPH_GRAPHML_DOUBLE ? "double" : "string"));
+
+}
+
+/* call-seq:
+ *   column.size -> Integer
+ *
+ * Returns the number of rows in the column.
+ */
+VALUE cIGraph_column_size(VALUE self){
+
+  cIGraph_column_t *c;
+
+  Data_Get_Struct(self, cIGraph_column_t, c);
+
+  return LONG2NUM(c->size);
+
+}
+
+static VALUE cIGraph_column_value(cIGraph_column_t *c, long int i){
+  if(c->type == CIGRAPH_GRAPHML_DOUBLE)
+    return rb_float_new(c->num[i]);
+  return c->code[i] < 0 ? Qnil : cIGraph_dict_get(&c->dict, c->code[i]);
+}
+
+/* call-seq:
+ *   column[row] -> Object
+ *
+ * Returns the value in row, a Float or a String (nil if there is none).
+ * Negative rows count from the end, and rows out of range return nil.
+ */
+VALUE cIGraph_column_get(VALUE self, VALUE row){
+
+  cIGraph_column_t *c;
+  long int i;
+
+  Data_Get_Struct(self, cIGraph_column_t, c);
+
+  i = NUM2LONG(row);
+  if(i < 0)
+    i += c->size;
+  if(i < 0 || i >= c->size)
+    return Qnil;
+
+  return cIGraph_column_value(c, i);
+
+}
+
+/* call-seq:
+ *   column.each{|value| block} -> nil
+ *
+ * Yields the value in each row in turn.
+ */
+VALUE cIGraph_column_each(VALUE self){
+
+  cIGraph_column_t *c;
+  long int i;
+
+  Data_Get_Struct(self, cIGraph_column_t, c);
+
+  for(i=0;i<c->size;i++)
+    rb_yield(cIGraph_column_value(c, i));
+
+  return Qnil;
+
+}
+
+/* call-seq:
+ *   column.to_a -> Array
+ *
+ * Returns the values of all rows.
+ */
+VALUE cIGraph_column_toa(VALUE self){
+
+  cIGraph_column_t *c;
+  VALUE a;
+  long int i;
+
+  Data_Get_Struct(self, cIGraph_column_t, c);
+
+  a = rb_ary_new2(c->size);
+  for(i=0;i<c->size;i++)
+    rb_ary_push(a, cIGraph_column_value(c, i));
+
+  return a;
+
+}
+
+/* call-seq:
+ *   column.dictionary -> Array
+ *
+ * Returns each distinct String of a string column once, in the order they
+ * first appeared, or nil for a column of doubles.
+ */
+VALUE cIGraph_column_dictionary(VALUE self){
+
+  cIGraph_column_t *c;
+  VALUE a;
+  long int i;
+
+  Data_Get_Struct(self, cIGraph_column_t, c);
+
+  if(c->type == CIGRAPH_GRAPHML_DOUBLE)
+    return Qnil;
+
+  a = rb_ary_new2(c->dict.count);
+  for(i=0;i<c->dict.count;i++)
+    rb_ary_push(a, cIGraph_dict_get(&c->dict, i));
+
+  return a;
+
+}
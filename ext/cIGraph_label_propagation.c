@@ -0,0 +1,417 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+/* Label propagation community detection (Raghavan, Albert and Kumara
+ * 2007). Every vertex repeatedly takes the label carrying the most weight
+ * among its neighbours, until no label changes. Ties keep the current
+ * label if it is one of the best, otherwise one of the best is picked at
+ * random.
+ *
+ * Three update orders are offered, each spreading blocks of vertices over
+ * the worker threads:
+ *
+ * - synchronous: every vertex updates from the labels of the previous
+ *   sweep. Fully parallel and reproducible, but can oscillate.
+ * - semi-synchronous (Cordasco and Gargano 2010): the vertices are
+ *   coloured so that no two neighbours share a colour and each colour
+ *   updates at once in turn. Reproducible and guaranteed to settle.
+ * - asynchronous: vertices update in place in a random order. With more
+ *   than one thread neighbours may update at the same time, so runs are
+ *   not reproducible.
+ *
+ * Random tie breaks use a stream per vertex and sweep.
+ */
+
+#define CIGRAPH_LPA_CHUNK 256
+
+//Blocks with fewer vertices than this are not worth starting threads for
+#define CIGRAPH_LPA_SERIAL 2048
+
+#define CIGRAPH_LPA_SYNC     0
+#define CIGRAPH_LPA_SEMISYNC 1
+#define CIGRAPH_LPA_ASYNC    2
+
+//Shared by all of the worker threads
+typedef struct {
+  cIGraph_wgraph_t *g;
+  unsigned long long seed;
+  long int sweep;
+  int *label;                //Labels read
+  int *update;               //Labels written (the same as label unless synchronous)
+  const int *nodes;          //Vertices to update, NULL for all of them
+  long int nnodes;
+  long int next;
+  long int changed;
+} cIGraph_lpa_shared_t;
+
+//A small open addressing table of label weights
+typedef struct {
+  cIGraph_lpa_shared_t *s;
+  int *keys;
+  double *vals;
+  long int *used;
+  long int mask;
+} cIGraph_lpa_worker_t;
+
+static int cIGraph_lpa_cmp(const void *a, const void *b){
+  int x = *(const int*)a;
+  int y = *(const int*)b;
+  return (x > y) - (x < y);
+}
+
+static int cIGraph_lpa_best(cIGraph_lpa_worker_t *w, long int v){
+
+  cIGraph_lpa_shared_t *s = w->s;
+  cIGraph_wgraph_t *g = s->g;
+  long int p, slot, nused = 0, ties = 0;
+  int cur = __atomic_load_n(&s->label[v], __ATOMIC_RELAXED);
+  int l, best = cur, keep = 0;
+  double max = 0;
+  cIGraph_rng_t rng;
+
+  if(g->offset[v] == g->offset[v+1])
+    return cur;
+
+  for(p=g->offset[v];p<g->offset[v+1];p++){
+    l = __atomic_load_n(&s->label[g->nbr[p]], __ATOMIC_RELAXED);
+    slot = (l * 2654435761UL) & w->mask;
+    while(w->keys[slot] != -1 && w->keys[slot] != l)
+      slot = (slot + 1) & w->mask;
+    if(w->keys[slot] == -1){
+      w->keys[slot] = l;
+      w->vals[slot] = 0;
+      w->used[nused++] = slot;
+    }
+    w->vals[slot] += g->weight[p];
+  }
+
+  for(p=0;p<nused;p++)
+    if(w->vals[w->used[p]] > max)
+      max = w->vals[w->used[p]];
+
+  for(p=0;p<nused;p++){
+    slot = w->used[p];
+    if(w->vals[slot] == max){
+      if(w->keys[slot] == cur)
+	keep = 1;
+      //Reservoir sampling over the tied labels
+      if(ties == 0)
+	cIGraph_rng_seed(&rng, s->seed ^ (0x9E3779B97F4A7C15ULL * (unsigned long long)(s->sweep + 1)), (int)v);
+      if(cIGraph_rng_integer(&rng, ++ties) == 0)
+	best = w->keys[slot];
+    }
+    w->keys[slot] = -1;
+  }
+
+  return keep ? cur : best;
+
+}
+
+static void *cIGraph_lpa_worker(void *arg){
+
+  cIGraph_lpa_worker_t *w = arg;
+  cIGraph_lpa_shared_t *s = w->s;
+  long int start, end, i, v, changed = 0;
+  int l;
+
+  while((start = __sync_fetch_and_add(&s->next, CIGRAPH_LPA_CHUNK)) < s->nnodes){
+    end = start + CIGRAPH_LPA_CHUNK < s->nnodes ? start + CIGRAPH_LPA_CHUNK : s->nnodes;
+    for(i=start;i<end;i++){
+      v = s->nodes ? s->nodes[i] : i;
+      l = cIGraph_lpa_best(w, v);
+      if(l != __atomic_load_n(&s->label[v], __ATOMIC_RELAXED))
+	changed++;
+      __atomic_store_n(&s->update[v], l, __ATOMIC_RELAXED);
+    }
+  }
+
+  __sync_fetch_and_add(&s->changed, changed);
+
+  return NULL;
+
+}
+
+typedef struct {
+  cIGraph_wgraph_t *g;
+  int mode;
+  long int maxiter;
+  unsigned long long seed;
+  int *label;
+  long int sweeps;
+  int converged;
+  int nthreads;
+  int failed;
+} cIGraph_lpa_job_t;
+
+static void *cIGraph_lpa_run(void *arg){
+
+  cIGraph_lpa_job_t *job = arg;
+  cIGraph_wgraph_t *g = job->g;
+  cIGraph_lpa_shared_t s;
+  cIGraph_lpa_worker_t *workers = NULL;
+  cIGraph_rng_t rng;
+  long int n = g->n, maxd = 0, hsize, ncol = 0, i, j, c;
+  long int *coff = NULL;
+  int *nodes = NULL, *spare = NULL, *tmp, t;
+
+  memset(&s,0,sizeof(s));
+  s.g     = g;
+  s.seed  = job->seed;
+  s.label = s.update = job->label;
+
+  for(i=0;i<n;i++)
+    if(g->offset[i+1] - g->offset[i] > maxd)
+      maxd = g->offset[i+1] - g->offset[i];
+  for(hsize=16;hsize<2*(maxd+1);hsize*=2)
+    ;
+
+  workers = calloc(job->nthreads, sizeof(cIGraph_lpa_worker_t));
+  if(!workers)
+    goto fail;
+  for(i=0;i<job->nthreads;i++){
+    workers[i].s    = &s;
+    workers[i].mask = hsize - 1;
+    workers[i].keys = malloc(sizeof(int) * hsize);
+    workers[i].vals = malloc(sizeof(double) * hsize);
+    workers[i].used = malloc(sizeof(long int) * (maxd+1));
+    if(!workers[i].keys || !workers[i].vals || !workers[i].used)
+      goto fail;
+    for(j=0;j<hsize;j++)
+      workers[i].keys[j] = -1;
+  }
+
+  cIGraph_rng_seed(&rng, job->seed, -1);
+
+  if(job->mode == CIGRAPH_LPA_SYNC){
+    spare = malloc(sizeof(int) * (n+1));
+    if(!spare)
+      goto fail;
+  } else {
+    nodes = malloc(sizeof(int) * (n+1));
+    coff  = malloc(sizeof(long int) * (n+2));
+    if(!nodes || !coff)
+      goto fail;
+    if(job->mode == CIGRAPH_LPA_SEMISYNC){
+      ncol = cIGraph_wgraph_colour(g, &rng, nodes, coff);
+      if(ncol < 0)
+	goto fail;
+    } else {
+      for(i=0;i<n;i++)
+	nodes[i] = (int)i;
+    }
+  }
+
+  for(job->sweeps=0;job->sweeps<job->maxiter && !cIGraph_interrupted();){
+
+    s.sweep   = job->sweeps++;
+    s.changed = 0;
+
+    if(job->mode == CIGRAPH_LPA_SYNC){
+      s.update = spare;
+      s.nodes  = NULL;
+      s.nnodes = n;
+      s.next   = 0;
+      cIGraph_parallel(cIGraph_lpa_worker, workers, sizeof(cIGraph_lpa_worker_t),
+		       s.nnodes < CIGRAPH_LPA_SERIAL ? 1 : job->nthreads);
+      tmp     = s.label;
+      s.label = spare;
+      spare   = tmp;
+    } else if(job->mode == CIGRAPH_LPA_SEMISYNC){
+      //Vertices of one colour are never neighbours, so they can update in place
+      for(c=0;c<ncol;c++){
+	s.nodes  = nodes + coff[c];
+	s.nnodes = coff[c+1] - coff[c];
+	s.next   = 0;
+	cIGraph_parallel(cIGraph_lpa_worker, workers, sizeof(cIGraph_lpa_worker_t),
+			 s.nnodes < CIGRAPH_LPA_SERIAL ? 1 : job->nthreads);
+      }
+    } else {
+      for(i=n-1;i>0;i--){
+	j = cIGraph_rng_integer(&rng, i+1);
+	t = nodes[i];
+	nodes[i] = nodes[j];
+	nodes[j] = t;
+      }
+      s.nodes  = nodes;
+      s.nnodes = n;
+      s.next   = 0;
+      cIGraph_parallel(cIGraph_lpa_worker, workers, sizeof(cIGraph_lpa_worker_t),
+		       s.nnodes < CIGRAPH_LPA_SERIAL ? 1 : job->nthreads);
+    }
+
+    if(s.changed == 0){
+      job->converged = 1;
+      break;
+    }
+
+  }
+
+  //The synchronous sweeps may have left the latest labels in the spare
+  if(s.label != job->label)
+    memcpy(job->label, s.label, sizeof(int) * n);
+
+  goto done;
+
+ fail:
+  job->failed = 1;
+
+ done:
+  if(workers){
+    for(i=0;i<job->nthreads;i++){
+      free(workers[i].keys);
+      free(workers[i].vals);
+      free(workers[i].used);
+    }
+  }
+  free(workers);
+  free(s.label != job->label ? s.label : spare);
+  free(nodes);
+  free(coff);
+
+  return NULL;
+
+}
+
+typedef struct {
+  VALUE initial;
+  long int n;
+  long int len;
+} cIGraph_lpa_initial_t;
+
+static VALUE cIGraph_lpa_unpack(VALUE arg){
+  cIGraph_lpa_initial_t *a = (cIGraph_lpa_initial_t*)arg;
+  return (VALUE)cIGraph_membership_unpack(a->initial, a->n, &a->len);
+}
+
+/* call-seq:
+ *   graph.community_label_propagation(weights=nil,mode=IGraph::LPA_SEMISYNC,initial=nil,max_iter=100,seed=nil) -> Array
+ *
+ * Finds communities by label propagation: each vertex repeatedly adopts
+ * the label that carries the most edge weight among its neighbours until
+ * no label changes or max_iter sweeps have been made. Edge directions are
+ * ignored. weights is an Array with one weight per edge, the name of an
+ * edge attribute holding the weights, or nil.
+ *
+ * mode is one of IGraph::LPA_SYNC (all vertices update together from the
+ * previous sweep; may oscillate), IGraph::LPA_SEMISYNC (vertices update a
+ * colour class at a time, never two neighbours together; always settles)
+ * or IGraph::LPA_ASYNC (vertices update in place in a random order; not
+ * reproducible with more than one thread).
+ *
+ * initial gives a starting label for each vertex, as a packed String (see
+ * IGraph#community_louvain) or an Array of Integers. It may be shorter
+ * than the number of vertices, and negative labels are allowed: vertices
+ * without a label start with one of their own. Starting from a previous
+ * result lets the labels settle again in a few sweeps after small changes
+ * to the graph. seed seeds the tie breaks and orders; pass nil to take one
+ * from Kernel#rand.
+ *
+ * Returns [membership, sweeps, converged]: the membership as a packed
+ * String with communities numbered from 0, the number of sweeps made and
+ * whether the labels settled.
+ *
+ * The sweeps run on IGraph.threads threads with the global VM lock
+ * released.
+ */
+VALUE cIGraph_community_label_propagation(int argc, VALUE *argv, VALUE self){
+
+  VALUE weights, mode, initial, max_iter, seed, memb;
+  cIGraph_wgraph_t g;
+  cIGraph_lpa_job_t job;
+  igraph_t *graph;
+  long int n, len = 0, nids = 0, i, j;
+  int *ids, next, state = 0;
+  cIGraph_lpa_initial_t a;
+
+  rb_scan_args(argc,argv,"05", &weights, &mode, &initial, &max_iter, &seed);
+
+  memset(&job,0,sizeof(job));
+  job.mode     = NIL_P(mode) ? CIGRAPH_LPA_SEMISYNC : NUM2INT(mode);
+  job.maxiter  = NIL_P(max_iter) ? 100 : NUM2LONG(max_iter);
+  job.seed     = cIGraph_rng_seed_value(seed);
+  job.nthreads = cIGraph_thread_count();
+
+  if(job.mode < CIGRAPH_LPA_SYNC || job.mode > CIGRAPH_LPA_ASYNC)
+    rb_raise(cIGraphError, "Unknown label propagation mode\n");
+
+  Data_Get_Struct(self, igraph_t, graph);
+  n = (long int)igraph_vcount(graph);
+
+  //Bad weights raise, so the lists are built before the labels
+  cIGraph_wgraph_init(self, &g, weights);
+  job.g = &g;
+
+  if(NIL_P(initial)){
+    job.label = malloc(sizeof(int) * (n+1));
+    if(!job.label){
+      cIGraph_wgraph_destroy(&g);
+      rb_raise(rb_eNoMemError, "Error allocating labels");
+    }
+  } else {
+    a.initial = initial;
+    a.n       = n;
+    a.len     = 0;
+    job.label = (int*)rb_protect(cIGraph_lpa_unpack, (VALUE)&a, &state);
+    if(state){
+      cIGraph_wgraph_destroy(&g);
+      rb_jump_tag(state);
+    }
+    len = a.len;
+  }
+
+  //Labels go to 0...n-1, with fresh ones for vertices that have none
+  ids = malloc(sizeof(int) * (len+1));
+  if(!ids){
+    cIGraph_wgraph_destroy(&g);
+    free(job.label);
+    rb_raise(rb_eNoMemError, "Error allocating labels");
+  }
+  for(i=0;i<len;i++){
+    if(job.label[i] >= 0)
+      ids[nids++] = job.label[i];
+  }
+  qsort(ids, nids, sizeof(int), cIGraph_lpa_cmp);
+  for(i=0,j=0;i<nids;i++){
+    if(j == 0 || ids[i] != ids[j-1])
+      ids[j++] = ids[i];
+  }
+  nids = j;
+  for(i=0;i<n;i++){
+    if(i < len && job.label[i] >= 0)
+      job.label[i] = (int)((int*)bsearch(&job.label[i], ids, nids, sizeof(int), cIGraph_lpa_cmp) - ids);
+    else
+      job.label[i] = (int)nids++;
+  }
+  free(ids);
+
+  cIGraph_without_gvl(cIGraph_lpa_run, &job);
+
+  cIGraph_wgraph_destroy(&g);
+
+  if(job.failed){
+    free(job.label);
+    rb_raise(rb_eNoMemError, "Error allocating label propagation buffers");
+  }
+
+  ids = malloc(sizeof(int) * (n+1));
+  if(!ids){
+    free(job.label);
+    rb_raise(rb_eNoMemError, "Error allocating labels");
+  }
+  for(i=0;i<n;i++)
+    ids[i] = -1;
+  for(next=0,i=0;i<n;i++){
+    if(ids[job.label[i]] == -1)
+      ids[job.label[i]] = next++;
+    job.label[i] = ids[job.label[i]];
+  }
+  free(ids);
+
+  memb = rb_str_new((char*)job.label, sizeof(int) * n);
+  free(job.label);
+
+  return rb_ary_new3(3, memb, LONG2NUM(job.sweeps),
+		     job.converged ? Qtrue : Qfalse);
+
+}
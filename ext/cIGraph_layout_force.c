@@ -0,0 +1,592 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Force directed layout engine shared by the Barnes-Hut layouts.
+ *
+ * Forces are those of Fruchterman and Reingold: every pair of vertices
+ * repels with k^2 / d and every edge pulls its ends together with
+ * w d^2 / k, k being the natural spring length. Repulsion is
+ * approximated following Barnes and Hut (1986): the vertices are sorted
+ * into a quadtree (an octree in 3D) each iteration and a whole cell acts
+ * as a single body at its centre of mass when it is small compared to its
+ * distance, size / d < theta. theta = 0 gives the exact O(V^2) forces.
+ *
+ * Each iteration builds the tree, spreads the force calculations over
+ * the worker threads in blocks of vertices and then moves every vertex
+ * along its force by at most the current temperature, which cools
+ * linearly to nothing over the iterations. When only some of the
+ * vertices may move, the others go into a second tree built once.
+ *
+ * Positions are kept as one array per coordinate, which is exactly how an
+ * IGraphMatrix stores its columns, so layouts are updated in place.
+ */
+
+#define CIGRAPH_FORCE_CHUNK 256
+
+//Cells are not split any further below this depth (coincident vertices)
+#define CIGRAPH_FORCE_MAXDEPTH 48
+
+typedef struct {
+  double com[3];          //Centre of mass (mass weighted sum while building)
+  double centre[3];
+  double half;            //Half the side of the cell
+  double mass;
+  long int count;         //Vertices in the cell
+  long int size;          //Nodes in the subtree
+  int child[8];
+  int body;               //The vertex of a leaf, -1 for inner cells
+} cIGraph_force_node_t;
+
+/* The tree flattened in depth first order for the force calculations,
+ * which then read it front to back: a cell's subtree runs up to skip.
+ */
+typedef struct {
+  double com[3];
+  double size2;           //Squared side
+  double mass;
+  int skip;
+  int body;               //The vertex of a leaf of one, -2 for a leaf of more, -1 inner
+} cIGraph_force_flat_t;
+
+//A tree over some of the vertices
+typedef struct {
+  int *verts;             //The vertices, left in tree order for locality
+  long int nverts;
+  cIGraph_force_node_t *tree;
+  long int cap;
+  cIGraph_force_flat_t *flat;
+  long int nflat;
+  long int flatcap;
+} cIGraph_force_bh_t;
+
+typedef struct {
+  cIGraph_force_t *f;
+  cIGraph_force_bh_t moving;
+  cIGraph_force_bh_t fixed;
+  int *link;              //Further vertices of the leaves at the bottom
+  double *disp[3];
+  long int next;
+} cIGraph_force_shared_t;
+
+typedef struct {
+  cIGraph_force_shared_t *s;
+} cIGraph_force_worker_t;
+
+static double cIGraph_force_mass(cIGraph_force_t *f, long int i){
+  return f->mass ? f->mass[i] : 1;
+}
+
+//Starts an empty cell in quadrant (octant) q of parent
+static void cIGraph_force_cell(cIGraph_force_node_t *c, cIGraph_force_node_t *parent,
+			       int q, int dim){
+  int d;
+  memset(c, 0, sizeof(cIGraph_force_node_t));
+  memset(c->child, -1, sizeof(c->child));
+  c->body = -1;
+  c->half = parent->half / 2;
+  for(d=0;d<dim;d++)
+    c->centre[d] = parent->centre[d] + (q & (1 << d) ? c->half : -c->half);
+}
+
+static int cIGraph_force_quadrant(cIGraph_force_t *f, cIGraph_force_node_t *node, long int b){
+  int d, q = 0;
+  for(d=0;d<f->dim;d++)
+    if(f->pos[d][b] >= node->centre[d])
+      q |= 1 << d;
+  return q;
+}
+
+static void cIGraph_force_add(cIGraph_force_t *f, cIGraph_force_node_t *node, long int b){
+  int d;
+  double m = cIGraph_force_mass(f, b);
+  node->mass += m;
+  node->count++;
+  for(d=0;d<f->dim;d++)
+    node->com[d] += m * f->pos[d][b];
+}
+
+/* Builds the tree of the vertices of bh into bh->tree (grown as needed)
+ * and flattens it into bh->flat. The vertices are then listed again in
+ * the order of the tree's leaves, so that neighbouring vertices come
+ * close together both here and in the force calculations, which keeps the
+ * parts of the tree they read in the cache. Returns the number of nodes
+ * or -1 if out of memory.
+ */
+static long int cIGraph_force_tree(cIGraph_force_t *f, cIGraph_force_bh_t *bh, int *link){
+
+  cIGraph_force_node_t *t, *node, *grown;
+  cIGraph_force_flat_t *flat;
+  long int n = bh->nverts, nnodes = 1, i, k, b, cur, depth;
+  int dim = f->dim, nchild = 1 << dim, d, q, e, top;
+  int stack[8*(CIGRAPH_FORCE_MAXDEPTH+2)];
+  double lo[3], hi[3];
+
+  if(!bh->tree){
+    bh->cap  = 2*n + 16;
+    bh->tree = malloc(sizeof(cIGraph_force_node_t) * bh->cap);
+    if(!bh->tree)
+      return -1;
+  }
+  t = bh->tree;
+
+  memset(&t[0], 0, sizeof(cIGraph_force_node_t));
+  memset(t[0].child, -1, sizeof(t[0].child));
+  t[0].body = -1;
+  for(d=0;d<dim;d++){
+    lo[d] = HUGE_VAL;
+    hi[d] = -HUGE_VAL;
+    for(k=0;k<n;k++){
+      i = bh->verts[k];
+      if(f->pos[d][i] < lo[d]) lo[d] = f->pos[d][i];
+      if(f->pos[d][i] > hi[d]) hi[d] = f->pos[d][i];
+    }
+    t[0].centre[d] = (lo[d] + hi[d]) / 2;
+    if((hi[d] - lo[d]) / 2 > t[0].half)
+      t[0].half = (hi[d] - lo[d]) / 2;
+  }
+  t[0].half = t[0].half * 1.0001 + 1e-9;
+
+  for(k=0;k<n;k++){
+    b   = bh->verts[k];
+    cur = 0;
+    link[b] = -1;
+    for(depth=0;;depth++){
+
+      node = &t[cur];
+
+      //An empty cell takes the body, as does a full one at the bottom
+      if(node->count == 0 || (node->body >= 0 && depth >= CIGRAPH_FORCE_MAXDEPTH)){
+	if(node->count == 0){
+	  node->body = (int)b;
+	} else {
+	  link[b] = link[node->body];
+	  link[node->body] = (int)b;
+	}
+	cIGraph_force_add(f, node, b);
+	break;
+      }
+
+      if(nnodes + 2 > bh->cap){
+	grown = realloc(t, sizeof(cIGraph_force_node_t) * bh->cap * 2);
+	if(!grown){
+	  bh->tree = t;
+	  return -1;
+	}
+	t        = grown;
+	bh->cap *= 2;
+	node     = &t[cur];
+      }
+
+      //A leaf passes its body down a level before taking another
+      if(node->body >= 0){
+	e = node->body;
+	q = cIGraph_force_quadrant(f, node, e);
+	cIGraph_force_cell(&t[nnodes], node, q, dim);
+	cIGraph_force_add(f, &t[nnodes], e);
+	t[nnodes].body = e;
+	node->child[q] = (int)nnodes++;
+	node->body = -1;
+      }
+
+      cIGraph_force_add(f, node, b);
+      q = cIGraph_force_quadrant(f, node, b);
+      if(node->child[q] < 0){
+	cIGraph_force_cell(&t[nnodes], node, q, dim);
+	node->child[q] = (int)nnodes++;
+      }
+      cur = node->child[q];
+
+    }
+  }
+
+  bh->tree = t;
+
+  if(nnodes > bh->flatcap){
+    flat = realloc(bh->flat, sizeof(cIGraph_force_flat_t) * bh->cap);
+    if(!flat)
+      return -1;
+    bh->flat    = flat;
+    bh->flatcap = bh->cap;
+  }
+
+  //Children always come after their parents
+  for(i=nnodes-1;i>=0;i--){
+    t[i].size = 1;
+    for(q=0;q<nchild;q++)
+      if(t[i].child[q] >= 0)
+	t[i].size += t[t[i].child[q]].size;
+  }
+
+  k         = 0;
+  bh->nflat = 0;
+  top       = 0;
+  stack[top++] = 0;
+  while(top > 0){
+    node = &t[stack[--top]];
+    flat = &bh->flat[bh->nflat];
+    for(d=0;d<dim;d++)
+      flat->com[d] = node->mass > 0 ? node->com[d] / node->mass : node->centre[d];
+    flat->size2 = 4 * node->half * node->half;
+    flat->mass  = node->mass;
+    flat->skip  = (int)(bh->nflat + node->size);
+    flat->body  = node->body >= 0 && node->count > 1 ? -2 : node->body;
+    bh->nflat++;
+    for(e=node->body;e>=0;e=link[e])
+      bh->verts[k++] = e;
+    for(q=nchild-1;q>=0;q--)
+      if(node->child[q] >= 0)
+	stack[top++] = node->child[q];
+  }
+
+  return nnodes;
+
+}
+
+static void cIGraph_force_bh_destroy(cIGraph_force_bh_t *bh){
+  free(bh->verts);
+  free(bh->tree);
+  free(bh->flat);
+}
+
+/* Adds the repulsion (over k^2) on vertex i at here to force, skipping
+ * the subtrees of the cells far enough away. Called with a constant dim
+ * so that the loops over the coordinates unroll.
+ */
+static inline void cIGraph_force_repel(const cIGraph_force_flat_t *flat, long int nflat,
+				       long int i, const double *here, int dim,
+				       double theta2, double *force){
+
+  const cIGraph_force_flat_t *cell;
+  long int c = 0;
+  int d;
+  double diff[3], dist2, x;
+
+  while(c < nflat){
+    cell = &flat[c];
+    if(cell->body == i){
+      c++;
+      continue;
+    }
+    dist2 = 0;
+    for(d=0;d<dim;d++){
+      diff[d] = here[d] - cell->com[d];
+      dist2  += diff[d] * diff[d];
+    }
+    if(cell->body != -1 || cell->size2 < theta2 * dist2){
+      if(dist2 > 0){
+	x = cell->mass / dist2;
+	for(d=0;d<dim;d++)
+	  force[d] += diff[d] * x;
+      }
+      c = cell->skip;
+      continue;
+    }
+    c++;
+  }
+
+}
+
+static void *cIGraph_force_worker(void *arg){
+
+  cIGraph_force_worker_t *w = arg;
+  cIGraph_force_shared_t *s = w->s;
+  cIGraph_force_t *f = s->f;
+  cIGraph_wgraph_t *g = f->g;
+  cIGraph_force_bh_t *bh;
+  long int start, end, a, i, j, v;
+  int dim = f->dim, d, t;
+  double k2 = f->k * f->k, theta2 = f->theta * f->theta;
+  double force[3], here[3], diff[3], dist2, dist, x;
+
+  while((start = __sync_fetch_and_add(&s->next, CIGRAPH_FORCE_CHUNK)) < s->moving.nverts){
+    end = start + CIGRAPH_FORCE_CHUNK < s->moving.nverts ? start + CIGRAPH_FORCE_CHUNK : s->moving.nverts;
+    for(a=start;a<end;a++){
+
+      i = s->moving.verts[a];
+      for(d=0;d<dim;d++){
+	force[d] = 0;
+	here[d]  = f->pos[d][i];
+      }
+
+      //Repulsion from the vertices that move and those that stay put
+      for(t=0;t<2;t++){
+	bh = t ? &s->fixed : &s->moving;
+	if(bh->nverts == 0)
+	  continue;
+	if(dim == 2)
+	  cIGraph_force_repel(bh->flat, bh->nflat, i, here, 2, theta2, force);
+	else
+	  cIGraph_force_repel(bh->flat, bh->nflat, i, here, 3, theta2, force);
+      }
+      for(d=0;d<dim;d++)
+	force[d] *= k2;
+
+      //Attraction along the edges
+      for(j=g->offset[i];j<g->offset[i+1];j++){
+	v = g->nbr[j];
+	dist2 = 0;
+	for(d=0;d<dim;d++){
+	  diff[d] = f->pos[d][v] - here[d];
+	  dist2  += diff[d] * diff[d];
+	}
+	dist = sqrt(dist2);
+	x = g->weight[j] * dist / f->k;
+	for(d=0;d<dim;d++)
+	  force[d] += diff[d] * x;
+      }
+
+      //By vertex when they all move, else in the order of moving.verts
+      for(d=0;d<dim;d++)
+	s->disp[d][f->active ? a : i] = force[d];
+
+    }
+  }
+
+  return NULL;
+
+}
+
+/* Moves each vertex along its force by at most temp: the vertices 0 ...
+ * n-1 if verts is NULL, otherwise verts[0 ... n-1].
+ */
+static void cIGraph_force_move(cIGraph_force_t *f, double **disp, double temp,
+			       const int *verts, long int n){
+
+  long int a = 0, i;
+  int dim = f->dim, d;
+  double len, x;
+
+#ifdef __SSE2__
+  if(!verts){
+    __m128d vt = _mm_set1_pd(temp);
+    __m128d tiny = _mm_set1_pd(1e-300);
+    for(;a+2<=n;a+=2){
+      __m128d len2 = _mm_setzero_pd(), scale;
+      for(d=0;d<dim;d++){
+	__m128d dd = _mm_loadu_pd(disp[d]+a);
+	len2 = _mm_add_pd(len2, _mm_mul_pd(dd,dd));
+      }
+      scale = _mm_div_pd(vt, _mm_max_pd(_mm_sqrt_pd(len2), tiny));
+      scale = _mm_min_pd(scale, _mm_set1_pd(1.0));
+      for(d=0;d<dim;d++){
+	__m128d p = _mm_loadu_pd(f->pos[d]+a);
+	p = _mm_add_pd(p, _mm_mul_pd(_mm_loadu_pd(disp[d]+a), scale));
+	_mm_storeu_pd(f->pos[d]+a, p);
+      }
+    }
+  }
+#endif
+
+  for(;a<n;a++){
+    i = verts ? verts[a] : a;
+    len = 0;
+    for(d=0;d<dim;d++)
+      len += disp[d][a] * disp[d][a];
+    len = sqrt(len);
+    if(len == 0)
+      continue;
+    x = len > temp ? temp / len : 1;
+    for(d=0;d<dim;d++)
+      f->pos[d][i] += disp[d][a] * x;
+  }
+
+}
+
+/* Runs f->niter iterations of the layout on f->nthreads threads. Meant
+ * for cIGraph_without_gvl; sets f->failed if out of memory.
+ *
+ * If f->active is given only those vertices move. The others still repel
+ * them: f->fixed lists the ones to take into account (all of the rest if
+ * NULL), whose tree is built just once.
+ */
+void *cIGraph_force_run(void *arg){
+
+  cIGraph_force_t *f = arg;
+  cIGraph_force_shared_t s;
+  cIGraph_force_worker_t *workers = NULL;
+  long int n = f->g->n, it, i, k;
+  int nthreads = f->nthreads, t, d;
+  char *moving = NULL;
+
+  if(!f->active)
+    f->nactive = n;
+  if(n == 0 || f->nactive == 0)
+    return NULL;
+  if(f->nactive < CIGRAPH_FORCE_CHUNK)
+    nthreads = 1;
+
+  memset(&s, 0, sizeof(s));
+  s.f              = f;
+  s.link           = malloc(sizeof(int) * (n+1));
+  s.moving.nverts  = f->nactive;
+  s.moving.verts   = malloc(sizeof(int) * (f->nactive+1));
+  for(d=0;d<f->dim;d++)
+    s.disp[d] = malloc(sizeof(double) * (f->nactive+1));
+  workers = calloc(nthreads, sizeof(cIGraph_force_worker_t));
+  if(!s.link || !s.moving.verts || !workers || !s.disp[0] || !s.disp[1] ||
+     (f->dim == 3 && !s.disp[2])){
+    f->failed = 1;
+    goto done;
+  }
+  for(t=0;t<nthreads;t++)
+    workers[t].s = &s;
+  for(i=0;i<f->nactive;i++)
+    s.moving.verts[i] = f->active ? f->active[i] : (int)i;
+
+  if(f->active){
+    s.fixed.nverts = f->fixed ? f->nfixed : n - f->nactive;
+    s.fixed.verts  = malloc(sizeof(int) * (s.fixed.nverts+1));
+    moving         = calloc(n+1, 1);
+    if(!s.fixed.verts || !moving){
+      f->failed = 1;
+      goto done;
+    }
+    for(i=0;i<f->nactive;i++)
+      moving[f->active[i]] = 1;
+    for(k=0,i=0;i<n;i++)
+      if(f->fixed ? i < f->nfixed : !moving[i])
+	s.fixed.verts[k++] = f->fixed ? f->fixed[i] : (int)i;
+    s.fixed.nverts = k;
+    if(k > 0 && cIGraph_force_tree(f, &s.fixed, s.link) < 0){
+      f->failed = 1;
+      goto done;
+    }
+  }
+
+  for(it=0;it<f->niter && !cIGraph_interrupted();it++){
+    if(cIGraph_force_tree(f, &s.moving, s.link) < 0){
+      f->failed = 1;
+      break;
+    }
+    s.next = 0;
+    cIGraph_parallel(cIGraph_force_worker, workers, sizeof(cIGraph_force_worker_t), nthreads);
+    cIGraph_force_move(f, s.disp, f->temp * (1 - (double)it / f->niter),
+		       f->active ? s.moving.verts : NULL, f->nactive);
+  }
+
+ done:
+  free(workers);
+  free(moving);
+  for(d=0;d<f->dim;d++)
+    free(s.disp[d]);
+  cIGraph_force_bh_destroy(&s.moving);
+  cIGraph_force_bh_destroy(&s.fixed);
+  free(s.link);
+
+  return NULL;
+
+}
+
+/* Returns the IGraphMatrix to lay graph out in: layout itself if given
+ * (checked for shape), otherwise a new matrix of random positions in a
+ * square or cube of side sqrt(vcount) * k.
+ */
+VALUE cIGraph_force_matrix(VALUE self, VALUE layout, int dim, double k, VALUE seed){
+
+  igraph_t *graph;
+  igraph_matrix_t *res;
+  cIGraph_rng_t rng;
+  long int n, i;
+  int d;
+  double side;
+
+  Data_Get_Struct(self, igraph_t, graph);
+  n = (long int)igraph_vcount(graph);
+
+  if(!NIL_P(layout)){
+    if(!rb_obj_is_kind_of(layout, cIGraphMatrix))
+      rb_raise(cIGraphError, "Layout must be an IGraphMatrix\n");
+    Data_Get_Struct(layout, igraph_matrix_t, res);
+    if(igraph_matrix_nrow(res) != n || igraph_matrix_ncol(res) != dim)
+      rb_raise(cIGraphError, "Layout must have a row for each vertex and %d columns\n", dim);
+    return layout;
+  }
+
+  res = malloc(sizeof(igraph_matrix_t));
+  igraph_matrix_init(res, n, dim);
+  layout = Data_Wrap_Struct(cIGraphMatrix, 0, cIGraph_matrix_free, res);
+
+  cIGraph_rng_seed(&rng, cIGraph_rng_seed_value(seed), 0);
+  side = sqrt((double)n) * k;
+  for(d=0;d<dim;d++)
+    for(i=0;i<n;i++)
+      MATRIX(*res,i,d) = (cIGraph_rng_unif(&rng) - 0.5) * side;
+
+  return layout;
+
+}
+
+static VALUE cIGraph_force_layout(int argc, VALUE *argv, VALUE self, int dim){
+
+  VALUE niter, theta, layout, seed;
+  igraph_matrix_t *res;
+  cIGraph_wgraph_t g;
+  cIGraph_force_t f;
+  int d;
+
+  rb_scan_args(argc,argv,"04", &niter, &theta, &layout, &seed);
+
+  memset(&f, 0, sizeof(f));
+  f.dim      = dim;
+  f.niter    = NIL_P(niter) ? 500 : NUM2LONG(niter);
+  f.theta    = NIL_P(theta) ? 0.8 : NUM2DBL(theta);
+  f.k        = 1;
+  f.nthreads = cIGraph_thread_count();
+
+  if(f.niter < 0 || f.theta < 0)
+    rb_raise(cIGraphError, "Iterations and theta must not be negative\n");
+
+  layout = cIGraph_force_matrix(self, layout, dim, f.k, seed);
+  Data_Get_Struct(layout, igraph_matrix_t, res);
+
+  cIGraph_wgraph_init(self, &g, Qnil);
+  f.g    = &g;
+  f.temp = f.k * sqrt((double)g.n) / 10;
+  for(d=0;d<dim && g.n>0;d++)
+    f.pos[d] = &MATRIX(*res,0,d);
+
+  cIGraph_without_gvl(cIGraph_force_run, &f);
+
+  cIGraph_wgraph_destroy(&g);
+
+  if(f.failed)
+    rb_raise(rb_eNoMemError, "Error allocating layout");
+
+  return layout;
+
+}
+
+/* call-seq:
+ *   graph.layout_fruchterman_reingold_bh(niter=500,theta=0.8,layout=nil,seed=nil) -> IGraphMatrix
+ *
+ * Places the vertices on a plane with Fruchterman-Reingold forces, the
+ * repulsion between all of the vertices being approximated with a
+ * Barnes-Hut quadtree. Cells smaller than theta times their distance
+ * from a vertex act on it as a single body, so larger values of theta
+ * are faster and less accurate, and 0 gives the exact forces. An
+ * iteration takes O(V log V + E) time, spread over IGraph.threads
+ * threads with the global VM lock released. Edge directions are ignored.
+ *
+ * If layout is an IGraphMatrix with a row for each vertex and two columns
+ * the vertices start from it and it is updated in place; otherwise they
+ * start from random positions drawn using seed.
+ */
+VALUE cIGraph_layout_fruchterman_reingold_bh(int argc, VALUE *argv, VALUE self){
+  return cIGraph_force_layout(argc, argv, self, 2);
+}
+
+/* call-seq:
+ *   graph.layout_fruchterman_reingold_bh_3d(niter=500,theta=0.8,layout=nil,seed=nil) -> IGraphMatrix
+ *
+ * The 3D version of layout_fruchterman_reingold_bh, using an octree.
+ */
+VALUE cIGraph_layout_fruchterman_reingold_bh_3d(int argc, VALUE *argv, VALUE self){
+  return cIGraph_force_layout(argc, argv, self, 3);
+}
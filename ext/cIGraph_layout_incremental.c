@@ -0,0 +1,348 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+#include <math.h>
+
+/* Incremental force directed layout.
+ *
+ * After a few vertices or edges have been added to or removed from a
+ * graph most of its previous layout still fits. Vertices that were in it
+ * keep their positions, new ones are put down at the mean of their
+ * placed neighbours (breadth first outwards from the old part) and then
+ * only the vertices within a few hops of a change are relaxed by the
+ * Barnes-Hut engine (cIGraph_force_run). That runs on a small local
+ * graph: the region that moves, its neighbours and the other vertices
+ * close enough to push it around, which all hold still. So the cost
+ * follows the size of the change rather than of the graph, apart from
+ * the linear passes copying and scanning the layout.
+ */
+
+//Vertices within this many spring lengths of the region repel it
+#define CIGRAPH_INCREMENTAL_MARGIN 3
+
+/* call-seq:
+ *   graph.layout_incremental(previous,vertices,changed=[],hops=2,niter=50,seed=nil) -> IGraphMatrix
+ *
+ * Updates a layout of the graph after it has been changed. previous is
+ * an IGraphMatrix with two or three columns holding the layout before
+ * the change, with a row for each of the vertices in the Array vertices
+ * (a copy of graph.vertices taken at the time). changed lists the
+ * vertices whose edges were added or removed since; vertices no longer
+ * in the graph are ignored.
+ *
+ * Returns a new IGraphMatrix with a row for each vertex of the graph.
+ * Vertices not in vertices are placed next to their neighbours (or at
+ * random, using seed, if they have none), and then these and the
+ * vertices within hops edges of them or of a changed vertex are moved by
+ * niter iterations of the Barnes-Hut layout (see
+ * layout_fruchterman_reingold_bh), the natural spring length being
+ * taken from the previous layout. All of the other vertices keep their
+ * positions. Edge directions are ignored.
+ */
+VALUE cIGraph_layout_incremental(int argc, VALUE *argv, VALUE self){
+
+  VALUE previous, vertices, changed, hops, niter, seed;
+  VALUE v_ary, vindex = Qnil, cindex = Qnil, obj, idx, buf, lbuf, layout;
+  igraph_t *graph;
+  igraph_matrix_t *prev, *res;
+  igraph_vector_t neis, adj;
+  cIGraph_wgraph_t g;
+  cIGraph_force_t f;
+  cIGraph_rng_t rng;
+  long int n, nold, nr = 0, nl, nq, nedge, maxhops, h, i, j, u, v;
+  long int *off;
+  int *row, *lid, *verts, *depth, *queue, *active, dim, d, cnt;
+  char *placed;
+  double k, dist, x, side, lo[3], hi[3], *lpos;
+
+  rb_scan_args(argc,argv,"24", &previous, &vertices, &changed, &hops, &niter, &seed);
+
+  if(!rb_obj_is_kind_of(previous, cIGraphMatrix))
+    rb_raise(cIGraphError, "Previous layout must be an IGraphMatrix\n");
+  Check_Type(vertices, T_ARRAY);
+  if(NIL_P(changed))
+    changed = rb_ary_new();
+  Check_Type(changed, T_ARRAY);
+
+  Data_Get_Struct(self, igraph_t, graph);
+  Data_Get_Struct(previous, igraph_matrix_t, prev);
+
+  dim  = (int)igraph_matrix_ncol(prev);
+  nold = RARRAY_LEN(vertices);
+  if(dim != 2 && dim != 3)
+    rb_raise(cIGraphError, "Previous layout must have 2 or 3 columns\n");
+  if(igraph_matrix_nrow(prev) != nold)
+    rb_raise(cIGraphError, "Previous layout must have a row for each of the vertices\n");
+
+  memset(&f, 0, sizeof(f));
+  f.dim      = dim;
+  f.niter    = NIL_P(niter) ? 50 : NUM2LONG(niter);
+  f.theta    = 0.8;
+  f.nthreads = cIGraph_thread_count();
+  maxhops    = NIL_P(hops) ? 2 : NUM2LONG(hops);
+
+  if(f.niter < 0 || maxhops < 0)
+    rb_raise(cIGraphError, "Iterations and hops must not be negative\n");
+
+  n     = (long int)igraph_vcount(graph);
+  v_ary = ((VALUE*)graph->attr)[0];
+
+  res = malloc(sizeof(igraph_matrix_t));
+  igraph_matrix_init(res, n, dim);
+  layout = Data_Wrap_Struct(cIGraphMatrix, 0, cIGraph_matrix_free, res);
+
+  if(n == 0)
+    return layout;
+
+  //Held in a String so that it is collected if anything raises
+  buf    = rb_str_new(NULL, (sizeof(long int) + sizeof(int)*5 + 1) * (n+1));
+  off    = (long int*)RSTRING_PTR(buf);
+  row    = (int*)(off + n + 1);
+  lid    = row   + n + 1;
+  verts  = lid   + n + 1;
+  depth  = verts + n + 1;
+  queue  = depth + n + 1;
+  placed = (char*)(queue + n + 1);
+
+  //Vertices keeping their place in the list need no lookup
+  for(i=0;i<n;i++){
+    obj    = rb_ary_entry(v_ary, i);
+    row[i] = -1;
+    lid[i] = -1;
+    if(i < nold && RTEST(rb_equal(rb_ary_entry(vertices, i), obj))){
+      row[i] = (int)i;
+      continue;
+    }
+    if(NIL_P(vindex)){
+      vindex = rb_hash_new();
+      for(j=0;j<nold;j++)
+	rb_hash_aset(vindex, rb_ary_entry(vertices, j), INT2NUM(j));
+    }
+    idx = rb_hash_aref(vindex, obj);
+    if(!NIL_P(idx))
+      row[i] = NUM2INT(idx);
+  }
+
+  for(i=0;i<n;i++){
+    placed[i] = row[i] >= 0;
+    for(d=0;d<dim;d++)
+      MATRIX(*res,i,d) = placed[i] ? MATRIX(*prev,row[i],d) : 0;
+  }
+
+  //The region that moves starts from the new and the changed vertices...
+  for(i=0;i<n;i++){
+    if(!placed[i]){
+      lid[i]      = (int)nr;
+      depth[nr]   = 0;
+      verts[nr++] = (int)i;
+    }
+  }
+  if(RARRAY_LEN(changed) > 0){
+    cindex = rb_hash_new();
+    for(i=0;i<n;i++)
+      rb_hash_aset(cindex, rb_ary_entry(v_ary, i), INT2NUM(i));
+  }
+  for(i=0;i<RARRAY_LEN(changed);i++){
+    idx = rb_hash_aref(cindex, rb_ary_entry(changed, i));
+    if(NIL_P(idx) || lid[NUM2LONG(idx)] >= 0)
+      continue;
+    u           = NUM2LONG(idx);
+    lid[u]      = (int)nr;
+    depth[nr]   = 0;
+    verts[nr++] = (int)u;
+  }
+
+  cIGraph_rng_seed(&rng, cIGraph_rng_seed_value(seed), 0);
+
+  //...and grows breadth first, collecting the neighbours of each vertex
+  igraph_vector_init(&adj, 0);
+  IGRAPH_FINALLY(igraph_vector_destroy, &adj);
+  igraph_vector_init(&neis, 0);
+  IGRAPH_FINALLY(igraph_vector_destroy, &neis);
+  for(h=0;h<nr;h++){
+    off[h] = igraph_vector_size(&adj);
+    igraph_neighbors(graph, &neis, verts[h], IGRAPH_ALL);
+    for(j=0;j<igraph_vector_size(&neis);j++){
+      v = (long int)VECTOR(neis)[j];
+      igraph_vector_push_back(&adj, v);
+      if(lid[v] < 0 && depth[h] < maxhops){
+	lid[v]      = (int)nr;
+	depth[nr]   = depth[h] + 1;
+	verts[nr++] = (int)v;
+      }
+    }
+  }
+  off[nr] = igraph_vector_size(&adj);
+  igraph_vector_destroy(&neis);
+  IGRAPH_FINALLY_CLEAN(1);
+
+  //The spring length is that of the placed edges around the region
+  k   = 0;
+  cnt = 0;
+  for(h=0;h<nr;h++){
+    u = verts[h];
+    for(j=off[h];j<off[h+1];j++){
+      v = (long int)VECTOR(adj)[j];
+      if(u == v || !placed[u] || !placed[v])
+	continue;
+      dist = 0;
+      for(d=0;d<dim;d++){
+	x     = MATRIX(*res,u,d) - MATRIX(*res,v,d);
+	dist += x * x;
+      }
+      k += sqrt(dist);
+      cnt++;
+    }
+  }
+  k = cnt > 0 && k > 0 ? k / cnt : 1;
+
+  //New vertices go next to their placed neighbours, outwards from the old part
+  nq = 0;
+  for(h=0;h<nr;h++){
+    u = verts[h];
+    if(placed[u])
+      continue;
+    for(j=off[h];j<off[h+1];j++){
+      if(placed[(long int)VECTOR(adj)[j]] == 1){
+	placed[u]   = 2;
+	queue[nq++] = (int)h;
+	break;
+      }
+    }
+  }
+  for(i=0;i<nq;i++){
+    h   = queue[i];
+    u   = verts[h];
+    cnt = 0;
+    for(d=0;d<dim;d++)
+      lo[d] = 0;
+    for(j=off[h];j<off[h+1];j++){
+      v = (long int)VECTOR(adj)[j];
+      if(placed[v] == 1){
+	for(d=0;d<dim;d++)
+	  lo[d] += MATRIX(*res,v,d);
+	cnt++;
+      }
+    }
+    for(d=0;d<dim;d++)
+      MATRIX(*res,u,d) = lo[d] / cnt + (cIGraph_rng_unif(&rng) - 0.5) * k;
+    placed[u] = 1;
+    for(j=off[h];j<off[h+1];j++){
+      v = (long int)VECTOR(adj)[j];
+      if(!placed[v]){
+	placed[v]   = 2;
+	queue[nq++] = lid[v];
+      }
+    }
+  }
+
+  //The rest anywhere within the old layout
+  for(d=0;d<dim;d++){
+    lo[d] = HUGE_VAL;
+    hi[d] = -HUGE_VAL;
+    for(i=0;i<n;i++){
+      if(row[i] < 0)
+	continue;
+      if(MATRIX(*res,i,d) < lo[d]) lo[d] = MATRIX(*res,i,d);
+      if(MATRIX(*res,i,d) > hi[d]) hi[d] = MATRIX(*res,i,d);
+    }
+    if(lo[d] > hi[d]){
+      side  = sqrt((double)n) * k;
+      lo[d] = -side / 2;
+      hi[d] = side / 2;
+    }
+  }
+  for(i=0;i<n;i++)
+    if(!placed[i])
+      for(d=0;d<dim;d++)
+	MATRIX(*res,i,d) = lo[d] + cIGraph_rng_unif(&rng) * (hi[d] - lo[d]);
+
+  if(nr == 0 || f.niter == 0){
+    igraph_vector_destroy(&adj);
+    IGRAPH_FINALLY_CLEAN(1);
+    return layout;
+  }
+
+  //The local graph: the region, its neighbours and whatever is close to it
+  nl = nr;
+  for(j=0;j<off[nr];j++){
+    v = (long int)VECTOR(adj)[j];
+    if(lid[v] < 0){
+      lid[v]      = (int)nl;
+      verts[nl++] = (int)v;
+    }
+  }
+  for(d=0;d<dim;d++){
+    lo[d] = HUGE_VAL;
+    hi[d] = -HUGE_VAL;
+    for(h=0;h<nr;h++){
+      if(MATRIX(*res,verts[h],d) < lo[d]) lo[d] = MATRIX(*res,verts[h],d);
+      if(MATRIX(*res,verts[h],d) > hi[d]) hi[d] = MATRIX(*res,verts[h],d);
+    }
+    lo[d] -= CIGRAPH_INCREMENTAL_MARGIN * k;
+    hi[d] += CIGRAPH_INCREMENTAL_MARGIN * k;
+  }
+  for(i=0;i<n;i++){
+    if(lid[i] >= 0)
+      continue;
+    for(d=0;d<dim;d++)
+      if(MATRIX(*res,i,d) < lo[d] || MATRIX(*res,i,d) > hi[d])
+	break;
+    if(d == dim){
+      lid[i]      = (int)nl;
+      verts[nl++] = (int)i;
+    }
+  }
+
+  nedge = off[nr];
+  lbuf  = rb_str_new(NULL, sizeof(long int) * (nl+1) + sizeof(double) * (nedge + dim*nl + 1) +
+		     sizeof(int) * (nedge + nr + 1));
+
+  memset(&g, 0, sizeof(g));
+  g.n      = nl;
+  g.offset = (long int*)RSTRING_PTR(lbuf);
+  g.weight = (double*)(g.offset + nl + 1);
+  lpos     = g.weight + nedge;
+  g.nbr    = (int*)(lpos + dim*nl + 1);
+  active   = g.nbr + nedge;
+
+  //Only the region's own edges pull, so the others get empty lists
+  for(i=0;i<=nl;i++)
+    g.offset[i] = i <= nr ? off[i] : nedge;
+  for(j=0;j<nedge;j++){
+    g.nbr[j]    = lid[(long int)VECTOR(adj)[j]];
+    g.weight[j] = 1;
+  }
+  igraph_vector_destroy(&adj);
+  IGRAPH_FINALLY_CLEAN(1);
+
+  for(d=0;d<dim;d++){
+    f.pos[d] = lpos + d*nl;
+    for(i=0;i<nl;i++)
+      f.pos[d][i] = MATRIX(*res,verts[i],d);
+  }
+  for(h=0;h<nr;h++)
+    active[h] = (int)h;
+
+  f.g       = &g;
+  f.active  = active;
+  f.nactive = nr;
+  f.k       = k;
+  f.temp    = k;
+
+  cIGraph_without_gvl(cIGraph_force_run, &f);
+
+  if(f.failed)
+    rb_raise(rb_eNoMemError, "Error allocating layout");
+
+  for(d=0;d<dim;d++)
+    for(h=0;h<nr;h++)
+      MATRIX(*res,verts[h],d) = f.pos[d][h];
+
+  RB_GC_GUARD(buf);
+  RB_GC_GUARD(lbuf);
+
+  return layout;
+
+}
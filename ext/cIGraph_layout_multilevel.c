@@ -0,0 +1,359 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+#include <math.h>
+
+/* Multilevel force directed layout (Walshaw, A Multilevel Algorithm for
+ * Force-Directed Graph Drawing, 2000).
+ *
+ * The graph is coarsened repeatedly by heavy edge matching: the vertices
+ * are visited in random order and each unmatched one is merged with the
+ * unmatched neighbour it shares the heaviest edge with (relative to that
+ * neighbour's mass), and vertices left without a partner join the group
+ * of their heaviest neighbour, so that stars shrink too. Masses and edge
+ * weights add up, so a coarse vertex repels with the weight of everything
+ * merged into it.
+ *
+ * The coarsest graph is laid out from random positions with the
+ * Barnes-Hut engine (cIGraph_force_run) and each finer level then starts
+ * with its vertices scattered around their coarse vertex and is refined
+ * by a short force pass with a temperature of about the spacing of the
+ * coarser level.
+ */
+
+//Coarsening stops at this many vertices...
+#define CIGRAPH_MULTILEVEL_MIN 50
+
+//...or when a level no longer shrinks the graph by this much
+#define CIGRAPH_MULTILEVEL_RATIO 0.9
+
+//Iterations spent on the coarsest level
+#define CIGRAPH_MULTILEVEL_COARSEST 500
+
+typedef struct {
+  cIGraph_wgraph_t g;
+  double *mass;
+  int *map;                  //Vertex of the next coarser level each vertex went into
+  double *pos[3];
+} cIGraph_multilevel_level_t;
+
+typedef struct {
+  cIGraph_wgraph_t *g;
+  int dim;
+  double *pos[3];            //The final layout
+  long int niter;
+  double theta;
+  unsigned long long seed;
+  int nthreads;
+  int failed;
+} cIGraph_multilevel_job_t;
+
+/* Coarsens fine into coarse, setting fine->map. Returns 0 if coarse could
+ * not be allocated.
+ */
+static int cIGraph_multilevel_coarsen(cIGraph_multilevel_level_t *fine,
+				      cIGraph_multilevel_level_t *coarse,
+				      cIGraph_rng_t *rng){
+
+  cIGraph_wgraph_t *g = &fine->g, *c = &coarse->g;
+  long int n = g->n, nc = 0, i, j, k, p, u, v, best;
+  long int *cstart = NULL, *slot = NULL;
+  int *order = NULL, *members = NULL, *mark = NULL, *map, t;
+  double w, bw;
+
+  map      = fine->map = malloc(sizeof(int) * (n+1));
+  order    = malloc(sizeof(int) * (n+1));
+  members  = malloc(sizeof(int) * (n+1));
+  cstart   = calloc(n+2, sizeof(long int));
+  if(!map || !order || !members || !cstart)
+    goto fail;
+
+  for(i=0;i<n;i++){
+    order[i] = (int)i;
+    map[i]   = -1;
+  }
+  for(i=n-1;i>0;i--){
+    j = cIGraph_rng_integer(rng, i+1);
+    t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+
+  //Heavy edge matching
+  for(k=0;k<n;k++){
+    u = order[k];
+    if(map[u] >= 0)
+      continue;
+    best = -1;
+    bw   = 0;
+    for(j=g->offset[u];j<g->offset[u+1];j++){
+      v = g->nbr[j];
+      w = g->weight[j] / fine->mass[v];
+      if(v != u && map[v] < 0 && w > bw){
+	best = v;
+	bw   = w;
+      }
+    }
+    if(best >= 0){
+      map[u] = map[best] = (int)nc++;
+    }
+  }
+
+  //Leftovers join their heaviest neighbour, or stay by themselves
+  for(k=0;k<n;k++){
+    u = order[k];
+    if(map[u] >= 0)
+      continue;
+    best = -1;
+    bw   = 0;
+    for(j=g->offset[u];j<g->offset[u+1];j++){
+      v = g->nbr[j];
+      if(map[v] >= 0 && g->weight[j] / fine->mass[v] > bw){
+	best = v;
+	bw   = g->weight[j] / fine->mass[v];
+      }
+    }
+    map[u] = best >= 0 ? map[best] : (int)nc++;
+  }
+
+  //Members of each coarse vertex together
+  for(i=0;i<n;i++)
+    cstart[map[i]+2]++;
+  for(i=0;i<nc;i++)
+    cstart[i+2] += cstart[i+1];
+  for(i=0;i<n;i++)
+    members[cstart[map[i]+1]++] = (int)i;
+
+  memset(c, 0, sizeof(cIGraph_wgraph_t));
+  c->n         = nc;
+  c->offset    = calloc(nc+1, sizeof(long int));
+  c->nbr       = malloc(sizeof(int) * (g->offset[n]+1));
+  c->weight    = malloc(sizeof(double) * (g->offset[n]+1));
+  coarse->mass = calloc(nc+1, sizeof(double));
+  mark         = malloc(sizeof(int) * (nc+1));
+  slot         = malloc(sizeof(long int) * (nc+1));
+  if(!c->offset || !c->nbr || !c->weight || !coarse->mass || !mark || !slot)
+    goto fail;
+
+  //Merge the lists of the members, adding up parallel edges
+  for(i=0;i<nc;i++)
+    mark[i] = -1;
+  for(p=0,i=0;i<nc;i++){
+    c->offset[i] = p;
+    for(k=cstart[i];k<cstart[i+1];k++){
+      u = members[k];
+      coarse->mass[i] += fine->mass[u];
+      for(j=g->offset[u];j<g->offset[u+1];j++){
+	v = map[g->nbr[j]];
+	if(v == i)
+	  continue;
+	if(mark[v] != i){
+	  mark[v]     = (int)i;
+	  slot[v]     = p;
+	  c->nbr[p]    = (int)v;
+	  c->weight[p] = 0;
+	  p++;
+	}
+	c->weight[slot[v]] += g->weight[j];
+      }
+    }
+  }
+  c->offset[nc] = p;
+
+  free(order);
+  free(members);
+  free(cstart);
+  free(mark);
+  free(slot);
+  return 1;
+
+ fail:
+  free(order);
+  free(members);
+  free(cstart);
+  free(mark);
+  free(slot);
+  return 0;
+
+}
+
+static void *cIGraph_multilevel_run(void *arg){
+
+  cIGraph_multilevel_job_t *job = arg;
+  cIGraph_multilevel_level_t *levels;
+  cIGraph_force_t f;
+  cIGraph_rng_t rng;
+  long int n = job->g->n, nlevels = 1, l, i, maxlevels = 64;
+  int dim = job->dim, d;
+  double side, spread;
+
+  if(n == 0)
+    return NULL;
+
+  levels = calloc(maxlevels, sizeof(cIGraph_multilevel_level_t));
+  if(!levels){
+    job->failed = 1;
+    return NULL;
+  }
+  cIGraph_rng_seed(&rng, job->seed, 0);
+
+  //Level 0 borrows the graph and the final layout
+  levels[0].g    = *job->g;
+  levels[0].mass = malloc(sizeof(double) * (n+1));
+  if(!levels[0].mass){
+    job->failed = 1;
+    goto done;
+  }
+  for(i=0;i<n;i++)
+    levels[0].mass[i] = 1;
+  for(d=0;d<dim;d++)
+    levels[0].pos[d] = job->pos[d];
+
+  while(nlevels < maxlevels && levels[nlevels-1].g.n > CIGRAPH_MULTILEVEL_MIN){
+    if(!cIGraph_multilevel_coarsen(&levels[nlevels-1], &levels[nlevels], &rng)){
+      nlevels++;
+      job->failed = 1;
+      goto done;
+    }
+    nlevels++;
+    if(levels[nlevels-1].g.n > CIGRAPH_MULTILEVEL_RATIO * levels[nlevels-2].g.n)
+      break;
+  }
+
+  for(l=1;l<nlevels;l++){
+    for(d=0;d<dim;d++){
+      levels[l].pos[d] = malloc(sizeof(double) * (levels[l].g.n+1));
+      if(!levels[l].pos[d]){
+	job->failed = 1;
+	goto done;
+      }
+    }
+  }
+
+  memset(&f, 0, sizeof(f));
+  f.dim      = dim;
+  f.theta    = job->theta;
+  f.k        = 1;
+  f.nthreads = job->nthreads;
+
+  //The coarsest level from scratch, spread over the area of the whole graph
+  l    = nlevels-1;
+  side = sqrt((double)n) * f.k;
+  for(d=0;d<dim;d++)
+    for(i=0;i<levels[l].g.n;i++)
+      levels[l].pos[d][i] = (cIGraph_rng_unif(&rng) - 0.5) * side;
+
+  for(;l>=0;l--){
+
+    if(l < nlevels-1){
+      //Start around the coarse vertex, within the area it stood for
+      for(i=0;i<levels[l].g.n;i++){
+	spread = f.k * sqrt(levels[l+1].mass[levels[l].map[i]]) / 2;
+	for(d=0;d<dim;d++)
+	  levels[l].pos[d][i] = levels[l+1].pos[d][levels[l].map[i]] +
+	    (cIGraph_rng_unif(&rng) - 0.5) * spread;
+      }
+    }
+
+    f.g       = &levels[l].g;
+    f.mass    = levels[l].mass;
+    f.active  = NULL;
+    f.nactive = 0;
+    for(d=0;d<dim;d++)
+      f.pos[d] = levels[l].pos[d];
+    if(l == nlevels-1){
+      f.niter = CIGRAPH_MULTILEVEL_COARSEST;
+      f.temp  = side / 10;
+    } else {
+      f.niter = job->niter;
+      f.temp  = f.k * sqrt((double)n / levels[l+1].g.n);
+    }
+
+    cIGraph_force_run(&f);
+    if(f.failed){
+      job->failed = 1;
+      goto done;
+    }
+
+  }
+
+ done:
+  for(l=0;l<nlevels;l++){
+    if(l > 0){
+      cIGraph_wgraph_destroy(&levels[l].g);
+      for(d=0;d<dim;d++)
+	free(levels[l].pos[d]);
+    }
+    free(levels[l].mass);
+    free(levels[l].map);
+  }
+  free(levels);
+
+  return NULL;
+
+}
+
+static VALUE cIGraph_multilevel_layout(int argc, VALUE *argv, VALUE self, int dim){
+
+  VALUE niter, theta, seed, layout;
+  igraph_matrix_t *res;
+  cIGraph_wgraph_t g;
+  cIGraph_multilevel_job_t job;
+  int d;
+
+  rb_scan_args(argc,argv,"03", &niter, &theta, &seed);
+
+  memset(&job, 0, sizeof(job));
+  job.dim      = dim;
+  job.niter    = NIL_P(niter) ? 50 : NUM2LONG(niter);
+  job.theta    = NIL_P(theta) ? 0.8 : NUM2DBL(theta);
+  job.seed     = cIGraph_rng_seed_value(seed);
+  job.nthreads = cIGraph_thread_count();
+
+  if(job.niter < 0 || job.theta < 0)
+    rb_raise(cIGraphError, "Iterations and theta must not be negative\n");
+
+  layout = cIGraph_force_matrix(self, Qnil, dim, 1, INT2FIX(0));
+  Data_Get_Struct(layout, igraph_matrix_t, res);
+
+  cIGraph_wgraph_init(self, &g, Qnil);
+  job.g = &g;
+  for(d=0;d<dim && g.n>0;d++)
+    job.pos[d] = &MATRIX(*res,0,d);
+
+  cIGraph_without_gvl(cIGraph_multilevel_run, &job);
+
+  cIGraph_wgraph_destroy(&g);
+
+  if(job.failed)
+    rb_raise(rb_eNoMemError, "Error allocating layout");
+
+  return layout;
+
+}
+
+/* call-seq:
+ *   graph.layout_multilevel(niter=50,theta=0.8,seed=nil) -> IGraphMatrix
+ *
+ * Places the vertices on a plane with a multilevel force directed
+ * layout, suitable for graphs with millions of vertices. The graph is
+ * coarsened by repeatedly merging matched pairs of vertices, the coarsest
+ * version is laid out first and each finer one then starts from the
+ * layout of the level above and is refined with niter iterations of the
+ * Barnes-Hut layout (see layout_fruchterman_reingold_bh, which takes the
+ * same theta). Runs on IGraph.threads threads with the global VM lock
+ * released. Edge directions are ignored.
+ */
+VALUE cIGraph_layout_multilevel(int argc, VALUE *argv, VALUE self){
+  return cIGraph_multilevel_layout(argc, argv, self, 2);
+}
+
+/* call-seq:
+ *   graph.layout_multilevel_3d(niter=50,theta=0.8,seed=nil) -> IGraphMatrix
+ *
+ * The 3D version of layout_multilevel.
+ */
+VALUE cIGraph_layout_multilevel_3d(int argc, VALUE *argv, VALUE self){
+  return cIGraph_multilevel_layout(argc, argv, self, 3);
+}
@@ -0,0 +1,970 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "ruby/encoding.h"
+#include "cIGraph.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+/* Write-ahead logs of the changes made to a graph.
+ *
+ * IGraph#open_log writes a binary snapshot of the graph into the log and
+ * from then on every vertex and edge added or deleted, every edge object
+ * set with []= and every conversion or simplification is appended to it as
+ * a compact record. Records are collected into frames of about
+ * CIGRAPH_LOG_GROUP bytes, so a write(2) is made per frame rather than per
+ * change, and IGraph#sync_log writes out the last frame and waits for the
+ * disk. IGraph.replay_log loads the snapshot and applies the records on
+ * top of it, adding vertices and edges a batch at a time.
+ *
+ *   header   32 bytes, see cIGraph_log_header_t
+ *   snapshot the base graph, as written by write_graph_snapshot
+ *   frames   payload length (32 bit), zero (32 bit), checksum of the
+ *            payload (64 bit) and then the payload, a run of records
+ *
+ * A record is its type in one byte followed by unsigned LEB128 integers
+ * and objects:
+ *
+ *   ADD_VERTICES  nv, count, count objects
+ *   ADD_EDGES     k, count, 2k vertex ids, count objects
+ *   DELETE_*      count, count vertex or edge ids
+ *   SET_EDGE      edge id, object
+ *   GRAPH_ATTR    the graph attribute Hash, an object
+ *   TO_*          mode
+ *   SIMPLIFY      multiple | loops << 1
+ *
+ * The objects are those the attribute handler pushes onto the vertex and
+ * edge Arrays, so replaying gives the same Arrays back. An object is a tag
+ * byte and then nothing (nil, true, false), a zigzag encoded integer
+ * (Fixnums), 8 bytes (Floats), or a length and that many bytes (UTF-8
+ * Strings, Marshal for everything else).
+ *
+ * A frame that is cut short or does not match its checksum ends the log:
+ * it is what is left of a write that was interrupted by a crash.
+ */
+
+#define CIGRAPH_LOG_VERSION 1
+
+//Payload bytes collected before a frame is written
+#define CIGRAPH_LOG_GROUP (1 << 16)
+
+//Bytes in front of each frame's payload
+#define CIGRAPH_LOG_FRAME 16
+
+#define CIGRAPH_LOG_ADD_VERTICES 1
+#define CIGRAPH_LOG_ADD_EDGES    2
+#define CIGRAPH_LOG_SET_EDGE     5
+#define CIGRAPH_LOG_GRAPH_ATTR   6
+
+#define CIGRAPH_LOG_NIL     0
+#define CIGRAPH_LOG_FIXNUM  1
+#define CIGRAPH_LOG_FLOAT   2
+#define CIGRAPH_LOG_STRING  3
+#define CIGRAPH_LOG_MARSHAL 4
+#define CIGRAPH_LOG_TRUE    5
+#define CIGRAPH_LOG_FALSE   6
+
+static const char cIGraph_log_magic[8] = {'I','G','R','A','P','H','W','L'};
+
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int reserved;
+  unsigned long long order;       //Tells the byte order apart
+  unsigned long long base;        //Bytes of the snapshot that follows
+} cIGraph_log_header_t;
+
+#define CIGRAPH_LOG_ORDER 0x0102030405060708ULL
+
+typedef struct {
+  int fd;
+  char *buf;                      //Frame being collected, header first
+  size_t len;
+  size_t cap;
+  int err;                        //errno of a failed write
+  VALUE exc;                      //Exception raised logging an object
+  VALUE path;
+} cIGraph_log_t;
+
+//FNV-1a
+static unsigned long long cIGraph_log_checksum(const char *data, size_t len){
+
+  unsigned long long h = 0xCBF29CE484222325ULL;
+  size_t i;
+
+  for(i=0;i<len;i++){
+    h ^= (unsigned char)data[i];
+    h *= 0x100000001B3ULL;
+  }
+
+  return h;
+
+}
+
+static int cIGraph_log_write(int fd, const char *data, size_t len){
+
+  ssize_t k;
+
+  while(len > 0){
+    k = write(fd, data, len);
+    if(k < 0){
+      if(errno == EINTR)
+	continue;
+      return errno;
+    }
+    data += k;
+    len  -= k;
+  }
+
+  return 0;
+
+}
+
+/* Writes out the frame collected so far. Errors are kept for sync_log to
+ * raise, as frames are also written from the attribute handler and when
+ * the log is garbage collected.
+ */
+static void cIGraph_log_flush(cIGraph_log_t *log){
+
+  unsigned int head[2];
+  unsigned long long sum;
+  size_t n = log->len - CIGRAPH_LOG_FRAME;
+
+  if(n == 0 || log->fd < 0 || log->err)
+    return;
+  if(n > UINT_MAX){
+    log->err = EFBIG;
+    return;
+  }
+
+  head[0] = (unsigned int)n;
+  head[1] = 0;
+  sum     = cIGraph_log_checksum(log->buf + CIGRAPH_LOG_FRAME, n);
+  memcpy(log->buf, head, 8);
+  memcpy(log->buf + 8, &sum, 8);
+
+  log->err = cIGraph_log_write(log->fd, log->buf, log->len);
+  log->len = CIGRAPH_LOG_FRAME;
+
+}
+
+static void cIGraph_log_mark(void *p){
+  cIGraph_log_t *log = p;
+  rb_gc_mark(log->path);
+  rb_gc_mark(log->exc);
+}
+
+static void cIGraph_log_free(void *p){
+
+  cIGraph_log_t *log = p;
+
+  if(log->fd >= 0){
+    cIGraph_log_flush(log);
+    close(log->fd);
+  }
+  free(log->buf);
+  xfree(log);
+
+}
+
+//The log of graph, or NULL if there is none or it has failed
+static cIGraph_log_t *cIGraph_log_of(const igraph_t *graph){
+
+  VALUE obj = ((VALUE*)graph->attr)[4];
+  cIGraph_log_t *log;
+
+  if(NIL_P(obj))
+    return NULL;
+  Data_Get_Struct(obj, cIGraph_log_t, log);
+  if(log->err || !NIL_P(log->exc))
+    return NULL;
+
+  return log;
+
+}
+
+static int cIGraph_log_reserve(cIGraph_log_t *log, size_t n){
+
+  size_t cap = log->cap;
+  char *buf;
+
+  if(log->len + n <= cap)
+    return 1;
+  while(cap < log->len + n)
+    cap *= 2;
+  if(!(buf = realloc(log->buf, cap))){
+    log->err = ENOMEM;
+    return 0;
+  }
+  log->buf = buf;
+  log->cap = cap;
+
+  return 1;
+
+}
+
+static void cIGraph_log_bytes(cIGraph_log_t *log, const void *data, size_t len){
+  if(!cIGraph_log_reserve(log, len))
+    return;
+  memcpy(log->buf + log->len, data, len);
+  log->len += len;
+}
+
+static void cIGraph_log_varint(cIGraph_log_t *log, unsigned long long x){
+
+  unsigned char *c;
+
+  if(!cIGraph_log_reserve(log, 10))
+    return;
+  c = (unsigned char*)log->buf + log->len;
+  while(x >= 0x80){
+    *c++ = (unsigned char)(x | 0x80);
+    x  >>= 7;
+  }
+  *c++ = (unsigned char)x;
+  log->len = (char*)c - log->buf;
+
+}
+
+static VALUE cIGraph_log_marshal(VALUE obj){
+  return rb_marshal_dump(obj, Qnil);
+}
+
+static void cIGraph_log_object(cIGraph_log_t *log, VALUE obj){
+
+  unsigned char tag;
+  long long k;
+  double x;
+  VALUE dump;
+  int state = 0;
+
+  if(NIL_P(obj) || obj == Qtrue || obj == Qfalse){
+    tag = NIL_P(obj) ? CIGRAPH_LOG_NIL : obj == Qtrue ? CIGRAPH_LOG_TRUE : CIGRAPH_LOG_FALSE;
+    cIGraph_log_bytes(log, &tag, 1);
+  } else if(FIXNUM_P(obj)){
+    tag = CIGRAPH_LOG_FIXNUM;
+    k   = FIX2LONG(obj);
+    cIGraph_log_bytes(log, &tag, 1);
+    cIGraph_log_varint(log, ((unsigned long long)k << 1) ^ (unsigned long long)(k >> 63));
+  } else if(TYPE(obj) == T_FLOAT){
+    tag = CIGRAPH_LOG_FLOAT;
+    x   = RFLOAT_VALUE(obj);
+    cIGraph_log_bytes(log, &tag, 1);
+    cIGraph_log_bytes(log, &x, 8);
+  } else if(TYPE(obj) == T_STRING && rb_enc_get_index(obj) == rb_utf8_encindex()){
+    tag = CIGRAPH_LOG_STRING;
+    cIGraph_log_bytes(log, &tag, 1);
+    cIGraph_log_varint(log, RSTRING_LEN(obj));
+    cIGraph_log_bytes(log, RSTRING_PTR(obj), RSTRING_LEN(obj));
+  } else {
+    //Raising here would unwind through igraph, so it waits for sync_log
+    dump = rb_protect(cIGraph_log_marshal, obj, &state);
+    if(state){
+      log->exc = rb_errinfo();
+      rb_set_errinfo(Qnil);
+      return;
+    }
+    tag = CIGRAPH_LOG_MARSHAL;
+    cIGraph_log_bytes(log, &tag, 1);
+    cIGraph_log_varint(log, RSTRING_LEN(dump));
+    cIGraph_log_bytes(log, RSTRING_PTR(dump), RSTRING_LEN(dump));
+  }
+
+}
+
+static size_t cIGraph_log_begin(cIGraph_log_t *log, int type){
+
+  size_t start = log->len;
+  unsigned char c = (unsigned char)type;
+
+  cIGraph_log_bytes(log, &c, 1);
+
+  return start;
+
+}
+
+//Ends the record begun at start, dropping it if it could not be finished
+static void cIGraph_log_end(cIGraph_log_t *log, size_t start){
+
+  if(log->err || !NIL_P(log->exc)){
+    log->len = start;
+    return;
+  }
+  if(log->len - CIGRAPH_LOG_FRAME >= CIGRAPH_LOG_GROUP)
+    cIGraph_log_flush(log);
+
+}
+
+/* Called by the attribute handler once vertices have been added, with the
+ * length the vertex Array had before.
+ */
+void cIGraph_log_add_vertices(const igraph_t *graph, long int nv, long int before){
+
+  cIGraph_log_t *log = cIGraph_log_of(graph);
+  VALUE v_ary = ((VALUE*)graph->attr)[0];
+  long int i, n;
+  size_t start;
+
+  if(!log)
+    return;
+  n = RARRAY_LEN(v_ary) - before;
+  if(nv == 0 && n == 0)
+    return;
+
+  start = cIGraph_log_begin(log, CIGRAPH_LOG_ADD_VERTICES);
+  cIGraph_log_varint(log, nv);
+  cIGraph_log_varint(log, n);
+  for(i=0;i<n;i++)
+    cIGraph_log_object(log, rb_ary_entry(v_ary, before + i));
+  cIGraph_log_end(log, start);
+
+}
+
+//As above for edges
+void cIGraph_log_add_edges(const igraph_t *graph, const igraph_vector_t *edges, long int before){
+
+  cIGraph_log_t *log = cIGraph_log_of(graph);
+  VALUE e_ary = ((VALUE*)graph->attr)[1];
+  long int i, n, k;
+  size_t start;
+
+  if(!log)
+    return;
+  k = igraph_vector_size(edges) / 2;
+  n = RARRAY_LEN(e_ary) - before;
+  if(k == 0 && n == 0)
+    return;
+
+  start = cIGraph_log_begin(log, CIGRAPH_LOG_ADD_EDGES);
+  cIGraph_log_varint(log, k);
+  cIGraph_log_varint(log, n);
+  for(i=0;i<2*k;i++)
+    cIGraph_log_varint(log, (unsigned long long)VECTOR(*edges)[i]);
+  for(i=0;i<n;i++)
+    cIGraph_log_object(log, rb_ary_entry(e_ary, before + i));
+  cIGraph_log_end(log, start);
+
+}
+
+//Called by IGraph#[]=
+void cIGraph_log_set_edge(const igraph_t *graph, long int eid, VALUE obj){
+
+  cIGraph_log_t *log = cIGraph_log_of(graph);
+  size_t start;
+
+  if(!log)
+    return;
+
+  start = cIGraph_log_begin(log, CIGRAPH_LOG_SET_EDGE);
+  cIGraph_log_varint(log, eid);
+  cIGraph_log_object(log, obj);
+  cIGraph_log_end(log, start);
+
+}
+
+static int cIGraph_log_apply(igraph_t *graph, int op, const igraph_vector_t *ids, int arg){
+
+  switch(op){
+  case CIGRAPH_LOG_DELETE_VERTICES:
+    return igraph_delete_vertices(graph, igraph_vss_vector(ids));
+  case CIGRAPH_LOG_DELETE_EDGES:
+    return igraph_delete_edges(graph, igraph_ess_vector(ids));
+  case CIGRAPH_LOG_TO_DIRECTED:
+    return igraph_to_directed(graph, arg);
+  case CIGRAPH_LOG_TO_UNDIRECTED:
+    return igraph_to_undirected(graph, arg);
+  case CIGRAPH_LOG_SIMPLIFY:
+    return igraph_simplify(graph, arg & 1, (arg >> 1) & 1);
+  }
+
+  return IGRAPH_EINVAL;
+
+}
+
+typedef struct {
+  igraph_t *graph;
+  int op;
+  const igraph_vector_t *ids;
+  int arg;
+  VALUE log;
+  int done;
+  int ret;
+} cIGraph_log_op_t;
+
+static VALUE cIGraph_log_run(VALUE arg){
+  cIGraph_log_op_t *o = (cIGraph_log_op_t*)arg;
+  o->ret  = cIGraph_log_apply(o->graph, o->op, o->ids, o->arg);
+  o->done = 1;
+  return Qnil;
+}
+
+static VALUE cIGraph_log_reattach(VALUE arg){
+
+  cIGraph_log_op_t *o = (cIGraph_log_op_t*)arg;
+  cIGraph_log_t *log;
+  size_t start;
+  long int i;
+
+  ((VALUE*)o->graph->attr)[4] = o->log;
+
+  if(!o->done || o->ret != 0 || !(log = cIGraph_log_of(o->graph)))
+    return Qnil;
+
+  start = cIGraph_log_begin(log, o->op);
+  if(o->ids){
+    cIGraph_log_varint(log, igraph_vector_size(o->ids));
+    for(i=0;i<igraph_vector_size(o->ids);i++)
+      cIGraph_log_varint(log, (unsigned long long)VECTOR(*o->ids)[i]);
+  } else {
+    cIGraph_log_varint(log, o->arg);
+  }
+  cIGraph_log_end(log, start);
+
+  return Qnil;
+
+}
+
+/* Deletes vertices or edges, or converts or simplifies the graph. igraph
+ * does these by building a new graph and copying the attributes over,
+ * which leaves the log behind, so the log is moved across by hand and the
+ * change logged as a whole.
+ */
+int cIGraph_log_replace(igraph_t *graph, int op, const igraph_vector_t *ids, int arg){
+
+  cIGraph_log_op_t o;
+  VALUE log = ((VALUE*)graph->attr)[4];
+
+  if(NIL_P(log))
+    return cIGraph_log_apply(graph, op, ids, arg);
+
+  o.graph = graph;
+  o.op    = op;
+  o.ids   = ids;
+  o.arg   = arg;
+  o.log   = log;
+  o.done  = 0;
+  o.ret   = 0;
+
+  ((VALUE*)graph->attr)[4] = Qnil;
+  rb_ensure(cIGraph_log_run, (VALUE)&o, cIGraph_log_reattach, (VALUE)&o);
+
+  RB_GC_GUARD(log);
+
+  return o.ret;
+
+}
+
+/* Logs the graph attributes, writes and syncs the frame. The Hash is
+ * logged whole every time, as changes made inside it leave no trace.
+ */
+static void cIGraph_log_sync(igraph_t *graph, cIGraph_log_t *log){
+
+  size_t start;
+
+  if(log->err)
+    return;
+
+  if(NIL_P(log->exc)){
+    start = cIGraph_log_begin(log, CIGRAPH_LOG_GRAPH_ATTR);
+    cIGraph_log_object(log, ((VALUE*)graph->attr)[2]);
+    cIGraph_log_end(log, start);
+  }
+
+  //After a failed Marshal.dump the records before it are still written
+  cIGraph_log_flush(log);
+  if(!log->err && fsync(log->fd) != 0)
+    log->err = errno;
+
+}
+
+static void cIGraph_log_check(cIGraph_log_t *log){
+  if(!NIL_P(log->exc))
+    rb_exc_raise(log->exc);
+  if(log->err)
+    rb_syserr_fail_str(log->err, log->path);
+}
+
+static cIGraph_log_t *cIGraph_log_get(VALUE self){
+
+  igraph_t *graph;
+  cIGraph_log_t *log;
+  VALUE obj;
+
+  Data_Get_Struct(self, igraph_t, graph);
+  obj = ((VALUE*)graph->attr)[4];
+  if(NIL_P(obj))
+    rb_raise(cIGraphError, "No mutation log is open");
+  Data_Get_Struct(obj, cIGraph_log_t, log);
+
+  return log;
+
+}
+
+//Writes the header and base snapshot of a new log to the File args[1]
+static VALUE cIGraph_log_base(VALUE arg){
+
+  VALUE *args = (VALUE*)arg;
+  cIGraph_log_header_t head;
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, cIGraph_log_magic, sizeof(head.magic));
+  head.version = CIGRAPH_LOG_VERSION;
+  head.order   = CIGRAPH_LOG_ORDER;
+
+  rb_funcall(args[1], rb_intern("write"), 1, rb_str_new((char*)&head, sizeof(head)));
+  head.base = NUM2ULL(cIGraph_write_graph_snapshot(args[0], args[1]));
+  rb_funcall(args[1], rb_intern("seek"), 1, INT2FIX(0));
+  rb_funcall(args[1], rb_intern("write"), 1, rb_str_new((char*)&head, sizeof(head)));
+  rb_funcall(args[1], rb_intern("fsync"), 0);
+
+  return Qnil;
+
+}
+
+static VALUE cIGraph_log_close_file(VALUE file){
+  return rb_funcall(file, rb_intern("close"), 0);
+}
+
+//So that a renamed log survives a crash
+static void cIGraph_log_sync_dir(VALUE path){
+
+  const char *c = StringValueCStr(path);
+  const char *slash = strrchr(c, '/');
+  VALUE dir;
+  int fd;
+
+  dir = slash ? rb_str_new(c, slash == c ? 1 : slash - c) : rb_str_new2(".");
+  if((fd = open(StringValueCStr(dir), O_RDONLY | O_CLOEXEC)) >= 0){
+    fsync(fd);
+    close(fd);
+  }
+
+}
+
+/* call-seq:
+ *   graph.open_log(path) -> IGraph
+ *
+ * Starts a write-ahead log of the changes made to the graph at path. The
+ * log begins with a snapshot of the graph as it is now (written next to
+ * path and renamed over it, so an existing log is only replaced once the
+ * new one is complete) and every vertex and edge added or deleted, every
+ * edge object set with []=, and every call to to_directed, to_undirected
+ * or simplify is appended to it. Changes to the graph attributes are
+ * logged by sync_log. IGraph.replay_log rebuilds the graph from the log.
+ *
+ * Changes are written in groups, so sync_log must be called for the last
+ * of them to reach the disk. Any log already open on the graph is closed.
+ * Copies of the graph are not logged, nor are changes made inside vertex
+ * or edge objects after they were added.
+ *
+ * Example:
+ *
+ *  g = IGraph.new([1,2,3,4],true)
+ *  g.open_log('graph.log')
+ *  g.add_vertex(5)
+ *  g.add_edge(4,5)
+ *  g.sync_log
+ *  IGraph.replay_log('graph.log').vcount # => 5
+ */
+VALUE cIGraph_open_log(VALUE self, VALUE path){
+
+  igraph_t *graph;
+  cIGraph_log_t *log;
+  VALUE obj, old, file, tmp, args[2];
+  int fd;
+
+  FilePathValue(path);
+  path = rb_str_new_frozen(path);
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  tmp  = rb_str_plus(path, rb_str_new2(".tmp"));
+  file = rb_funcall(rb_cFile, rb_intern("open"), 2, tmp, rb_str_new2("wb"));
+  args[0] = self;
+  args[1] = file;
+  rb_ensure(cIGraph_log_base, (VALUE)args, cIGraph_log_close_file, file);
+
+  if(rename(StringValueCStr(tmp), StringValueCStr(path)) != 0)
+    rb_syserr_fail_str(errno, path);
+  cIGraph_log_sync_dir(path);
+
+  obj = Data_Make_Struct(rb_cObject, cIGraph_log_t, cIGraph_log_mark, cIGraph_log_free, log);
+  log->fd        = -1;
+  log->exc       = Qnil;
+  log->path      = path;
+  log->cap       = CIGRAPH_LOG_FRAME + CIGRAPH_LOG_GROUP;
+  log->len       = CIGRAPH_LOG_FRAME;
+  if(!(log->buf = malloc(log->cap)))
+    rb_memerror();
+
+  if((fd = open(StringValueCStr(path), O_WRONLY | O_APPEND | O_CLOEXEC)) < 0)
+    rb_syserr_fail_str(errno, path);
+  log->fd = fd;
+
+  old = ((VALUE*)graph->attr)[4];
+  ((VALUE*)graph->attr)[4] = obj;
+
+  //The old log's last changes are in the new snapshot already
+  if(!NIL_P(old)){
+    Data_Get_Struct(old, cIGraph_log_t, log);
+    cIGraph_log_flush(log);
+    close(log->fd);
+    log->fd = -1;
+  }
+
+  return self;
+
+}
+
+/* call-seq:
+ *   graph.sync_log -> nil
+ *
+ * Logs the graph attributes, then writes out the changes
+ * not yet written and waits for them to reach the disk. Raises the error
+ * of any write or Marshal.dump that failed since the log was opened;
+ * nothing more is logged after such an error, until compact_log starts
+ * the log afresh, though the changes made before a failed Marshal.dump
+ * are still written.
+ */
+VALUE cIGraph_sync_log(VALUE self){
+
+  igraph_t *graph;
+  cIGraph_log_t *log = cIGraph_log_get(self);
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  cIGraph_log_sync(graph, log);
+  cIGraph_log_check(log);
+
+  return Qnil;
+
+}
+
+/* call-seq:
+ *   graph.compact_log -> IGraph
+ *
+ * Replaces the log with one holding just a snapshot of the graph as it is
+ * now, so it no longer grows without bound and replays quickly.
+ */
+VALUE cIGraph_compact_log(VALUE self){
+  return cIGraph_open_log(self, cIGraph_log_get(self)->path);
+}
+
+/* call-seq:
+ *   graph.close_log -> nil
+ *
+ * Syncs the log as sync_log does and stops logging changes.
+ */
+VALUE cIGraph_close_log(VALUE self){
+
+  igraph_t *graph;
+  cIGraph_log_t *log;
+  VALUE obj;
+
+  Data_Get_Struct(self, igraph_t, graph);
+  obj = ((VALUE*)graph->attr)[4];
+  if(NIL_P(obj))
+    return Qnil;
+  Data_Get_Struct(obj, cIGraph_log_t, log);
+
+  cIGraph_log_sync(graph, log);
+  ((VALUE*)graph->attr)[4] = Qnil;
+  if(close(log->fd) != 0 && !log->err)
+    log->err = errno;
+  log->fd = -1;
+  cIGraph_log_check(log);
+
+  RB_GC_GUARD(obj);
+
+  return Qnil;
+
+}
+
+typedef struct {
+  cIGraph_map_t map;
+  VALUE graph;
+  const unsigned char *p;         //Record being read
+  const unsigned char *end;
+  long int nv;                    //Vertices waiting to be added...
+  VALUE v_obj;                    //...with their objects
+  igraph_vector_t edges;          //Edges waiting to be added...
+  VALUE e_obj;                    //...with theirs
+  igraph_vector_t ids;
+  igraph_vector_ptr_t attr;
+  igraph_i_attribute_record_t rec;
+  int init;
+} cIGraph_replay_t;
+
+static void cIGraph_replay_corrupt(void){
+  rb_raise(cIGraphError, "Corrupt mutation log");
+}
+
+static unsigned long long cIGraph_replay_varint(cIGraph_replay_t *r){
+
+  unsigned long long x = 0;
+  int shift;
+
+  for(shift=0;r->p < r->end && shift < 64;shift+=7){
+    x |= (unsigned long long)(*r->p & 0x7f) << shift;
+    if(!(*r->p++ & 0x80))
+      return x;
+  }
+  cIGraph_replay_corrupt();
+
+  return 0;
+
+}
+
+//A count of things at least a byte each, so it cannot overrun the frame
+static long int cIGraph_replay_count(cIGraph_replay_t *r, int per){
+
+  unsigned long long n = cIGraph_replay_varint(r);
+
+  if(n > (unsigned long long)(r->end - r->p) / per)
+    cIGraph_replay_corrupt();
+
+  return (long int)n;
+
+}
+
+static VALUE cIGraph_replay_object(cIGraph_replay_t *r){
+
+  unsigned long long z;
+  long int len;
+  double x;
+  int tag;
+  VALUE str, obj;
+
+  if(r->p >= r->end)
+    cIGraph_replay_corrupt();
+  tag = *r->p++;
+
+  switch(tag){
+  case CIGRAPH_LOG_NIL:
+    return Qnil;
+  case CIGRAPH_LOG_TRUE:
+    return Qtrue;
+  case CIGRAPH_LOG_FALSE:
+    return Qfalse;
+  case CIGRAPH_LOG_FIXNUM:
+    z = cIGraph_replay_varint(r);
+    return LL2NUM((long long)(z >> 1) ^ -(long long)(z & 1));
+  case CIGRAPH_LOG_FLOAT:
+    if(r->end - r->p < 8)
+      cIGraph_replay_corrupt();
+    memcpy(&x, r->p, 8);
+    r->p += 8;
+    return rb_float_new(x);
+  case CIGRAPH_LOG_STRING:
+  case CIGRAPH_LOG_MARSHAL:
+    len   = cIGraph_replay_count(r, 1);
+    r->p += len;
+    if(tag == CIGRAPH_LOG_STRING)
+      return rb_enc_str_new((const char*)r->p - len, len, rb_utf8_encoding());
+    //Marshal does not keep its source alive
+    str = rb_str_new((const char*)r->p - len, len);
+    obj = rb_marshal_load(str);
+    RB_GC_GUARD(str);
+    return obj;
+  }
+  cIGraph_replay_corrupt();
+
+  return Qnil;
+
+}
+
+//Adds the vertices and then the edges waiting, one igraph call each
+static void cIGraph_replay_flush(cIGraph_replay_t *r, igraph_t *graph){
+
+  if(r->nv > 0 || RARRAY_LEN(r->v_obj) > 0){
+    r->rec.value = (void*)r->v_obj;
+    igraph_add_vertices(graph, r->nv, &r->attr);
+    r->nv    = 0;
+    r->v_obj = rb_ary_new();
+  }
+  if(igraph_vector_size(&r->edges) > 0 || RARRAY_LEN(r->e_obj) > 0){
+    r->rec.value = (void*)r->e_obj;
+    igraph_add_edges(graph, &r->edges, &r->attr);
+    igraph_vector_clear(&r->edges);
+    r->e_obj = rb_ary_new();
+  }
+
+}
+
+static void cIGraph_replay_record(cIGraph_replay_t *r, igraph_t *graph){
+
+  long int i, k, n, count, limit;
+  unsigned long long id;
+  int type = *r->p++;
+  VALUE obj;
+
+  switch(type){
+  case CIGRAPH_LOG_ADD_VERTICES:
+    //Vertices never change the ids of edges, so all the vertices waiting
+    //can be added before all the edges
+    k     = cIGraph_replay_count(r, 1);
+    count = cIGraph_replay_count(r, 1);
+    if(k > INT_MAX - (long int)igraph_vcount(graph) - r->nv)
+      cIGraph_replay_corrupt();
+    r->nv += k;
+    for(i=0;i<count;i++)
+      rb_ary_push(r->v_obj, cIGraph_replay_object(r));
+    break;
+  case CIGRAPH_LOG_ADD_EDGES:
+    k     = cIGraph_replay_count(r, 2);
+    count = cIGraph_replay_count(r, 1);
+    limit = (long int)igraph_vcount(graph) + r->nv;
+    for(i=0;i<2*k;i++){
+      if((id = cIGraph_replay_varint(r)) >= (unsigned long long)limit)
+	cIGraph_replay_corrupt();
+      igraph_vector_push_back(&r->edges, (igraph_real_t)id);
+    }
+    for(i=0;i<count;i++)
+      rb_ary_push(r->e_obj, cIGraph_replay_object(r));
+    break;
+  case CIGRAPH_LOG_DELETE_VERTICES:
+  case CIGRAPH_LOG_DELETE_EDGES:
+    cIGraph_replay_flush(r, graph);
+    n     = cIGraph_replay_count(r, 1);
+    limit = (long int)(type == CIGRAPH_LOG_DELETE_VERTICES ? igraph_vcount(graph) : igraph_ecount(graph));
+    igraph_vector_resize(&r->ids, n);
+    for(i=0;i<n;i++){
+      if((id = cIGraph_replay_varint(r)) >= (unsigned long long)limit)
+	cIGraph_replay_corrupt();
+      VECTOR(r->ids)[i] = (igraph_real_t)id;
+    }
+    cIGraph_log_apply(graph, type, &r->ids, 0);
+    break;
+  case CIGRAPH_LOG_SET_EDGE:
+    cIGraph_replay_flush(r, graph);
+    if((id = cIGraph_replay_varint(r)) >= (unsigned long long)igraph_ecount(graph))
+      cIGraph_replay_corrupt();
+    obj = cIGraph_replay_object(r);
+    rb_ary_store(((VALUE*)graph->attr)[1], (long int)id, obj);
+    break;
+  case CIGRAPH_LOG_GRAPH_ATTR:
+    obj = cIGraph_replay_object(r);
+    if(TYPE(obj) != T_HASH)
+      cIGraph_replay_corrupt();
+    ((VALUE*)graph->attr)[2] = obj;
+    break;
+  case CIGRAPH_LOG_TO_DIRECTED:
+  case CIGRAPH_LOG_TO_UNDIRECTED:
+  case CIGRAPH_LOG_SIMPLIFY:
+    cIGraph_replay_flush(r, graph);
+    cIGraph_log_apply(graph, type, NULL, (int)cIGraph_replay_varint(r));
+    break;
+  default:
+    cIGraph_replay_corrupt();
+  }
+
+}
+
+static VALUE cIGraph_replay_run(VALUE arg){
+
+  cIGraph_replay_t *r = (cIGraph_replay_t*)arg;
+  cIGraph_log_header_t head;
+  igraph_t *graph;
+  const char *data = r->map.data;
+  size_t len = r->map.len, pos;
+  unsigned int frame[2];
+  unsigned long long sum;
+
+  if(len < sizeof(head) || memcmp(data, cIGraph_log_magic, sizeof(head.magic)) != 0)
+    rb_raise(cIGraphError, "Not an IGraph mutation log");
+  memcpy(&head, data, sizeof(head));
+  if(head.order != CIGRAPH_LOG_ORDER)
+    rb_raise(cIGraphError, "Mutation log was written on a machine of another byte order");
+  if(head.version != CIGRAPH_LOG_VERSION)
+    rb_raise(cIGraphError, "Mutation log version %u is not supported (expected %d)", head.version, CIGRAPH_LOG_VERSION);
+  if(head.base > len - sizeof(head))
+    cIGraph_replay_corrupt();
+
+  r->graph = cIGraph_snapshot_read(data + sizeof(head), (size_t)head.base);
+  Data_Get_Struct(r->graph, igraph_t, graph);
+
+  r->v_obj = rb_ary_new();
+  r->e_obj = rb_ary_new();
+  r->rec.name = "__RUBY__";
+  r->rec.type = IGRAPH_ATTRIBUTE_PY_OBJECT;
+  igraph_vector_init(&r->edges, 0);
+  igraph_vector_init(&r->ids, 0);
+  igraph_vector_ptr_init(&r->attr, 1);
+  VECTOR(r->attr)[0] = &r->rec;
+  r->init = 1;
+
+  for(pos=sizeof(head)+head.base;len-pos>=CIGRAPH_LOG_FRAME;pos+=CIGRAPH_LOG_FRAME+frame[0]){
+    memcpy(frame, data + pos, 8);
+    memcpy(&sum, data + pos + 8, 8);
+    if(frame[1] != 0 || frame[0] > len - pos - CIGRAPH_LOG_FRAME ||
+       cIGraph_log_checksum(data + pos + CIGRAPH_LOG_FRAME, frame[0]) != sum)
+      break;
+    r->p   = (const unsigned char*)data + pos + CIGRAPH_LOG_FRAME;
+    r->end = r->p + frame[0];
+    while(r->p < r->end)
+      cIGraph_replay_record(r, graph);
+  }
+  cIGraph_replay_flush(r, graph);
+
+  return r->graph;
+
+}
+
+static VALUE cIGraph_replay_release(VALUE arg){
+
+  cIGraph_replay_t *r = (cIGraph_replay_t*)arg;
+
+  if(r->init){
+    igraph_vector_destroy(&r->edges);
+    igraph_vector_destroy(&r->ids);
+    igraph_vector_ptr_destroy(&r->attr);
+  }
+  cIGraph_unmap_file(&r->map);
+
+  return Qnil;
+
+}
+
+/* call-seq:
+ *   IGraph.replay_log(path) -> IGraph
+ *
+ * Rebuilds a graph from the log at path written by IGraph#open_log: the
+ * snapshot at its start is loaded and the changes logged after it applied
+ * in order, with runs of added vertices and edges added in one go. A
+ * change left half written by a crash ends the log. Raises an IGraphError
+ * if the log is of another version of the format or is damaged anywhere
+ * else.
+ *
+ * The graph returned is not logged; call open_log on it to carry on.
+ */
+VALUE cIGraph_replay_log(VALUE self, VALUE path){
+
+  cIGraph_replay_t r;
+  VALUE graph;
+  int err;
+
+  FilePathValue(path);
+
+  memset(&r, 0, sizeof(r));
+  r.graph = r.v_obj = r.e_obj = Qnil;
+
+  if((err = cIGraph_map_file(StringValueCStr(path), &r.map)) < 0)
+    rb_raise(cIGraphError, "%s: Invalid gzip input", StringValueCStr(path));
+  if(err)
+    rb_syserr_fail_str(err, path);
+
+  graph = rb_ensure(cIGraph_replay_run, (VALUE)&r, cIGraph_replay_release, (VALUE)&r);
+
+  RB_GC_GUARD(r.v_obj);
+  RB_GC_GUARD(r.e_obj);
+
+  return graph;
+
+}
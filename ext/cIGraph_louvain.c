@@ -0,0 +1,833 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+/* Louvain and Leiden community detection.
+ *
+ * Both alternate a local moving phase, where each vertex moves to the
+ * neighbouring community that most increases the modularity, with
+ * aggregation, where each community becomes a single vertex of a smaller
+ * weighted graph. Leiden adds a refinement phase in between: each
+ * community is split into well connected pieces by merging its vertices
+ * at random (favouring larger gains), and it is those pieces that get
+ * aggregated, with the communities carried over as the starting partition
+ * of the next level.
+ *
+ * Local moving is parallel. The vertices are greedily coloured so that
+ * no two neighbours share a colour, and the vertices of one colour all
+ * choose their moves at once on the worker threads. Because none of them
+ * are adjacent their choices only interact through the community totals.
+ * The moves are then applied in order. The colouring order and the
+ * refinement draws come from the seed, so a seed gives the same partition
+ * whatever the thread count. Refinement runs one community per worker.
+ * Aggregation is serial.
+ *
+ * Modularity uses the resolution parameter gamma:
+ *   Q = sum over c of in(c)/2m - gamma (tot(c)/2m)^2
+ * and edge directions are ignored.
+ */
+
+#define CIGRAPH_LOUVAIN_CHUNK  256
+
+//Colours with fewer vertices than this are not worth starting threads for
+#define CIGRAPH_LOUVAIN_SERIAL 2048
+
+#define CIGRAPH_LOUVAIN_SWEEPS 64
+#define CIGRAPH_LOUVAIN_LEVELS 64
+
+//Everything the run needs, so it can go without the GVL
+typedef struct {
+  cIGraph_wgraph_t *g;
+  double gamma;
+  double theta;              //Leiden randomness, 0 for Louvain
+  unsigned long long seed;
+  int nthreads;
+  int *memb;                 //Result, per vertex
+  double *q;                 //Result, per level
+  int nq;
+  int failed;
+} cIGraph_lv_job_t;
+
+//Shared by the local moving workers
+typedef struct {
+  cIGraph_wgraph_t *g;
+  double gamma;
+  int *comm;
+  double *tot;
+  int *target;
+  const int *nodes;          //The colour class being moved
+  long int nnodes;
+  long int next;
+} cIGraph_lv_shared_t;
+
+//A small open addressing table of community weights
+typedef struct {
+  cIGraph_lv_shared_t *s;
+  int *keys;
+  double *vals;
+  long int *used;
+  long int mask;
+} cIGraph_lv_worker_t;
+
+static long int cIGraph_lv_maxdeg(cIGraph_wgraph_t *g){
+
+  long int i, d = 0;
+
+  for(i=0;i<g->n;i++)
+    if(g->offset[i+1] - g->offset[i] > d)
+      d = g->offset[i+1] - g->offset[i];
+  return d;
+
+}
+
+/* Finds the best community for vertex i given the current state. Ties go
+ * to the current community.
+ */
+static int cIGraph_lv_best(cIGraph_lv_worker_t *w, long int i){
+
+  cIGraph_lv_shared_t *s = w->s;
+  cIGraph_wgraph_t *g = s->g;
+  long int p, slot, nused = 0;
+  int c = s->comm[i], d, best = c;
+  double ki = g->k[i], kic = 0, gain, bestgain;
+
+  for(p=g->offset[i];p<g->offset[i+1];p++){
+    d = s->comm[g->nbr[p]];
+    slot = (d * 2654435761UL) & w->mask;
+    while(w->keys[slot] != -1 && w->keys[slot] != d)
+      slot = (slot + 1) & w->mask;
+    if(w->keys[slot] == -1){
+      w->keys[slot] = d;
+      w->vals[slot] = 0;
+      w->used[nused++] = slot;
+    }
+    w->vals[slot] += g->weight[p];
+  }
+
+  for(p=0;p<nused;p++)
+    if(w->keys[w->used[p]] == c)
+      kic = w->vals[w->used[p]];
+
+  bestgain = kic - s->gamma * ki * (s->tot[c] - ki) / g->m2;
+
+  for(p=0;p<nused;p++){
+    slot = w->used[p];
+    d = w->keys[slot];
+    if(d != c){
+      gain = w->vals[slot] - s->gamma * ki * s->tot[d] / g->m2;
+      if(gain > bestgain){
+	bestgain = gain;
+	best = d;
+      }
+    }
+    w->keys[slot] = -1;
+  }
+
+  return best;
+
+}
+
+static void *cIGraph_lv_worker(void *arg){
+
+  cIGraph_lv_worker_t *w = arg;
+  cIGraph_lv_shared_t *s = w->s;
+  long int start, end, i;
+
+  while((start = __sync_fetch_and_add(&s->next, CIGRAPH_LOUVAIN_CHUNK)) < s->nnodes){
+    end = start + CIGRAPH_LOUVAIN_CHUNK < s->nnodes ? start + CIGRAPH_LOUVAIN_CHUNK : s->nnodes;
+    for(i=start;i<end;i++)
+      s->target[s->nodes[i]] = cIGraph_lv_best(w, s->nodes[i]);
+  }
+
+  return NULL;
+
+}
+
+/* Modularity of the partition comm of g. tot and in are scratch of size
+ * g->n.
+ */
+static double cIGraph_lv_quality(cIGraph_wgraph_t *g, const int *comm, double gamma,
+				 double *tot, double *in){
+
+  long int i, p;
+  double q = 0;
+
+  if(g->m2 <= 0)
+    return 0;
+
+  for(i=0;i<g->n;i++)
+    tot[i] = in[i] = 0;
+  for(i=0;i<g->n;i++){
+    tot[comm[i]] += g->k[i];
+    in[comm[i]]  += g->self[i];
+    for(p=g->offset[i];p<g->offset[i+1];p++)
+      if(comm[g->nbr[p]] == comm[i])
+	in[comm[i]] += g->weight[p];
+  }
+  for(i=0;i<g->n;i++)
+    q += in[i] / g->m2 - gamma * (tot[i] / g->m2) * (tot[i] / g->m2);
+
+  return q;
+
+}
+
+/* Renumbers comm in place to 0...C-1 in order of first appearance and
+ * returns C. ids is scratch of size n.
+ */
+static long int cIGraph_lv_renumber(int *comm, long int n, int *ids){
+
+  long int i, c = 0;
+
+  for(i=0;i<n;i++)
+    ids[i] = -1;
+  for(i=0;i<n;i++){
+    if(ids[comm[i]] == -1)
+      ids[comm[i]] = (int)c++;
+    comm[i] = ids[comm[i]];
+  }
+  return c;
+
+}
+
+/* Local moving on g, starting from the partition in comm, until a sweep
+ * no longer improves the modularity. Returns 0 if out of memory.
+ */
+static int cIGraph_lv_move(cIGraph_lv_job_t *job, cIGraph_wgraph_t *g,
+			   int *comm, int level){
+
+  cIGraph_lv_shared_t s;
+  cIGraph_lv_worker_t *workers = NULL;
+  cIGraph_rng_t rng;
+  long int n = g->n, maxd, hsize, ncol = 0, c, i, j, moves, sweep;
+  long int *coff = NULL;
+  int *nodes = NULL;
+  double *scratch = NULL, q, prev;
+  int v, d, nth, ok = 0;
+
+  if(g->m2 <= 0)
+    return 1;
+
+  maxd = cIGraph_lv_maxdeg(g);
+  for(hsize=16;hsize<2*(maxd+1);hsize*=2)
+    ;
+
+  memset(&s,0,sizeof(s));
+  s.g      = g;
+  s.gamma  = job->gamma;
+  s.comm   = comm;
+  s.tot    = calloc(n+1, sizeof(double));
+  s.target = malloc(sizeof(int) * (n+1));
+  nodes    = malloc(sizeof(int) * (n+1));
+  coff     = malloc(sizeof(long int) * (n+2));
+  scratch  = malloc(sizeof(double) * 2*(n+1));
+  workers  = calloc(job->nthreads, sizeof(cIGraph_lv_worker_t));
+  if(!s.tot || !s.target || !nodes || !coff || !scratch || !workers)
+    goto done;
+
+  for(i=0;i<job->nthreads;i++){
+    workers[i].s    = &s;
+    workers[i].mask = hsize - 1;
+    workers[i].keys = malloc(sizeof(int) * hsize);
+    workers[i].vals = malloc(sizeof(double) * hsize);
+    workers[i].used = malloc(sizeof(long int) * (maxd+1));
+    if(!workers[i].keys || !workers[i].vals || !workers[i].used)
+      goto done;
+    for(j=0;j<hsize;j++)
+      workers[i].keys[j] = -1;
+  }
+
+  cIGraph_rng_seed(&rng, job->seed, level);
+  ncol = cIGraph_wgraph_colour(g, &rng, nodes, coff);
+  if(ncol < 0)
+    goto done;
+
+  for(i=0;i<n;i++)
+    s.tot[comm[i]] += g->k[i];
+
+  prev = cIGraph_lv_quality(g, comm, job->gamma, scratch, scratch+n);
+
+  for(sweep=0;sweep<CIGRAPH_LOUVAIN_SWEEPS && !cIGraph_interrupted();sweep++){
+
+    moves = 0;
+    for(c=0;c<ncol;c++){
+      s.nodes  = nodes + coff[c];
+      s.nnodes = coff[c+1] - coff[c];
+      s.next   = 0;
+      nth = s.nnodes < CIGRAPH_LOUVAIN_SERIAL ? 1 : job->nthreads;
+      cIGraph_parallel(cIGraph_lv_worker, workers, sizeof(cIGraph_lv_worker_t), nth);
+      for(i=0;i<s.nnodes;i++){
+	v = s.nodes[i];
+	d = s.target[v];
+	if(d != comm[v]){
+	  s.tot[comm[v]] -= g->k[v];
+	  s.tot[d]       += g->k[v];
+	  comm[v] = d;
+	  moves++;
+	}
+      }
+    }
+
+    if(moves == 0)
+      break;
+    q = cIGraph_lv_quality(g, comm, job->gamma, scratch, scratch+n);
+    if(q - prev <= 1e-10)
+      break;
+    prev = q;
+
+  }
+
+  ok = 1;
+
+ done:
+  if(workers){
+    for(i=0;i<job->nthreads;i++){
+      free(workers[i].keys);
+      free(workers[i].vals);
+      free(workers[i].used);
+    }
+  }
+  free(workers);
+  free(s.tot);
+  free(s.target);
+  free(nodes);
+  free(coff);
+  free(scratch);
+
+  return ok;
+
+}
+
+//Shared by the refinement workers
+typedef struct {
+  cIGraph_wgraph_t *g;
+  double gamma;
+  double theta;
+  unsigned long long seed;
+  const int *part;           //Communities from local moving
+  long int *moff;            //Members of each, grouped
+  int *mem;
+  int *pos;                  //Index of each vertex among its community's members
+  int *rref;                 //Result: a representative vertex per piece
+  long int ncomm;
+  long int next;
+} cIGraph_lv_refine_t;
+
+typedef struct {
+  cIGraph_lv_refine_t *s;
+  int *ref;                  //Piece of each member, by member index
+  int *rsize;
+  double *kr;                //Weighted degree of each piece
+  double *ext;               //Weight from each piece to the rest of its community
+  double *acc;
+  double *prob;
+  int *used;
+  int *order;
+  long int *stamp;
+  long int tick;
+} cIGraph_lv_refiner_t;
+
+/* Splits community c into well connected pieces. Each member that is still
+ * on its own and well connected joins a neighbouring well connected piece
+ * (or stays put) with probability proportional to exp(gain/theta).
+ */
+static void cIGraph_lv_refine_one(cIGraph_lv_refiner_t *w, long int c){
+
+  cIGraph_lv_refine_t *s = w->s;
+  cIGraph_wgraph_t *g = s->g;
+  const int *mem = s->mem + s->moff[c];
+  long int sz = s->moff[c+1] - s->moff[c];
+  long int t, i, j, p, nused;
+  double ks = 0, kv, gain, gmax, total, x;
+  cIGraph_rng_t rng;
+  int u, r, choice;
+
+  if(sz == 1){
+    s->rref[mem[0]] = mem[0];
+    return;
+  }
+
+  for(t=0;t<sz;t++)
+    s->pos[mem[t]] = (int)t;
+
+  for(t=0;t<sz;t++){
+    w->ref[t]   = (int)t;
+    w->rsize[t] = 1;
+    w->kr[t]    = g->k[mem[t]];
+    w->ext[t]   = 0;
+    w->order[t] = (int)t;
+    ks += g->k[mem[t]];
+    for(p=g->offset[mem[t]];p<g->offset[mem[t]+1];p++)
+      if(s->part[g->nbr[p]] == c)
+	w->ext[t] += g->weight[p];
+  }
+
+  cIGraph_rng_seed(&rng, s->seed, (int)c);
+  for(t=sz-1;t>0;t--){
+    j = cIGraph_rng_integer(&rng, t+1);
+    u = w->order[t];
+    w->order[t] = w->order[j];
+    w->order[j] = u;
+  }
+
+  for(i=0;i<sz;i++){
+
+    t  = w->order[i];
+    kv = g->k[mem[t]];
+    if(w->ref[t] != t || w->rsize[t] != 1)
+      continue;
+    if(w->ext[t] < s->gamma * kv * (ks - kv) / g->m2)
+      continue;
+
+    //Weight from the member to each neighbouring piece
+    w->tick++;
+    nused = 0;
+    for(p=g->offset[mem[t]];p<g->offset[mem[t]+1];p++){
+      if(s->part[g->nbr[p]] != c)
+	continue;
+      r = w->ref[s->pos[g->nbr[p]]];
+      if(w->stamp[r] != w->tick){
+	w->stamp[r] = w->tick;
+	w->acc[r]   = 0;
+	w->used[nused++] = r;
+      }
+      w->acc[r] += g->weight[p];
+    }
+
+    //Staying put counts as a gain of 0
+    gmax = 0;
+    for(j=0;j<nused;j++){
+      r = w->used[j];
+      w->prob[j] = -1;
+      if(w->ext[r] < s->gamma * w->kr[r] * (ks - w->kr[r]) / g->m2)
+	continue;
+      gain = w->acc[r] - s->gamma * kv * w->kr[r] / g->m2;
+      if(gain < 0)
+	continue;
+      w->prob[j] = gain;
+      if(gain > gmax)
+	gmax = gain;
+    }
+
+    total = exp(-gmax / s->theta);
+    for(j=0;j<nused;j++){
+      if(w->prob[j] >= 0){
+	w->prob[j] = exp((w->prob[j] - gmax) / s->theta);
+	total += w->prob[j];
+      }
+    }
+
+    choice = (int)t;
+    x = cIGraph_rng_unif(&rng) * total - exp(-gmax / s->theta);
+    for(j=0;j<nused && x >= 0;j++){
+      if(w->prob[j] >= 0){
+	choice = w->used[j];
+	x -= w->prob[j];
+      }
+    }
+
+    if(choice != t){
+      w->ref[t] = choice;
+      w->rsize[choice]++;
+      w->rsize[t] = 0;
+      w->kr[choice] += kv;
+      w->ext[choice] += w->ext[t] - 2 * w->acc[choice];
+    }
+
+  }
+
+  for(t=0;t<sz;t++)
+    s->rref[mem[t]] = mem[w->ref[t]];
+
+}
+
+static void *cIGraph_lv_refine_worker(void *arg){
+
+  cIGraph_lv_refiner_t *w = arg;
+  cIGraph_lv_refine_t *s = w->s;
+  long int start, end, c;
+
+  while((start = __sync_fetch_and_add(&s->next, 16)) < s->ncomm){
+    end = start + 16 < s->ncomm ? start + 16 : s->ncomm;
+    for(c=start;c<end;c++)
+      cIGraph_lv_refine_one(w, c);
+  }
+
+  return NULL;
+
+}
+
+/* Refines the partition part (numbered 0...ncomm-1) of g into rpart and
+ * returns the number of pieces, or -1 if out of memory.
+ */
+static long int cIGraph_lv_refine(cIGraph_lv_job_t *job, cIGraph_wgraph_t *g,
+				  const int *part, long int ncomm, int level,
+				  int *rpart){
+
+  cIGraph_lv_refine_t s;
+  cIGraph_lv_refiner_t *workers = NULL;
+  long int n = g->n, i, c, maxs = 0, res = -1;
+  long int *fill = NULL;
+  int *ids = NULL;
+
+  memset(&s,0,sizeof(s));
+  s.g     = g;
+  s.gamma = job->gamma;
+  s.theta = job->theta;
+  s.seed  = job->seed ^ (0x9E3779B97F4A7C15ULL * (unsigned long long)(level + 1));
+  s.part  = part;
+  s.rref  = rpart;
+  s.ncomm = ncomm;
+
+  s.moff  = calloc(ncomm+2, sizeof(long int));
+  s.mem   = malloc(sizeof(int) * (n+1));
+  s.pos   = malloc(sizeof(int) * (n+1));
+  fill    = malloc(sizeof(long int) * (ncomm+1));
+  ids     = malloc(sizeof(int) * (n+1));
+  workers = calloc(job->nthreads, sizeof(cIGraph_lv_refiner_t));
+  if(!s.moff || !s.mem || !s.pos || !fill || !ids || !workers)
+    goto done;
+
+  for(i=0;i<n;i++)
+    s.moff[part[i]+1]++;
+  for(c=0;c<ncomm;c++){
+    s.moff[c+1] += s.moff[c];
+    fill[c] = s.moff[c];
+    if(s.moff[c+1] - s.moff[c] > maxs)
+      maxs = s.moff[c+1] - s.moff[c];
+  }
+  for(i=0;i<n;i++)
+    s.mem[fill[part[i]]++] = (int)i;
+
+  for(i=0;i<job->nthreads;i++){
+    workers[i].s     = &s;
+    workers[i].ref   = malloc(sizeof(int) * (maxs+1));
+    workers[i].rsize = malloc(sizeof(int) * (maxs+1));
+    workers[i].used  = malloc(sizeof(int) * (maxs+1));
+    workers[i].order = malloc(sizeof(int) * (maxs+1));
+    workers[i].kr    = malloc(sizeof(double) * (maxs+1));
+    workers[i].ext   = malloc(sizeof(double) * (maxs+1));
+    workers[i].acc   = malloc(sizeof(double) * (maxs+1));
+    workers[i].prob  = malloc(sizeof(double) * (maxs+1));
+    workers[i].stamp = calloc(maxs+1, sizeof(long int));
+    if(!workers[i].ref || !workers[i].rsize || !workers[i].used ||
+       !workers[i].order || !workers[i].kr || !workers[i].ext ||
+       !workers[i].acc || !workers[i].prob || !workers[i].stamp)
+      goto done;
+  }
+
+  cIGraph_parallel(cIGraph_lv_refine_worker, workers, sizeof(cIGraph_lv_refiner_t), job->nthreads);
+
+  res = cIGraph_lv_renumber(rpart, n, ids);
+
+ done:
+  if(workers){
+    for(i=0;i<job->nthreads;i++){
+      free(workers[i].ref);
+      free(workers[i].rsize);
+      free(workers[i].used);
+      free(workers[i].order);
+      free(workers[i].kr);
+      free(workers[i].ext);
+      free(workers[i].acc);
+      free(workers[i].prob);
+      free(workers[i].stamp);
+    }
+  }
+  free(workers);
+  free(s.moff);
+  free(s.mem);
+  free(s.pos);
+  free(fill);
+  free(ids);
+
+  return res;
+
+}
+
+/* Builds in h the graph with one vertex per part of agg (numbered
+ * 0...nagg-1), summing the weights between parts and turning those within
+ * a part into loops. Returns 0 if out of memory.
+ */
+static int cIGraph_lv_aggregate(cIGraph_wgraph_t *g, const int *agg, long int nagg,
+				cIGraph_wgraph_t *h){
+
+  long int n = g->n, i, c, p, q = 0, start;
+  long int *moff, *fill;
+  int *mem, *stamp;
+  double *acc;
+  int d, v;
+
+  memset(h,0,sizeof(cIGraph_wgraph_t));
+  h->n      = nagg;
+  h->m2     = g->m2;
+  h->offset = calloc(nagg+1, sizeof(long int));
+  h->nbr    = malloc(sizeof(int) * (g->offset[n]+1));
+  h->weight = malloc(sizeof(double) * (g->offset[n]+1));
+  h->self   = calloc(nagg+1, sizeof(double));
+  h->k      = calloc(nagg+1, sizeof(double));
+  moff      = calloc(nagg+2, sizeof(long int));
+  fill      = malloc(sizeof(long int) * (nagg+1));
+  mem       = malloc(sizeof(int) * (n+1));
+  stamp     = malloc(sizeof(int) * (nagg+1));
+  acc       = malloc(sizeof(double) * (nagg+1));
+
+  if(!h->offset || !h->nbr || !h->weight || !h->self || !h->k ||
+     !moff || !fill || !mem || !stamp || !acc){
+    cIGraph_wgraph_destroy(h);
+    free(moff);
+    free(fill);
+    free(mem);
+    free(stamp);
+    free(acc);
+    return 0;
+  }
+
+  for(i=0;i<n;i++)
+    moff[agg[i]+1]++;
+  for(c=0;c<nagg;c++){
+    moff[c+1] += moff[c];
+    fill[c] = moff[c];
+    stamp[c] = -1;
+  }
+  for(i=0;i<n;i++)
+    mem[fill[agg[i]]++] = (int)i;
+
+  for(c=0;c<nagg;c++){
+    h->offset[c] = start = q;
+    for(i=moff[c];i<moff[c+1];i++){
+      v = mem[i];
+      h->self[c] += g->self[v];
+      h->k[c]    += g->k[v];
+      for(p=g->offset[v];p<g->offset[v+1];p++){
+	d = agg[g->nbr[p]];
+	if(d == c){
+	  h->self[c] += g->weight[p];
+	} else {
+	  if(stamp[d] != c){
+	    stamp[d] = (int)c;
+	    acc[d]   = 0;
+	    h->nbr[q++] = d;
+	  }
+	  acc[d] += g->weight[p];
+	}
+      }
+    }
+    for(p=start;p<q;p++)
+      h->weight[p] = acc[h->nbr[p]];
+  }
+  h->offset[nagg] = q;
+
+  free(moff);
+  free(fill);
+  free(mem);
+  free(stamp);
+  free(acc);
+
+  return 1;
+
+}
+
+static void *cIGraph_lv_run(void *arg){
+
+  cIGraph_lv_job_t *job = arg;
+  cIGraph_wgraph_t *g = job->g, *h = NULL;
+  long int n0 = g->n, n, i, ncomm, nagg;
+  int *map, *comm, *part, *rpart, *ids, *agg;
+  double *scratch;
+  int level;
+
+  map     = malloc(sizeof(int) * (n0+1));
+  comm    = malloc(sizeof(int) * (n0+1));
+  part    = malloc(sizeof(int) * (n0+1));
+  rpart   = malloc(sizeof(int) * (n0+1));
+  ids     = malloc(sizeof(int) * (n0+1));
+  scratch = malloc(sizeof(double) * 2*(n0+1));
+  if(!map || !comm || !part || !rpart || !ids || !scratch)
+    goto fail;
+
+  for(i=0;i<n0;i++){
+    map[i]  = (int)i;
+    comm[i] = (int)i;
+  }
+
+  for(level=0;level<CIGRAPH_LOUVAIN_LEVELS && !cIGraph_interrupted();level++){
+
+    n = g->n;
+
+    if(!cIGraph_lv_move(job, g, comm, level))
+      goto fail;
+
+    memcpy(part, comm, sizeof(int) * n);
+    ncomm = cIGraph_lv_renumber(part, n, ids);
+
+    if(ncomm == n && level > 0)
+      break;
+    job->q[job->nq++] = cIGraph_lv_quality(g, part, job->gamma, scratch, scratch+n);
+    if(ncomm == n)
+      break;
+
+    //Leiden aggregates the refined pieces, unless none could be merged
+    agg  = part;
+    nagg = ncomm;
+    if(job->theta > 0){
+      nagg = cIGraph_lv_refine(job, g, part, ncomm, level, rpart);
+      if(nagg < 0)
+	goto fail;
+      if(nagg < n)
+	agg = rpart;
+      else
+	nagg = ncomm;
+    }
+
+    h = malloc(sizeof(cIGraph_wgraph_t));
+    if(!h || !cIGraph_lv_aggregate(g, agg, nagg, h)){
+      free(h);
+      goto fail;
+    }
+
+    for(i=0;i<n0;i++)
+      map[i] = agg[map[i]];
+
+    //Next level starts from singletons, or from the unrefined communities
+    for(i=0;i<nagg;i++)
+      comm[i] = (int)i;
+    if(agg == rpart)
+      for(i=0;i<n;i++)
+	comm[rpart[i]] = part[i];
+
+    if(g != job->g){
+      cIGraph_wgraph_destroy(g);
+      free(g);
+    }
+    g = h;
+
+  }
+
+  cIGraph_lv_renumber(comm, g->n, ids);
+  for(i=0;i<n0;i++)
+    job->memb[i] = comm[map[i]];
+
+  goto done;
+
+ fail:
+  job->failed = 1;
+
+ done:
+  if(g != job->g){
+    cIGraph_wgraph_destroy(g);
+    free(g);
+  }
+  free(map);
+  free(comm);
+  free(part);
+  free(rpart);
+  free(ids);
+  free(scratch);
+
+  return NULL;
+
+}
+
+static VALUE cIGraph_lv(VALUE self, VALUE weights, VALUE resolution, VALUE seed,
+			double theta){
+
+  cIGraph_wgraph_t g;
+  cIGraph_lv_job_t job;
+  VALUE memb, q = rb_ary_new();
+  int i;
+
+  memset(&job,0,sizeof(job));
+  job.gamma    = NIL_P(resolution) ? 1.0 : NUM2DBL(resolution);
+  job.theta    = theta;
+  job.seed     = cIGraph_rng_seed_value(seed);
+  job.nthreads = cIGraph_thread_count();
+
+  cIGraph_wgraph_init(self, &g, weights);
+
+  job.g    = &g;
+  job.memb = malloc(sizeof(int) * (g.n+1));
+  job.q    = malloc(sizeof(double) * CIGRAPH_LOUVAIN_LEVELS);
+  if(!job.memb || !job.q){
+    free(job.memb);
+    free(job.q);
+    cIGraph_wgraph_destroy(&g);
+    rb_raise(rb_eNoMemError, "Error allocating communities");
+  }
+
+  cIGraph_without_gvl(cIGraph_lv_run, &job);
+
+  if(job.failed){
+    free(job.memb);
+    free(job.q);
+    cIGraph_wgraph_destroy(&g);
+    rb_raise(rb_eNoMemError, "Error allocating communities");
+  }
+
+  memb = rb_str_new((char*)job.memb, sizeof(int) * g.n);
+  for(i=0;i<job.nq;i++)
+    rb_ary_push(q,rb_float_new(job.q[i]));
+
+  free(job.memb);
+  free(job.q);
+  cIGraph_wgraph_destroy(&g);
+
+  return rb_ary_new3(2,memb,q);
+
+}
+
+/* call-seq:
+ *   graph.community_louvain(weights=nil,resolution=1.0,seed=nil) -> Array
+ *
+ * Finds communities with the Louvain method (Blondel et al. 2008): vertices
+ * are moved greedily between neighbouring communities while that improves
+ * the modularity, then each community is collapsed to a single vertex and
+ * the process repeats on the smaller graph. weights is an Array with one
+ * weight per edge, the name of an edge attribute holding the weights, or
+ * nil. resolution scales the null model term of the modularity; larger
+ * values give smaller communities. seed fixes the order vertices are
+ * visited in; pass nil to take one from Kernel#rand. Edge directions are
+ * ignored.
+ *
+ * Returns [membership, modularity]. membership is a String of native
+ * 32 bit integers (see String#unpack with 'l*') giving the community of
+ * each vertex, by vertex id, with communities numbered from 0. modularity
+ * is an Array of the modularity after each level.
+ *
+ * The moving phases run on IGraph.threads threads and the global VM lock is
+ * released throughout. The result only depends on the seed.
+ */
+VALUE cIGraph_community_louvain(int argc, VALUE *argv, VALUE self){
+
+  VALUE weights, resolution, seed;
+
+  rb_scan_args(argc,argv,"03", &weights, &resolution, &seed);
+
+  return cIGraph_lv(self, weights, resolution, seed, 0);
+
+}
+
+/* call-seq:
+ *   graph.community_leiden(weights=nil,resolution=1.0,seed=nil,randomness=0.01) -> Array
+ *
+ * Finds communities with the Leiden algorithm (Traag et al. 2019), which
+ * improves on IGraph#community_louvain by refining each community into
+ * well connected pieces before aggregating, so that no community comes out
+ * disconnected. randomness controls how greedy the refinement is: each
+ * vertex joins a piece with probability proportional to
+ * exp(gain/randomness). The other arguments and the result are as for
+ * IGraph#community_louvain.
+ */
+VALUE cIGraph_community_leiden(int argc, VALUE *argv, VALUE self){
+
+  VALUE weights, resolution, seed, randomness;
+  double theta;
+
+  rb_scan_args(argc,argv,"04", &weights, &resolution, &seed, &randomness);
+
+  theta = NIL_P(randomness) ? 0.01 : NUM2DBL(randomness);
+  if(theta <= 0)
+    rb_raise(cIGraphError, "Randomness must be positive\n");
+
+  return cIGraph_lv(self, weights, resolution, seed, theta);
+
+}
@@ -2,6 +2,10 @@
 #include "ruby.h"
 #include "cIGraph.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 //Classes
 VALUE cIGraphMatrix;
 
@@ -239,3 +243,148 @@ VALUE cIGraph_matrix_toa(VALUE self){
 
 }
   
+
+/* Copies the n doubles at src to dst as floats, to stride apart. */
+static void cIGraph_matrix_tofloat(float *dst, long int stride, const double *src, long int n){
+
+  long int i = 0;
+
+#ifdef __SSE2__
+  if(stride == 1){
+    for(;i+4<=n;i+=4){
+      __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src+i));
+      __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src+i+2));
+      _mm_storeu_ps(dst+i, _mm_movelh_ps(lo, hi));
+    }
+  }
+#endif
+
+  for(;i<n;i++)
+    dst[i*stride] = (float)src[i];
+
+}
+
+//Reads the type and order arguments of pack and unpack
+static void cIGraph_matrix_layout(VALUE type, VALUE order, int *single, int *rowmajor){
+
+  int t = NIL_P(type)  ? 0 : NUM2INT(type);
+  int o = NIL_P(order) ? 0 : NUM2INT(order);
+
+  if(t != 0 && t != 1)
+    rb_raise(cIGraphError, "Type must be IGraphMatrix::FLOAT64 or IGraphMatrix::FLOAT32\n");
+  if(o != 0 && o != 1)
+    rb_raise(cIGraphError, "Order must be IGraphMatrix::ROW_MAJOR or IGraphMatrix::COLUMN_MAJOR\n");
+
+  *single   = t == 1;
+  *rowmajor = o == 0;
+
+}
+
+/* call-seq:
+ *   matrix.pack(type=IGraphMatrix::FLOAT64,order=IGraphMatrix::ROW_MAJOR) -> String
+ *
+ * Returns the contents of the matrix as a binary String of native
+ * endian floating point numbers, without creating a Ruby object for each
+ * value. type is IGraphMatrix::FLOAT64 for doubles or
+ * IGraphMatrix::FLOAT32 to convert them to floats, and order is
+ * IGraphMatrix::ROW_MAJOR for the values of each row together (x,y,x,y
+ * ... for a layout) or IGraphMatrix::COLUMN_MAJOR for each column
+ * together, which is how the matrix is stored so that FLOAT64 is then a
+ * straight copy.
+ */
+VALUE cIGraph_matrix_pack(int argc, VALUE *argv, VALUE self){
+
+  igraph_matrix_t *m;
+  VALUE type, order, str;
+  long int nrow, ncol, i, j;
+  int single, rowmajor;
+  double *src;
+  char *dst;
+
+  rb_scan_args(argc,argv,"02", &type, &order);
+
+  cIGraph_matrix_layout(type, order, &single, &rowmajor);
+
+  Data_Get_Struct(self, igraph_matrix_t, m);
+
+  nrow = igraph_matrix_nrow(m);
+  ncol = igraph_matrix_ncol(m);
+  src  = VECTOR(m->data);
+
+  str = rb_str_new(NULL, nrow * ncol * (single ? sizeof(float) : sizeof(double)));
+  dst = RSTRING_PTR(str);
+
+  if(nrow * ncol == 0)
+    return str;
+
+  if(single){
+    if(rowmajor)
+      for(j=0;j<ncol;j++)
+	cIGraph_matrix_tofloat((float*)dst + j, ncol, src + j*nrow, nrow);
+    else
+      cIGraph_matrix_tofloat((float*)dst, 1, src, nrow * ncol);
+  } else {
+    if(rowmajor)
+      for(i=0;i<nrow;i++)
+	for(j=0;j<ncol;j++)
+	  ((double*)dst)[i*ncol+j] = src[j*nrow+i];
+    else
+      memcpy(dst, src, sizeof(double) * nrow * ncol);
+  }
+
+  return str;
+
+}
+
+/* call-seq:
+ *   IGraphMatrix.unpack(str,nrow,ncol,type=IGraphMatrix::FLOAT64,order=IGraphMatrix::ROW_MAJOR) -> IGraphMatrix
+ *
+ * Creates an IGraphMatrix with nrow rows and ncol columns from a binary
+ * String laid out as described for IGraphMatrix#pack. The String must
+ * hold exactly nrow * ncol values, and type and order must be among the
+ * constants pack takes.
+ */
+VALUE cIGraph_matrix_unpack(int argc, VALUE *argv, VALUE klass){
+
+  igraph_matrix_t *m;
+  VALUE str, nrow_v, ncol_v, type, order, obj;
+  long int nrow, ncol, i, j;
+  int single, rowmajor;
+  double *dst;
+  const char *src;
+
+  rb_scan_args(argc,argv,"32", &str, &nrow_v, &ncol_v, &type, &order);
+
+  StringValue(str);
+  nrow     = NUM2LONG(nrow_v);
+  ncol     = NUM2LONG(ncol_v);
+  cIGraph_matrix_layout(type, order, &single, &rowmajor);
+
+  if(nrow < 0 || ncol < 0)
+    rb_raise(cIGraphError, "Matrix dimensions must not be negative\n");
+  if(RSTRING_LEN(str) != nrow * ncol * (long int)(single ? sizeof(float) : sizeof(double)))
+    rb_raise(cIGraphError, "String must hold %ld values\n", nrow * ncol);
+
+  obj = cIGraph_matrix_alloc(klass);
+  Data_Get_Struct(obj, igraph_matrix_t, m);
+  igraph_matrix_resize(m, nrow, ncol);
+
+  dst = VECTOR(m->data);
+  src = RSTRING_PTR(str);
+
+  if(single){
+    for(i=0;i<nrow;i++)
+      for(j=0;j<ncol;j++)
+	dst[j*nrow+i] = rowmajor ? ((const float*)src)[i*ncol+j] : ((const float*)src)[j*nrow+i];
+  } else {
+    if(rowmajor)
+      for(i=0;i<nrow;i++)
+	for(j=0;j<ncol;j++)
+	  dst[j*nrow+i] = ((const double*)src)[i*ncol+j];
+    else
+      memcpy(dst, src, sizeof(double) * nrow * ncol);
+  }
+
+  return obj;
+
+}
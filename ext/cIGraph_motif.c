@@ -2,65 +2,470 @@
 #include "ruby.h"
 #include "cIGraph.h"
 
-/* call-seq:
- *   igraph.motifs_randesu(size,cut)
+#include <time.h>
+
+/* Native RAND-ESU motif counting.
+ *
+ * ESU (Wernicke 2006) visits every connected induced subgraph of the given
+ * size exactly once: a subgraph is grown from its smallest vertex (the
+ * root) and only ever extended by vertices above the root that are not
+ * already next to it. The search trees of different roots are independent,
+ * so roots are handed out to the worker threads in small chunks and each
+ * worker fills its own isoclass histogram. RAND-ESU skips each branch at
+ * depth d with probability cut[d]. The random numbers come from a stream
+ * per root vertex, so a seed gives the same counts whatever the thread
+ * count or scheduling.
+ *
+ * Subgraphs are classified by packing their adjacency matrix into a code
+ * and looking it up in a table built once from igraph_isoclass, so the
+ * class ids are igraph's.
  *
+ * The adaptive estimate searches from roots taken in a random order until
+ * a time budget runs out or the standard error of every class is small
+ * enough. Every subgraph is counted at exactly one root, so n times the
+ * mean count per root is an unbiased estimate of the total.
+ */
+
+#define CIGRAPH_MOTIF_CHUNK 16
+
+//Fewest sampled roots the adaptive estimate trusts its error bars with
+#define CIGRAPH_MOTIF_MIN_SAMPLES 32
+
+//Code to isoclass tables, by [directed][size-3]
+static int *cIGraph_motif_tables[2][2];
+static int  cIGraph_motif_classes[2][2];
+
+/* Sets *out to the table mapping adjacency codes of size vertex graphs to
+ * their isoclass, building it on first use, and returns an igraph error
+ * code. Bits are assigned to the vertex pairs (i,j) in row order, i<j for
+ * undirected graphs and i!=j for directed ones.
+ */
+static int cIGraph_motif_table(int size, int directed, const int **out, int *nclass){
+
+  igraph_t g;
+  igraph_vector_t edges;
+  igraph_integer_t iso;
+  long int code, ncode;
+  int *table;
+  int i, j, b, max = 0;
+
+  if(cIGraph_motif_tables[directed][size-3]){
+    *out    = cIGraph_motif_tables[directed][size-3];
+    *nclass = cIGraph_motif_classes[directed][size-3];
+    return 0;
+  }
+
+  ncode = 1L << (directed ? size*(size-1) : size*(size-1)/2);
+  table = malloc(sizeof(int) * ncode);
+  if(!table)
+    rb_raise(rb_eNoMemError, "Error allocating isoclass table");
+
+  IGRAPH_FINALLY(free, table);
+  igraph_vector_init(&edges,0);
+  IGRAPH_FINALLY(igraph_vector_destroy,&edges);
+
+  for(code=0;code<ncode;code++){
+    igraph_vector_clear(&edges);
+    b = 0;
+    for(i=0;i<size;i++){
+      for(j=0;j<size;j++){
+	if(i == j || (!directed && j < i))
+	  continue;
+	if(code & (1L << b)){
+	  IGRAPH_CHECK(igraph_vector_push_back(&edges,i));
+	  IGRAPH_CHECK(igraph_vector_push_back(&edges,j));
+	}
+	b++;
+      }
+    }
+    IGRAPH_CHECK(igraph_create(&g,&edges,size,directed));
+    IGRAPH_FINALLY(igraph_destroy,&g);
+    IGRAPH_CHECK(igraph_isoclass(&g,&iso));
+    igraph_destroy(&g);
+    IGRAPH_FINALLY_CLEAN(1);
+    table[code] = (int)iso;
+    if(table[code] > max)
+      max = table[code];
+  }
+
+  igraph_vector_destroy(&edges);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  cIGraph_motif_tables[directed][size-3]  = table;
+  cIGraph_motif_classes[directed][size-3] = max + 1;
+
+  *out    = table;
+  *nclass = max + 1;
+  return 0;
+
+}
+
+//Data shared by all of the worker threads
+typedef struct {
+  cIGraph_csr_t *adj;        //Neighbours ignoring direction
+  cIGraph_csr_t *out;        //Out neighbours, directed graphs only
+  int size;
+  const int *table;
+  int nclass;
+  double cut[4];
+  int cutting;
+  unsigned long long seed;
+  const int *roots;          //Roots to search from, NULL for every vertex
+  long int nroots;
+  long int next;             //Next unclaimed root
+} cIGraph_esu_shared_t;
+
+typedef struct {
+  cIGraph_esu_shared_t *s;
+  cIGraph_rng_t rng;
+  unsigned long long *hist;
+  int sub[4];
+  int root;
+  int *ext;                  //Extension sets, one block per depth
+  long int stride;
+  char *insub;
+  int *cover;                //Number of subgraph vertices next to each vertex
+} cIGraph_esu_worker_t;
+
+static int cIGraph_esu_edge(const cIGraph_csr_t *csr, int u, int v){
+
+  long int lo = csr->offset[u], hi = csr->offset[u+1] - 1, mid;
+
+  while(lo <= hi){
+    mid = (lo + hi) / 2;
+    if(csr->nbr[mid] == v)
+      return 1;
+    else if(csr->nbr[mid] < v)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return 0;
+
+}
+
+static int cIGraph_esu_class(cIGraph_esu_worker_t *w){
+
+  cIGraph_esu_shared_t *s = w->s;
+  int i, j, b = 0;
+  long int code = 0;
+
+  for(i=0;i<s->size;i++){
+    for(j=0;j<s->size;j++){
+      if(i == j || (!s->out && j < i))
+	continue;
+      if(cIGraph_esu_edge(s->out ? s->out : s->adj, w->sub[i], w->sub[j]))
+	code |= 1L << b;
+      b++;
+    }
+  }
+  return s->table[code];
+
+}
+
+static void cIGraph_esu_extend(cIGraph_esu_worker_t *w, int d,
+			       const int *ext, long int next){
+
+  cIGraph_esu_shared_t *s = w->s;
+  cIGraph_csr_t *adj = s->adj;
+  int *child = w->ext + d * w->stride;
+  long int i, j, p, nc;
+  int u, x;
+
+  for(i=0;i<next;i++){
+
+    if(s->cutting && cIGraph_rng_unif(&w->rng) < s->cut[d])
+      continue;
+
+    u = ext[i];
+    w->sub[d] = u;
+
+    if(d+1 == s->size){
+      w->hist[cIGraph_esu_class(w)]++;
+      continue;
+    }
+
+    //The rest of this level's candidates plus the exclusive neighbours of u
+    nc = 0;
+    for(j=i+1;j<next;j++)
+      child[nc++] = ext[j];
+    for(p=adj->offset[u];p<adj->offset[u+1];p++){
+      x = adj->nbr[p];
+      if(x > w->root && !w->insub[x] && w->cover[x] == 0)
+	child[nc++] = x;
+    }
+
+    w->insub[u] = 1;
+    for(p=adj->offset[u];p<adj->offset[u+1];p++)
+      w->cover[adj->nbr[p]]++;
+
+    cIGraph_esu_extend(w, d+1, child, nc);
+
+    w->insub[u] = 0;
+    for(p=adj->offset[u];p<adj->offset[u+1];p++)
+      w->cover[adj->nbr[p]]--;
+
+  }
+
+}
+
+//Counts every subgraph whose smallest vertex is root into w->hist
+static void cIGraph_esu_root(cIGraph_esu_worker_t *w, int root){
+
+  cIGraph_esu_shared_t *s = w->s;
+  cIGraph_csr_t *adj = s->adj;
+  long int p, n0 = 0;
+
+  if(s->cutting){
+    cIGraph_rng_seed(&w->rng, s->seed, root);
+    if(cIGraph_rng_unif(&w->rng) < s->cut[0])
+      return;
+  }
+
+  w->root   = root;
+  w->sub[0] = root;
+  w->insub[root] = 1;
+  for(p=adj->offset[root];p<adj->offset[root+1];p++){
+    w->cover[adj->nbr[p]]++;
+    if(adj->nbr[p] > root)
+      w->ext[n0++] = adj->nbr[p];
+  }
+
+  cIGraph_esu_extend(w, 1, w->ext, n0);
+
+  w->insub[root] = 0;
+  for(p=adj->offset[root];p<adj->offset[root+1];p++)
+    w->cover[adj->nbr[p]]--;
+
+}
+
+static void *cIGraph_esu_worker(void *arg){
+
+  cIGraph_esu_worker_t *w = arg;
+  cIGraph_esu_shared_t *s = w->s;
+  long int start, end, r;
+
+  while(!cIGraph_interrupted() && (start = __sync_fetch_and_add(&s->next, CIGRAPH_MOTIF_CHUNK)) < s->nroots){
+    end = start + CIGRAPH_MOTIF_CHUNK < s->nroots ? start + CIGRAPH_MOTIF_CHUNK : s->nroots;
+    for(r=start;r<end;r++)
+      cIGraph_esu_root(w, s->roots ? s->roots[r] : (int)r);
+  }
+
+  return NULL;
+
+}
+
+static int cIGraph_esu_worker_init(cIGraph_esu_worker_t *w, cIGraph_esu_shared_t *s){
+
+  long int i, d, maxd = 0;
+
+  for(i=0;i<s->adj->n;i++){
+    d = s->adj->offset[i+1] - s->adj->offset[i];
+    if(d > maxd)
+      maxd = d;
+  }
+
+  w->s      = s;
+  w->stride = s->size * maxd + 1;
+  w->hist   = calloc(s->nclass, sizeof(unsigned long long));
+  w->ext    = malloc(sizeof(int) * w->stride * s->size);
+  w->insub  = calloc(s->adj->n+1, 1);
+  w->cover  = calloc(s->adj->n+1, sizeof(int));
+
+  return w->hist && w->ext && w->insub && w->cover;
+
+}
+
+static void cIGraph_esu_worker_destroy(cIGraph_esu_worker_t *w){
+  free(w->hist);
+  free(w->ext);
+  free(w->insub);
+  free(w->cover);
+}
+
+typedef struct {
+  cIGraph_esu_shared_t *s;
+  unsigned long long *hist;
+  int nthreads;
+  int failed;
+} cIGraph_esu_job_t;
+
+static void *cIGraph_esu_run(void *arg){
+
+  cIGraph_esu_job_t *job = arg;
+  cIGraph_esu_worker_t *workers;
+  int i, c;
+
+  workers = calloc(job->nthreads, sizeof(cIGraph_esu_worker_t));
+  if(!workers){
+    job->failed = 1;
+    return NULL;
+  }
+
+  for(i=0;i<job->nthreads;i++){
+    if(!cIGraph_esu_worker_init(&workers[i], job->s))
+      job->failed = 1;
+  }
+
+  if(!job->failed){
+    cIGraph_parallel(cIGraph_esu_worker, workers, sizeof(cIGraph_esu_worker_t), job->nthreads);
+    for(i=0;i<job->nthreads;i++)
+      for(c=0;c<job->s->nclass;c++)
+	job->hist[c] += workers[i].hist[c];
+  }
+
+  for(i=0;i<job->nthreads;i++)
+    cIGraph_esu_worker_destroy(&workers[i]);
+  free(workers);
+
+  return NULL;
+
+}
+
+/* Checks the arguments common to the RAND-ESU methods and fills in s,
+ * building the adjacency lists in adj and out. Free them again with
+ * cIGraph_motif_destroy.
  */
-VALUE cIGraph_motifs_randesu(VALUE self, VALUE size, VALUE cuts){
+static void cIGraph_motif_init(VALUE self, VALUE size, VALUE cuts, VALUE seed,
+			       cIGraph_esu_shared_t *s,
+			       cIGraph_csr_t *adj, cIGraph_csr_t *out){
 
   igraph_t *graph;
-  igraph_vector_t cutsv;
-  igraph_vector_t res;
-  int i;
-  VALUE hist = rb_ary_new();
+  int i, directed;
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  igraph_vector_init(&res,0);
+  memset(s,0,sizeof(cIGraph_esu_shared_t));
 
-  //Convert an array of vertices to a vector of vertex ids
-  igraph_vector_init(&cutsv,0);
-  for(i=0;i<RARRAY_LEN(cuts);i++){
-    igraph_vector_push_back(&cutsv,NUM2DBL(RARRAY_PTR(cuts)[i]));
+  s->size  = NUM2INT(size);
+  directed = igraph_is_directed(graph) ? 1 : 0;
+
+  if(s->size != 3 && s->size != 4)
+    rb_raise(cIGraphError, "Only 3 and 4 vertex motifs are implemented\n");
+
+  Check_Type(cuts, T_ARRAY);
+  if(RARRAY_LEN(cuts) != s->size)
+    rb_raise(cIGraphError, "Cut probability vector size must agree with motif size\n");
+  for(i=0;i<s->size;i++){
+    s->cut[i] = NUM2DBL(RARRAY_PTR(cuts)[i]);
+    if(s->cut[i] > 0)
+      s->cutting = 1;
   }
+  if(s->cutting)
+    s->seed = cIGraph_rng_seed_value(seed);
 
-  igraph_motifs_randesu(graph,&res,NUM2INT(size),&cutsv);
+  if(cIGraph_motif_table(s->size, directed, &s->table, &s->nclass))
+    rb_raise(cIGraphError, "Error building isoclass table\n");
+  s->nroots = (long int)igraph_vcount(graph);
 
-  for(i=0; i<igraph_vector_size(&res); i++){
-    rb_ary_push(hist,INT2NUM(VECTOR(res)[i]));
+  cIGraph_csr_init(graph,adj,IGRAPH_ALL,1);
+  if(directed){
+    IGRAPH_FINALLY(cIGraph_csr_destroy, adj);
+    cIGraph_csr_init(graph,out,IGRAPH_OUT,1);
+    IGRAPH_FINALLY_CLEAN(1);
   }
 
-  igraph_vector_destroy(&cutsv);
-  igraph_vector_destroy(&res);
- 
-  return hist;
+  s->adj = adj;
+  s->out = directed ? out : NULL;
+
+}
+
+static void cIGraph_motif_destroy(cIGraph_esu_shared_t *s){
+  cIGraph_csr_destroy(s->adj);
+  if(s->out)
+    cIGraph_csr_destroy(s->out);
+}
+
+/* Runs RAND-ESU over the whole graph and returns the histogram of isoclass
+ * counts, which the caller must free. *nclass is set to its length.
+ */
+static unsigned long long *cIGraph_motif_count(VALUE self, VALUE size, VALUE cuts,
+					       VALUE seed, int *nclass){
+
+  cIGraph_csr_t adj, out;
+  cIGraph_esu_shared_t s;
+  cIGraph_esu_job_t job;
+
+  cIGraph_motif_init(self, size, cuts, seed, &s, &adj, &out);
+
+  memset(&job,0,sizeof(job));
+  job.s        = &s;
+  job.nthreads = cIGraph_thread_count();
+  job.hist     = calloc(s.nclass, sizeof(unsigned long long));
+  if(!job.hist){
+    cIGraph_motif_destroy(&s);
+    rb_raise(rb_eNoMemError, "Error allocating motif counts");
+  }
+
+  cIGraph_without_gvl(cIGraph_esu_run, &job);
+
+  cIGraph_motif_destroy(&s);
+
+  if(job.failed){
+    free(job.hist);
+    rb_raise(rb_eNoMemError, "Error allocating motif search buffers");
+  }
+
+  *nclass = s.nclass;
+  return job.hist;
 
 }
 
 /* call-seq:
- *   igraph.motifs_randesu_no(size,cut)
+ *   igraph.motifs_randesu(size,cut,seed=nil) -> Array
  *
+ * Counts the motifs of size vertices (3 or 4) in the graph with the
+ * RAND-ESU algorithm and returns an Array holding the number found in
+ * each isoclass (see IGraph#isoclass). cut is an Array of size
+ * probabilities for cutting the search tree at each level; all zeros gives
+ * exact counts. seed seeds the cuts; pass nil to take one from Kernel#rand.
+ *
+ * Root vertices are shared out between IGraph.threads threads and the
+ * global VM lock is released while counting.
  */
-VALUE cIGraph_motifs_randesu_no(VALUE self, VALUE size, VALUE cuts){
+VALUE cIGraph_motifs_randesu(int argc, VALUE *argv, VALUE self){
 
-  igraph_t *graph;
-  igraph_vector_t cutsv;
-  igraph_integer_t res;
-  int i;
+  VALUE size, cuts, seed;
+  VALUE hist = rb_ary_new();
+  unsigned long long *res;
+  int i, nclass;
 
-  Data_Get_Struct(self, igraph_t, graph);
+  rb_scan_args(argc,argv,"21", &size, &cuts, &seed);
 
-  //Convert an array of vertices to a vector of vertex ids
-  igraph_vector_init(&cutsv,0);
-  for(i=0;i<RARRAY_LEN(cuts);i++){
-    igraph_vector_push_back(&cutsv,NUM2DBL(RARRAY_PTR(cuts)[i]));
+  res = cIGraph_motif_count(self, size, cuts, seed, &nclass);
+
+  for(i=0;i<nclass;i++){
+    rb_ary_push(hist,ULL2NUM(res[i]));
   }
 
-  igraph_motifs_randesu_no(graph,&res,NUM2INT(size),&cutsv);
+  free(res);
 
-  igraph_vector_destroy(&cutsv);
- 
-  return INT2NUM(res);
+  return hist;
+
+}
+
+/* call-seq:
+ *   igraph.motifs_randesu_no(size,cut,seed=nil) -> Integer
+ *
+ * Returns the total number of motifs of size vertices found by RAND-ESU,
+ * that is the sum of IGraph#motifs_randesu. The arguments are the same.
+ */
+VALUE cIGraph_motifs_randesu_no(int argc, VALUE *argv, VALUE self){
+
+  VALUE size, cuts, seed;
+  unsigned long long *res, total = 0;
+  int i, nclass;
+
+  rb_scan_args(argc,argv,"21", &size, &cuts, &seed);
+
+  res = cIGraph_motif_count(self, size, cuts, seed, &nclass);
+
+  for(i=0;i<nclass;i++)
+    total += res[i];
+
+  free(res);
+
+  return ULL2NUM(total);
 
 }
 
@@ -107,3 +512,234 @@ VALUE cIGraph_motifs_randesu_estimate(VALUE self, VALUE size, VALUE cuts,
   return INT2NUM(res);
 
 }
+
+static double cIGraph_motif_clock(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//Running sums of the per root counts of one worker
+typedef struct {
+  cIGraph_esu_worker_t esu;
+  double *sum;
+  double *sumsq;
+  long int k;
+  double deadline;           //0 for none
+} cIGraph_esu_sampler_t;
+
+static void *cIGraph_esu_sample_worker(void *arg){
+
+  cIGraph_esu_sampler_t *w = arg;
+  cIGraph_esu_shared_t *s = w->esu.s;
+  long int r;
+  double h;
+  int c;
+
+  while(!cIGraph_interrupted() && (r = __sync_fetch_and_add(&s->next, 1)) < s->nroots){
+    if(w->deadline > 0 && cIGraph_motif_clock() > w->deadline)
+      break;
+    cIGraph_esu_root(&w->esu, s->roots[r]);
+    for(c=0;c<s->nclass;c++){
+      h = (double)w->esu.hist[c];
+      w->sum[c]   += h;
+      w->sumsq[c] += h * h;
+      w->esu.hist[c] = 0;
+    }
+    w->k++;
+  }
+
+  return NULL;
+
+}
+
+typedef struct {
+  cIGraph_esu_shared_t *s;
+  int *perm;                 //Roots in sampling order
+  double budget;             //Seconds, 0 for none
+  double error;              //Target relative error, 0 for none
+  double *est;
+  double *se;
+  long int k;
+  int nthreads;
+  int failed;
+} cIGraph_esu_adaptive_t;
+
+static void *cIGraph_esu_adaptive_run(void *arg){
+
+  cIGraph_esu_adaptive_t *job = arg;
+  cIGraph_esu_shared_t *s = job->s;
+  cIGraph_esu_sampler_t *workers;
+  long int n = s->adj->n, end = 0, round;
+  double deadline = 0, s1, s2, var;
+  int i, c, done;
+
+  workers = calloc(job->nthreads, sizeof(cIGraph_esu_sampler_t));
+  if(!workers){
+    job->failed = 1;
+    return NULL;
+  }
+
+  if(job->budget > 0)
+    deadline = cIGraph_motif_clock() + job->budget;
+
+  for(i=0;i<job->nthreads;i++){
+    workers[i].sum      = calloc(s->nclass, sizeof(double));
+    workers[i].sumsq    = calloc(s->nclass, sizeof(double));
+    workers[i].deadline = deadline;
+    if(!cIGraph_esu_worker_init(&workers[i].esu, s) ||
+       !workers[i].sum || !workers[i].sumsq)
+      job->failed = 1;
+  }
+
+  s->roots = job->perm;
+
+  while(!job->failed && end < n && !cIGraph_interrupted()){
+
+    //Rounds grow with the sample so the checks between them stay cheap
+    round = end / 2 > 16 * job->nthreads ? end / 2 : 16 * job->nthreads;
+    s->next   = end;
+    s->nroots = end + round < n ? end + round : n;
+    end = s->nroots;
+
+    cIGraph_parallel(cIGraph_esu_sample_worker, workers, sizeof(cIGraph_esu_sampler_t), job->nthreads);
+
+    job->k = 0;
+    for(i=0;i<job->nthreads;i++)
+      job->k += workers[i].k;
+
+    done = job->k > 0;
+    for(c=0;c<s->nclass;c++){
+      s1 = s2 = 0;
+      for(i=0;i<job->nthreads;i++){
+	s1 += workers[i].sum[c];
+	s2 += workers[i].sumsq[c];
+      }
+      job->est[c] = job->k > 0 ? n * s1 / job->k : 0;
+      job->se[c]  = 0;
+      if(job->k > 1 && job->k < n){
+	var = (s2 - s1 * s1 / job->k) / (job->k - 1);
+	if(var > 0)
+	  job->se[c] = n * sqrt(var / job->k * (1.0 - (double)job->k / n));
+      }
+      if(job->est[c] > 0 && job->se[c] > job->error * job->est[c])
+	done = 0;
+    }
+
+    if(deadline > 0 && cIGraph_motif_clock() >= deadline)
+      break;
+    if(job->error > 0 && done && job->k >= CIGRAPH_MOTIF_MIN_SAMPLES)
+      break;
+
+  }
+
+  for(i=0;i<job->nthreads;i++){
+    cIGraph_esu_worker_destroy(&workers[i].esu);
+    free(workers[i].sum);
+    free(workers[i].sumsq);
+  }
+  free(workers);
+
+  return NULL;
+
+}
+
+/* call-seq:
+ *   igraph.motifs_randesu_adaptive(size,cut,time,error,seed=nil) -> Array
+ *
+ * Estimates the motif counts returned by IGraph#motifs_randesu by running
+ * the search from randomly chosen root vertices until time seconds have
+ * passed or the standard error of every class found is at most error
+ * times its estimate. Either of time and error may be nil but not both.
+ * The sample is drawn without replacement, so if it reaches every vertex
+ * the counts are exact. seed seeds the sample and the cuts; pass nil to
+ * take one from Kernel#rand.
+ *
+ * Returns [estimates, lower, upper, samples]: Arrays holding the estimated
+ * count of each isoclass and the bounds of an approximate 95% confidence
+ * interval for it, and the number of root vertices searched.
+ *
+ * Roots are searched on IGraph.threads threads with the global VM lock
+ * released. The clock is checked between roots.
+ */
+VALUE cIGraph_motifs_randesu_adaptive(int argc, VALUE *argv, VALUE self){
+
+  VALUE size, cuts, time, error, seed;
+  VALUE est = rb_ary_new();
+  VALUE lower = rb_ary_new();
+  VALUE upper = rb_ary_new();
+  VALUE result = rb_ary_new();
+  cIGraph_csr_t adj, out;
+  cIGraph_esu_shared_t s;
+  cIGraph_esu_adaptive_t job;
+  cIGraph_rng_t rng;
+  long int n, i, j;
+  int c, t;
+
+  rb_scan_args(argc,argv,"41", &size, &cuts, &time, &error, &seed);
+
+  if(NIL_P(time) && NIL_P(error))
+    rb_raise(cIGraphError, "A time budget or a target error is needed\n");
+
+  memset(&job,0,sizeof(job));
+  job.budget   = NIL_P(time)  ? 0 : NUM2DBL(time);
+  job.error    = NIL_P(error) ? 0 : NUM2DBL(error);
+  job.nthreads = cIGraph_thread_count();
+
+  cIGraph_motif_init(self, size, cuts, seed, &s, &adj, &out);
+  if(!s.cutting)
+    s.seed = cIGraph_rng_seed_value(seed);
+
+  n = s.nroots;
+  job.s    = &s;
+  job.perm = malloc(sizeof(int) * (n+1));
+  job.est  = calloc(s.nclass, sizeof(double));
+  job.se   = calloc(s.nclass, sizeof(double));
+  if(!job.perm || !job.est || !job.se){
+    free(job.perm);
+    free(job.est);
+    free(job.se);
+    cIGraph_motif_destroy(&s);
+    rb_raise(rb_eNoMemError, "Error allocating motif estimates");
+  }
+
+  //Stream -1 keeps the shuffle apart from the per root cut streams
+  cIGraph_rng_seed(&rng, s.seed, -1);
+  for(i=0;i<n;i++)
+    job.perm[i] = (int)i;
+  for(i=n-1;i>0;i--){
+    j = cIGraph_rng_integer(&rng, i+1);
+    t = job.perm[i];
+    job.perm[i] = job.perm[j];
+    job.perm[j] = t;
+  }
+
+  cIGraph_without_gvl(cIGraph_esu_adaptive_run, &job);
+
+  cIGraph_motif_destroy(&s);
+  free(job.perm);
+
+  if(job.failed){
+    free(job.est);
+    free(job.se);
+    rb_raise(rb_eNoMemError, "Error allocating motif search buffers");
+  }
+
+  for(c=0;c<s.nclass;c++){
+    rb_ary_push(est,rb_float_new(job.est[c]));
+    rb_ary_push(lower,rb_float_new(job.est[c] - 1.96 * job.se[c] > 0 ?
+				   job.est[c] - 1.96 * job.se[c] : 0));
+    rb_ary_push(upper,rb_float_new(job.est[c] + 1.96 * job.se[c]));
+  }
+
+  free(job.est);
+  free(job.se);
+
+  rb_ary_push(result,est);
+  rb_ary_push(result,lower);
+  rb_ary_push(result,upper);
+  rb_ary_push(result,LONG2NUM(job.k));
+
+  return result;
+
+}
@@ -53,7 +53,7 @@ VALUE cIGraph_simplify(VALUE self, VALUE mult, VALUE loops){
 
   Data_Get_Struct(self, igraph_t, graph);
 
-  igraph_simplify(graph,m,l);
+  cIGraph_log_replace(graph,CIGRAPH_LOG_SIMPLIFY,NULL,m | (l << 1));
 
   return Qnil;
 
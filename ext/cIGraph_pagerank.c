@@ -0,0 +1,339 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+//Classes
+VALUE cIGraphPageRank;
+
+typedef struct {
+  VALUE graph;           //Graph the ranks belong to
+  VALUE vertices;        //Vertex Array the ranks were indexed by
+  long int n;
+  double *rank;
+  igraph_bool_t directed;
+  long int niter;
+  double eps;
+  double damping;
+  long int iterations;   //Iterations taken by the last calculation
+  unsigned long generation;
+} cIGraph_pagerank_t;
+
+void cIGraph_pagerank_mark(void *p){
+  cIGraph_pagerank_t *pr = p;
+  rb_gc_mark(pr->graph);
+  rb_gc_mark(pr->vertices);
+}
+
+void cIGraph_pagerank_free(void *p){
+  cIGraph_pagerank_t *pr = p;
+  xfree(pr->rank);
+  xfree(pr);
+}
+
+/* Power iteration starting from whatever is in rank. Each step pulls rank
+ * along the in-edges, spreads the rank held by dangling vertices evenly and
+ * adds the teleport term. Stops when no vertex moves by more than eps or
+ * after niter steps and returns the number of steps taken. share is
+ * scratch space for n doubles.
+ */
+static long int cIGraph_pagerank_iterate(cIGraph_csr_t *in, long int *outdeg,
+					 double *rank, double *share,
+					 double damping, double eps,
+					 long int niter){
+
+  long int n = in->n;
+  long int i, j, it;
+  double dangling, base, sum, pulled, old, maxdiff;
+
+  for(it=0;it<niter;it++){
+
+    //Share of each vertex passed along each of its out-edges
+    dangling = 0;
+    for(i=0;i<n;i++){
+      if(outdeg[i] == 0){
+	dangling += rank[i];
+	share[i] = 0;
+      } else {
+	share[i] = rank[i] / outdeg[i];
+      }
+    }
+
+    base    = ((1 - damping) + damping * dangling) / n;
+    sum     = 0;
+    maxdiff = 0;
+
+    for(i=0;i<n;i++){
+      pulled = 0;
+      for(j=in->offset[i];j<in->offset[i+1];j++)
+	pulled += share[in->nbr[j]];
+      old     = rank[i];
+      rank[i] = base + damping * pulled;
+      if(fabs(rank[i] - old) > maxdiff)
+	maxdiff = fabs(rank[i] - old);
+      sum += rank[i];
+    }
+
+    //Only corrects rounding drift, the update itself preserves the total
+    for(i=0;i<n;i++)
+      rank[i] /= sum;
+
+    if(maxdiff < eps)
+      return it+1;
+
+  }
+
+  return niter;
+
+}
+
+/* Runs the power iteration on the graph for the ranks currently held in
+ * pr. Any vertex without a rank is expected to have been seeded by the
+ * caller.
+ */
+static int cIGraph_pagerank_run(cIGraph_pagerank_t *pr, igraph_t *graph){
+
+  cIGraph_csr_t in;
+  cIGraph_csr_t out;
+  long int *outdeg;
+  double *share;
+  long int i;
+
+  pr->iterations = 0;
+  if(pr->n == 0)
+    return IGRAPH_SUCCESS;
+
+  IGRAPH_CHECK(cIGraph_csr_init(graph,&in,pr->directed ? IGRAPH_IN : IGRAPH_ALL,0));
+  IGRAPH_FINALLY(cIGraph_csr_destroy,&in);
+  IGRAPH_CHECK(cIGraph_csr_init(graph,&out,pr->directed ? IGRAPH_OUT : IGRAPH_ALL,0));
+  IGRAPH_FINALLY(cIGraph_csr_destroy,&out);
+
+  outdeg = malloc(sizeof(long int) * pr->n);
+  share  = malloc(sizeof(double) * pr->n);
+  if(!outdeg || !share){
+    free(outdeg);
+    free(share);
+    IGRAPH_ERROR("Error allocating PageRank vectors\n", IGRAPH_ENOMEM);
+  }
+  for(i=0;i<pr->n;i++)
+    outdeg[i] = out.offset[i+1] - out.offset[i];
+
+  cIGraph_csr_destroy(&out);
+
+  pr->iterations = cIGraph_pagerank_iterate(&in,outdeg,pr->rank,share,
+					    pr->damping,pr->eps,pr->niter);
+
+  free(outdeg);
+  free(share);
+  cIGraph_csr_destroy(&in);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  return IGRAPH_SUCCESS;
+
+}
+
+/* call-seq:
+ *   graph.pagerank_tracker(directed,niter,eps,damping) -> IGraphPageRank
+ *
+ * Calculates the PageRank of every vertex in the graph and returns the
+ * result as an IGraphPageRank object which stays bound to the graph. After
+ * the graph has been changed (e.g. with IGraph#add_edges) call
+ * IGraphPageRank#refresh to bring the ranks up to date. The refresh starts
+ * the power iteration from the previous ranks so it usually converges in
+ * a small fraction of the iterations needed here.
+ *
+ * directed is a boolean saying whether to follow edge directions, niter
+ * is the maximum number of iterations, eps the largest change in any rank
+ * that still counts as converged and damping the damping factor.
+ *
+ * Example:
+ *
+ *   pr = g.pagerank_tracker(true,1000,0.00001,0.85)
+ *   pr.iterations          # iterations for the cold start
+ *   g.add_edges(['A','B'])
+ *   pr.refresh             # far fewer iterations
+ *   pr['B']
+ */
+VALUE cIGraph_pagerank_tracker(VALUE self, VALUE directed, VALUE niter, VALUE eps, VALUE damping){
+
+  igraph_t *graph;
+  cIGraph_pagerank_t *pr;
+  VALUE obj;
+  long int i;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  pr = ALLOC(cIGraph_pagerank_t);
+  pr->graph      = self;
+  pr->vertices   = ((VALUE*)graph->attr)[0];
+  pr->n          = (long int)igraph_vcount(graph);
+  pr->rank       = ALLOC_N(double, pr->n + 1);
+  pr->directed   = directed == Qtrue ? 1 : 0;
+  pr->niter      = NUM2INT(niter);
+  pr->eps        = NUM2DBL(eps);
+  pr->damping    = NUM2DBL(damping);
+  pr->iterations = 0;
+  pr->generation = cIGraph_generation(graph);
+
+  obj = Data_Wrap_Struct(cIGraphPageRank, cIGraph_pagerank_mark, cIGraph_pagerank_free, pr);
+
+  for(i=0;i<pr->n;i++)
+    pr->rank[i] = 1.0 / pr->n;
+
+  if(cIGraph_pagerank_run(pr,graph))
+    rb_raise(rb_eNoMemError, "Error allocating PageRank vectors");
+
+  return obj;
+
+}
+
+/* call-seq:
+ *   pagerank.refresh -> Integer
+ *
+ * Brings the ranks up to date with the graph and returns the number of
+ * iterations this took (0 if the graph has not changed). The previous ranks
+ * are used as the starting point. Vertices added since the last calculation
+ * start from 1/n.
+ */
+VALUE cIGraph_pagerank_refresh(VALUE self){
+
+  cIGraph_pagerank_t *pr;
+  igraph_t *graph;
+  VALUE vertices;
+  VALUE old_ids = Qnil;
+  VALUE idx;
+  double *rank;
+  double sum = 0;
+  long int n, i;
+
+  Data_Get_Struct(self, cIGraph_pagerank_t, pr);
+  Data_Get_Struct(pr->graph, igraph_t, graph);
+
+  if(pr->generation == cIGraph_generation(graph)){
+    pr->iterations = 0;
+    return INT2NUM(0);
+  }
+
+  vertices = ((VALUE*)graph->attr)[0];
+  n        = (long int)igraph_vcount(graph);
+  rank     = ALLOC_N(double, n + 1);
+
+  //Adding vertices only appends to the vertex Array, so the old ids are
+  //still valid. Anything else (deletions, conversions) gets a new Array and
+  //the old ranks have to be matched up by vertex object.
+  if(vertices != pr->vertices){
+    old_ids = rb_hash_new();
+    for(i=0;i<pr->n;i++)
+      rb_hash_aset(old_ids,rb_ary_entry(pr->vertices,i),LONG2NUM(i));
+  }
+
+  for(i=0;i<n;i++){
+    if(old_ids == Qnil){
+      rank[i] = i < pr->n ? pr->rank[i] : 1.0 / n;
+    } else {
+      idx = rb_hash_aref(old_ids,rb_ary_entry(vertices,i));
+      rank[i] = idx == Qnil ? 1.0 / n : pr->rank[NUM2LONG(idx)];
+    }
+    sum += rank[i];
+  }
+  for(i=0;i<n;i++)
+    rank[i] /= sum;
+
+  xfree(pr->rank);
+  pr->rank       = rank;
+  pr->n          = n;
+  pr->vertices   = vertices;
+
+  //Left stale if the run fails, so the next refresh tries again
+  if(cIGraph_pagerank_run(pr,graph))
+    rb_raise(rb_eNoMemError, "Error allocating PageRank vectors");
+  pr->generation = cIGraph_generation(graph);
+
+  return LONG2NUM(pr->iterations);
+
+}
+
+/* call-seq:
+ *   pagerank.iterations -> Integer
+ *
+ * Returns the number of power iterations taken by the last calculation
+ * (the initial one, or the last IGraphPageRank#refresh).
+ */
+VALUE cIGraph_pagerank_iterations(VALUE self){
+
+  cIGraph_pagerank_t *pr;
+
+  Data_Get_Struct(self, cIGraph_pagerank_t, pr);
+  return LONG2NUM(pr->iterations);
+
+}
+
+/* call-seq:
+ *   pagerank.stale? -> true/false
+ *
+ * Returns true if the graph has changed since the ranks were calculated.
+ */
+VALUE cIGraph_pagerank_stale(VALUE self){
+
+  cIGraph_pagerank_t *pr;
+  igraph_t *graph;
+
+  Data_Get_Struct(self, cIGraph_pagerank_t, pr);
+  Data_Get_Struct(pr->graph, igraph_t, graph);
+
+  return pr->generation == cIGraph_generation(graph) ? Qfalse : Qtrue;
+
+}
+
+/* call-seq:
+ *   pagerank.graph -> IGraph
+ *
+ * Returns the graph the ranks belong to.
+ */
+VALUE cIGraph_pagerank_graph(VALUE self){
+
+  cIGraph_pagerank_t *pr;
+
+  Data_Get_Struct(self, cIGraph_pagerank_t, pr);
+  return pr->graph;
+
+}
+
+/* call-seq:
+ *   pagerank[v] -> Float
+ *
+ * Returns the rank of vertex v as of the last calculation.
+ */
+VALUE cIGraph_pagerank_get(VALUE self, VALUE v){
+
+  cIGraph_pagerank_t *pr;
+  VALUE idx;
+
+  Data_Get_Struct(self, cIGraph_pagerank_t, pr);
+
+  idx = rb_funcall(pr->vertices,rb_intern("index"),1,v);
+  if(idx == Qnil || NUM2LONG(idx) >= pr->n)
+    rb_raise(cIGraphError, "Unable to find vertex\n");
+
+  return rb_float_new(pr->rank[NUM2LONG(idx)]);
+
+}
+
+/* call-seq:
+ *   pagerank.to_a -> Array
+ *
+ * Returns the ranks of all vertices in vertex order (see IGraph#vertices).
+ */
+VALUE cIGraph_pagerank_toa(VALUE self){
+
+  cIGraph_pagerank_t *pr;
+  VALUE a = rb_ary_new();
+  long int i;
+
+  Data_Get_Struct(self, cIGraph_pagerank_t, pr);
+
+  for(i=0;i<pr->n;i++)
+    rb_ary_push(a,rb_float_new(pr->rank[i]));
+
+  return a;
+
+}
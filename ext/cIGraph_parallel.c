@@ -0,0 +1,241 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+
+/* Helpers for running the native kernels on several threads. Worker
+ * functions must only touch plain C data: igraph is not thread-safe and
+ * its error handler raises Ruby exceptions, so everything they need is
+ * copied out of the graph (see cIGraph_csr_init) beforehand.
+ *
+ * A kernel run by cIGraph_without_gvl is interrupted (by Ctrl-C,
+ * Thread#kill and so on) through a flag that it and its worker threads
+ * poll with cIGraph_interrupted, stopping early. The interrupt itself is
+ * raised by Ruby once the method has cleaned up and returned, so what the
+ * kernel left behind only has to be safe to free and convert.
+ */
+
+//0 means one thread per online processor
+static int cIGraph_threads = 0;
+
+//Cancel flag of the kernel running on this thread, if any
+static __thread volatile int *cIGraph_cancel = NULL;
+
+int cIGraph_interrupted(void){
+  return cIGraph_cancel && __atomic_load_n(cIGraph_cancel, __ATOMIC_RELAXED);
+}
+
+int cIGraph_thread_count(void){
+
+#ifdef HAVE_PTHREAD_H
+  long int n;
+
+  if(cIGraph_threads > 0)
+    return cIGraph_threads;
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#else
+  return 1;
+#endif
+
+}
+
+#ifdef HAVE_PTHREAD_H
+
+typedef struct {
+  void *(*func)(void *);
+  void *arg;
+  volatile int *cancel;
+} cIGraph_parallel_call_t;
+
+//Hands the cancel flag of the starting thread on to a worker
+static void *cIGraph_parallel_start(void *arg){
+  cIGraph_parallel_call_t *c = arg;
+  cIGraph_cancel = c->cancel;
+  return c->func(c->arg);
+}
+
+#endif
+
+/* Calls func once for each of the nthreads argument blocks in args (each
+ * size bytes long), one thread per block, and waits for them all. If a
+ * thread cannot be started its block is run on the calling thread.
+ */
+void cIGraph_parallel(void *(*func)(void *), void *args, size_t size, int nthreads){
+
+  int i;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_t *threads;
+  cIGraph_parallel_call_t *calls;
+  char *started;
+
+  if(nthreads > 1){
+    threads = malloc(sizeof(pthread_t) * nthreads);
+    calls   = malloc(sizeof(cIGraph_parallel_call_t) * nthreads);
+    started = calloc(nthreads, 1);
+    if(threads && calls && started){
+      for(i=1;i<nthreads;i++){
+	calls[i].func   = func;
+	calls[i].arg    = (char*)args + i*size;
+	calls[i].cancel = cIGraph_cancel;
+	started[i] = pthread_create(&threads[i],NULL,cIGraph_parallel_start,&calls[i]) == 0;
+      }
+      func(args);
+      for(i=1;i<nthreads;i++){
+	if(started[i])
+	  pthread_join(threads[i],NULL);
+	else
+	  func((char*)args + i*size);
+      }
+      free(threads);
+      free(calls);
+      free(started);
+      return;
+    }
+    free(threads);
+    free(calls);
+    free(started);
+  }
+#endif
+
+  for(i=0;i<nthreads;i++)
+    func((char*)args + i*size);
+
+}
+
+typedef struct {
+  void *(*func)(void *);
+  void *data;
+  void (*wake)(void *);
+  volatile int cancel;
+  int ran;
+} cIGraph_gvl_call_t;
+
+static void *cIGraph_gvl_run(void *arg){
+
+  cIGraph_gvl_call_t *c = arg;
+  volatile int *outer = cIGraph_cancel;
+  void *r;
+
+  c->ran = 1;
+  cIGraph_cancel = &c->cancel;
+  r = c->func(c->data);
+  cIGraph_cancel = outer;
+
+  return r;
+
+}
+
+//Unblocking function, called by Ruby to interrupt the kernel
+static void cIGraph_gvl_ubf(void *arg){
+  cIGraph_gvl_call_t *c = arg;
+  __atomic_store_n(&c->cancel, 1, __ATOMIC_RELAXED);
+  if(c->wake)
+    c->wake(c->data);
+}
+
+/* Calls func(data) with the global VM lock released where the interpreter
+ * supports it, so other Ruby threads keep running during long kernels.
+ * func stops early if it polls cIGraph_interrupted. A func that waits on
+ * a condition variable also checks cIGraph_interrupted while waiting, and
+ * wake(data) is called to rouse it.
+ */
+void cIGraph_without_gvl_wait(void *(*func)(void *), void *data, void (*wake)(void *)){
+
+  cIGraph_gvl_call_t c;
+
+  c.func   = func;
+  c.data   = data;
+  c.wake   = wake;
+  c.cancel = 0;
+  c.ran    = 0;
+
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL2)
+  //Leaves the interrupt pending for Ruby to raise once the method returns
+  rb_thread_call_without_gvl2(cIGraph_gvl_run, &c, cIGraph_gvl_ubf, &c);
+  //It skips func if the interrupt came first, but the caller needs its results
+  if(!c.ran){
+    c.cancel = 1;
+    cIGraph_gvl_run(&c);
+  }
+#elif defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+  rb_thread_call_without_gvl(cIGraph_gvl_run, &c, cIGraph_gvl_ubf, &c);
+#else
+  cIGraph_gvl_run(&c);
+#endif
+
+}
+
+void cIGraph_without_gvl(void *(*func)(void *), void *data){
+  cIGraph_without_gvl_wait(func, data, NULL);
+}
+
+/* Small random number streams for the kernels (splitmix64). Each worker
+ * gets its own stream so results do not depend on thread scheduling.
+ */
+void cIGraph_rng_seed(cIGraph_rng_t *rng, unsigned long long seed, int stream){
+  rng->state = seed ^ (0xD1B54A32D192ED03ULL * (unsigned long long)(stream + 1));
+}
+
+unsigned long long cIGraph_rng_next(cIGraph_rng_t *rng){
+  unsigned long long x = (rng->state += 0x9E3779B97F4A7C15ULL);
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+//Uniform on [0,1)
+double cIGraph_rng_unif(cIGraph_rng_t *rng){
+  return (cIGraph_rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//Uniform on 0..n-1
+long int cIGraph_rng_integer(cIGraph_rng_t *rng, long int n){
+  return (long int)(cIGraph_rng_unif(rng) * n);
+}
+
+/* Turns a seed argument into a stream seed. nil draws one from Kernel#rand
+ * so Kernel#srand makes the kernels reproducible too.
+ */
+unsigned long long cIGraph_rng_seed_value(VALUE seed){
+  if(NIL_P(seed))
+    seed = rb_funcall(rb_mKernel, rb_intern("rand"), 1, LL2NUM(1LL << 62));
+  return (unsigned long long)NUM2LL(seed);
+}
+
+/* call-seq:
+ *   IGraph.threads -> Integer
+ *
+ * Returns the number of threads used by the parallel native kernels
+ * (triangle counting, clique enumeration and so on). Defaults to the
+ * number of online processors.
+ */
+VALUE cIGraph_get_threads(VALUE self){
+  return INT2NUM(cIGraph_thread_count());
+}
+
+/* call-seq:
+ *   IGraph.threads = n
+ *
+ * Sets the number of threads used by the parallel native kernels. 0 goes
+ * back to the default of one per online processor.
+ */
+VALUE cIGraph_set_threads(VALUE self, VALUE n){
+
+  if(NUM2INT(n) < 0)
+    rb_raise(rb_eArgError, "Thread count must not be negative");
+
+  cIGraph_threads = NUM2INT(n);
+  return n;
+
+}
@@ -0,0 +1,828 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+/* Native parsers for the edge list, .ncol and .lgl formats, used when
+ * the FileRead readers are given the path of a file instead of an IO.
+ * The file is mapped into memory (or read into a buffer where mmap is
+ * missing) and parsed with the global VM lock released, without going
+ * through a Ruby String.
+ *
+ * The input is cut into one chunk per thread on line boundaries (on '#'
+ * lines for .lgl, so every chunk starts with its own vertex) and each
+ * chunk is parsed into its own buffer. Symbolic names go into a hash map
+ * split into independently locked stripes, and remember where they first
+ * appear so vertex ids can be handed out in order of appearance once all
+ * chunks are done, exactly as a single pass would. The buffers are then
+ * translated to vertex ids straight into the vector given to a single
+ * igraph_add_edges.
+ */
+
+//Smallest chunk worth a thread of its own
+#define CIGRAPH_PARSE_MIN_CHUNK (1 << 20)
+
+//Stripes of the name table, a power of two
+#define CIGRAPH_PARSE_STRIPE_BITS 8
+#define CIGRAPH_PARSE_STRIPES (1 << CIGRAPH_PARSE_STRIPE_BITS)
+
+#define CIGRAPH_PARSE_MAXTOKENS 4
+
+typedef struct {
+  const char *name;
+  long int len;
+  unsigned long long hash;
+  long long first;           //Offset of the first occurrence
+} cIGraph_parse_entry_t;
+
+typedef struct {
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock;
+#endif
+  long int *slots;           //Entry + 1, 0 for an empty slot
+  long int cap;
+  cIGraph_parse_entry_t *entries;
+  long int count;
+  long int entrycap;
+  int *ids;                  //Vertex id of each entry, once numbered
+} cIGraph_parse_stripe_t;
+
+struct cIGraph_parse_s;
+
+typedef struct {
+  struct cIGraph_parse_s *p;
+  const char *start;
+  const char *end;
+  int *ids;                  //Vertices, two per edge. For the symbolic
+                             //formats these are handles into the name
+                             //table until merged.
+  double *weight;
+  long int nids;
+  long int idcap;
+  long int max;              //Largest vertex id of an edge list
+  long int lines;
+  long int line;             //Line of an error, within the chunk
+  const char *error;
+  int failed;
+  long int off;              //Position of ids in the merged edges
+  igraph_real_t *out;
+} cIGraph_parse_chunk_t;
+
+typedef struct cIGraph_parse_s {
+  int format;
+  cIGraph_map_t map;
+  const char *data;
+  size_t len;
+  char *predef;              //Copies of the predefined names
+  cIGraph_parse_stripe_t *stripes;
+  cIGraph_parse_chunk_t *chunks;
+  int nchunks;
+  long int nids;
+  long int nvertices;
+  long int line;             //Line of an error
+  const char *error;
+  int failed;
+} cIGraph_parse_t;
+
+//FNV-1a
+static unsigned long long cIGraph_parse_hash(const char *s, long int len){
+  unsigned long long h = 14695981039346656037ULL;
+  long int i;
+  for(i=0;i<len;i++){
+    h ^= (unsigned char)s[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+//Makes room for one more entry in st
+static int cIGraph_parse_grow(cIGraph_parse_stripe_t *st){
+
+  cIGraph_parse_entry_t *entries;
+  long int *slots, cap, i, j;
+
+  if(st->count == st->entrycap){
+    j = st->entrycap ? st->entrycap * 2 : 64;
+    entries = realloc(st->entries, sizeof(cIGraph_parse_entry_t) * j);
+    if(!entries)
+      return 0;
+    st->entries  = entries;
+    st->entrycap = j;
+  }
+
+  //Kept at most half full
+  if(2*(st->count+1) <= st->cap)
+    return 1;
+
+  cap   = st->cap ? st->cap * 2 : 128;
+  slots = calloc(cap, sizeof(long int));
+  if(!slots)
+    return 0;
+  for(j=0;j<st->count;j++){
+    for(i=(st->entries[j].hash>>CIGRAPH_PARSE_STRIPE_BITS)&(cap-1);slots[i];i=(i+1)&(cap-1));
+    slots[i] = j + 1;
+  }
+  free(st->slots);
+  st->slots = slots;
+  st->cap   = cap;
+
+  return 1;
+
+}
+
+/* Returns the handle of the vertex called s, adding it if it is new, or
+ * -1 if out of memory. first is where s was seen, the earliest of which
+ * decides the vertex id.
+ */
+static int cIGraph_parse_id(cIGraph_parse_t *p, const char *s, long int len, long long first){
+
+  unsigned long long h = cIGraph_parse_hash(s, len);
+  cIGraph_parse_stripe_t *st = &p->stripes[h & (CIGRAPH_PARSE_STRIPES-1)];
+  cIGraph_parse_entry_t *e;
+  long int i, handle = -1;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_lock(&st->lock);
+#endif
+
+  if(st->cap > 0){
+    for(i=(h>>CIGRAPH_PARSE_STRIPE_BITS)&(st->cap-1);st->slots[i];i=(i+1)&(st->cap-1)){
+      e = &st->entries[st->slots[i]-1];
+      if(e->hash == h && e->len == len && memcmp(e->name, s, len) == 0){
+	if(first < e->first)
+	  e->first = first;
+	handle = (st->slots[i]-1) << CIGRAPH_PARSE_STRIPE_BITS | (h & (CIGRAPH_PARSE_STRIPES-1));
+	break;
+      }
+    }
+  }
+
+  if(handle < 0 && st->count < (INT_MAX >> CIGRAPH_PARSE_STRIPE_BITS) &&
+     cIGraph_parse_grow(st)){
+    for(i=(h>>CIGRAPH_PARSE_STRIPE_BITS)&(st->cap-1);st->slots[i];i=(i+1)&(st->cap-1));
+    e = &st->entries[st->count];
+    e->name  = s;
+    e->len   = len;
+    e->hash  = h;
+    e->first = first;
+    st->slots[i] = ++st->count;
+    handle = (st->count-1) << CIGRAPH_PARSE_STRIPE_BITS | (h & (CIGRAPH_PARSE_STRIPES-1));
+  }
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock(&st->lock);
+#endif
+
+  return (int)handle;
+
+}
+
+static int cIGraph_parse_push(cIGraph_parse_chunk_t *c, int id){
+
+  int *ids;
+  double *weight;
+  long int cap;
+
+  if(c->nids == c->idcap){
+    cap = c->idcap ? c->idcap * 2 : 4096;
+    ids = realloc(c->ids, sizeof(int) * cap);
+    if(!ids)
+      return 0;
+    c->ids = ids;
+    if(c->p->format != CIGRAPH_FORMAT_EDGELIST){
+      weight = realloc(c->weight, sizeof(double) * (cap / 2));
+      if(!weight)
+	return 0;
+      c->weight = weight;
+    }
+    c->idcap = cap;
+  }
+  c->ids[c->nids++] = id;
+
+  return 1;
+
+}
+
+static int cIGraph_parse_edge(cIGraph_parse_chunk_t *c, int from, int to, double w){
+  if(!cIGraph_parse_push(c, from) || !cIGraph_parse_push(c, to))
+    return 0;
+  c->weight[c->nids/2-1] = w;
+  return 1;
+}
+
+static int cIGraph_parse_int(const char *s, long int len, int *res){
+
+  long int i;
+  long long x = 0;
+
+  if(len == 0)
+    return 0;
+  for(i=0;i<len;i++){
+    if(s[i] < '0' || s[i] > '9')
+      return 0;
+    x = x*10 + (s[i] - '0');
+    if(x > INT_MAX)
+      return 0;
+  }
+  *res = (int)x;
+
+  return 1;
+
+}
+
+static int cIGraph_parse_double(const char *s, long int len, double *res){
+
+  char buf[64], *end;
+
+  if(len == 0 || len >= (long int)sizeof(buf))
+    return 0;
+  memcpy(buf, s, len);
+  buf[len] = 0;
+  *res = strtod(buf, &end);
+
+  return end == buf + len;
+
+}
+
+#define CIGRAPH_PARSE_ID(c,tok,len) \
+  cIGraph_parse_id((c)->p, (tok), (len), (long long)((tok) - (c)->p->data))
+
+//Parses one chunk line by line, run by cIGraph_parallel
+static void *cIGraph_parse_chunk(void *arg){
+
+  cIGraph_parse_chunk_t *c = arg;
+  const char *s = c->start, *end = c->end;
+  const char *tok[CIGRAPH_PARSE_MAXTOKENS];
+  long int toklen[CIGRAPH_PARSE_MAXTOKENS];
+  int ntok, from, to, cur = -1, i;
+  double w;
+
+  c->max = -1;
+
+  for(c->line=1;s<end;c->line++){
+
+    //Split the line into whitespace separated tokens
+    ntok = 0;
+    while(s < end && *s != '\n'){
+      if(*s == ' ' || *s == '\t' || *s == '\r' || *s == '\f' || *s == '\v'){
+	s++;
+	continue;
+      }
+      if(ntok == CIGRAPH_PARSE_MAXTOKENS){
+	c->error = "too many fields";
+	return NULL;
+      }
+      tok[ntok] = s;
+      while(s < end && *s != '\n' && *s != ' ' && *s != '\t' && *s != '\r' &&
+	    *s != '\f' && *s != '\v')
+	s++;
+      toklen[ntok] = s - tok[ntok];
+      ntok++;
+    }
+    if(s < end)
+      s++;
+
+    switch(c->p->format){
+
+    case CIGRAPH_FORMAT_EDGELIST:
+      //Any number of ids on a line, pairs may span lines (and chunks)
+      for(i=0;i<ntok;i++){
+	if(!cIGraph_parse_int(tok[i], toklen[i], &to)){
+	  c->error = "vertex ids must be non-negative integers";
+	  return NULL;
+	}
+	if(to > c->max)
+	  c->max = to;
+	if(!cIGraph_parse_push(c, to)){
+	  c->failed = 1;
+	  return NULL;
+	}
+      }
+      break;
+
+    case CIGRAPH_FORMAT_NCOL:
+      if(ntok == 0)
+	break;
+      if(ntok > 3){
+	c->error = "too many fields";
+	return NULL;
+      }
+      if(ntok < 2){
+	c->error = "an edge needs two vertices";
+	return NULL;
+      }
+      w = 0;
+      if(ntok == 3 && !cIGraph_parse_double(tok[2], toklen[2], &w)){
+	c->error = "invalid weight";
+	return NULL;
+      }
+      if((from = CIGRAPH_PARSE_ID(c, tok[0], toklen[0])) < 0 ||
+	 (to = CIGRAPH_PARSE_ID(c, tok[1], toklen[1])) < 0 ||
+	 !cIGraph_parse_edge(c, from, to, w)){
+	c->failed = 1;
+	return NULL;
+      }
+      break;
+
+    case CIGRAPH_FORMAT_LGL:
+      if(ntok == 0)
+	break;
+      //'# name' starts the edges of name
+      if(tok[0][0] == '#'){
+	if(toklen[0] > 1){
+	  tok[0]++;
+	  toklen[0]--;
+	} else if(ntok > 1){
+	  tok[0]    = tok[1];
+	  toklen[0] = toklen[1];
+	  ntok--;
+	} else {
+	  c->error = "missing vertex name";
+	  return NULL;
+	}
+	if(ntok > 1){
+	  c->error = "too many fields";
+	  return NULL;
+	}
+	if((cur = CIGRAPH_PARSE_ID(c, tok[0], toklen[0])) < 0){
+	  c->failed = 1;
+	  return NULL;
+	}
+	break;
+      }
+      if(cur < 0){
+	c->error = "edge before the first '#' line";
+	return NULL;
+      }
+      if(ntok > 2){
+	c->error = "too many fields";
+	return NULL;
+      }
+      w = 0;
+      if(ntok == 2 && !cIGraph_parse_double(tok[1], toklen[1], &w)){
+	c->error = "invalid weight";
+	return NULL;
+      }
+      if((to = CIGRAPH_PARSE_ID(c, tok[0], toklen[0])) < 0 ||
+	 !cIGraph_parse_edge(c, cur, to, w)){
+	c->failed = 1;
+	return NULL;
+      }
+      break;
+
+    }
+  }
+
+  c->lines = c->line - 1;
+
+  return NULL;
+
+}
+
+/* The start of the first line after pos a chunk may start at, or the end
+ * of the input if there is none.
+ */
+static const char *cIGraph_parse_boundary(cIGraph_parse_t *p, const char *pos){
+
+  const char *end = p->data + p->len, *s;
+
+  for(;;){
+    pos = memchr(pos, '\n', end - pos);
+    if(!pos)
+      return end;
+    pos++;
+    if(p->format != CIGRAPH_FORMAT_LGL)
+      return pos;
+    for(s=pos;s<end && (*s == ' ' || *s == '\t');s++);
+    if(s < end && *s == '#')
+      return pos;
+  }
+
+}
+
+static int cIGraph_parse_cmp(const void *a, const void *b){
+  long long x = ((const long long*)a)[0], y = ((const long long*)b)[0];
+  return x < y ? -1 : x > y;
+}
+
+/* Numbers the names in order of first appearance. Returns 0 if out of
+ * memory.
+ */
+static int cIGraph_parse_number(cIGraph_parse_t *p){
+
+  cIGraph_parse_stripe_t *st;
+  long long *order;
+  long int i, j, n = 0;
+
+  for(i=0;i<CIGRAPH_PARSE_STRIPES;i++)
+    n += p->stripes[i].count;
+
+  //Pairs of first occurrence and handle
+  order = malloc(sizeof(long long) * 2 * (n > 0 ? n : 1));
+  if(!order)
+    return 0;
+  for(n=0,i=0;i<CIGRAPH_PARSE_STRIPES;i++){
+    st = &p->stripes[i];
+    st->ids = malloc(sizeof(int) * (st->count > 0 ? st->count : 1));
+    if(!st->ids){
+      free(order);
+      return 0;
+    }
+    for(j=0;j<st->count;j++){
+      order[2*n]   = st->entries[j].first;
+      order[2*n+1] = j << CIGRAPH_PARSE_STRIPE_BITS | i;
+      n++;
+    }
+  }
+  qsort(order, n, sizeof(long long) * 2, cIGraph_parse_cmp);
+  for(i=0;i<n;i++){
+    j = (long int)order[2*i+1];
+    p->stripes[j & (CIGRAPH_PARSE_STRIPES-1)].ids[j >> CIGRAPH_PARSE_STRIPE_BITS] = (int)i;
+  }
+  free(order);
+
+  p->nvertices = n;
+
+  return 1;
+
+}
+
+//Parses the whole input, meant for cIGraph_without_gvl
+static void *cIGraph_parse_run(void *arg){
+
+  cIGraph_parse_t *p = arg;
+  cIGraph_parse_chunk_t *c;
+  const char *s = p->data, *end = p->data + p->len;
+  long int lines = 0, max = -1;
+  int i;
+
+  for(i=0;i<p->nchunks;i++){
+    p->chunks[i].p     = p;
+    p->chunks[i].start = s;
+    if(i == p->nchunks - 1 || end - s <= (long int)(p->len / p->nchunks))
+      s = end;
+    else
+      s = cIGraph_parse_boundary(p, s + p->len / p->nchunks);
+    p->chunks[i].end = s;
+  }
+
+  cIGraph_parallel(cIGraph_parse_chunk, p->chunks, sizeof(cIGraph_parse_chunk_t), p->nchunks);
+
+  //Report the first error in the file
+  for(i=0;i<p->nchunks;i++){
+    c = &p->chunks[i];
+    if(c->failed){
+      p->failed = 1;
+      return NULL;
+    }
+    if(c->error){
+      p->error = c->error;
+      p->line  = lines + c->line;
+      return NULL;
+    }
+    c->off   = p->nids;
+    p->nids += c->nids;
+    lines   += c->lines;
+    if(c->max > max)
+      max = c->max;
+  }
+
+  if(p->format == CIGRAPH_FORMAT_EDGELIST){
+    if(p->nids % 2){
+      p->error = "odd number of vertex ids";
+      p->line  = lines;
+      return NULL;
+    }
+    p->nvertices = max + 1;
+  } else if(!cIGraph_parse_number(p)){
+    p->failed = 1;
+  }
+
+  return NULL;
+
+}
+
+//Copies a chunk's vertex ids into the edge vector, run by cIGraph_parallel
+static void *cIGraph_parse_merge(void *arg){
+
+  cIGraph_parse_chunk_t *c = arg;
+  cIGraph_parse_stripe_t *stripes = c->p->stripes;
+  long int i;
+  int h;
+
+  if(c->p->format == CIGRAPH_FORMAT_EDGELIST){
+    for(i=0;i<c->nids;i++)
+      c->out[c->off+i] = c->ids[i];
+  } else {
+    for(i=0;i<c->nids;i++){
+      h = c->ids[i];
+      c->out[c->off+i] = stripes[h & (CIGRAPH_PARSE_STRIPES-1)].ids[h >> CIGRAPH_PARSE_STRIPE_BITS];
+    }
+  }
+
+  return NULL;
+
+}
+
+static void *cIGraph_parse_merge_all(void *arg){
+  cIGraph_parse_t *p = arg;
+  cIGraph_parallel(cIGraph_parse_merge, p->chunks, sizeof(cIGraph_parse_chunk_t), p->nchunks);
+  return NULL;
+}
+
+//Maps the file at path into memory, or reads it into a buffer
+static int cIGraph_map_raw(const char *path, cIGraph_map_t *map){
+
+  struct stat st;
+  int fd, err = 0;
+  char *buf;
+  ssize_t r;
+  size_t got = 0;
+
+  memset(map, 0, sizeof(cIGraph_map_t));
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return errno;
+  if(fstat(fd, &st) < 0){
+    err = errno;
+    close(fd);
+    return err;
+  }
+
+  map->len = (size_t)st.st_size;
+  if(map->len == 0){
+    close(fd);
+    return 0;
+  }
+
+#ifdef HAVE_SYS_MMAN_H
+  buf = mmap(NULL, map->len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(buf != MAP_FAILED){
+#ifdef MADV_SEQUENTIAL
+    madvise(buf, map->len, MADV_SEQUENTIAL);
+#endif
+    close(fd);
+    map->data   = buf;
+    map->mapped = 1;
+    return 0;
+  }
+#endif
+
+  buf = malloc(map->len);
+  if(!buf){
+    close(fd);
+    return ENOMEM;
+  }
+  while(got < map->len){
+    r = read(fd, buf + got, map->len - got);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r <= 0){
+      err = r < 0 ? errno : EIO;
+      free(buf);
+      close(fd);
+      return err;
+    }
+    got += r;
+  }
+  close(fd);
+  map->data = buf;
+
+  return 0;
+
+}
+
+/* Maps the file at path into memory, or reads it into a buffer where
+ * mmap is not available. gzip files are inflated into a buffer instead.
+ * Returns an errno value on failure, or -1 if a gzip file is corrupt.
+ */
+int cIGraph_map_file(const char *path, cIGraph_map_t *map){
+
+  cIGraph_map_t raw;
+  int err;
+
+  if((err = cIGraph_map_raw(path, &raw)) != 0){
+    memset(map, 0, sizeof(cIGraph_map_t));
+    return err;
+  }
+  if(!CIGRAPH_GZIP_P(raw.data, raw.len)){
+    *map = raw;
+    return 0;
+  }
+
+  err = cIGraph_gunzip(raw.data, raw.len, map);
+  cIGraph_unmap_file(&raw);
+
+  return err;
+
+}
+
+void cIGraph_unmap_file(cIGraph_map_t *map){
+#ifdef HAVE_SYS_MMAN_H
+  if(map->mapped)
+    munmap((void*)map->data, map->len);
+  else
+#endif
+    free((void*)map->data);
+  map->data = NULL;
+}
+
+static VALUE cIGraph_parse_release(VALUE arg){
+
+  cIGraph_parse_t *p = (cIGraph_parse_t*)arg;
+  int i;
+
+  cIGraph_unmap_file(&p->map);
+  free(p->predef);
+  if(p->stripes){
+    for(i=0;i<CIGRAPH_PARSE_STRIPES;i++){
+#ifdef HAVE_PTHREAD_H
+      pthread_mutex_destroy(&p->stripes[i].lock);
+#endif
+      free(p->stripes[i].slots);
+      free(p->stripes[i].entries);
+      free(p->stripes[i].ids);
+    }
+    free(p->stripes);
+  }
+  if(p->chunks){
+    for(i=0;i<p->nchunks;i++){
+      free(p->chunks[i].ids);
+      free(p->chunks[i].weight);
+    }
+    free(p->chunks);
+  }
+
+  return Qnil;
+
+}
+
+typedef struct {
+  cIGraph_parse_t *p;
+  VALUE path;
+  VALUE predefnames;
+  int names;
+  int weights;
+  int directed;
+} cIGraph_parse_job_t;
+
+static VALUE cIGraph_parse_build(VALUE arg){
+
+  cIGraph_parse_job_t *job = (cIGraph_parse_job_t*)arg;
+  cIGraph_parse_t *p = job->p;
+  cIGraph_parse_stripe_t *st;
+  VALUE new_graph, v_ary, e_ary, str;
+  igraph_t *graph;
+  igraph_vector_t edges;
+  igraph_vector_ptr_t v_attr, e_attr;
+  igraph_i_attribute_record_t v_rec, e_rec;
+  long int i, j, n, size = 0;
+  int err;
+  char *c;
+
+  if((err = cIGraph_map_file(StringValueCStr(job->path), &p->map)) < 0)
+    rb_raise(cIGraphError, "%s: Invalid gzip input", StringValueCStr(job->path));
+  if(err)
+    rb_syserr_fail_str(err, job->path);
+  p->data = p->map.data;
+  p->len  = p->map.len;
+
+  n = (long int)(p->len / CIGRAPH_PARSE_MIN_CHUNK) + 1;
+  p->nchunks = cIGraph_thread_count() < n ? cIGraph_thread_count() : (int)n;
+  p->chunks  = calloc(p->nchunks, sizeof(cIGraph_parse_chunk_t));
+  if(!p->chunks)
+    rb_raise(rb_eNoMemError, "Error allocating parser");
+
+  if(p->format != CIGRAPH_FORMAT_EDGELIST){
+    p->stripes = calloc(CIGRAPH_PARSE_STRIPES, sizeof(cIGraph_parse_stripe_t));
+    if(!p->stripes)
+      rb_raise(rb_eNoMemError, "Error allocating parser");
+#ifdef HAVE_PTHREAD_H
+    for(i=0;i<CIGRAPH_PARSE_STRIPES;i++)
+      pthread_mutex_init(&p->stripes[i].lock, NULL);
+#endif
+
+    //Predefined names come first, copied as the Strings could change
+    n = NIL_P(job->predefnames) ? 0 : RARRAY_LEN(job->predefnames);
+    for(i=0;i<n;i++){
+      str   = rb_ary_entry(job->predefnames, i);
+      size += RSTRING_LEN(StringValue(str));
+    }
+    if(n > 0){
+      p->predef = malloc(size + 1);
+      if(!p->predef)
+	rb_raise(rb_eNoMemError, "Error allocating parser");
+      for(c=p->predef,i=0;i<n;i++){
+	str = rb_ary_entry(job->predefnames, i);
+	memcpy(c, RSTRING_PTR(str), RSTRING_LEN(str));
+	if(cIGraph_parse_id(p, c, RSTRING_LEN(str), (long long)(i - n)) < 0)
+	  rb_raise(rb_eNoMemError, "Error allocating parser");
+	c += RSTRING_LEN(str);
+      }
+    }
+  }
+
+  cIGraph_without_gvl(cIGraph_parse_run, p);
+
+  if(p->failed)
+    rb_raise(rb_eNoMemError, "Error allocating parser");
+  if(p->error)
+    rb_raise(cIGraphError, "%s:%ld: %s", RSTRING_PTR(job->path), p->line, p->error);
+
+  igraph_vector_init(&edges, p->nids);
+  for(i=0;i<p->nchunks;i++)
+    p->chunks[i].out = VECTOR(edges);
+  cIGraph_without_gvl(cIGraph_parse_merge_all, p);
+
+  new_graph = cIGraph_alloc(cIGraph);
+  Data_Get_Struct(new_graph, igraph_t, graph);
+  igraph_destroy(graph);
+  igraph_empty(graph, 0, job->directed);
+
+  v_ary = rb_ary_new2(p->nvertices);
+  if(job->names && p->format != CIGRAPH_FORMAT_EDGELIST){
+    for(i=0;i<p->nvertices;i++)
+      rb_ary_push(v_ary, Qnil);
+    for(i=0;i<CIGRAPH_PARSE_STRIPES;i++){
+      st = &p->stripes[i];
+      for(j=0;j<st->count;j++)
+	rb_ary_store(v_ary, st->ids[j], rb_str_new(st->entries[j].name, st->entries[j].len));
+    }
+  } else {
+    for(i=0;i<p->nvertices;i++)
+      rb_ary_push(v_ary, INT2NUM(i));
+  }
+  e_ary = rb_ary_new2(p->nids / 2);
+  if(p->format == CIGRAPH_FORMAT_EDGELIST){
+    //A pair can span two chunks, so only the total is even
+    for(i=0;i<p->nids/2;i++)
+      rb_ary_push(e_ary, Qnil);
+  } else {
+    for(i=0;i<p->nchunks;i++){
+      for(j=0;j<p->chunks[i].nids/2;j++)
+	rb_ary_push(e_ary, job->weights ? rb_float_new(p->chunks[i].weight[j]) : Qnil);
+    }
+  }
+
+  v_rec.name  = "__RUBY__";
+  v_rec.type  = IGRAPH_ATTRIBUTE_PY_OBJECT;
+  v_rec.value = (void*)v_ary;
+  e_rec.name  = "__RUBY__";
+  e_rec.type  = IGRAPH_ATTRIBUTE_PY_OBJECT;
+  e_rec.value = (void*)e_ary;
+
+  igraph_vector_ptr_init(&v_attr, 0);
+  igraph_vector_ptr_init(&e_attr, 0);
+  igraph_vector_ptr_push_back(&v_attr, &v_rec);
+  igraph_vector_ptr_push_back(&e_attr, &e_rec);
+
+  igraph_add_vertices(graph, p->nvertices, &v_attr);
+  if(p->nids > 0)
+    igraph_add_edges(graph, &edges, &e_attr);
+
+  igraph_vector_destroy(&edges);
+  igraph_vector_ptr_destroy(&v_attr);
+  igraph_vector_ptr_destroy(&e_attr);
+
+  return new_graph;
+
+}
+
+/* Reads a graph in format (CIGRAPH_FORMAT_EDGELIST, _NCOL or _LGL) from
+ * the file at path. For the symbolic formats the vertices are the names
+ * if names is set (vertex ids otherwise, numbered in order of appearance
+ * after predefnames) and the edges their weights if weights is set.
+ */
+VALUE cIGraph_parse_file(VALUE path, int format, VALUE predefnames, int names, int weights, int directed){
+
+  cIGraph_parse_t p;
+  cIGraph_parse_job_t job;
+
+  memset(&p, 0, sizeof(p));
+  p.format = format;
+
+  job.p           = &p;
+  job.path        = path;
+  job.predefnames = predefnames;
+  job.names       = names;
+  job.weights     = weights;
+  job.directed    = directed;
+
+  return rb_ensure(cIGraph_parse_build, (VALUE)&job, cIGraph_parse_release, (VALUE)&p);
+
+}
@@ -247,6 +247,11 @@ VALUE cIGraph_average_path_length(VALUE self, VALUE directed, VALUE unconn){
  * otherwise the number of vertices is used for the length of non-existing 
  * geodesics. (The rationale behind this is that this is always longer than 
  * the longest possible diamter in a graph.)
+ *
+ * When edge directions do not matter (an undirected graph, or directed
+ * false) and every geodesic is finite or unconn is true, the path is found
+ * with a few breadth first searches (see IGraph#eccentricity) instead of
+ * one from every vertex.
  */
 VALUE cIGraph_diameter(VALUE self, VALUE directed, VALUE unconn){
 
@@ -254,6 +259,7 @@ VALUE cIGraph_diameter(VALUE self, VALUE directed, VALUE unconn){
   igraph_bool_t directed_b = 0;
   igraph_bool_t unconn_b   = 0;
   igraph_vector_t res;
+  igraph_bool_t connected = 0;
   int i;
   VALUE path = rb_ary_new();
 
@@ -264,6 +270,13 @@ VALUE cIGraph_diameter(VALUE self, VALUE directed, VALUE unconn){
   
   Data_Get_Struct(self, igraph_t, graph);
 
+  if(!directed_b || !igraph_is_directed(graph)){
+    if(!unconn_b)
+      igraph_is_connected(graph,&connected,IGRAPH_WEAK);
+    if(unconn_b || connected)
+      return cIGraph_diameter_path(self);
+  }
+
   //vector to hold the results of the calculations
   igraph_vector_init(&res,0);
 
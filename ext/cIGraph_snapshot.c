@@ -0,0 +1,792 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "ruby/encoding.h"
+#include "cIGraph.h"
+
+#include <limits.h>
+#include <string.h>
+
+/* Binary snapshots of whole graphs, for loading large graphs quickly.
+ *
+ * A snapshot holds igraph's own indexed edge lists (the from, to, oi, ii,
+ * os and is vectors of igraph_t: the edge endpoints, the edges sorted by
+ * source and by target, and where each vertex starts in those orders) so
+ * loading is a copy out of the mapped file rather than a rebuild. They
+ * are followed by the vertex objects, the edge objects and the graph
+ * attribute Hash, each stored as a column: packed doubles, integers or
+ * UTF-8 Strings when every element has that type, Marshal otherwise.
+ *
+ * The header carries a version and a checksum of everything after it, and
+ * the vectors are range checked, so stale or damaged snapshots are
+ * rejected before any of them reaches igraph.
+ *
+ *   header   64 bytes, see cIGraph_snapshot_header_t
+ *   from, to, oi, ii   m doubles each
+ *   os, is             n+1 doubles each
+ *   vertices, edges, graph attributes   columns
+ *
+ * A column is its type, the number of objects and the length of its
+ * payload in bytes (all 64 bit), then the payload padded to 8 bytes. The
+ * objects need not be one per vertex or edge: edges added without any
+ * have none. A String column's payload is count+1 64 bit offsets into the
+ * bytes that follow them.
+ */
+
+#define CIGRAPH_SNAPSHOT_VERSION 1
+
+//Bytes per checksum block, so the checksum can be split between threads
+#define CIGRAPH_SNAPSHOT_BLOCK (1 << 16)
+
+#define CIGRAPH_COLUMN_NIL     0
+#define CIGRAPH_COLUMN_FLOAT64 1
+#define CIGRAPH_COLUMN_INT64   2
+#define CIGRAPH_COLUMN_STRING  3
+#define CIGRAPH_COLUMN_MARSHAL 4
+
+#define CIGRAPH_SNAPSHOT_PAD(x) (((x) + 7) & ~(size_t)7)
+
+static const char cIGraph_snapshot_magic[8] = {'I','G','R','A','P','H','S','N'};
+
+typedef struct {
+  char magic[8];
+  unsigned int version;
+  unsigned int directed;
+  unsigned long long order;       //Tells the byte order apart
+  unsigned long long n;
+  unsigned long long m;
+  unsigned long long size;        //Of the whole file
+  unsigned long long checksum;    //Of everything after the header
+  unsigned long long reserved;
+} cIGraph_snapshot_header_t;
+
+#define CIGRAPH_SNAPSHOT_ORDER 0x0102030405060708ULL
+
+typedef struct {
+  const char *data;               //Start of the body
+  size_t len;
+  unsigned long long *sums;       //One per block
+  const igraph_real_t *vec[6];    //from, to, oi, ii, os, is
+  igraph_real_t *out[6];          //Where they are copied to on loading
+  long int n;
+  long int m;
+  int nthreads;
+  int thread;
+  int bad;
+} cIGraph_snapshot_job_t;
+
+static unsigned long long cIGraph_snapshot_mix(unsigned long long x){
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+//Checksum of one block of len bytes, a multiple of 8
+static unsigned long long cIGraph_snapshot_block(const char *data, size_t len){
+
+  unsigned long long a = 1, b = 2, c = 3, d = 4, w[4];
+  size_t i, n = len / 8;
+
+  //Four independent lanes keep the multiplier busy
+  for(i=0;i+4<=n;i+=4){
+    memcpy(w, data + 8*i, 32);
+    a = (a ^ w[0]) * 0x9E3779B97F4A7C15ULL;
+    b = (b ^ w[1]) * 0x9E3779B97F4A7C15ULL;
+    c = (c ^ w[2]) * 0x9E3779B97F4A7C15ULL;
+    d = (d ^ w[3]) * 0x9E3779B97F4A7C15ULL;
+    a ^= a >> 29;
+    b ^= b >> 29;
+    c ^= c >> 29;
+    d ^= d >> 29;
+  }
+  for(;i<n;i++){
+    memcpy(w, data + 8*i, 8);
+    a = (a ^ w[0]) * 0x9E3779B97F4A7C15ULL;
+    a ^= a >> 29;
+  }
+
+  return cIGraph_snapshot_mix(a ^ cIGraph_snapshot_mix(b ^ cIGraph_snapshot_mix(c ^ cIGraph_snapshot_mix(d ^ len))));
+
+}
+
+//Checksums (and on loading checks and copies) a share of the snapshot
+static void *cIGraph_snapshot_worker(void *arg){
+
+  cIGraph_snapshot_job_t *job = arg;
+  long int nblocks = (long int)((job->len + CIGRAPH_SNAPSHOT_BLOCK - 1) / CIGRAPH_SNAPSHOT_BLOCK);
+  long int b, b0, b1, i, i0, i1, k, len;
+  const igraph_real_t *v;
+
+  b0 = nblocks * job->thread / job->nthreads;
+  b1 = nblocks * (job->thread + 1) / job->nthreads;
+  for(b=b0;b<b1;b++){
+    len = (long int)job->len - b * CIGRAPH_SNAPSHOT_BLOCK;
+    if(len > CIGRAPH_SNAPSHOT_BLOCK)
+      len = CIGRAPH_SNAPSHOT_BLOCK;
+    job->sums[b] = cIGraph_snapshot_block(job->data + b * CIGRAPH_SNAPSHOT_BLOCK, len);
+  }
+
+  if(!job->out[0])
+    return NULL;
+
+  //Endpoints and sorted edge ids must be in range...
+  i0 = job->m * job->thread / job->nthreads;
+  i1 = job->m * (job->thread + 1) / job->nthreads;
+  for(k=0;k<4;k++){
+    v = job->vec[k];
+    for(i=i0;i<i1;i++){
+      if(!(v[i] >= 0 && v[i] < (k < 2 ? job->n : job->m)) || v[i] != (long int)v[i])
+	job->bad = 1;
+    }
+    memcpy(job->out[k] + i0, v + i0, sizeof(igraph_real_t) * (i1 - i0));
+  }
+
+  //...and the vertex starts rise to m
+  i0 = (job->n + 1) * job->thread / job->nthreads;
+  i1 = (job->n + 1) * (job->thread + 1) / job->nthreads;
+  for(k=4;k<6;k++){
+    v = job->vec[k];
+    for(i=i0;i<i1;i++){
+      if(!(v[i] >= 0 && v[i] <= job->m) || (i > 0 && v[i] < v[i-1]) ||
+	 (i == 0 && v[i] != 0) || (i == job->n && v[i] != job->m))
+	job->bad = 1;
+    }
+    memcpy(job->out[k] + i0, v + i0, sizeof(igraph_real_t) * (i1 - i0));
+  }
+
+  return NULL;
+
+}
+
+static void *cIGraph_snapshot_run(void *arg){
+
+  cIGraph_snapshot_job_t *jobs = arg;
+  cIGraph_parallel(cIGraph_snapshot_worker, jobs, sizeof(cIGraph_snapshot_job_t), jobs[0].nthreads);
+
+  return NULL;
+
+}
+
+/* Runs the workers over the body of a snapshot and returns its checksum.
+ * If job->out is set the vectors are checked and copied too, and *bad set
+ * if any of them is out of range.
+ */
+static unsigned long long cIGraph_snapshot_sum(cIGraph_snapshot_job_t *job, int *bad){
+
+  cIGraph_snapshot_job_t *jobs;
+  VALUE jobs_str, sums_str;
+  long int nblocks = (long int)((job->len + CIGRAPH_SNAPSHOT_BLOCK - 1) / CIGRAPH_SNAPSHOT_BLOCK);
+  unsigned long long sum = CIGRAPH_SNAPSHOT_VERSION;
+  int i, nthreads = cIGraph_thread_count();
+  long int b;
+
+  jobs_str = rb_str_new(NULL, sizeof(cIGraph_snapshot_job_t) * nthreads);
+  sums_str = rb_str_new(NULL, sizeof(unsigned long long) * (nblocks + 1));
+  jobs     = (cIGraph_snapshot_job_t*)RSTRING_PTR(jobs_str);
+  job->sums     = (unsigned long long*)RSTRING_PTR(sums_str);
+  job->nthreads = nthreads;
+  for(i=0;i<nthreads;i++){
+    jobs[i] = *job;
+    jobs[i].thread = i;
+  }
+
+  cIGraph_without_gvl(cIGraph_snapshot_run, jobs);
+
+  for(b=0;b<nblocks;b++)
+    sum = cIGraph_snapshot_mix(sum ^ job->sums[b]) + b;
+  if(bad){
+    *bad = 0;
+    for(i=0;i<nthreads;i++)
+      *bad |= jobs[i].bad;
+  }
+
+  RB_GC_GUARD(jobs_str);
+  RB_GC_GUARD(sums_str);
+
+  return sum;
+
+}
+
+//The type a column of the objects in ary is stored as
+static int cIGraph_snapshot_column_type(VALUE ary){
+
+  long int i, n = RARRAY_LEN(ary);
+  int type = CIGRAPH_COLUMN_NIL, t;
+  VALUE obj;
+
+  for(i=0;i<n;i++){
+    obj = RARRAY_PTR(ary)[i];
+    if(NIL_P(obj))
+      t = CIGRAPH_COLUMN_NIL;
+    else if(TYPE(obj) == T_FLOAT)
+      t = CIGRAPH_COLUMN_FLOAT64;
+    else if(FIXNUM_P(obj))
+      t = CIGRAPH_COLUMN_INT64;
+    else if(TYPE(obj) == T_STRING && rb_enc_get_index(obj) == rb_utf8_encindex())
+      t = CIGRAPH_COLUMN_STRING;
+    else
+      return CIGRAPH_COLUMN_MARSHAL;
+    if(i > 0 && t != type)
+      return CIGRAPH_COLUMN_MARSHAL;
+    type = t;
+  }
+
+  return type;
+
+}
+
+//Bytes taken by the column of obj, including its type and length
+static size_t cIGraph_snapshot_column_size(VALUE obj, int type, VALUE dump){
+
+  long int i, n;
+  size_t size = 0;
+
+  switch(type){
+  case CIGRAPH_COLUMN_FLOAT64:
+  case CIGRAPH_COLUMN_INT64:
+    size = 8 * RARRAY_LEN(obj);
+    break;
+  case CIGRAPH_COLUMN_STRING:
+    n    = RARRAY_LEN(obj);
+    size = 8 * (n + 1);
+    for(i=0;i<n;i++)
+      size += RSTRING_LEN(RARRAY_PTR(obj)[i]);
+    break;
+  case CIGRAPH_COLUMN_MARSHAL:
+    size = RSTRING_LEN(dump);
+    break;
+  }
+
+  return 24 + CIGRAPH_SNAPSHOT_PAD(size);
+
+}
+
+static char *cIGraph_snapshot_write_column(char *c, VALUE obj, int type, VALUE dump){
+
+  unsigned long long head[3], off;
+  long int i, n;
+  char *payload = c + 24, *bytes;
+  double x;
+  long long k;
+  VALUE str;
+
+  n = type == CIGRAPH_COLUMN_MARSHAL ? 0 : RARRAY_LEN(obj);
+
+  switch(type){
+  case CIGRAPH_COLUMN_FLOAT64:
+    for(i=0;i<n;i++){
+      x = RFLOAT_VALUE(RARRAY_PTR(obj)[i]);
+      memcpy(payload + 8*i, &x, 8);
+    }
+    head[2] = 8 * n;
+    break;
+  case CIGRAPH_COLUMN_INT64:
+    for(i=0;i<n;i++){
+      k = FIX2LONG(RARRAY_PTR(obj)[i]);
+      memcpy(payload + 8*i, &k, 8);
+    }
+    head[2] = 8 * n;
+    break;
+  case CIGRAPH_COLUMN_STRING:
+    bytes = payload + 8 * (n + 1);
+    for(off=0,i=0;i<n;i++){
+      str = RARRAY_PTR(obj)[i];
+      memcpy(payload + 8*i, &off, 8);
+      memcpy(bytes + off, RSTRING_PTR(str), RSTRING_LEN(str));
+      off += RSTRING_LEN(str);
+    }
+    memcpy(payload + 8*n, &off, 8);
+    head[2] = 8 * (n + 1) + off;
+    break;
+  case CIGRAPH_COLUMN_MARSHAL:
+    memcpy(payload, RSTRING_PTR(dump), RSTRING_LEN(dump));
+    head[2] = RSTRING_LEN(dump);
+    break;
+  default:
+    head[2] = 0;
+  }
+
+  head[0] = type;
+  head[1] = n;
+  memcpy(c, head, 24);
+  memset(payload + head[2], 0, CIGRAPH_SNAPSHOT_PAD(head[2]) - head[2]);
+
+  return payload + CIGRAPH_SNAPSHOT_PAD(head[2]);
+
+}
+
+/* Reads the column at *pos, an Array (or a Hash if hash is set), and moves
+ * *pos past it. Returns Qundef if it is malformed.
+ */
+static VALUE cIGraph_snapshot_read_column(const char *data, size_t len, size_t *pos, int hash){
+
+  unsigned long long head[3], off[2];
+  const char *payload;
+  long int i, count;
+  double x;
+  long long k;
+  VALUE obj, str;
+
+  if(len - *pos < 24)
+    return Qundef;
+  memcpy(head, data + *pos, 24);
+  if(head[2] > len - *pos - 24 || CIGRAPH_SNAPSHOT_PAD(head[2]) > len - *pos - 24 ||
+     head[1] >= INT_MAX)
+    return Qundef;
+  payload = data + *pos + 24;
+  count   = (long int)head[1];
+  *pos   += 24 + CIGRAPH_SNAPSHOT_PAD(head[2]);
+
+  if(hash && head[0] != CIGRAPH_COLUMN_MARSHAL)
+    return Qundef;
+
+  switch(head[0]){
+  case CIGRAPH_COLUMN_NIL:
+    if(head[2] != 0)
+      return Qundef;
+    obj = rb_ary_new2(count);
+    for(i=0;i<count;i++)
+      rb_ary_push(obj, Qnil);
+    return obj;
+  case CIGRAPH_COLUMN_FLOAT64:
+  case CIGRAPH_COLUMN_INT64:
+    if(head[2] != 8 * head[1])
+      return Qundef;
+    obj = rb_ary_new2(count);
+    for(i=0;i<count;i++){
+      if(head[0] == CIGRAPH_COLUMN_FLOAT64){
+	memcpy(&x, payload + 8*i, 8);
+	rb_ary_push(obj, rb_float_new(x));
+      } else {
+	memcpy(&k, payload + 8*i, 8);
+	rb_ary_push(obj, LL2NUM(k));
+      }
+    }
+    return obj;
+  case CIGRAPH_COLUMN_STRING:
+    if(head[2] < 8 * (head[1] + 1))
+      return Qundef;
+    obj = rb_ary_new2(count);
+    for(i=0;i<count;i++){
+      memcpy(off, payload + 8*i, 16);
+      if(off[0] > off[1] || off[1] > head[2] - 8 * (head[1] + 1))
+	return Qundef;
+      rb_ary_push(obj, rb_enc_str_new(payload + 8 * (count + 1) + off[0], off[1] - off[0], rb_utf8_encoding()));
+    }
+    return obj;
+  case CIGRAPH_COLUMN_MARSHAL:
+    //Marshal does not keep its source alive
+    str = rb_str_new(payload, head[2]);
+    obj = rb_marshal_load(str);
+    RB_GC_GUARD(str);
+    if(TYPE(obj) != (hash ? T_HASH : T_ARRAY))
+      return Qundef;
+    return obj;
+  }
+
+  return Qundef;
+
+}
+
+//Writes the finished snapshot, a String, through cIGraph_stream_write
+static int cIGraph_snapshot_put(FILE *stream, void *arg){
+  VALUE *buf = arg;
+  if(fwrite(RSTRING_PTR(*buf), 1, RSTRING_LEN(*buf), stream) != (size_t)RSTRING_LEN(*buf))
+    return IGRAPH_EFILE;
+  return 0;
+}
+
+/* call-seq:
+ *   graph.write_graph_snapshot(file) -> Integer
+ *
+ * Writes the graph to file (an IO) as a binary snapshot, which
+ * IGraph::FileRead.read_graph_snapshot loads far faster than any of the
+ * text formats can be parsed. The vertex and edge objects and the graph
+ * attributes are kept, as packed columns if they are all Floats, all
+ * Integers or all UTF-8 Strings and through Marshal otherwise. Returns the
+ * size of the snapshot, which is gzip compressed if file is named *.gz.
+ *
+ * Snapshots are meant for caching graphs on the machine that wrote them:
+ * they are only read back by the same version of the format on machines
+ * of the same byte order.
+ */
+VALUE cIGraph_write_graph_snapshot(VALUE self, VALUE file){
+
+  igraph_t *graph;
+  cIGraph_snapshot_header_t head;
+  cIGraph_snapshot_job_t job;
+  VALUE obj[3], dump[3], buf;
+  int type[3], i;
+  size_t size, vec;
+  long int n, m;
+  char *c;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  n = (long int)igraph_vcount(graph);
+  m = (long int)igraph_ecount(graph);
+
+  obj[0] = ((VALUE*)graph->attr)[0];
+  obj[1] = ((VALUE*)graph->attr)[1];
+  obj[2] = ((VALUE*)graph->attr)[2];
+  type[0] = cIGraph_snapshot_column_type(obj[0]);
+  type[1] = cIGraph_snapshot_column_type(obj[1]);
+  type[2] = CIGRAPH_COLUMN_MARSHAL;
+
+  size = sizeof(head);
+  vec  = sizeof(igraph_real_t);
+  size += vec * (4 * m + 2 * (n + 1));
+  for(i=0;i<3;i++){
+    dump[i] = type[i] == CIGRAPH_COLUMN_MARSHAL ? rb_marshal_dump(obj[i], Qnil) : Qnil;
+    size   += cIGraph_snapshot_column_size(obj[i], type[i], dump[i]);
+  }
+
+  buf = rb_str_new(NULL, size);
+  c   = RSTRING_PTR(buf) + sizeof(head);
+
+  memcpy(c, VECTOR(graph->from), vec * m); c += vec * m;
+  memcpy(c, VECTOR(graph->to),   vec * m); c += vec * m;
+  memcpy(c, VECTOR(graph->oi),   vec * m); c += vec * m;
+  memcpy(c, VECTOR(graph->ii),   vec * m); c += vec * m;
+  memcpy(c, VECTOR(graph->os),   vec * (n + 1)); c += vec * (n + 1);
+  memcpy(c, VECTOR(graph->is),   vec * (n + 1)); c += vec * (n + 1);
+  for(i=0;i<3;i++)
+    c = cIGraph_snapshot_write_column(c, obj[i], type[i], dump[i]);
+
+  memset(&job, 0, sizeof(job));
+  job.data = RSTRING_PTR(buf) + sizeof(head);
+  job.len  = size - sizeof(head);
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, cIGraph_snapshot_magic, sizeof(head.magic));
+  head.version  = CIGRAPH_SNAPSHOT_VERSION;
+  head.directed = igraph_is_directed(graph) ? 1 : 0;
+  head.order    = CIGRAPH_SNAPSHOT_ORDER;
+  head.n        = n;
+  head.m        = m;
+  head.size     = size;
+  head.checksum = cIGraph_snapshot_sum(&job, NULL);
+  memcpy(RSTRING_PTR(buf), &head, sizeof(head));
+
+  cIGraph_stream_write(file, cIGraph_snapshot_put, &buf, 1);
+
+  RB_GC_GUARD(dump[0]);
+  RB_GC_GUARD(dump[1]);
+  RB_GC_GUARD(dump[2]);
+  RB_GC_GUARD(buf);
+
+  return LONG2NUM((long int)size);
+
+}
+
+typedef struct {
+  cIGraph_map_t map;
+  VALUE str;
+} cIGraph_snapshot_input_t;
+
+static VALUE cIGraph_snapshot_load(VALUE arg){
+
+  cIGraph_snapshot_input_t *in = (cIGraph_snapshot_input_t*)arg;
+  cIGraph_snapshot_header_t head;
+  cIGraph_snapshot_job_t job;
+  VALUE new_graph, v_ary, e_ary, hsh;
+  igraph_t *graph;
+  size_t pos, vec = sizeof(igraph_real_t);
+  long int n, m;
+  int bad, k;
+  const char *error = NULL;
+
+  if(in->map.len < sizeof(head) ||
+     memcmp(in->map.data, cIGraph_snapshot_magic, sizeof(head.magic)) != 0)
+    rb_raise(cIGraphError, "Not an IGraph snapshot");
+  memcpy(&head, in->map.data, sizeof(head));
+  if(head.order != CIGRAPH_SNAPSHOT_ORDER)
+    rb_raise(cIGraphError, "Snapshot was written on a machine of another byte order");
+  if(head.version != CIGRAPH_SNAPSHOT_VERSION)
+    rb_raise(cIGraphError, "Snapshot version %u is not supported (expected %d)", head.version, CIGRAPH_SNAPSHOT_VERSION);
+  if(head.size != in->map.len)
+    rb_raise(cIGraphError, "Snapshot is %lu bytes, expected %llu", (unsigned long)in->map.len, head.size);
+  if(head.n >= INT_MAX || head.m >= INT_MAX ||
+     vec * (4 * head.m + 2 * (head.n + 1)) > head.size - sizeof(head))
+    rb_raise(cIGraphError, "Corrupt snapshot");
+
+  n = (long int)head.n;
+  m = (long int)head.m;
+
+  memset(&job, 0, sizeof(job));
+  job.data = in->map.data + sizeof(head);
+  job.len  = in->map.len - sizeof(head);
+  job.n    = n;
+  job.m    = m;
+  for(k=0;k<6;k++)
+    job.vec[k] = (const igraph_real_t*)(job.data + vec * (k < 4 ? k * m : 4 * m + (k - 4) * (n + 1)));
+
+  new_graph = cIGraph_alloc(cIGraph);
+  Data_Get_Struct(new_graph, igraph_t, graph);
+  igraph_destroy(graph);
+  igraph_empty(graph, 0, head.directed ? 1 : 0);
+
+  igraph_vector_resize(&graph->from, m);
+  igraph_vector_resize(&graph->to,   m);
+  igraph_vector_resize(&graph->oi,   m);
+  igraph_vector_resize(&graph->ii,   m);
+  igraph_vector_resize(&graph->os,   n + 1);
+  igraph_vector_resize(&graph->is,   n + 1);
+  job.out[0] = VECTOR(graph->from);
+  job.out[1] = VECTOR(graph->to);
+  job.out[2] = VECTOR(graph->oi);
+  job.out[3] = VECTOR(graph->ii);
+  job.out[4] = VECTOR(graph->os);
+  job.out[5] = VECTOR(graph->is);
+
+  //Nothing is unmarshalled before the checksum is known to match
+  pos = sizeof(head) + vec * (4 * m + 2 * (n + 1));
+  if(cIGraph_snapshot_sum(&job, &bad) != head.checksum){
+    error = "Snapshot checksum mismatch";
+  } else {
+    v_ary = cIGraph_snapshot_read_column(in->map.data, in->map.len, &pos, 0);
+    e_ary = v_ary == Qundef ? Qundef : cIGraph_snapshot_read_column(in->map.data, in->map.len, &pos, 0);
+    hsh   = e_ary == Qundef ? Qundef : cIGraph_snapshot_read_column(in->map.data, in->map.len, &pos, 1);
+    if(bad || hsh == Qundef || pos != in->map.len)
+      error = "Corrupt snapshot";
+  }
+
+  //Leave a valid empty graph behind
+  if(error){
+    igraph_destroy(graph);
+    igraph_empty(graph, 0, 1);
+    rb_raise(cIGraphError, "%s", error);
+  }
+
+  graph->n = n;
+  ((VALUE*)graph->attr)[0] = v_ary;
+  ((VALUE*)graph->attr)[1] = e_ary;
+  ((VALUE*)graph->attr)[2] = hsh;
+  cIGraph_touch(graph);
+
+  return new_graph;
+
+}
+
+static VALUE cIGraph_snapshot_release(VALUE arg){
+
+  cIGraph_snapshot_input_t *in = (cIGraph_snapshot_input_t*)arg;
+
+  if(NIL_P(in->str))
+    cIGraph_unmap_file(&in->map);
+
+  return Qnil;
+
+}
+
+/* Loads the snapshot of exactly len bytes at data, which stays with the
+ * caller. Used for the base of mutation logs.
+ */
+VALUE cIGraph_snapshot_read(const char *data, size_t len){
+
+  cIGraph_snapshot_input_t in;
+
+  memset(&in, 0, sizeof(in));
+  in.map.data = data;
+  in.map.len  = len;
+  in.str      = Qtrue;
+
+  return cIGraph_snapshot_load((VALUE)&in);
+
+}
+
+/* call-seq:
+ *   IGraph::FileRead.read_graph_snapshot(file) -> IGraph
+ *
+ * Loads a graph written by IGraph::FileWrite#write_graph_snapshot. file is
+ * the path of the snapshot, which is then mapped into memory, or an IO to
+ * read it from. Compressed snapshots are inflated first. Raises an
+ * IGraphError if the snapshot is of another version of the format or does
+ * not match its checksum.
+ */
+VALUE cIGraph_read_graph_snapshot(VALUE self, VALUE file){
+
+  cIGraph_snapshot_input_t in;
+  VALUE new_graph;
+  int err;
+
+  memset(&in, 0, sizeof(in));
+  in.str = Qnil;
+
+  if(TYPE(file) == T_STRING){
+    if((err = cIGraph_map_file(StringValueCStr(file), &in.map)) < 0)
+      rb_raise(cIGraphError, "%s: Invalid gzip input", StringValueCStr(file));
+    if(err)
+      rb_syserr_fail_str(err, file);
+  } else {
+    in.str = rb_funcall(file, rb_intern("read"), 0);
+    StringValue(in.str);
+    in.map.data = RSTRING_PTR(in.str);
+    in.map.len  = RSTRING_LEN(in.str);
+    if(CIGRAPH_GZIP_P(in.map.data, in.map.len)){
+      if((err = cIGraph_gunzip(RSTRING_PTR(in.str), RSTRING_LEN(in.str), &in.map)) < 0)
+	rb_raise(cIGraphError, "Invalid gzip input");
+      if(err)
+	rb_syserr_fail(err, "reading graph");
+      in.str = Qnil;
+    }
+  }
+
+  new_graph = rb_ensure(cIGraph_snapshot_load, (VALUE)&in, cIGraph_snapshot_release, (VALUE)&in);
+
+  RB_GC_GUARD(in.str);
+
+  return new_graph;
+
+}
+
+/* Marshal support. The dump is a short header, the edges as packed 32 bit
+ * vertex ids and the same three columns as a snapshot. It is much smaller
+ * than a snapshot as igraph's indexes are rebuilt on loading.
+ *
+ *   "IGM", version        4 bytes
+ *   directed              4 bytes
+ *   n, m                  64 bit each
+ *   edges                 2m 32 bit ids, padded to 8 bytes
+ *   vertices, edges, graph attributes   columns
+ */
+
+#define CIGRAPH_DUMP_VERSION 1
+
+static const char cIGraph_dump_magic[3] = {'I','G','M'};
+
+/* call-seq:
+ *   graph._dump(level) -> String
+ *
+ * Used by Marshal.dump. The vertex and edge objects and the graph
+ * attributes are kept along with the edges and directedness.
+ */
+VALUE cIGraph_dump(VALUE self, VALUE level){
+
+  igraph_t *graph;
+  VALUE obj[3], dump[3], buf;
+  int type[3], i;
+  unsigned int directed;
+  unsigned long long count[2];
+  size_t size;
+  long int n, m, e;
+  char *c;
+  int *ids;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  n = (long int)igraph_vcount(graph);
+  m = (long int)igraph_ecount(graph);
+
+  obj[0] = ((VALUE*)graph->attr)[0];
+  obj[1] = ((VALUE*)graph->attr)[1];
+  obj[2] = ((VALUE*)graph->attr)[2];
+  type[0] = cIGraph_snapshot_column_type(obj[0]);
+  type[1] = cIGraph_snapshot_column_type(obj[1]);
+  type[2] = CIGRAPH_COLUMN_MARSHAL;
+
+  size = 24 + CIGRAPH_SNAPSHOT_PAD(sizeof(int) * 2 * m);
+  for(i=0;i<3;i++){
+    dump[i] = type[i] == CIGRAPH_COLUMN_MARSHAL ? rb_marshal_dump(obj[i], Qnil) : Qnil;
+    size   += cIGraph_snapshot_column_size(obj[i], type[i], dump[i]);
+  }
+
+  buf = rb_str_new(NULL, size);
+  c   = RSTRING_PTR(buf);
+
+  directed = igraph_is_directed(graph) ? 1 : 0;
+  count[0] = n;
+  count[1] = m;
+  memcpy(c, cIGraph_dump_magic, 3);
+  c[3] = CIGRAPH_DUMP_VERSION;
+  memcpy(c + 4, &directed, 4);
+  memcpy(c + 8, count, 16);
+  c += 24;
+
+  ids = (int*)c;
+  for(e=0;e<m;e++){
+    ids[2*e]   = (int)VECTOR(graph->from)[e];
+    ids[2*e+1] = (int)VECTOR(graph->to)[e];
+  }
+  memset(c + sizeof(int) * 2 * m, 0, CIGRAPH_SNAPSHOT_PAD(sizeof(int) * 2 * m) - sizeof(int) * 2 * m);
+  c += CIGRAPH_SNAPSHOT_PAD(sizeof(int) * 2 * m);
+
+  for(i=0;i<3;i++)
+    c = cIGraph_snapshot_write_column(c, obj[i], type[i], dump[i]);
+
+  RB_GC_GUARD(dump[0]);
+  RB_GC_GUARD(dump[1]);
+  RB_GC_GUARD(dump[2]);
+
+  return buf;
+
+}
+
+/* call-seq:
+ *   IGraph._load(str) -> IGraph
+ *
+ * Used by Marshal.load to rebuild a graph from IGraph#_dump.
+ */
+VALUE cIGraph_load(VALUE klass, VALUE str){
+
+  VALUE new_graph, v_ary, e_ary, hsh;
+  igraph_t *graph;
+  igraph_vector_t edges;
+  unsigned int directed;
+  unsigned long long count[2];
+  const char *data;
+  size_t len, pos;
+  long int n, m, i;
+  int id;
+
+  StringValue(str);
+  data = RSTRING_PTR(str);
+  len  = RSTRING_LEN(str);
+
+  if(len < 24 || memcmp(data, cIGraph_dump_magic, 3) != 0)
+    rb_raise(rb_eTypeError, "Not a dumped IGraph");
+  if(data[3] != CIGRAPH_DUMP_VERSION)
+    rb_raise(rb_eTypeError, "IGraph dump version %d is not supported (expected %d)", data[3], CIGRAPH_DUMP_VERSION);
+  memcpy(&directed, data + 4, 4);
+  memcpy(count, data + 8, 16);
+  if(count[0] >= INT_MAX || count[1] >= INT_MAX ||
+     CIGRAPH_SNAPSHOT_PAD(sizeof(int) * 2 * count[1]) > len - 24)
+    rb_raise(rb_eTypeError, "Corrupt IGraph dump");
+  n = (long int)count[0];
+  m = (long int)count[1];
+
+  pos   = 24 + CIGRAPH_SNAPSHOT_PAD(sizeof(int) * 2 * m);
+  v_ary = cIGraph_snapshot_read_column(data, len, &pos, 0);
+  e_ary = v_ary == Qundef ? Qundef : cIGraph_snapshot_read_column(data, len, &pos, 0);
+  hsh   = e_ary == Qundef ? Qundef : cIGraph_snapshot_read_column(data, len, &pos, 1);
+  if(hsh == Qundef || pos != len)
+    rb_raise(rb_eTypeError, "Corrupt IGraph dump");
+
+  //The String may have moved while the columns were read
+  data = RSTRING_PTR(str);
+
+  igraph_vector_init(&edges, 2 * m);
+  for(i=0;i<2*m;i++){
+    memcpy(&id, data + 24 + sizeof(int) * i, sizeof(int));
+    if(id < 0 || id >= n){
+      igraph_vector_destroy(&edges);
+      rb_raise(rb_eTypeError, "Corrupt IGraph dump");
+    }
+    VECTOR(edges)[i] = id;
+  }
+
+  new_graph = cIGraph_alloc(klass);
+  Data_Get_Struct(new_graph, igraph_t, graph);
+  igraph_destroy(graph);
+  igraph_create(graph, &edges, n, directed ? 1 : 0);
+  igraph_vector_destroy(&edges);
+
+  ((VALUE*)graph->attr)[0] = v_ary;
+  ((VALUE*)graph->attr)[1] = e_ary;
+  ((VALUE*)graph->attr)[2] = hsh;
+  cIGraph_touch(graph);
+
+  RB_GC_GUARD(str);
+
+  return new_graph;
+
+}
@@ -0,0 +1,380 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+#include <math.h>
+
+/* Several independent runs of the Reichardt and Bornholdt spin glass
+ * community detection on worker threads. igraph_community_spinglass draws
+ * from the global igraph random number generator and reports errors
+ * through the Ruby error handler, so it can only run on the Ruby thread;
+ * this is a native version of its heat bath annealing over the weighted
+ * adjacency lists (see cIGraph_wgraph_init), with a random number stream
+ * per replica.
+ *
+ * The Hamiltonian is
+ *
+ *   H = -sum_{i<j} (A_ij - gamma p_ij) delta(s_i,s_j)
+ *
+ * with p_ij = k_i k_j / 2m (SPINCOMM_UPDATE_CONFIG) or the mean edge
+ * density (SPINCOMM_UPDATE_SIMPLE). A sweep makes one heat bath update
+ * per vertex, picking the new spin of a vertex with probability
+ * proportional to exp(-H/T) given all the others.
+ *
+ * Replicas are either annealed independently from starttemp down to
+ * stoptemp, or, with parallel tempering, held at a ladder of fixed
+ * temperatures spanning the same range and offered neighbouring
+ * configurations to swap every CIGRAPH_SPIN_EXCHANGE sweeps.
+ */
+
+#define CIGRAPH_SPIN_EXCHANGE 10
+
+typedef struct {
+  cIGraph_rng_t rng;
+  int *spin;
+  double *total;          //Degree (config) or vertex count (simple) per spin
+  double *field;          //Scratch: weight from a vertex to each spin
+  double *prob;           //Scratch: heat bath weights
+  double temp;
+  double energy;
+  double modularity;
+} cIGraph_spin_replica_t;
+
+//Shared by all of the worker threads
+typedef struct {
+  cIGraph_wgraph_t *g;
+  int q;
+  int config;
+  double gamma;
+  double density;         //Null model edge weight for the simple rule
+  double starttemp;
+  double stoptemp;
+  double coolfact;
+  int tempering;
+  long int sweeps;        //Sweeps each replica makes in a round
+  cIGraph_spin_replica_t *reps;
+  long int nrep;
+  long int next;
+} cIGraph_spin_shared_t;
+
+typedef struct {
+  cIGraph_spin_shared_t *s;
+} cIGraph_spin_worker_t;
+
+static void cIGraph_spin_sweep(cIGraph_spin_shared_t *s, cIGraph_spin_replica_t *r){
+
+  cIGraph_wgraph_t *g = s->g;
+  long int n = g->n, it, i, j;
+  int a, c, q = s->q;
+  double weight, h, hmax, sum, x;
+
+  for(it=0;it<n;it++){
+
+    i = cIGraph_rng_integer(&r->rng, n);
+    a = r->spin[i];
+    weight = s->config ? g->k[i] : 1;
+    r->total[a] -= weight;
+
+    for(j=g->offset[i];j<g->offset[i+1];j++)
+      r->field[r->spin[g->nbr[j]]] += g->weight[j];
+
+    /* Local field of each spin, relative to the largest for exp's sake.
+     * Without any edge weight there is no null model term.
+     */
+    hmax = -HUGE_VAL;
+    for(c=0;c<q;c++){
+      h = r->field[c] - s->gamma * (s->config ? (g->m2 > 0 ? g->k[i] * r->total[c] / g->m2 : 0)
+				    : s->density * r->total[c]);
+      r->prob[c]  = h;
+      r->field[c] = 0;
+      if(h > hmax)
+	hmax = h;
+    }
+    sum = 0;
+    for(c=0;c<q;c++){
+      r->prob[c] = exp((r->prob[c] - hmax) / r->temp);
+      sum += r->prob[c];
+    }
+    x = cIGraph_rng_unif(&r->rng) * sum;
+    for(c=0;c<q-1;c++){
+      x -= r->prob[c];
+      if(x < 0)
+	break;
+    }
+
+    r->spin[i] = c;
+    r->total[c] += weight;
+
+  }
+
+}
+
+//Energy and (gamma = 1, configuration model) modularity of a replica
+static void cIGraph_spin_energy(cIGraph_spin_shared_t *s, cIGraph_spin_replica_t *r){
+
+  cIGraph_wgraph_t *g = s->g;
+  long int n = g->n, i, j;
+  int c;
+  double in = 0, null = 0, sq = 0;
+
+  for(i=0;i<n;i++){
+    in += g->self[i];
+    for(j=g->offset[i];j<g->offset[i+1];j++)
+      if(r->spin[g->nbr[j]] == r->spin[i])
+	in += g->weight[j];
+  }
+
+  memset(r->field, 0, sizeof(double) * s->q);
+  for(i=0;i<n;i++)
+    r->field[r->spin[i]] += g->k[i];
+  for(c=0;c<s->q;c++){
+    sq   += r->field[c] * r->field[c];
+    null += s->config ? (g->m2 > 0 ? r->field[c] * r->field[c] / g->m2 : 0)
+      : s->density * r->total[c] * r->total[c];
+    r->field[c] = 0;
+  }
+
+  r->energy     = -(in - s->gamma * null) / 2;
+  r->modularity = g->m2 > 0 ? in / g->m2 - sq / (g->m2 * g->m2) : 0;
+
+}
+
+static void *cIGraph_spin_worker(void *arg){
+
+  cIGraph_spin_worker_t *w = arg;
+  cIGraph_spin_shared_t *s = w->s;
+  cIGraph_spin_replica_t *r;
+  long int k, i;
+
+  while((k = __sync_fetch_and_add(&s->next, 1)) < s->nrep){
+    r = &s->reps[k];
+    if(s->tempering){
+      for(i=0;i<s->sweeps && !cIGraph_interrupted();i++)
+	cIGraph_spin_sweep(s, r);
+    } else {
+      for(r->temp=s->starttemp;r->temp>=s->stoptemp && !cIGraph_interrupted();r->temp*=s->coolfact)
+	cIGraph_spin_sweep(s, r);
+      r->temp /= s->coolfact;
+    }
+    cIGraph_spin_energy(s, r);
+  }
+
+  return NULL;
+
+}
+
+typedef struct {
+  cIGraph_spin_shared_t s;
+  unsigned long long seed;
+  int nthreads;
+  int failed;
+} cIGraph_spin_job_t;
+
+static void *cIGraph_spin_run(void *arg){
+
+  cIGraph_spin_job_t *job = arg;
+  cIGraph_spin_shared_t *s = &job->s;
+  cIGraph_spin_worker_t *workers;
+  cIGraph_spin_replica_t *r, tmp;
+  cIGraph_rng_t rng;
+  long int n = s->g->n, nsweeps, done, k, i;
+  int nthreads = job->nthreads, t;
+  double x;
+
+  if(nthreads > s->nrep)
+    nthreads = (int)s->nrep;
+
+  workers = calloc(nthreads, sizeof(cIGraph_spin_worker_t));
+  if(!workers){
+    job->failed = 1;
+    return NULL;
+  }
+  for(t=0;t<nthreads;t++)
+    workers[t].s = s;
+
+  for(k=0;k<s->nrep;k++){
+    r = &s->reps[k];
+    cIGraph_rng_seed(&r->rng, job->seed, (int)k);
+    r->spin    = malloc(sizeof(int) * (n+1));
+    r->total   = calloc(s->q, sizeof(double));
+    r->field   = calloc(s->q, sizeof(double));
+    r->prob    = malloc(sizeof(double) * s->q);
+    if(!r->spin || !r->total || !r->field || !r->prob){
+      job->failed = 1;
+      free(workers);
+      return NULL;
+    }
+    for(i=0;i<n;i++){
+      r->spin[i] = (int)cIGraph_rng_integer(&r->rng, s->q);
+      r->total[r->spin[i]] += s->config ? s->g->k[i] : 1;
+    }
+    //A ladder of temperatures for tempering, coldest first
+    r->temp = s->nrep > 1 ? s->stoptemp * pow(s->starttemp / s->stoptemp, (double)k / (s->nrep-1))
+      : s->stoptemp;
+  }
+
+  if(!s->tempering){
+    s->next = 0;
+    cIGraph_parallel(cIGraph_spin_worker, workers, sizeof(cIGraph_spin_worker_t), nthreads);
+    free(workers);
+    return NULL;
+  }
+
+  //As many sweeps as annealing would make, in rounds between exchanges
+  nsweeps = (long int)ceil(log(s->stoptemp / s->starttemp) / log(s->coolfact));
+  if(nsweeps < 1)
+    nsweeps = 1;
+  cIGraph_rng_seed(&rng, job->seed, (int)s->nrep);
+
+  for(done=0;done<nsweeps && !cIGraph_interrupted();done+=s->sweeps){
+    s->sweeps = nsweeps - done < CIGRAPH_SPIN_EXCHANGE ? nsweeps - done : CIGRAPH_SPIN_EXCHANGE;
+    s->next   = 0;
+    cIGraph_parallel(cIGraph_spin_worker, workers, sizeof(cIGraph_spin_worker_t), nthreads);
+
+    //Replicas stay in temperature order, so swapping configurations
+    //between neighbours means swapping everything but the temperature
+    for(k=(done / CIGRAPH_SPIN_EXCHANGE) % 2;k+1<s->nrep;k+=2){
+      x = (1/s->reps[k].temp - 1/s->reps[k+1].temp) *
+	(s->reps[k].energy - s->reps[k+1].energy);
+      if(x >= 0 || cIGraph_rng_unif(&rng) < exp(x)){
+	tmp = s->reps[k];
+	s->reps[k] = s->reps[k+1];
+	s->reps[k+1] = tmp;
+	x = s->reps[k].temp;
+	s->reps[k].temp = s->reps[k+1].temp;
+	s->reps[k+1].temp = x;
+      }
+    }
+  }
+
+  free(workers);
+  return NULL;
+
+}
+
+static void cIGraph_spin_free(cIGraph_spin_shared_t *s){
+
+  long int k;
+
+  for(k=0;k<s->nrep;k++){
+    free(s->reps[k].spin);
+    free(s->reps[k].total);
+    free(s->reps[k].field);
+    free(s->reps[k].prob);
+  }
+  free(s->reps);
+
+}
+
+static int cIGraph_spin_cmp(const void *a, const void *b){
+  double x = ((const cIGraph_spin_replica_t*)a)->energy;
+  double y = ((const cIGraph_spin_replica_t*)b)->energy;
+  return (x > y) - (x < y);
+}
+
+/* call-seq:
+ *   graph.community_spinglass_replicas(replicas,weights=nil,spins=25,starttemp=1.0,stoptemp=0.01,coolfact=0.99,update_rule=IGraph::SPINCOMM_UPDATE_CONFIG,gamma=1.0,tempering=false,seed=nil) -> Array
+ *
+ * Runs the spin glass community detection of community_spinglass
+ * replicas times on IGraph.threads threads, with the global VM lock
+ * released. weights is an Array of edge weights or the name of an edge
+ * attribute holding them; edge directions are ignored.
+ *
+ * Without tempering each replica is annealed independently from
+ * starttemp down to stoptemp. With tempering the replicas are instead
+ * held at temperatures spread geometrically between stoptemp and
+ * starttemp, and neighbouring replicas exchange configurations every few
+ * sweeps with the Metropolis probability, which helps the cold replicas
+ * out of local minima.
+ *
+ * Returns an Array of [membership, modularity, energy, temperature] for
+ * each replica, lowest energy (the best) first, where membership is a
+ * packed String of native ints numbering the communities from 0. Each
+ * replica has its own random number stream, so the results depend on
+ * seed but not on the number of threads.
+ */
+VALUE cIGraph_community_spinglass_replicas(int argc, VALUE *argv, VALUE self){
+
+  VALUE replicas, weights, spins, starttemp, stoptemp, coolfact;
+  VALUE update_rule, gamma, tempering, seed;
+  VALUE res, memb;
+  cIGraph_wgraph_t g;
+  cIGraph_spin_job_t job;
+  cIGraph_spin_shared_t *s = &job.s;
+  cIGraph_spin_replica_t *r;
+  long int n, k, i;
+  int *ids, next;
+
+  rb_scan_args(argc,argv,"19", &replicas, &weights, &spins, &starttemp,
+	       &stoptemp, &coolfact, &update_rule, &gamma, &tempering, &seed);
+
+  memset(&job,0,sizeof(job));
+  s->nrep      = NUM2LONG(replicas);
+  s->q         = NIL_P(spins) ? 25 : NUM2INT(spins);
+  s->starttemp = NIL_P(starttemp) ? 1.0 : NUM2DBL(starttemp);
+  s->stoptemp  = NIL_P(stoptemp) ? 0.01 : NUM2DBL(stoptemp);
+  s->coolfact  = NIL_P(coolfact) ? 0.99 : NUM2DBL(coolfact);
+  s->config    = NIL_P(update_rule) ? 1 : NUM2INT(update_rule) != 0;
+  s->gamma     = NIL_P(gamma) ? 1.0 : NUM2DBL(gamma);
+  s->tempering = RTEST(tempering);
+  job.seed     = cIGraph_rng_seed_value(seed);
+  job.nthreads = cIGraph_thread_count();
+
+  if(s->nrep < 1)
+    rb_raise(cIGraphError, "Need at least one replica\n");
+  if(s->q < 2)
+    rb_raise(cIGraphError, "Need at least two spins\n");
+  if(s->stoptemp <= 0 || s->starttemp < s->stoptemp)
+    rb_raise(cIGraphError, "Temperatures must satisfy 0 < stoptemp <= starttemp\n");
+  if(s->coolfact <= 0 || s->coolfact >= 1)
+    rb_raise(cIGraphError, "Cooling factor must be between 0 and 1\n");
+
+  cIGraph_wgraph_init(self, &g, weights);
+  n = g.n;
+  s->g = &g;
+  s->density = n > 0 ? g.m2 / ((double)n * n) : 0;
+
+  s->reps = calloc(s->nrep, sizeof(cIGraph_spin_replica_t));
+  ids     = malloc(sizeof(int) * s->q);
+  if(!s->reps || !ids){
+    free(s->reps);
+    free(ids);
+    cIGraph_wgraph_destroy(&g);
+    rb_raise(rb_eNoMemError, "Error allocating replicas");
+  }
+
+  cIGraph_without_gvl(cIGraph_spin_run, &job);
+
+  cIGraph_wgraph_destroy(&g);
+
+  if(job.failed){
+    cIGraph_spin_free(s);
+    free(ids);
+    rb_raise(rb_eNoMemError, "Error allocating replicas");
+  }
+
+  qsort(s->reps, s->nrep, sizeof(cIGraph_spin_replica_t), cIGraph_spin_cmp);
+
+  res = rb_ary_new();
+  for(k=0;k<s->nrep;k++){
+    r = &s->reps[k];
+    for(i=0;i<s->q;i++)
+      ids[i] = -1;
+    for(next=0,i=0;i<n;i++){
+      if(ids[r->spin[i]] < 0)
+	ids[r->spin[i]] = next++;
+      r->spin[i] = ids[r->spin[i]];
+    }
+    memb = rb_str_new((char*)r->spin, sizeof(int) * n);
+    rb_ary_push(res, rb_ary_new3(4, memb,
+				 rb_float_new(r->modularity),
+				 rb_float_new(r->energy),
+				 rb_float_new(r->temp)));
+  }
+
+  cIGraph_spin_free(s);
+  free(ids);
+
+  return res;
+
+}
@@ -0,0 +1,1026 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#include <unistd.h>
+
+/* Streams the input of igraph's readers, which take a FILE, from Ruby IO
+ * objects a chunk at a time instead of reading the whole input into a
+ * String first, so the extra memory stays constant whatever the size of
+ * the file.
+ *
+ * The FILE is a fopencookie stream. If the IO is a file with nothing
+ * buffered on the Ruby side its descriptor is read directly, by a thread
+ * that reads the next chunk while the parser works through the current
+ * one. Anything else (pipes, sockets, StringIO, ...) is read through
+ * IO#read on the calling thread. Without fopencookie the whole input is
+ * read and wrapped with fmemopen as before.
+ *
+ * The writers work the same way in the other direction: each full chunk
+ * goes to the descriptor of a regular file (without the global VM lock)
+ * or else to IO#write, so the output is never held in memory as a whole.
+ *
+ * gzip input is recognised by its magic number and inflated on the way
+ * to the parser, by the reading thread where there is one. Output to a
+ * file whose name ends in .gz is compressed, by a thread of its own when
+ * writing to the descriptor.
+ */
+
+//Bytes read or written at a time
+#define CIGRAPH_STREAM_CHUNK (1 << 20)
+
+typedef struct {
+  VALUE io;
+  int fd;                  //Read directly if >= 0
+  int state;               //Tag of an exception raised by IO#read...
+  VALUE exc;               //...and the exception
+  int err;                 //errno of a failed read
+  long int want;
+  VALUE str;               //Whole input without fopencookie
+  cIGraph_map_t inflated;  //...inflated if it was compressed
+  int writing;
+  int nogvl;               //Set while the writer runs without the GVL
+  const char *out;         //Chunk being written to fd
+  size_t outlen;
+#ifdef HAVE_ZLIB_H
+  int gzip;                //1 inflating, 2 deflating, -1 plain, 0 not known yet
+  int zend;                //Set at the end of the compressed input
+  int zerr;                //Set if the compressed input is corrupt
+  z_stream z;
+  char *zbuf;              //Compressed data going in or out
+#endif
+#ifdef HAVE_PTHREAD_H
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int started;
+  int stop;
+  char *data[2];           //Chunks read ahead or waiting to be compressed
+  ssize_t len[2];          //-1 while empty, 0 at the end of the input
+  int head;                //Chunk being consumed or filled
+  size_t off;
+#endif
+} cIGraph_stream_t;
+
+typedef struct {
+  cIGraph_stream_t *s;
+  FILE *stream;
+  int (*parse)(FILE *stream, void *arg);
+  void *arg;
+  int res;
+  int native;
+#ifndef HAVE_FOPENCOOKIE
+  char *buf;
+  size_t size;
+#endif
+} cIGraph_stream_job_t;
+
+/* Inflates the gzip data at data into a buffer allocated for out, to be
+ * released with cIGraph_unmap_file. Members following each other are
+ * joined as gzip does. Returns 0, an errno value or -1 if the data is
+ * corrupt.
+ */
+int cIGraph_gunzip(const char *data, size_t len, cIGraph_map_t *out){
+
+#ifdef HAVE_ZLIB_H
+  z_stream z;
+  char *buf, *grown;
+  size_t cap, used = 0, left = len, room;
+  uInt n;
+  int r;
+
+  memset(out, 0, sizeof(cIGraph_map_t));
+  memset(&z, 0, sizeof(z));
+
+  //The trailer holds the size of the last member modulo 2^32
+  cap = 0;
+  if(len >= 4)
+    cap = (size_t)(unsigned char)data[len-4]         |
+          (size_t)(unsigned char)data[len-3] << 8    |
+          (size_t)(unsigned char)data[len-2] << 16   |
+          (size_t)(unsigned char)data[len-1] << 24;
+  if(cap < len)
+    cap = len * 4;
+  if(cap < 4096)
+    cap = 4096;
+
+  buf = malloc(cap);
+  if(!buf)
+    return ENOMEM;
+  if(inflateInit2(&z, 16 + MAX_WBITS) != Z_OK){
+    free(buf);
+    return ENOMEM;
+  }
+
+  z.next_in = (Bytef*)data;
+
+  for(;;){
+    if(z.avail_in == 0 && left > 0){
+      n = left > (1u << 30) ? (1u << 30) : (uInt)left;
+      z.avail_in = n;
+      left -= n;
+    }
+    if(used == cap){
+      grown = realloc(buf, cap * 2);
+      if(!grown){
+	inflateEnd(&z);
+	free(buf);
+	return ENOMEM;
+      }
+      buf  = grown;
+      cap *= 2;
+    }
+    room = cap - used > (1u << 30) ? (1u << 30) : cap - used;
+    z.next_out  = (Bytef*)buf + used;
+    z.avail_out = (uInt)room;
+
+    r = inflate(&z, Z_NO_FLUSH);
+    used += room - z.avail_out;
+
+    if(r == Z_STREAM_END){
+      if(!CIGRAPH_GZIP_P(z.next_in, z.avail_in + left))
+	break;
+      inflateReset(&z);
+      continue;
+    }
+    if((r != Z_OK && r != Z_BUF_ERROR) || (r == Z_BUF_ERROR && z.avail_in == 0 && left == 0)){
+      inflateEnd(&z);
+      free(buf);
+      return -1;
+    }
+  }
+
+  inflateEnd(&z);
+
+  out->data = buf;
+  out->len  = used;
+
+  return 0;
+#else
+  memset(out, 0, sizeof(cIGraph_map_t));
+  return ENOTSUP;
+#endif
+
+}
+
+//Writes n bytes of buf to fd. Returns 0 or an errno value.
+static int cIGraph_stream_put(int fd, const char *buf, size_t n){
+
+  ssize_t r;
+
+  while(n > 0){
+    r = write(fd, buf, n);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r < 0)
+      return errno;
+    buf += r;
+    n   -= r;
+  }
+
+  return 0;
+
+}
+
+//Writes s->out to s->fd, may run without the GVL
+static void *cIGraph_stream_drain(void *arg){
+
+  cIGraph_stream_t *s = arg;
+
+  s->err = cIGraph_stream_put(s->fd, s->out, s->outlen);
+
+  return NULL;
+
+}
+
+static VALUE cIGraph_stream_io_write(VALUE arg){
+  cIGraph_stream_t *s = (cIGraph_stream_t*)arg;
+  return rb_funcall(s->io, rb_intern("write"), 1, rb_str_new(s->out, s->outlen));
+}
+
+//Passes size bytes of output on to the IO. -1 on error.
+static int cIGraph_stream_out(cIGraph_stream_t *s, const char *buf, size_t size){
+
+  s->out    = buf;
+  s->outlen = size;
+
+  if(s->fd >= 0){
+    if(s->nogvl)
+      cIGraph_stream_drain(s);
+    else
+      cIGraph_without_gvl(cIGraph_stream_drain, s);
+    return s->err ? -1 : 0;
+  }
+
+  //As for reading, IO errors are raised once the writer is done
+  rb_protect(cIGraph_stream_io_write, (VALUE)s, &s->state);
+  if(s->state){
+    s->exc = rb_errinfo();
+    rb_set_errinfo(Qnil);
+    return -1;
+  }
+
+  return 0;
+
+}
+
+#ifdef HAVE_ZLIB_H
+
+/* Compresses size bytes of buf and passes the output on, or writes it
+ * straight to the descriptor from the compressing thread. Returns 0, or
+ * -1 (an errno value from the thread) on error.
+ */
+static int cIGraph_stream_deflate(cIGraph_stream_t *s, const char *buf, size_t size, int flush, int thread){
+
+  size_t n;
+  int err;
+
+  s->z.next_in  = (Bytef*)buf;
+  s->z.avail_in = (uInt)size;
+
+  do {
+    s->z.next_out  = (Bytef*)s->zbuf;
+    s->z.avail_out = CIGRAPH_STREAM_CHUNK;
+    deflate(&s->z, flush);
+    n = CIGRAPH_STREAM_CHUNK - s->z.avail_out;
+    if(n == 0)
+      continue;
+    if(thread){
+      if((err = cIGraph_stream_put(s->fd, s->zbuf, n)) != 0)
+	return err;
+    } else if(cIGraph_stream_out(s, s->zbuf, n)){
+      return -1;
+    }
+  } while(s->z.avail_out == 0);
+
+  return 0;
+
+}
+
+static VALUE cIGraph_stream_io_path(VALUE io){
+  return rb_funcall(io, rb_intern("path"), 0);
+}
+
+//Output to files named *.gz is compressed
+static int cIGraph_stream_gzip_path(VALUE io){
+
+  VALUE path;
+  int state = 0;
+
+  if(!rb_respond_to(io, rb_intern("path")))
+    return 0;
+
+  path = rb_protect(cIGraph_stream_io_path, io, &state);
+  if(state){
+    rb_set_errinfo(Qnil);
+    return 0;
+  }
+
+  return TYPE(path) == T_STRING && RSTRING_LEN(path) >= 3 &&
+    memcmp(RSTRING_PTR(path) + RSTRING_LEN(path) - 3, ".gz", 3) == 0;
+
+}
+
+#endif
+
+#ifdef HAVE_FOPENCOOKIE
+
+//Reads up to n bytes from fd, retrying short reads. -1 on error.
+static ssize_t cIGraph_stream_fill(int fd, char *buf, size_t n, int *err){
+
+  size_t got = 0;
+  ssize_t r;
+
+  while(got < n){
+    r = read(fd, buf + got, n - got);
+    if(r < 0 && errno == EINTR)
+      continue;
+    if(r < 0){
+      *err = errno;
+      return -1;
+    }
+    if(r == 0)
+      break;
+    got += r;
+  }
+
+  return (ssize_t)got;
+
+}
+
+static VALUE cIGraph_stream_io_read(VALUE arg){
+  cIGraph_stream_t *s = (cIGraph_stream_t*)arg;
+  return rb_funcall(s->io, rb_intern("read"), 1, LONG2NUM(s->want));
+}
+
+static VALUE cIGraph_stream_io_fileno(VALUE io){
+  rb_funcall(io, rb_intern("sysseek"), 2, INT2FIX(0), INT2FIX(SEEK_CUR));
+  return rb_funcall(io, rb_intern("fileno"), 0);
+}
+
+/* The descriptor to read io through, or -1. IO#sysseek fails for pipes
+ * and sockets and when Ruby has read ahead into its own buffer.
+ */
+static int cIGraph_stream_fileno(VALUE io){
+
+  VALUE fd;
+  int state = 0;
+
+  if(!rb_obj_is_kind_of(io, rb_cIO))
+    return -1;
+
+  fd = rb_protect(cIGraph_stream_io_fileno, io, &state);
+  if(state){
+    rb_set_errinfo(Qnil);
+    return -1;
+  }
+
+  return NUM2INT(fd);
+
+}
+
+/* Reads up to size bytes of the input as it is stored. IO#read needs the
+ * GVL, descriptors are read from any thread. 0 at the end or on error.
+ */
+static ssize_t cIGraph_stream_raw(cIGraph_stream_t *s, char *buf, size_t size, int *err){
+
+  VALUE str;
+  ssize_t n;
+
+  if(s->fd >= 0){
+    n = cIGraph_stream_fill(s->fd, buf, size, err);
+    return n > 0 ? n : 0;
+  }
+
+  //IO errors end the input here and are raised once the parser is done
+  s->want = (long int)size;
+  str = rb_protect(cIGraph_stream_io_read, (VALUE)s, &s->state);
+  if(s->state){
+    s->exc = rb_errinfo();
+    rb_set_errinfo(Qnil);
+    return 0;
+  }
+  if(NIL_P(str))
+    return 0;
+  if(TYPE(str) != T_STRING || RSTRING_LEN(str) > (long int)size){
+    s->state = -1;
+    return 0;
+  }
+  memcpy(buf, RSTRING_PTR(str), RSTRING_LEN(str));
+
+  return RSTRING_LEN(str);
+
+}
+
+#ifdef HAVE_ZLIB_H
+
+//Inflates input into buf until it is full or the input ends
+static ssize_t cIGraph_stream_inflate(cIGraph_stream_t *s, char *buf, size_t size, int *err){
+
+  ssize_t n;
+  int r;
+
+  s->z.next_out  = (Bytef*)buf;
+  s->z.avail_out = (uInt)size;
+
+  while(s->z.avail_out > 0 && !s->zend){
+    if(s->z.avail_in == 0){
+      n = cIGraph_stream_raw(s, s->zbuf, CIGRAPH_STREAM_CHUNK, err);
+      if(n == 0){
+	//Cut short, unless reading failed in the first place
+	if(!*err && !s->state)
+	  s->zerr = 1;
+	s->zend = 1;
+	break;
+      }
+      s->z.next_in  = (Bytef*)s->zbuf;
+      s->z.avail_in = (uInt)n;
+    }
+    r = inflate(&s->z, Z_NO_FLUSH);
+    if(r == Z_STREAM_END){
+      if(s->z.avail_in == 0){
+	n = cIGraph_stream_raw(s, s->zbuf, CIGRAPH_STREAM_CHUNK, err);
+	s->z.next_in  = (Bytef*)s->zbuf;
+	s->z.avail_in = (uInt)n;
+      }
+      //Anything but another member after the end is ignored, as by gzip
+      if(!CIGRAPH_GZIP_P(s->z.next_in, s->z.avail_in)){
+	s->zend = 1;
+	break;
+      }
+      inflateReset(&s->z);
+    } else if(r != Z_OK && r != Z_BUF_ERROR){
+      s->zerr = 1;
+      s->zend = 1;
+    }
+  }
+
+  return (ssize_t)(size - s->z.avail_out);
+
+}
+
+#endif
+
+//Reads up to size bytes of input into buf, inflating gzip input
+static ssize_t cIGraph_stream_source(cIGraph_stream_t *s, char *buf, size_t size, int *err){
+
+#ifdef HAVE_ZLIB_H
+  ssize_t n;
+
+  if(s->gzip == 0){
+    //No more than zbuf holds, in case the input is gzip
+    n = cIGraph_stream_raw(s, buf, size < CIGRAPH_STREAM_CHUNK ? size : CIGRAPH_STREAM_CHUNK, err);
+    s->gzip = -1;
+    if(!CIGRAPH_GZIP_P(buf, n))
+      return n;
+    s->zbuf = malloc(CIGRAPH_STREAM_CHUNK);
+    if(!s->zbuf || inflateInit2(&s->z, 16 + MAX_WBITS) != Z_OK){
+      *err = ENOMEM;
+      return 0;
+    }
+    memcpy(s->zbuf, buf, n);
+    s->z.next_in  = (Bytef*)s->zbuf;
+    s->z.avail_in = (uInt)n;
+    s->gzip = 1;
+  }
+  if(s->gzip > 0)
+    return cIGraph_stream_inflate(s, buf, size, err);
+#endif
+
+  return cIGraph_stream_raw(s, buf, size, err);
+
+}
+
+#ifdef HAVE_PTHREAD_H
+
+static void *cIGraph_stream_prefetch(void *arg){
+
+  cIGraph_stream_t *s = arg;
+  ssize_t n;
+  int i = 0, err = 0;
+
+  for(;;){
+    pthread_mutex_lock(&s->lock);
+    while(s->len[i] >= 0 && !s->stop)
+      pthread_cond_wait(&s->cond, &s->lock);
+    if(s->stop){
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    n = cIGraph_stream_source(s, s->data[i], CIGRAPH_STREAM_CHUNK, &err);
+
+    pthread_mutex_lock(&s->lock);
+    if(err){
+      s->err = err;
+      n = 0;
+    }
+    s->len[i] = n;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    if(n == 0)
+      break;
+    i ^= 1;
+  }
+
+  return NULL;
+
+}
+
+//Rouses a thread waiting on s->cond to see that it was interrupted
+static void cIGraph_stream_wake(void *arg){
+
+  cIGraph_stream_t *s = arg;
+
+  pthread_mutex_lock(&s->lock);
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+
+}
+
+//Waits for the next chunk, meant for cIGraph_without_gvl_wait
+static void *cIGraph_stream_wait(void *arg){
+
+  cIGraph_stream_t *s = arg;
+
+  pthread_mutex_lock(&s->lock);
+  while(s->len[s->head] < 0 && !cIGraph_interrupted())
+    pthread_cond_wait(&s->cond, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+
+  return NULL;
+
+}
+
+#endif
+
+static ssize_t cIGraph_stream_cookie_read(void *cookie, char *buf, size_t size){
+
+  cIGraph_stream_t *s = cookie;
+  ssize_t n;
+
+  if(s->state || s->err)
+    return 0;
+
+#ifdef HAVE_PTHREAD_H
+  if(s->started){
+    cIGraph_without_gvl_wait(cIGraph_stream_wait, s, cIGraph_stream_wake);
+    pthread_mutex_lock(&s->lock);
+    //Interrupted, the input ends here and the interrupt is raised after
+    if(s->len[s->head] < 0)
+      s->err = EINTR;
+    n = s->len[s->head] - (ssize_t)s->off;
+    if(n > (ssize_t)size)
+      n = size;
+    if(n > 0){
+      memcpy(buf, s->data[s->head] + s->off, n);
+      s->off += n;
+      if(s->off == (size_t)s->len[s->head]){
+	s->len[s->head] = -1;
+	s->off  = 0;
+	s->head ^= 1;
+	pthread_cond_broadcast(&s->cond);
+      }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return n > 0 ? n : 0;
+  }
+#endif
+
+  n = cIGraph_stream_source(s, buf, size, &s->err);
+
+  return n;
+
+}
+
+static VALUE cIGraph_stream_io_flush(VALUE io){
+  struct stat st;
+  VALUE fd;
+
+  rb_funcall(io, rb_intern("flush"), 0);
+  fd = rb_funcall(io, rb_intern("fileno"), 0);
+  //Pipes and sockets may be non-blocking, only files are written directly
+  if(fstat(NUM2INT(fd), &st) < 0 || !S_ISREG(st.st_mode))
+    return INT2FIX(-1);
+
+  return fd;
+}
+
+//The descriptor to write io through once Ruby's buffer is flushed, or -1
+static int cIGraph_stream_fileno_write(VALUE io){
+
+  VALUE fd;
+  int state = 0;
+
+  if(!rb_obj_is_kind_of(io, rb_cIO))
+    return -1;
+
+  fd = rb_protect(cIGraph_stream_io_flush, io, &state);
+  if(state){
+    rb_set_errinfo(Qnil);
+    return -1;
+  }
+
+  return NUM2INT(fd);
+
+}
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_PTHREAD_H)
+
+//Compresses the chunks handed over by the writer and writes them to fd
+static void *cIGraph_stream_compress(void *arg){
+
+  cIGraph_stream_t *s = arg;
+  int i = 0, err = 0, stop;
+
+  for(;;){
+    pthread_mutex_lock(&s->lock);
+    while(s->len[i] < 0 && !s->stop)
+      pthread_cond_wait(&s->cond, &s->lock);
+    stop = s->len[i] < 0;
+    pthread_mutex_unlock(&s->lock);
+    if(stop)
+      break;
+
+    if(!err)
+      err = cIGraph_stream_deflate(s, s->data[i], s->len[i], Z_NO_FLUSH, 1);
+
+    pthread_mutex_lock(&s->lock);
+    s->len[i] = -1;
+    if(err)
+      s->err = err;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    i ^= 1;
+  }
+
+  if(!err && (err = cIGraph_stream_deflate(s, NULL, 0, Z_FINISH, 1)) != 0){
+    pthread_mutex_lock(&s->lock);
+    s->err = err;
+    pthread_mutex_unlock(&s->lock);
+  }
+
+  return NULL;
+
+}
+
+//Waits for the next chunk to be free, meant for cIGraph_without_gvl_wait
+static void *cIGraph_stream_wait_free(void *arg){
+
+  cIGraph_stream_t *s = arg;
+
+  pthread_mutex_lock(&s->lock);
+  while(s->len[s->head] >= 0 && !cIGraph_interrupted())
+    pthread_cond_wait(&s->cond, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+
+  return NULL;
+
+}
+
+/* Hands output over to the compressing thread. stdio passes large writes
+ * on unbuffered, so they are split into chunks.
+ */
+static ssize_t cIGraph_stream_handoff(cIGraph_stream_t *s, const char *buf, size_t size){
+
+  size_t off, n;
+  int err = 0;
+
+  for(off=0;off<size && !err;off+=n){
+    n = size - off < CIGRAPH_STREAM_CHUNK ? size - off : CIGRAPH_STREAM_CHUNK;
+
+    if(s->nogvl)
+      cIGraph_stream_wait_free(s);
+    else
+      cIGraph_without_gvl_wait(cIGraph_stream_wait_free, s, cIGraph_stream_wake);
+
+    pthread_mutex_lock(&s->lock);
+    if(s->len[s->head] >= 0){
+      s->err = EINTR;
+      pthread_mutex_unlock(&s->lock);
+      return -1;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    memcpy(s->data[s->head], buf + off, n);
+
+    pthread_mutex_lock(&s->lock);
+    err = s->err;
+    s->len[s->head] = n;
+    s->head ^= 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+  }
+
+  return err ? -1 : (ssize_t)size;
+
+}
+
+#endif
+
+static ssize_t cIGraph_stream_cookie_write(void *cookie, const char *buf, size_t size){
+
+  cIGraph_stream_t *s = cookie;
+
+  if(s->state || s->err)
+    return -1;
+
+#ifdef HAVE_ZLIB_H
+  if(s->gzip){
+#ifdef HAVE_PTHREAD_H
+    if(s->started)
+      return cIGraph_stream_handoff(s, buf, size);
+#endif
+    return cIGraph_stream_deflate(s, buf, size, Z_NO_FLUSH, 0) ? -1 : (ssize_t)size;
+  }
+#endif
+
+  return cIGraph_stream_out(s, buf, size) ? -1 : (ssize_t)size;
+
+}
+
+#endif
+
+static VALUE cIGraph_stream_body(VALUE arg){
+
+  cIGraph_stream_job_t *job = (cIGraph_stream_job_t*)arg;
+
+  job->res = job->parse(job->stream, job->arg);
+
+  return Qnil;
+
+}
+
+#ifdef HAVE_PTHREAD_H
+static void *cIGraph_stream_join(void *arg){
+  cIGraph_stream_t *s = arg;
+  pthread_join(s->thread, NULL);
+  return NULL;
+}
+#endif
+
+/* Stops the reading thread, or waits for the compressing thread to
+ * finish, and raises any error from the IO.
+ */
+static void cIGraph_stream_release(cIGraph_stream_t *s){
+
+#ifdef HAVE_PTHREAD_H
+  if(s->started){
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    cIGraph_without_gvl(cIGraph_stream_join, s);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+  }
+  free(s->data[0]);
+  free(s->data[1]);
+#endif
+#ifdef HAVE_ZLIB_H
+  if(s->gzip == 1)
+    inflateEnd(&s->z);
+  if(s->gzip == 2)
+    deflateEnd(&s->z);
+  free(s->zbuf);
+#endif
+  if(s->inflated.data)
+    cIGraph_unmap_file(&s->inflated);
+
+  //The IO's own errors win over whatever the cut short input led to
+  if(s->state > 0 && !NIL_P(s->exc))
+    rb_exc_raise(s->exc);
+  if(s->state > 0)
+    rb_jump_tag(s->state);
+  if(s->state < 0)
+    rb_raise(rb_eTypeError, "IO#read must return a String of at most the requested length");
+  //A wait cut short by an interrupt, which Ruby raises here
+  if(s->err == EINTR)
+    rb_thread_check_ints();
+  if(s->err)
+    rb_syserr_fail(s->err, s->writing ? "writing graph" : "reading graph");
+#ifdef HAVE_ZLIB_H
+  if(s->zerr)
+    rb_raise(cIGraphError, "Invalid gzip input");
+#endif
+
+}
+
+static VALUE cIGraph_stream_cleanup(VALUE arg){
+
+  cIGraph_stream_job_t *job = (cIGraph_stream_job_t*)arg;
+
+  fclose(job->stream);
+  cIGraph_stream_release(job->s);
+
+  return Qnil;
+
+}
+
+/* Calls parse(stream, arg) with a FILE reading from the Ruby IO io and
+ * returns its result. The stream is closed and any reading thread
+ * stopped even if parse raises, and exceptions raised by io are passed
+ * on after parse returns.
+ */
+int cIGraph_stream_read(VALUE io, int (*parse)(FILE *stream, void *arg), void *arg){
+
+  cIGraph_stream_t s;
+  cIGraph_stream_job_t job;
+
+  memset(&s, 0, sizeof(s));
+  memset(&job, 0, sizeof(job));
+  s.io      = io;
+  s.exc     = Qnil;
+  s.str     = Qnil;
+  s.fd      = -1;
+  job.s     = &s;
+  job.parse = parse;
+  job.arg   = arg;
+
+#ifdef HAVE_FOPENCOOKIE
+  {
+    cookie_io_functions_t funcs;
+
+    memset(&funcs, 0, sizeof(funcs));
+    funcs.read = cIGraph_stream_cookie_read;
+
+    s.fd = cIGraph_stream_fileno(io);
+
+#ifdef HAVE_PTHREAD_H
+    if(s.fd >= 0){
+      s.data[0] = malloc(CIGRAPH_STREAM_CHUNK);
+      s.data[1] = malloc(CIGRAPH_STREAM_CHUNK);
+      s.len[0]  = s.len[1] = -1;
+      if(s.data[0] && s.data[1]){
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+	s.started = pthread_create(&s.thread, NULL, cIGraph_stream_prefetch, &s) == 0;
+	if(!s.started){
+	  pthread_mutex_destroy(&s.lock);
+	  pthread_cond_destroy(&s.cond);
+	}
+      }
+    }
+#endif
+
+    job.stream = fopencookie(&s, "r", funcs);
+  }
+#else
+  {
+    int err;
+
+    s.str = rb_funcall(io, rb_intern("read"), 0);
+    StringValue(s.str);
+    if(CIGRAPH_GZIP_P(RSTRING_PTR(s.str), RSTRING_LEN(s.str))){
+      if((err = cIGraph_gunzip(RSTRING_PTR(s.str), RSTRING_LEN(s.str), &s.inflated)) < 0)
+	rb_raise(cIGraphError, "Invalid gzip input");
+      if(err)
+	rb_syserr_fail(err, "reading graph");
+      job.stream = fmemopen((void*)s.inflated.data, s.inflated.len, "r");
+    } else {
+      job.stream = fmemopen(RSTRING_PTR(s.str), RSTRING_LEN(s.str), "r");
+    }
+  }
+#endif
+
+  if(!job.stream){
+    cIGraph_stream_release(&s);
+    rb_raise(rb_eNoMemError, "Error opening stream");
+  }
+
+#ifdef HAVE_FOPENCOOKIE
+  setvbuf(job.stream, NULL, _IOFBF, CIGRAPH_STREAM_CHUNK);
+#endif
+
+  rb_ensure(cIGraph_stream_body, (VALUE)&job, cIGraph_stream_cleanup, (VALUE)&job);
+
+  RB_GC_GUARD(s.str);
+  RB_GC_GUARD(s.exc);
+
+  return job.res;
+
+}
+
+#ifdef HAVE_FOPENCOOKIE
+//Runs a native writer without the GVL, flushing before it is taken back
+static void *cIGraph_stream_native(void *arg){
+
+  cIGraph_stream_job_t *job = arg;
+
+  job->s->nogvl = 1;
+  job->res = job->parse(job->stream, job->arg);
+  fflush(job->stream);
+  job->s->nogvl = 0;
+
+  return NULL;
+
+}
+#endif
+
+static VALUE cIGraph_stream_write_body(VALUE arg){
+
+  cIGraph_stream_job_t *job = (cIGraph_stream_job_t*)arg;
+
+#ifdef HAVE_FOPENCOOKIE
+  if(job->native && job->s->fd >= 0){
+    cIGraph_without_gvl(cIGraph_stream_native, job);
+    return Qnil;
+  }
+#endif
+  job->res = job->parse(job->stream, job->arg);
+
+  return Qnil;
+
+}
+
+static VALUE cIGraph_stream_write_cleanup(VALUE arg){
+
+  cIGraph_stream_job_t *job = (cIGraph_stream_job_t*)arg;
+  cIGraph_stream_t *s = job->s;
+
+  //Flushes what is left through the cookie
+  fclose(job->stream);
+
+#ifndef HAVE_FOPENCOOKIE
+  if(!s->state){
+#ifdef HAVE_ZLIB_H
+    if(s->gzip)
+      cIGraph_stream_deflate(s, job->buf, job->size, Z_FINISH, 0);
+    else
+#endif
+      cIGraph_stream_out(s, job->buf, job->size);
+  }
+  free(job->buf);
+#elif defined(HAVE_ZLIB_H)
+  //The compressing thread ends the stream itself once it is stopped
+#ifdef HAVE_PTHREAD_H
+  if(s->gzip && !s->started && !s->state && !s->err)
+#else
+  if(s->gzip && !s->state && !s->err)
+#endif
+    cIGraph_stream_deflate(s, NULL, 0, Z_FINISH, 0);
+#endif
+
+  cIGraph_stream_release(s);
+
+  return Qnil;
+
+}
+
+/* Calls write(stream, arg) with a FILE writing to the Ruby IO io and
+ * returns its result. Output is passed on a chunk at a time. If native is
+ * set write only formats plain C data and runs without the GVL when io
+ * is a file written through its descriptor. As for reading, exceptions
+ * raised by io are passed on once write returns.
+ */
+int cIGraph_stream_write(VALUE io, int (*write)(FILE *stream, void *arg), void *arg, int native){
+
+  cIGraph_stream_t s;
+  cIGraph_stream_job_t job;
+
+  memset(&s, 0, sizeof(s));
+  memset(&job, 0, sizeof(job));
+  s.io       = io;
+  s.exc      = Qnil;
+  s.str      = Qnil;
+  s.fd       = -1;
+  s.writing  = 1;
+  job.s      = &s;
+  job.parse  = write;
+  job.arg    = arg;
+  job.native = native;
+
+#ifdef HAVE_ZLIB_H
+  if(cIGraph_stream_gzip_path(io)){
+    s.zbuf = malloc(CIGRAPH_STREAM_CHUNK);
+    if(!s.zbuf || deflateInit2(&s.z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+      free(s.zbuf);
+      rb_raise(rb_eNoMemError, "Error opening stream");
+    }
+    s.gzip = 2;
+  }
+#endif
+
+#ifdef HAVE_FOPENCOOKIE
+  {
+    cookie_io_functions_t funcs;
+
+    memset(&funcs, 0, sizeof(funcs));
+    funcs.write = cIGraph_stream_cookie_write;
+
+    s.fd = cIGraph_stream_fileno_write(io);
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_PTHREAD_H)
+    if(s.gzip && s.fd >= 0){
+      s.data[0] = malloc(CIGRAPH_STREAM_CHUNK);
+      s.data[1] = malloc(CIGRAPH_STREAM_CHUNK);
+      s.len[0]  = s.len[1] = -1;
+      if(s.data[0] && s.data[1]){
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+	s.started = pthread_create(&s.thread, NULL, cIGraph_stream_compress, &s) == 0;
+	if(!s.started){
+	  pthread_mutex_destroy(&s.lock);
+	  pthread_cond_destroy(&s.cond);
+	}
+      }
+    }
+#endif
+
+    job.stream = fopencookie(&s, "w", funcs);
+  }
+#else
+  job.stream = open_memstream(&job.buf, &job.size);
+#endif
+
+  if(!job.stream){
+    cIGraph_stream_release(&s);
+    rb_raise(rb_eNoMemError, "Error opening stream");
+  }
+
+#ifdef HAVE_FOPENCOOKIE
+  setvbuf(job.stream, NULL, _IOFBF, CIGRAPH_STREAM_CHUNK);
+#endif
+
+  rb_ensure(cIGraph_stream_write_body, (VALUE)&job, cIGraph_stream_write_cleanup, (VALUE)&job);
+
+  RB_GC_GUARD(s.exc);
+
+  return job.res;
+
+}
@@ -15,58 +15,46 @@
  */
 VALUE cIGraph_transitivity(VALUE self){
 
-  igraph_t *graph;
-  igraph_real_t res;
+  cIGraph_triangles_t *tri;
+  double triples = 0;
+  long int i;
 
-  Data_Get_Struct(self, igraph_t, graph);
+  tri = cIGraph_triangles(self);
 
-  igraph_transitivity_undirected(graph,&res);
+  for(i=0;i<tri->n;i++)
+    triples += tri->degree[i] * (tri->degree[i] - 1) / 2.0;
 
-  return rb_float_new(res);
+  return rb_float_new(3.0 * tri->triangles / triples);
 
 }
 
 /* call-seq:
- *   graph.transitivity() -> Float
+ *   graph.transitivity_local(vs) -> Array
  *
- * Calculates the transitivity (clustering coefficient) of a graph.
+ * Calculates the local transitivity (clustering coefficient) of each of
+ * the vertices in the vs Array.
  *
- * The transitivity measures the probability that two neighbors of a vertex 
- * are connected. More precisely this is the ratio of the triangles and 
- * connected triples in the graph, the result is a single real number or 
- * NaN (0/0) if there are no connected triples in the graph. Directed graphs 
- * are considered as undirected ones.
+ * The local transitivity of a vertex is the ratio of the triangles 
+ * through the vertex and the connected triples centred on it. Vertices
+ * with fewer than two neighbours give NaN. Directed graphs are considered 
+ * as undirected ones.
  */
 VALUE cIGraph_transitivity_local(VALUE self, VALUE vs){
 
-  igraph_t *graph;
-  igraph_vs_t vids;
-  igraph_vector_t vidv;
-  igraph_vector_t res;
+  cIGraph_triangles_t *tri;
   VALUE trans = rb_ary_new();
+  long int v;
+  double d;
   int i;
 
-  //vector to hold the results of the calculations
-  igraph_vector_init_int(&res,0);
- 
-  //Convert an array of vertices to a vector of vertex ids
-  igraph_vector_init_int(&vidv,0);
-  cIGraph_vertex_arr_to_id_vec(self,vs,&vidv);
-  //create vertex selector from the vecotr of ids
-  igraph_vs_vector(&vids,&vidv);
+  tri = cIGraph_triangles(self);
 
-  Data_Get_Struct(self, igraph_t, graph);
-
-  igraph_transitivity_local_undirected(graph,&res,vids);
-
-  for(i=0;i<igraph_vector_size(&res);i++){
-    rb_ary_push(trans,rb_float_new(VECTOR(res)[i]));
+  for(i=0;i<RARRAY_LEN(vs);i++){
+    v = (long int)cIGraph_get_vertex_id(self,RARRAY_PTR(vs)[i]);
+    d = tri->degree[v];
+    rb_ary_push(trans,rb_float_new(tri->vtri[v] / (d * (d - 1) / 2.0)));
   }
 
-  igraph_vector_destroy(&vidv);
-  igraph_vector_destroy(&res);
-  igraph_vs_destroy(&vids);
-
   return trans;
 
 }
@@ -74,24 +62,95 @@ VALUE cIGraph_transitivity_local(VALUE self, VALUE vs){
 /* call-seq:
  *   graph.transitivity_avglocal() -> Float
  *
- * Calculates the transitivity (clustering coefficient) of a graph.
- *
- * The transitivity measures the probability that two neighbors of a vertex 
- * are connected. More precisely this is the ratio of the triangles and 
- * connected triples in the graph, the result is a single real number or 
- * NaN (0/0) if there are no connected triples in the graph. Directed graphs 
- * are considered as undirected ones.
+ * Calculates the average local transitivity (clustering coefficient) of a 
+ * graph, i.e. the mean of IGraph#transitivity_local over all vertices with
+ * at least two neighbours. Directed graphs are considered as undirected 
+ * ones.
  */
 VALUE cIGraph_transitivity_avglocal(VALUE self){
 
-  igraph_t *graph;
-  igraph_real_t res;
+  cIGraph_triangles_t *tri;
+  double sum = 0;
+  double d;
+  long int counted = 0;
+  long int i;
+
+  tri = cIGraph_triangles(self);
+
+  for(i=0;i<tri->n;i++){
+    d = tri->degree[i];
+    if(d < 2)
+      continue;
+    sum += tri->vtri[i] / (d * (d - 1) / 2.0);
+    counted++;
+  }
 
-  Data_Get_Struct(self, igraph_t, graph);
+  return rb_float_new(sum / counted);
 
-  igraph_transitivity_avglocal_undirected(graph,&res);
+}
+
+/* call-seq:
+ *   graph.triangle_count() -> Integer
+ *
+ * Returns the number of triangles in the graph. Directed graphs are 
+ * considered as undirected ones and multiple edges and loops are ignored.
+ *
+ * The counts behind this method, IGraph#local_triangle_count, 
+ * IGraph#edge_triangle_count and the transitivity methods come from a single
+ * (multithreaded, see IGraph.threads) pass over the graph that is reused 
+ * until the graph is changed.
+ */
+VALUE cIGraph_triangle_count(VALUE self){
+
+  cIGraph_triangles_t *tri;
+
+  tri = cIGraph_triangles(self);
+
+  return LONG2NUM(tri->triangles);
+
+}
+
+/* call-seq:
+ *   graph.local_triangle_count(vs) -> Array
+ *
+ * Returns the number of triangles through each of the vertices in the vs 
+ * Array.
+ */
+VALUE cIGraph_local_triangle_count(VALUE self, VALUE vs){
+
+  cIGraph_triangles_t *tri;
+  VALUE counts = rb_ary_new();
+  int i;
+
+  tri = cIGraph_triangles(self);
+
+  for(i=0;i<RARRAY_LEN(vs);i++){
+    rb_ary_push(counts,LONG2NUM(tri->vtri[(long int)cIGraph_get_vertex_id(self,RARRAY_PTR(vs)[i])]));
+  }
+
+  return counts;
+
+}
+
+/* call-seq:
+ *   graph.edge_triangle_count() -> Array
+ *
+ * Returns the number of triangles each edge is part of, in edge id order
+ * (see IGraph#edge and IGraph#each_edge_eid). Loops are in no triangles.
+ */
+VALUE cIGraph_edge_triangle_count(VALUE self){
+
+  cIGraph_triangles_t *tri;
+  VALUE counts = rb_ary_new();
+  long int i;
+
+  tri = cIGraph_triangles(self);
+
+  for(i=0;i<tri->m;i++){
+    rb_ary_push(counts,LONG2NUM(tri->etri[i]));
+  }
 
-  return rb_float_new(res);
+  return counts;
 
 }
 
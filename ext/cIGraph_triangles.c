@@ -0,0 +1,355 @@
+#include "igraph.h"
+#include "ruby.h"
+#include "cIGraph.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Triangle counting engine shared by the Transitivity methods.
+ *
+ * Vertices are ranked by degree and every edge is kept only in the list of
+ * its lower ranked end ("forward" lists, sorted by vertex id). Each
+ * triangle u < v < w (by rank) is then found exactly once, as a common
+ * element w of forward(u) and forward(v) for v in forward(u). High degree
+ * vertices end up with short forward lists, which keeps the intersections
+ * cheap on skewed graphs. One pass gives the total, the per-vertex and the
+ * per-edge counts. Vertices are handed out to the worker threads in small
+ * chunks and the shared counters are updated atomically.
+ *
+ * Results are cached on the graph until it next changes.
+ */
+
+#define CIGRAPH_TRI_CHUNK 64
+
+static const char *cIGraph_triangles_cache = "__triangles__";
+
+//Data shared by all of the worker threads
+typedef struct {
+  long int n;
+  long int *fwd_off;
+  int *fwd;
+  long int *vtri;
+  long int *stri;            //Per forward list slot, i.e. per simple edge
+  long int next;             //Next unclaimed vertex
+} cIGraph_tri_shared_t;
+
+typedef struct {
+  cIGraph_tri_shared_t *s;
+  long int *ia;              //Scratch for the matching positions
+  long int *ib;
+  long int triangles;
+} cIGraph_tri_worker_t;
+
+/* Intersects the sorted sets a and b, storing the positions of each common
+ * element in ia and ib. Returns the number of common elements. With SSE2
+ * four elements of a are compared against four of b at a time and the
+ * merge only falls back to scalar code for the tails.
+ */
+static long int cIGraph_tri_intersect(const int *a, long int na,
+				      const int *b, long int nb,
+				      long int *ia, long int *ib){
+
+  long int i = 0, j = 0, k = 0;
+
+#ifdef __SSE2__
+  while(i+4 <= na && j+4 <= nb){
+
+    __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(b+j));
+    __m128i ca, cb;
+    int ma, mb, amax, bmax;
+
+    ca = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(va,vb),
+				   _mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,_MM_SHUFFLE(0,3,2,1)))),
+		      _mm_or_si128(_mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,_MM_SHUFFLE(1,0,3,2))),
+				   _mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,_MM_SHUFFLE(2,1,0,3)))));
+    ma = _mm_movemask_ps(_mm_castsi128_ps(ca));
+
+    if(ma){
+      //Same comparison from the other side to find where the matches sit
+      //in b. Both blocks are sorted so the nth match in one is the nth
+      //match in the other.
+      cb = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(vb,va),
+				     _mm_cmpeq_epi32(vb,_mm_shuffle_epi32(va,_MM_SHUFFLE(0,3,2,1)))),
+			_mm_or_si128(_mm_cmpeq_epi32(vb,_mm_shuffle_epi32(va,_MM_SHUFFLE(1,0,3,2))),
+				     _mm_cmpeq_epi32(vb,_mm_shuffle_epi32(va,_MM_SHUFFLE(2,1,0,3)))));
+      mb = _mm_movemask_ps(_mm_castsi128_ps(cb));
+      while(ma){
+	ia[k] = i + __builtin_ctz(ma);
+	ib[k] = j + __builtin_ctz(mb);
+	k++;
+	ma &= ma - 1;
+	mb &= mb - 1;
+      }
+    }
+
+    amax = a[i+3];
+    bmax = b[j+3];
+    if(amax <= bmax)
+      i += 4;
+    if(bmax <= amax)
+      j += 4;
+
+  }
+#endif
+
+  while(i < na && j < nb){
+    if(a[i] < b[j]){
+      i++;
+    } else if(a[i] > b[j]){
+      j++;
+    } else {
+      ia[k] = i++;
+      ib[k] = j++;
+      k++;
+    }
+  }
+
+  return k;
+
+}
+
+static void *cIGraph_tri_worker(void *arg){
+
+  cIGraph_tri_worker_t *w = arg;
+  cIGraph_tri_shared_t *s = w->s;
+  long int start, end, u, p, k, c, v, x;
+  long int *off = s->fwd_off;
+
+  while(!cIGraph_interrupted() && (start = __sync_fetch_and_add(&s->next, CIGRAPH_TRI_CHUNK)) < s->n){
+    end = start + CIGRAPH_TRI_CHUNK < s->n ? start + CIGRAPH_TRI_CHUNK : s->n;
+    for(u=start;u<end;u++){
+      for(p=off[u];p<off[u+1];p++){
+	v = s->fwd[p];
+	c = cIGraph_tri_intersect(s->fwd+off[u], off[u+1]-off[u],
+				  s->fwd+off[v], off[v+1]-off[v],
+				  w->ia, w->ib);
+	if(c == 0)
+	  continue;
+	w->triangles += c;
+	__sync_fetch_and_add(&s->vtri[u], c);
+	__sync_fetch_and_add(&s->vtri[v], c);
+	__sync_fetch_and_add(&s->stri[p], c);
+	for(k=0;k<c;k++){
+	  x = off[u] + w->ia[k];
+	  __sync_fetch_and_add(&s->vtri[s->fwd[x]], 1);
+	  __sync_fetch_and_add(&s->stri[x], 1);
+	  __sync_fetch_and_add(&s->stri[off[v] + w->ib[k]], 1);
+	}
+      }
+    }
+  }
+
+  return NULL;
+
+}
+
+//Everything the counting pass needs, so it can run without the GVL
+typedef struct {
+  cIGraph_csr_t *csr;
+  int *from;
+  int *to;
+  cIGraph_triangles_t *res;
+  int nthreads;
+  int failed;
+} cIGraph_tri_job_t;
+
+static void *cIGraph_tri_run(void *arg){
+
+  cIGraph_tri_job_t *job = arg;
+  cIGraph_csr_t *csr = job->csr;
+  cIGraph_triangles_t *res = job->res;
+  cIGraph_tri_shared_t s;
+  cIGraph_tri_worker_t *workers = NULL;
+  long int n = csr->n;
+  long int *rank = NULL;
+  long int *bucket = NULL;
+  long int i, j, d, maxd = 0, maxf = 0;
+  long int lo, hi, mid, u, v;
+
+  memset(&s,0,sizeof(s));
+  s.n = n;
+
+  for(i=0;i<n;i++){
+    res->degree[i] = csr->offset[i+1] - csr->offset[i];
+    if(res->degree[i] > maxd)
+      maxd = res->degree[i];
+  }
+
+  //Rank by degree, ties broken by id (a counting sort keeps them in order)
+  rank   = malloc(sizeof(long int) * (n+1));
+  bucket = calloc(maxd+2, sizeof(long int));
+  s.fwd_off = calloc(n+1, sizeof(long int));
+  s.fwd     = malloc(sizeof(int) * (csr->offset[n]/2 + 1));
+  s.stri    = calloc(csr->offset[n]/2 + 1, sizeof(long int));
+  if(!rank || !bucket || !s.fwd_off || !s.fwd || !s.stri)
+    goto fail;
+
+  for(i=0;i<n;i++)
+    bucket[res->degree[i]+1]++;
+  for(d=0;d<=maxd;d++)
+    bucket[d+1] += bucket[d];
+  for(i=0;i<n;i++)
+    rank[i] = bucket[res->degree[i]]++;
+
+  //Forward lists keep the neighbours ranked above each vertex, still
+  //sorted by id
+  for(i=0;i<n;i++){
+    s.fwd_off[i+1] = s.fwd_off[i];
+    for(j=csr->offset[i];j<csr->offset[i+1];j++){
+      if(rank[csr->nbr[j]] > rank[i])
+	s.fwd[s.fwd_off[i+1]++] = csr->nbr[j];
+    }
+    if(s.fwd_off[i+1] - s.fwd_off[i] > maxf)
+      maxf = s.fwd_off[i+1] - s.fwd_off[i];
+  }
+
+  s.vtri = res->vtri;
+
+  workers = calloc(job->nthreads, sizeof(cIGraph_tri_worker_t));
+  if(!workers)
+    goto fail;
+  for(i=0;i<job->nthreads;i++){
+    workers[i].s  = &s;
+    workers[i].ia = malloc(sizeof(long int) * (maxf+1));
+    workers[i].ib = malloc(sizeof(long int) * (maxf+1));
+    if(!workers[i].ia || !workers[i].ib)
+      goto fail;
+  }
+
+  cIGraph_parallel(cIGraph_tri_worker, workers, sizeof(cIGraph_tri_worker_t), job->nthreads);
+
+  res->triangles = 0;
+  for(i=0;i<job->nthreads;i++)
+    res->triangles += workers[i].triangles;
+
+  //Map the simple edges back onto igraph's edge ids
+  for(i=0;i<res->m;i++){
+    u = job->from[i];
+    v = job->to[i];
+    res->etri[i] = 0;
+    if(u == v)
+      continue;
+    if(rank[v] < rank[u]){
+      u = job->to[i];
+      v = job->from[i];
+    }
+    lo = s.fwd_off[u];
+    hi = s.fwd_off[u+1] - 1;
+    while(lo <= hi){
+      mid = (lo + hi) / 2;
+      if(s.fwd[mid] == v){
+	res->etri[i] = s.stri[mid];
+	break;
+      } else if(s.fwd[mid] < v){
+	lo = mid + 1;
+      } else {
+	hi = mid - 1;
+      }
+    }
+  }
+
+  goto done;
+
+ fail:
+  job->failed = 1;
+
+ done:
+  if(workers){
+    for(i=0;i<job->nthreads;i++){
+      free(workers[i].ia);
+      free(workers[i].ib);
+    }
+  }
+  free(workers);
+  free(rank);
+  free(bucket);
+  free(s.fwd_off);
+  free(s.fwd);
+  free(s.stri);
+
+  return NULL;
+
+}
+
+void cIGraph_triangles_free(void *p){
+  cIGraph_triangles_t *t = p;
+  free(t->vtri);
+  free(t->degree);
+  free(t->etri);
+  free(t);
+}
+
+/* Returns the triangle counts for the graph, running the counting pass if
+ * there is no cached result for its current state.
+ */
+cIGraph_triangles_t *cIGraph_triangles(VALUE self){
+
+  igraph_t *graph;
+  cIGraph_triangles_t *res;
+  cIGraph_csr_t csr;
+  cIGraph_tri_job_t job;
+  igraph_integer_t from, to;
+  VALUE obj;
+  long int i;
+
+  obj = cIGraph_cache_get(self, cIGraph_triangles_cache);
+  if(!NIL_P(obj)){
+    Data_Get_Struct(obj, cIGraph_triangles_t, res);
+    return res;
+  }
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  res = calloc(1, sizeof(cIGraph_triangles_t));
+  if(!res)
+    rb_raise(rb_eNoMemError, "Error allocating triangle counts");
+  obj = Data_Wrap_Struct(rb_cObject, 0, cIGraph_triangles_free, res);
+
+  res->n      = (long int)igraph_vcount(graph);
+  res->m      = (long int)igraph_ecount(graph);
+  res->vtri   = calloc(res->n+1, sizeof(long int));
+  res->degree = calloc(res->n+1, sizeof(long int));
+  res->etri   = calloc(res->m+1, sizeof(long int));
+
+  memset(&job,0,sizeof(job));
+  job.from = malloc(sizeof(int) * (res->m+1));
+  job.to   = malloc(sizeof(int) * (res->m+1));
+
+  if(!res->vtri || !res->degree || !res->etri || !job.from || !job.to){
+    free(job.from);
+    free(job.to);
+    rb_raise(rb_eNoMemError, "Error allocating triangle counts");
+  }
+
+  for(i=0;i<res->m;i++){
+    igraph_edge(graph,i,&from,&to);
+    job.from[i] = (int)from;
+    job.to[i]   = (int)to;
+  }
+
+  //Raises through the error handler if it fails
+  IGRAPH_FINALLY(free, job.from);
+  IGRAPH_FINALLY(free, job.to);
+  cIGraph_csr_init(graph,&csr,IGRAPH_ALL,1);
+  IGRAPH_FINALLY_CLEAN(2);
+
+  job.csr      = &csr;
+  job.res      = res;
+  job.nthreads = cIGraph_thread_count();
+
+  cIGraph_without_gvl(cIGraph_tri_run, &job);
+
+  cIGraph_csr_destroy(&csr);
+  free(job.from);
+  free(job.to);
+
+  if(job.failed)
+    rb_raise(rb_eNoMemError, "Error allocating triangle counts");
+
+  cIGraph_cache_set(self, cIGraph_triangles_cache, obj);
+
+  return res;
+
+}
@@ -69,3 +69,84 @@ VALUE cIGraph_include(VALUE self, VALUE v){
 
   return rb_ary_includes(v_ary,v);
 }
+
+/* Reads a membership vector, either a String of native 32 bit integers
+ * (as returned by the community methods) or an Array of Integers, one per
+ * vertex id. Returns a malloc'd buffer with room for n entries and sets
+ * len to the number given, raising if there are more than n.
+ */
+int *cIGraph_membership_unpack(VALUE membership, long int n, long int *len){
+
+  long int i;
+  int *memb;
+  VALUE v;
+
+  if(TYPE(membership) == T_STRING){
+    if(RSTRING_LEN(membership) % sizeof(int) != 0)
+      rb_raise(cIGraphError, "Packed membership length must be a multiple of %d\n", (int)sizeof(int));
+    *len = RSTRING_LEN(membership) / sizeof(int);
+  } else {
+    membership = rb_check_array_type(membership);
+    if(NIL_P(membership))
+      rb_raise(cIGraphError, "Array or String expected\n");
+    *len = RARRAY_LEN(membership);
+    for(i=0;i<*len;i++){
+      v = RARRAY_PTR(membership)[i];
+      if(!FIXNUM_P(v) || FIX2LONG(v) < INT_MIN || FIX2LONG(v) > INT_MAX)
+	rb_raise(cIGraphError, "Membership must be an Array of Integers\n");
+    }
+  }
+
+  if(*len > n)
+    rb_raise(cIGraphError, "Membership vector is longer than the number of vertices\n");
+
+  memb = malloc(sizeof(int) * (n+1));
+  if(!memb)
+    rb_raise(rb_eNoMemError, "Error allocating membership");
+
+  if(TYPE(membership) == T_STRING){
+    memcpy(memb, RSTRING_PTR(membership), sizeof(int) * *len);
+  } else {
+    for(i=0;i<*len;i++)
+      memb[i] = (int)FIX2LONG(RARRAY_PTR(membership)[i]);
+  }
+
+  return memb;
+
+}
+
+/* Native results cached on a graph object live in hidden instance variables
+ * (names without an @ cannot be reached from Ruby) together with the
+ * generation of the graph they were computed for. Returns the cached object
+ * or nil if there is none or the graph has changed since.
+ */
+VALUE cIGraph_cache_get(VALUE self, const char *name){
+
+  igraph_t *graph;
+  VALUE entry;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  entry = rb_attr_get(self, rb_intern(name));
+  if(NIL_P(entry))
+    return Qnil;
+
+  if(NUM2ULONG(rb_ary_entry(entry,0)) != cIGraph_generation(graph))
+    return Qnil;
+
+  return rb_ary_entry(entry,1);
+
+}
+
+VALUE cIGraph_cache_set(VALUE self, const char *name, VALUE obj){
+
+  igraph_t *graph;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  rb_ivar_set(self, rb_intern(name),
+	      rb_ary_new3(2, ULONG2NUM(cIGraph_generation(graph)), obj));
+
+  return obj;
+
+}
@@ -2,6 +2,10 @@
 #include "ruby.h"
 #include "cIGraph.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* call-seq:
  *   graph.neighbourhood_size(vertices,order,mode) -> Array
  *
@@ -163,5 +167,380 @@ VALUE cIGraph_neighborhood_graphs(VALUE self, VALUE from, VALUE order, VALUE mod
 }
 
 
+/* Approximate neighbourhood sizes (HyperANF).
+ *
+ * Every vertex gets a HyperLogLog counter holding its ball of radius t.
+ * The ball of radius t+1 is the union of the vertex's own ball and those of
+ * its neighbours, and a HyperLogLog union is just the register-wise
+ * maximum, so each order costs one sweep over the edges for all vertices
+ * at once. Vertices are split between the worker threads; each only writes
+ * its own counters in the next generation so no locking is needed.
+ */
+
+#define CIGRAPH_HLL_CHUNK 256
+
+typedef struct {
+  cIGraph_csr_t *csr;
+  int p;                     //log2 of the number of registers
+  long int regs;
+  unsigned char *cur;
+  unsigned char *nxt;
+  int *watch;                //Position of each vertex in the requested list
+  double *sizes;             //Estimates for the requested vertices
+  double *nf;                //Neighbourhood function, per order
+  long int order;
+  long int t;                //Order being computed
+  long int next;
+  int nthreads;
+  int failed;
+} cIGraph_hll_job_t;
+
+typedef struct {
+  cIGraph_hll_job_t *job;
+  double total;
+  int changed;
+} cIGraph_hll_worker_t;
+
+static unsigned long long cIGraph_hll_hash(unsigned long long x){
+  //splitmix64 finaliser
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+static double cIGraph_hll_estimate(const unsigned char *r, long int regs){
+
+  double sum = 0;
+  double alpha, e;
+  long int zeros = 0;
+  long int j;
+
+  for(j=0;j<regs;j++){
+    sum += ldexp(1.0, -r[j]);
+    if(r[j] == 0)
+      zeros++;
+  }
+
+  //Bias correction, the formula only holds from 128 registers on
+  if(regs == 16)
+    alpha = 0.673;
+  else if(regs == 32)
+    alpha = 0.697;
+  else if(regs == 64)
+    alpha = 0.709;
+  else
+    alpha = 0.7213 / (1 + 1.079 / regs);
+  e = alpha * regs * regs / sum;
+
+  //Small range correction
+  if(e <= 2.5 * regs && zeros > 0)
+    e = regs * log((double)regs / zeros);
+
+  return e;
+
+}
+
+//Register-wise maximum of a and b into a, returns non-zero if a changed
+static int cIGraph_hll_union(unsigned char *a, const unsigned char *b, long int regs){
+
+  long int j;
+  int changed = 0;
+
+#ifdef __SSE2__
+  for(j=0;j+16<=regs;j+=16){
+    __m128i va = _mm_loadu_si128((const __m128i*)(a+j));
+    __m128i vm = _mm_max_epu8(va,_mm_loadu_si128((const __m128i*)(b+j)));
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(va,vm)) != 0xFFFF){
+      _mm_storeu_si128((__m128i*)(a+j),vm);
+      changed = 1;
+    }
+  }
+#else
+  j = 0;
+#endif
+
+  for(;j<regs;j++){
+    if(b[j] > a[j]){
+      a[j] = b[j];
+      changed = 1;
+    }
+  }
+
+  return changed;
+
+}
+
+static void cIGraph_hll_record(cIGraph_hll_job_t *job, cIGraph_hll_worker_t *w,
+			       long int v, long int t, const unsigned char *r){
+
+  double e = cIGraph_hll_estimate(r, job->regs);
 
-  
+  w->total += e;
+  if(job->watch[v] >= 0)
+    job->sizes[job->watch[v] * (job->order+1) + t] = e;
+
+}
+
+static void *cIGraph_hll_step(void *arg){
+
+  cIGraph_hll_worker_t *w = arg;
+  cIGraph_hll_job_t *job = w->job;
+  cIGraph_csr_t *csr = job->csr;
+  long int regs = job->regs;
+  long int start, end, v, j;
+  unsigned char *r;
+
+  while((start = __sync_fetch_and_add(&job->next, CIGRAPH_HLL_CHUNK)) < csr->n){
+    end = start + CIGRAPH_HLL_CHUNK < csr->n ? start + CIGRAPH_HLL_CHUNK : csr->n;
+    for(v=start;v<end;v++){
+      r = job->nxt + v*regs;
+      memcpy(r, job->cur + v*regs, regs);
+      for(j=csr->offset[v];j<csr->offset[v+1];j++){
+	if(cIGraph_hll_union(r, job->cur + (long int)csr->nbr[j]*regs, regs))
+	  w->changed = 1;
+      }
+      cIGraph_hll_record(job, w, v, job->t, r);
+    }
+  }
+
+  return NULL;
+
+}
+
+static void *cIGraph_hll_run(void *arg){
+
+  cIGraph_hll_job_t *job = arg;
+  cIGraph_hll_worker_t *workers;
+  cIGraph_hll_worker_t seed;
+  unsigned long long h;
+  unsigned char *tmp;
+  long int n = job->csr->n;
+  long int v, t, i, idx;
+  int changed, rho;
+
+  workers = calloc(job->nthreads, sizeof(cIGraph_hll_worker_t));
+  if(!workers){
+    job->failed = 1;
+    return NULL;
+  }
+
+  //Order 0: each counter holds just its own vertex
+  memset(&seed,0,sizeof(seed));
+  seed.job = job;
+  for(v=0;v<n;v++){
+    h   = cIGraph_hll_hash((unsigned long long)v);
+    idx = (long int)(h >> (64 - job->p));
+    h   = (h << job->p) | (1ULL << (job->p - 1));
+    rho = __builtin_clzll(h) + 1;
+    job->cur[v*job->regs + idx] = (unsigned char)rho;
+    cIGraph_hll_record(job, &seed, v, 0, job->cur + v*job->regs);
+  }
+  job->nf[0] = seed.total;
+
+  for(t=1;t<=job->order && !cIGraph_interrupted();t++){
+
+    for(i=0;i<job->nthreads;i++){
+      workers[i].job     = job;
+      workers[i].total   = 0;
+      workers[i].changed = 0;
+    }
+    job->next = 0;
+    job->t    = t;
+
+    cIGraph_parallel(cIGraph_hll_step, workers, sizeof(cIGraph_hll_worker_t), job->nthreads);
+
+    job->nf[t] = 0;
+    changed = 0;
+    for(i=0;i<job->nthreads;i++){
+      job->nf[t] += workers[i].total;
+      changed |= workers[i].changed;
+    }
+
+    tmp = job->cur;
+    job->cur = job->nxt;
+    job->nxt = tmp;
+
+    //Nothing grew, so every larger ball is the same
+    if(!changed){
+      for(i=t+1;i<=job->order;i++){
+	job->nf[i] = job->nf[t];
+	for(v=0;v<n;v++){
+	  if(job->watch[v] >= 0)
+	    job->sizes[job->watch[v]*(job->order+1) + i] = job->sizes[job->watch[v]*(job->order+1) + t];
+	}
+      }
+      break;
+    }
+
+  }
+
+  free(workers);
+  return NULL;
+
+}
+
+/* Runs HyperANF up to order on the graph. Returns the estimates for the
+ * vertices in vs (order+1 per vertex, nil for none) in sizes and the
+ * neighbourhood function in nf. Both are malloc'd.
+ */
+static void cIGraph_hll(VALUE self, VALUE vs, VALUE order, VALUE mode, VALUE precision,
+			double **sizes, double **nf){
+
+  igraph_t *graph;
+  cIGraph_csr_t csr;
+  cIGraph_hll_job_t job;
+  long int n, i, j, nvs = 0;
+  VALUE ids;
+
+  Data_Get_Struct(self, igraph_t, graph);
+
+  memset(&job,0,sizeof(job));
+  job.p     = NUM2INT(precision);
+  job.order = NUM2INT(order);
+  if(job.p < 4 || job.p > 16)
+    rb_raise(cIGraphError, "Precision must be between 4 and 16\n");
+  if(job.order < 0)
+    rb_raise(cIGraphError, "Order must not be negative\n");
+  if(NUM2INT(mode) != IGRAPH_OUT && NUM2INT(mode) != IGRAPH_IN && NUM2INT(mode) != IGRAPH_ALL)
+    rb_raise(cIGraphError, "Mode must be IGraph::OUT, IGraph::IN or IGraph::ALL\n");
+  job.regs     = 1L << job.p;
+  job.nthreads = cIGraph_thread_count();
+
+  n = (long int)igraph_vcount(graph);
+  if(!NIL_P(vs))
+    nvs = RARRAY_LEN(vs);
+
+  //Looking the vertices up can raise, so do it before allocating anything
+  ids = rb_ary_new2(nvs);
+  for(i=0;i<nvs;i++)
+    rb_ary_push(ids,INT2NUM(cIGraph_get_vertex_id(self,RARRAY_PTR(vs)[i])));
+
+  job.watch = malloc(sizeof(int) * (n+1));
+  job.sizes = malloc(sizeof(double) * (nvs*(job.order+1) + 1));
+  job.nf    = malloc(sizeof(double) * (job.order+1));
+  job.cur   = calloc(n * job.regs + 1, 1);
+  job.nxt   = malloc(n * job.regs + 1);
+
+  if(!job.watch || !job.sizes || !job.nf || !job.cur || !job.nxt){
+    free(job.watch);
+    free(job.sizes);
+    free(job.nf);
+    free(job.cur);
+    free(job.nxt);
+    rb_raise(rb_eNoMemError, "Error allocating HyperLogLog counters");
+  }
+
+  for(i=0;i<n;i++)
+    job.watch[i] = -1;
+
+  IGRAPH_FINALLY(free, job.watch);
+  IGRAPH_FINALLY(free, job.sizes);
+  IGRAPH_FINALLY(free, job.nf);
+  IGRAPH_FINALLY(free, job.cur);
+  IGRAPH_FINALLY(free, job.nxt);
+
+  //A vertex asked for twice is watched at its first position
+  for(i=nvs-1;i>=0;i--)
+    job.watch[NUM2LONG(RARRAY_PTR(ids)[i])] = i;
+
+  //A ball grows along the edges leaving it, so pull along the same mode
+  cIGraph_csr_init(graph,&csr,NUM2INT(mode),0);
+  job.csr = &csr;
+
+  cIGraph_without_gvl(cIGraph_hll_run, &job);
+
+  //...and its estimates copied to the others
+  for(i=0;!job.failed && i<nvs;i++){
+    j = job.watch[NUM2LONG(RARRAY_PTR(ids)[i])];
+    if(j != i)
+      memcpy(job.sizes + i*(job.order+1), job.sizes + j*(job.order+1), sizeof(double) * (job.order+1));
+  }
+
+  cIGraph_csr_destroy(&csr);
+  free(job.watch);
+  free(job.cur);
+  free(job.nxt);
+  IGRAPH_FINALLY_CLEAN(5);
+
+  if(job.failed){
+    free(job.sizes);
+    free(job.nf);
+    rb_raise(rb_eNoMemError, "Error allocating HyperLogLog counters");
+  }
+
+  *sizes = job.sizes;
+  *nf    = job.nf;
+
+  RB_GC_GUARD(ids);
+
+}
+
+/* call-seq:
+ *   graph.approximate_neighbourhood_size(vertices,order,mode,precision) -> Array
+ *
+ * Estimates the number of vertices within each distance 0..order of the 
+ * vertices in the vertices Array. Returns an Array with an Array of 
+ * order+1 Floats for each requested vertex. mode is IGraph::OUT, IGraph::IN 
+ * or IGraph::ALL as for IGraph#neighbourhood_size.
+ *
+ * Rather than a breadth first search from every vertex this propagates a
+ * HyperLogLog counter for every vertex of the graph at once (HyperANF), so 
+ * the cost is order sweeps over the edges however many vertices are asked 
+ * for. Each counter uses 2**precision bytes (4 to 16) and the typical
+ * relative error is 1.04/sqrt(2**precision), e.g. 3% for a precision of 10.
+ */
+VALUE cIGraph_approximate_neighborhood_size(VALUE self, VALUE from, VALUE order, VALUE mode, VALUE precision){
+
+  double *sizes;
+  double *nf;
+  long int i, t, k;
+  VALUE result = rb_ary_new();
+  VALUE row;
+
+  cIGraph_hll(self,from,order,mode,precision,&sizes,&nf);
+  k = NUM2INT(order);
+
+  for(i=0;i<RARRAY_LEN(from);i++){
+    row = rb_ary_new();
+    for(t=0;t<=k;t++)
+      rb_ary_push(row,rb_float_new(sizes[i*(k+1)+t]));
+    rb_ary_push(result,row);
+  }
+
+  free(sizes);
+  free(nf);
+
+  return result;
+
+}
+
+/* call-seq:
+ *   graph.approximate_neighbourhood_function(order,mode,precision) -> Array
+ *
+ * Estimates the neighbourhood function of the graph: for each distance 
+ * t from 0 to order the number of (ordered) pairs of vertices at most t 
+ * apart, counting each vertex as a pair with itself. The Array holds 
+ * order+1 Floats. The effective diameter (the distance within which e.g. 
+ * 90% of the reachable pairs lie) can be read off the result. See 
+ * IGraph#approximate_neighbourhood_size for the parameters.
+ */
+VALUE cIGraph_approximate_neighborhood_function(VALUE self, VALUE order, VALUE mode, VALUE precision){
+
+  double *sizes;
+  double *nf;
+  long int t, k;
+  VALUE result = rb_ary_new();
+
+  cIGraph_hll(self,Qnil,order,mode,precision,&sizes,&nf);
+  k = NUM2INT(order);
+
+  for(t=0;t<=k;t++)
+    rb_ary_push(result,rb_float_new(nf[t]));
+
+  free(sizes);
+  free(nf);
+
+  return result;
+
+}
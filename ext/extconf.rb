@@ -8,5 +8,26 @@ unless have_header("igraph.h")
   $stderr.puts "\nERROR: Cannot find the iGraph header, aborting."
   exit 1
 end
+
+#Optional: the native kernels run on several threads when pthreads are
+#available and release the global VM lock on interpreters that allow it.
+if have_header("pthread.h")
+  have_library("pthread")
+end
+if have_header("ruby/thread.h")
+  have_func("rb_thread_call_without_gvl", "ruby/thread.h")
+  have_func("rb_thread_call_without_gvl2", "ruby/thread.h")
+end
+
+#Optional: the file readers and writers stream through fopencookie.
+have_func("fopencookie", "stdio.h")
+
+#Optional: files read by path are mapped into memory.
+have_header("sys/mman.h")
+
+#Optional: gzip compressed files are read and written transparently.
+if have_header("zlib.h")
+  have_library("z")
+end
   
 create_makefile("igraph")
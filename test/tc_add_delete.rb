@@ -104,4 +104,18 @@ class TestGraph < Test::Unit::TestCase
     end
   end
 
+  def test_delete_missing_vertex
+    graph = IGraph.new(['A','B','C','D'],true)
+    assert_raises(IGraphError) do
+      graph.delete_vertex('E')
+    end
+    assert_equal 4, graph.vcount
+    #A later igraph error must not find anything left behind by the first
+    assert_raises(IGraphError) do
+      graph.delete_edge('A','C')
+    end
+    graph.delete_vertex('A')
+    assert_equal ['B','C','D'], graph.vertices
+  end
+
 end
@@ -18,6 +18,35 @@ class TestGraph < Test::Unit::TestCase
     g = IGraph.new(['A','B','C','D','E','B','F','B'],true)
     assert_equal 48, (g.pagerank(['B'],true,100,0.01,0.8)[0] * 100).to_i
   end 
+  def test_pagerank_tracker
+    edges = []
+    (1...200).each{|i| edges.push(i,i/2,i,i/3,i,(i+1)%200)}
+    g  = IGraph.new(edges,true)
+    pr = g.pagerank_tracker(true,1000,0.0000001,0.85)
+    assert_in_delta 1.0, pr.to_a.inject(0){|s,x| s+x}, 0.0001
+    assert !pr.stale?
+    assert_equal 0, pr.refresh
+    cold = pr.iterations
+    g.add_edges([150,160])
+    assert pr.stale?
+    warm = pr.refresh
+    assert warm < cold
+    assert_equal warm, pr.iterations
+    assert !pr.stale?
+    fresh = g.pagerank_tracker(true,1000,0.0000001,0.85)
+    g.vertices.each do |v|
+      assert_in_delta fresh[v], pr[v], 0.00001
+    end
+  end
+  def test_pagerank_tracker_delete
+    g  = IGraph.new(['A','B','B','C','C','A','C','D'],true)
+    pr = g.pagerank_tracker(true,1000,0.0000001,0.85)
+    g.delete_vertex('A')
+    pr.refresh
+    fresh = g.pagerank_tracker(true,1000,0.0000001,0.85)
+    assert_equal 3, pr.to_a.size
+    assert_in_delta fresh['D'], pr['D'], 0.00001
+  end
   def test_constraint
     g = IGraph.new(['A','B','C','D'],true)
     assert_equal [1], g.constraint(['A'])    
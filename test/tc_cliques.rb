@@ -5,6 +5,10 @@ class TestGraph < Test::Unit::TestCase
    def test_cliques
      g = IGraph.new([1,2,3,4],false)
      assert_equal [[1,2],[3,4]], g.cliques(2,0)
+     assert_equal 1, g.cliques(2,0,1).size
+     g = IGraph.new(['A','B','C','D','A','E','B','E'],false)
+     assert_equal [['A','B','E']], g.cliques(3,3)
+     assert_equal [['A','B'],['A','E'],['B','E'],['C','D']], g.cliques(2,2)
    end
    def test_largest_cliques
      g = IGraph.new(['A','B','C','D','A','E','B','E'],false)
@@ -18,4 +22,54 @@ class TestGraph < Test::Unit::TestCase
      g = IGraph.new(['A','B','C','D','A','E','B','E'],false)
      assert_equal 3, g.clique_number
    end
+   def test_each_clique
+     g = IGraph.new(['A','B','C','D','A','E','B','E'],false)
+     found = []
+     g.each_clique(2,0){|c| found << c.sort}
+     assert_equal [['A','B'],['A','B','E'],['A','E'],['B','E'],['C','D']], found.sort
+     assert_equal [['A','B','E']], g.each_clique(3,3).to_a.map{|c| c.sort}
+     assert_equal 2, g.each_clique(2,2,2).to_a.size
+     assert_equal 1, g.each_clique(1,0).lazy.first(1).size
+     found = []
+     g.cliques(2,2){|c| found << c}
+     assert_equal 4, found.size
+   end
+   def test_each_maximal_clique
+     g = IGraph.new(['A','B','C','D','A','E','B','E'],false)
+     assert_equal [['A','B','E'],['C','D']],
+       g.each_maximal_clique.map{|c| c.sort}.sort
+     assert_equal [['A','B','E']], g.each_maximal_clique(3).map{|c| c.sort}
+     assert_equal 1, g.each_maximal_clique(0,1).to_a.size
+     assert_instance_of Enumerator, g.each_maximal_clique
+   end
+   def test_cliques_threads
+     edges = []
+     (0...12).each{|i| (i+1...12).each{|j| edges << i << j if (i*j) % 3 != 1}}
+     g = IGraph.new(edges,false)
+     threads = IGraph.threads
+     begin
+       IGraph.threads = 1
+       single  = g.maximal_cliques
+       streamed = g.each_maximal_clique.to_a.sort
+       number  = g.clique_number
+       largest = g.largest_cliques
+       IGraph.threads = 4
+       assert_equal single, g.maximal_cliques
+       assert_equal streamed, g.each_maximal_clique.to_a.sort
+       assert_equal single, streamed
+       assert_equal number, g.clique_number
+       assert_equal largest, g.largest_cliques
+       assert_equal 3, g.each_maximal_clique(0,3).to_a.size
+       assert largest.all?{|c| c.size == number}
+     ensure
+       IGraph.threads = threads
+     end
+   end
+   def test_each_largest_clique
+     g = IGraph.new(['A','B','C','D','A','E','B','E'],false)
+     assert_equal [['A','B','E']], g.each_largest_clique.map{|c| c.sort}
+     found = []
+     g.largest_cliques{|c| found << c.sort}
+     assert_equal [['A','B','E']], found
+   end
 end
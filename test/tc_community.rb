@@ -5,6 +5,14 @@ class TestGraph < Test::Unit::TestCase
   def test_modularity
     g = IGraph.new(['A','B','B','C','A','C','C','D','D','E','E','F','D','F'])
     assert_in_delta 0.357, g.modularity([['A','B','C'],['D','E','F']]), 0.001
+    assert_in_delta 0.357, g.modularity([0,0,0,1,1,1].pack('l*')), 0.001
+    assert_in_delta 0.045, g.modularity([0,0,0,1,1,1],[1,1,1,5,1,1,1]), 0.001
+    q = g.modularity_batch([[0,0,0,1,1,1],[0,0,0,0,0,0],[['A','B','C'],['D','E','F']]])
+    assert_in_delta 0.357, q[0], 0.001
+    assert_in_delta 0.0,   q[1], 0.001
+    assert_equal q[0], q[2]
+    assert_raises(IGraphError){ g.modularity([0,0,0,1,1]) }
+    assert_raises(IGraphError){ g.modularity([['A','B','C'],['D','E','F'],[],[],[],[],[]]) }
   end
   def test_spinglass
     g = IGraph.new(['A','B','B','C','A','C','C','D','D','E','E','F','D','F'])
@@ -69,4 +77,73 @@ class TestGraph < Test::Unit::TestCase
     assert_in_delta 0.19, mod[3], 0.1
   end
 
+  def test_louvain
+    g = IGraph.new(['A','B','B','C','A','C','C','D','D','E','E','F','D','F'],false)
+    memb,mod = g.community_louvain(nil,1.0,42)
+    assert_equal [0,0,0,1,1,1], memb.unpack('l*')
+    assert_in_delta 0.357, mod.last, 0.001
+    memb,mod = g.community_louvain([1,1,1,5,1,1,1],1.0,42)
+    assert_equal [0,0,1,1,2,2], memb.unpack('l*')
+  end
+
+  def test_leiden
+    g = IGraph.new(['A','B','B','C','A','C','C','D','D','E','E','F','D','F'],false)
+    t = IGraph.threads
+    IGraph.threads = 1
+    memb,mod = g.community_leiden(nil,1.0,42)
+    assert_equal [0,0,0,1,1,1], memb.unpack('l*')
+    assert_in_delta 0.357, mod.last, 0.001
+    IGraph.threads = 4
+    assert_equal [memb,mod], g.community_leiden(nil,1.0,42)
+    memb,mod = g.community_leiden(nil,0.1,42)
+    assert_equal 1, memb.unpack('l*').uniq.size
+  ensure
+    IGraph.threads = t
+  end
+
+  def test_label_propagation
+    g = IGraph.new(['A','B','B','C','A','C','C','D','D','E','E','F','D','F'],false)
+    t = IGraph.threads
+    IGraph.threads = 1
+    memb,sweeps,conv = g.community_label_propagation(nil,IGraph::LPA_SEMISYNC,nil,100,42)
+    assert conv
+    IGraph.threads = 4
+    assert_equal [memb,sweeps,conv], g.community_label_propagation(nil,IGraph::LPA_SEMISYNC,nil,100,42)
+    memb,sweeps,conv = g.community_label_propagation(nil,IGraph::LPA_ASYNC,[0,0,0,1,1,1].pack('l*'))
+    assert_equal [0,0,0,1,1,1], memb.unpack('l*')
+    assert_equal 1, sweeps
+    g = IGraph.new(['A','B','B','C','C','D'],false,[{'w'=>5},{'w'=>0},{'w'=>5}])
+    memb,sweeps,conv = g.community_label_propagation('w',IGraph::LPA_SEMISYNC,nil,100,42)
+    assert_equal [0,0,1,1], memb.unpack('l*')
+    assert_raises(IGraphError){ g.community_label_propagation([1,-1,1]) }
+    assert_raises(IGraphError){ g.community_label_propagation(nil,IGraph::LPA_ASYNC,[0,0,0,0,0]) }
+  ensure
+    IGraph.threads = t
+  end
+
+  def test_spinglass_replicas
+    g = IGraph.new(['A','B','B','C','A','C','C','D','D','E','E','F','D','F'],false)
+    t = IGraph.threads
+    IGraph.threads = 1
+    res = g.community_spinglass_replicas(4,nil,6,1.0,0.01,0.95,IGraph::SPINCOMM_UPDATE_CONFIG,1.0,false,42)
+    assert_equal 4, res.size
+    memb,mod,energy,temp = res[0]
+    assert_equal [0,0,0,1,1,1], memb.unpack('l*')
+    assert_in_delta 0.357, mod, 0.001
+    assert res.all?{|r| r[2] >= energy }
+    IGraph.threads = 4
+    assert_equal res, g.community_spinglass_replicas(4,nil,6,1.0,0.01,0.95,IGraph::SPINCOMM_UPDATE_CONFIG,1.0,false,42)
+    res = g.community_spinglass_replicas(4,nil,6,1.0,0.01,0.95,IGraph::SPINCOMM_UPDATE_CONFIG,1.0,true,42)
+    assert_equal [0,0,0,1,1,1], res[0][0].unpack('l*')
+    g = IGraph.new([],false)
+    g.add_vertices(['A','B','C'])
+    res = g.community_spinglass_replicas(2,nil,3,1.0,0.01,0.95,IGraph::SPINCOMM_UPDATE_CONFIG,1.0,false,42)
+    memb,mod,energy,temp = res[0]
+    assert_equal 3, memb.unpack('l*').size
+    assert_equal 0, mod
+    assert_equal 0, energy
+  ensure
+    IGraph.threads = t
+  end
+
 end
@@ -10,4 +10,19 @@ class TestGraph < Test::Unit::TestCase
     h['A','B'] = g['A','B'] + 1
     assert g['A','B'] != h['A','B']
   end
+  def test_marshal
+    g = IGraph.new(['A','B','C','D'],true,[1,2.5])
+    g.attributes['name'] = 'test'
+    h = Marshal.load(Marshal.dump(g))
+    assert h.directed?
+    assert_equal g.vertices, h.vertices
+    assert_equal 2.5, h['C','D']
+    assert_equal 'test', h.attributes['name']
+    assert !h.are_connected?('B','A')
+    g = IGraph.new([1,2,2,3,3,1],false)
+    h = Marshal.load(Marshal.dump([g]))[0]
+    assert !h.directed?
+    assert_equal 3, h.ecount
+    assert h.are_connected?(1,3)
+  end
 end
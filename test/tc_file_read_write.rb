@@ -21,6 +21,61 @@ class TestGraph < Test::Unit::TestCase
     assert g.are_connected?(0,1)
   end
 
+  def test_edgelist_read_streaming
+    return if CONFIG['host'] =~ /apple/
+    path = "/tmp/igraph_test_#{$$}.txt"
+    File.open(path,'w'){|f| 100000.times{|i| f.puts "#{i} #{i+1}"}}
+    g = File.open(path){|f| IGraph::FileRead.read_graph_edgelist(f,true) }
+    assert_equal 100001, g.vcount
+    assert_equal 100000, g.ecount
+    g = File.open(path){|f| f.gets; IGraph::FileRead.read_graph_edgelist(f,true) }
+    assert_equal 99999, g.ecount
+    io = Object.new
+    def io.read(n); raise IOError, 'broken' if @done; @done = true; "0 1\n"; end
+    assert_raises(IOError){ IGraph::FileRead.read_graph_edgelist(io,true) }
+  ensure
+    File.delete(path) if path && File.exist?(path)
+  end
+
+  def test_read_path
+    return if CONFIG['host'] =~ /apple/
+    path = "/tmp/igraph_test_#{$$}.txt"
+    File.open(path,'w'){|f| f.write "0 1\n2\n3 4 5\n" }
+    g = IGraph::FileRead.read_graph_edgelist(path,true)
+    assert_equal 6, g.vcount
+    assert_equal 3, g.ecount
+    assert g.are_connected?(2,3)
+    File.open(path,'w'){|f| f.write "A B 1\nC D 2.5\n\nB C\n" }
+    g = IGraph::FileRead.read_graph_ncol(path,['D'],true,true,false)
+    assert_equal ['D','A','B','C'], g.vertices
+    assert_equal 2.5, g['C','D']
+    assert_equal 0, g['B','C']
+    File.open(path,'w'){|f| f.write "# A\nB 1\nC\n#D\n" }
+    g = IGraph::FileRead.read_graph_lgl(path,true,true)
+    assert_equal ['A','B','C','D'], g.vertices
+    assert_equal 1, g['A','B']
+    File.open(path,'w'){|f| 100000.times{|i| f.puts "v#{i*7%30011} v#{i%1000} #{i%10}" }}
+    g = IGraph::FileRead.read_graph_ncol(path,[],true,true,true)
+    h = File.open(path){|f| IGraph::FileRead.read_graph_ncol(f,[],true,true,true) }
+    assert_equal h.vertices, g.vertices
+    e = []
+    g.each_edge(IGraph::EDGEORDER_ID){|v,w| e.push([v,w,g[v,w]]) }
+    h.each_edge(IGraph::EDGEORDER_ID){|v,w| assert_equal e.shift, [v,w,h[v,w]] }
+    File.open(path,'w'){|f| f.write "0 1\n2\n" }
+    assert_raises(IGraphError){ IGraph::FileRead.read_graph_edgelist(path,true) }
+    assert_raises(Errno::ENOENT){ IGraph::FileRead.read_graph_edgelist(path + '.missing',true) }
+    #Large enough for several chunks, the first ending inside a pair
+    t = IGraph.threads
+    IGraph.threads = 2
+    File.open(path,'w'){|f| f.write "0 1 2\n" + "3 4\n" * 600000 + "5\n" }
+    g = IGraph::FileRead.read_graph_edgelist(path,true)
+    assert_equal 600002, g.ecount
+    g.add_edges([0,5],['x'])
+    assert_equal 'x', g[0,5]
+  ensure
+    IGraph.threads = t if t
+    File.delete(path) if path && File.exist?(path)
+  end
   def test_edgelist_write
     g = IGraph.new([0,1,2,3])
     s = StringIO.new("")
@@ -82,6 +137,42 @@ class TestGraph < Test::Unit::TestCase
     str = g.write_graph_ncol(s,true,true)
     s.rewind
     assert_equal "A B 1.0\nC D 2.0\n", s.read
+    assert_equal ["A","B","C","D"], g.vertices
+    assert_equal 2, g['C','D']
+  end
+
+  def test_gzip
+    return if CONFIG['host'] =~ /apple/
+    path = "/tmp/igraph_test_#{$$}.ncol.gz"
+    g = IGraph.new(["A","B","C","D","B","C"],false,[1,2,3])
+    File.open(path,'wb'){|f| g.write_graph_ncol(f,true,true) }
+    assert_equal "\x1f\x8b".b, File.binread(path,2)
+    [path, File.open(path,'rb'), StringIO.new(File.binread(path))].each do |file|
+      h = IGraph::FileRead.read_graph_ncol(file,[],true,true,false)
+      assert_equal ["A","B","C","D"], h.vertices.sort
+      assert_equal 3, h['B','C']
+    end
+    assert_raises(IGraphError){
+      IGraph::FileRead.read_graph_ncol(StringIO.new(File.binread(path)[0,20]),[],true,true,false)
+    }
+  ensure
+    File.unlink(path) if path and File.exist?(path)
+  end
+
+  def test_write_file
+    return if CONFIG['host'] =~ /apple/
+    path = "/tmp/igraph_test_#{$$}.txt"
+    g = IGraph.new((0...20000).to_a.map{|i| i % 997},false)
+    s = StringIO.new("")
+    g.write_graph_edgelist(s)
+    File.open(path,'w'){|f|
+      f.write "#edges\n"
+      g.write_graph_edgelist(f)
+    }
+    assert_equal "#edges\n" + s.string, File.read(path)
+    assert_equal 10000, s.string.count("\n")
+  ensure
+    File.unlink(path) if path and File.exist?(path)
   end
 
   def test_lgl_read
@@ -157,6 +248,9 @@ class TestGraph < Test::Unit::TestCase
     str = g.write_graph_dimacs(s,0,1,[1,2])
     s.rewind
     assert_equal "c created by igraph\np max 4 2\nn 1 s\nn 2 t\na 1 2 1\na 3 4 2\n", s.read
+    assert_raises(TypeError){ g.write_graph_dimacs(StringIO.new(""),0,1,[1,'x']) }
+    s.close
+    assert_raises(IOError){ g.write_graph_dimacs(s,0,1,[1,2]) }
   end
 
   def test_graphml_read
@@ -179,6 +273,64 @@ class TestGraph < Test::Unit::TestCase
     assert_equal g.attributes['date'], h.attributes['date']
   end
 
+  def test_graphml_read_columns
+    if CONFIG['host'] =~ /apple/
+       assert_raises(NoMethodError){
+         IGraph::FileRead.read_graph_graphml_columns(StringIO.new(Graphml),0)
+       }
+       return
+    end
+    err = StringIO.open('','w')
+    $stderr = err
+    g, v, e = IGraph::FileRead.read_graph_graphml_columns(StringIO.new(Graphml),0)
+    $stderr = STDERR
+    assert_instance_of IGraph, g
+    assert !g.is_directed?
+    assert_equal [0,1,2,3,4,5], g.vertices
+    assert_equal 7, g.ecount
+    assert_equal '2006-11-12', g.attributes['date']
+    assert_equal :string, v['color'].type
+    assert_equal ['green',nil,'blue','red',nil,'turquoise'], v['color'].to_a
+    assert_equal ['green','blue','red','turquoise'], v['color'].dictionary
+    assert_equal %w{n0 n1 n2 n3 n4 n5}, v['id'].to_a
+    assert_equal :double, e['weight'].type
+    assert_equal 1.0, e['weight'][g[0,2]]
+    assert_equal 2.0, e['weight'][g[1,3]]
+    assert e['weight'][g[3,2]].nan?
+    assert_equal 1.1, e['weight'][-1]
+    assert_nil e['weight'][7]
+    g.delete_vertex(0)
+    assert_equal 'n1', v['id'][g.vertices[0]]
+
+    doc = %q{<?xml version="1.0"?>
+<graphml xmlns="http://graphml.graphdrawing.org/xmlns">
+  <key id="k0" for="node" attr.name="label" attr.type="string"><default>none</default></key>
+  <key id="k1" for="edge" attr.name="on" attr.type="boolean"/>
+  <graph edgedefault="undirected"><node id="a"/></graph>
+  <graph edgedefault="directed">
+    <edge source="x" target="y"><data key="k1">true</data></edge>
+    <node id="y"><data key="k0">caf&#xE9; &lt;b&gt;&#0;&#xD800;</data></node>
+    <node id="x"><!-- a comment --><data key="k0"><![CDATA[<i>]]>&amp;<![CDATA[a&lt;b]]></data></node>
+    <node id="z"/>
+  </graph>
+</graphml>
+}
+    path = "/tmp/igraph_test_#{$$}.graphml"
+    File.open(path,'w'){|f| f.write doc}
+    g, v, e = IGraph::FileRead.read_graph_graphml_columns(path,1)
+    assert g.is_directed?
+    assert_equal 3, g.vcount
+    assert g.are_connected?(0,1)
+    assert_equal %w{x y z}, v['id'].to_a
+    assert_equal ['<i>&a&lt;b', "caf\303\251 <b>&#0;&#xD800;", 'none'], v['label'].to_a
+    assert_equal [1.0], e['on'].to_a
+    assert_raises(IGraphError){
+      IGraph::FileRead.read_graph_graphml_columns(path,2)
+    }
+  ensure
+    File.unlink(path) if path && File.exist?(path)
+  end
+
   def test_graphml_write
     g = IGraph.new([{'id'=>0,'name'=>'a','type' => 4.0},
                     {'id'=>1,'name'=>'b','type' => 5},
@@ -234,6 +386,96 @@ class TestGraph < Test::Unit::TestCase
     #assert_equal Gml_out, s
   end
 
+  def test_snapshot
+    path = "/tmp/igraph_test_#{$$}.snap"
+    g = IGraph.new(['A','B','C','D'],true,[1.5,2.5])
+    g.attributes['name'] = 'test'
+    File.open(path,'wb'){|f| g.write_graph_snapshot(f) }
+    h = IGraph::FileRead.read_graph_snapshot(path)
+    assert h.directed?
+    assert_equal ['A','B','C','D'], h.vertices
+    assert_equal 2.5, h['C','D']
+    assert_equal 'test', h.attributes['name']
+    assert !h.are_connected?('B','A')
+    h = File.open(path,'rb'){|f| IGraph::FileRead.read_graph_snapshot(f) }
+    assert_equal 2, h.ecount
+    g = IGraph.new([[1],:b,3,4],false,[{'w'=>1},nil])
+    s = StringIO.new
+    g.write_graph_snapshot(s)
+    h = IGraph::FileRead.read_graph_snapshot(StringIO.new(s.string))
+    assert !h.directed?
+    assert_equal [[1],:b,3,4], h.vertices
+    assert_equal({'w'=>1}, h[[1],:b])
+    assert h.are_connected?(4,3)
+    data = s.string.dup
+    data.setbyte(data.size - 1, data.getbyte(data.size - 1) ^ 1)
+    assert_raises(IGraphError){ IGraph::FileRead.read_graph_snapshot(StringIO.new(data)) }
+    data = s.string.dup
+    data.setbyte(8, 99)
+    assert_raises(IGraphError){ IGraph::FileRead.read_graph_snapshot(StringIO.new(data)) }
+  ensure
+    File.delete(path) if path && File.exist?(path)
+  end
+
+  def test_mutation_log
+    path = "/tmp/igraph_test_#{$$}.log"
+    g = IGraph.new(['A','B','C','D'],true,[1.5,2.5])
+    g.open_log(path)
+    100.times{|i| g.add_vertex(i); g.add_edge('A',i,i * 0.5) }
+    g.add_edges(['B','C',1,2],[:x,nil])
+    g['A','B'] = {'w' => 2}
+    g.delete_edge('C','D')
+    g.delete_vertex(7)
+    g.attributes['name'] = 'test'
+    g.sync_log
+    h = IGraph.replay_log(path)
+    assert_equal g.vertices, h.vertices
+    e = []
+    g.each_edge(IGraph::EDGEORDER_ID){|v,w| e << [v,w] }
+    h.each_edge(IGraph::EDGEORDER_ID){|v,w| assert_equal e.shift, [v,w] }
+    assert e.empty?
+    assert_equal({'w' => 2}, h['A','B'])
+    assert_equal :x, h['B','C']
+    assert_equal 'test', h.attributes['name']
+    g.attributes['name'] << 'ed'
+    g.sync_log
+    assert_equal 'tested', IGraph.replay_log(path).attributes['name']
+    g.to_undirected(IGraph::EACH)
+    g.add_vertex('E')
+    g.close_log
+    h = IGraph.replay_log(path)
+    assert !h.directed?
+    assert_equal g.vcount, h.vcount
+    assert_equal g.ecount, h.ecount
+    #A change cut short by a crash ends the log
+    data = File.binread(path)
+    File.binwrite(path, data[0..-2])
+    assert !IGraph.replay_log(path).vertices.include?('E')
+    g.open_log(path)
+    200.times{|i| g.add_vertex("F#{i}"); g.delete_vertex("F#{i}") }
+    g.add_vertex('F')
+    g.sync_log
+    size = File.size(path)
+    g.compact_log
+    assert File.size(path) < size
+    h = IGraph.replay_log(path)
+    assert h.vertices.include?('F')
+    g.close_log
+    #Changes before an object that cannot be dumped are kept
+    g.open_log(path)
+    g.add_vertex('G')
+    g.add_vertex(proc{})
+    assert_raises(TypeError){ g.sync_log }
+    assert_raises(TypeError){ g.close_log }
+    h = IGraph.replay_log(path)
+    assert h.vertices.include?('G')
+    assert_equal g.vcount - 1, h.vcount
+    File.binwrite(path, 'not a log')
+    assert_raises(IGraphError){ IGraph.replay_log(path) }
+  ensure
+    File.delete(path) if path && File.exist?(path)
+  end
+
   def test_pajek_read_write
     if CONFIG['host'] =~ /apple/
        assert_raises(NoMethodError){
@@ -68,4 +68,40 @@ class TestGraph < Test::Unit::TestCase
     assert_equal g.vcount + h.vcount, f.nrow
     assert_equal 2,                   f.ncol
   end
+  def test_fruchterman_reingold_bh
+    g = IGraph.new([1,2,2,3,3,4,4,1],false)
+    l = g.layout_fruchterman_reingold_bh(50,0.8,nil,42)
+    assert_instance_of IGraphMatrix, l
+    assert_equal g.vcount, l.nrow
+    assert_equal 2,        l.ncol
+    assert_equal l.to_a, g.layout_fruchterman_reingold_bh(50,0.8,nil,42).to_a
+    m = g.layout_fruchterman_reingold_bh(10,0.0,l)
+    assert_same l, m
+    assert_raises(IGraphError){ g.layout_fruchterman_reingold_bh(10,0.8,IGraphMatrix.new([1,2])) }
+  end
+  def test_multilevel
+    g = IGraph.new((0...200).map{|i| [i,(i+1)%200]}.flatten,false)
+    l = g.layout_multilevel(20,0.8,42)
+    assert_instance_of IGraphMatrix, l
+    assert_equal g.vcount, l.nrow
+    assert_equal 2,        l.ncol
+    assert_equal l.to_a, g.layout_multilevel(20,0.8,42).to_a
+  end
+  def test_incremental
+    g = IGraph.new(['A','B','B','C','C','D'],false)
+    l = g.layout_fruchterman_reingold_bh(50,0.8,nil,42)
+    old = g.vertices.dup
+    g.add_vertices(['E'])
+    g.add_edges(['D','E'])
+    m = g.layout_incremental(l,old,['D'],1,50,42)
+    assert_equal 5, m.nrow
+    assert_equal 2, m.ncol
+    assert_equal l.to_a[0..1], m.to_a[0..1]
+    assert_equal m.to_a, g.layout_incremental(l,old,['Z','D','D'],1,50,42).to_a
+    m = g.layout_incremental(l,old,[],0,0,42)
+    assert_equal l.to_a, m.to_a[0..3]
+    d = Math.sqrt((m[4,0]-m[3,0])**2 + (m[4,1]-m[3,1])**2)
+    assert d < Math.sqrt((l[0,0]-l[3,0])**2 + (l[0,1]-l[3,1])**2)
+    assert_raises(IGraphError){ g.layout_incremental(l,old[0..2]) }
+  end
 end
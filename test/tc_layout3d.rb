@@ -31,4 +31,20 @@ class TestGraph < Test::Unit::TestCase
     assert_equal 3,        l.ncol
   end  
   
+  def test_fruchterman_reingold_bh_3d
+    g = IGraph.new([1,2,3,4],true)
+    l = g.layout_fruchterman_reingold_bh_3d(10,0.8)
+    assert_instance_of IGraphMatrix, l
+    assert_equal g.vcount, l.nrow
+    assert_equal 3,        l.ncol
+  end
+
+  def test_multilevel_3d
+    g = IGraph.new([1,2,3,4],true)
+    l = g.layout_multilevel_3d(10,0.8)
+    assert_instance_of IGraphMatrix, l
+    assert_equal g.vcount, l.nrow
+    assert_equal 3,        l.ncol
+  end
+
 end
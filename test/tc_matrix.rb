@@ -29,4 +29,17 @@ class TestGraph < Test::Unit::TestCase
     m = IGraphMatrix.new([1,2],[3,4])
     assert_equal [[1,2],[3,4]], m.to_a
   end
+  def test_pack
+    m = IGraphMatrix.new([1,2],[3,4.5])
+    assert_equal [1,2,3,4.5], m.pack.unpack('d*')
+    assert_equal [1,3,2,4.5], m.pack(IGraphMatrix::FLOAT64,IGraphMatrix::COLUMN_MAJOR).unpack('d*')
+    assert_equal [1,2,3,4.5], m.pack(IGraphMatrix::FLOAT32).unpack('f*')
+    assert_equal m.to_a, IGraphMatrix.unpack(m.pack,2,2).to_a
+    n = IGraphMatrix.unpack([1,3,2,4.5].pack('f*'),2,2,IGraphMatrix::FLOAT32,IGraphMatrix::COLUMN_MAJOR)
+    assert_equal m.to_a, n.to_a
+    assert_raises(IGraphError){ IGraphMatrix.unpack([1,2,3].pack('d*'),2,2) }
+    assert_raises(IGraphError){ IGraphMatrix.unpack(m.pack,2,2,2) }
+    assert_raises(IGraphError){ IGraphMatrix.unpack(m.pack,2,2,IGraphMatrix::FLOAT64,-1) }
+    assert_raises(IGraphError){ m.pack(IGraphMatrix::FLOAT64,2) }
+  end
 end
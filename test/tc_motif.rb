@@ -11,9 +11,32 @@ class TestGraph < Test::Unit::TestCase
     g = IGraph.new(['A','B','C','D','A','C'],false)
     assert_equal 2, g.motifs_randesu_no(3,[0,0,0])    
   end
+  def test_motifs_randesu_threads
+    g = IGraph.new(['A','B','B','C','C','A','C','D','D','E'],true)
+    t = IGraph.threads
+    IGraph.threads = 1
+    hist = g.motifs_randesu(3,[0,0,0])
+    assert_equal 16, hist.size
+    assert_equal 4, hist.inject(0){|a,b| a+b}
+    IGraph.threads = 4
+    assert_equal hist, g.motifs_randesu(3,[0,0,0])
+    assert_equal g.motifs_randesu(4,[0.5,0.5,0.5,0.5],7),
+                 g.motifs_randesu(4,[0.5,0.5,0.5,0.5],7)
+  ensure
+    IGraph.threads = t
+  end
   def test_motifs_randesu_estimate
     g = IGraph.new(['A','B','C','D','A','C'],false)
     assert_equal 2, g.motifs_randesu_estimate(3,[0,0,0],4,nil)
     assert_equal 2, g.motifs_randesu_estimate(3,[0,0,0],0,['A','B','C','D'])
   end 
+  def test_motifs_randesu_adaptive
+    g = IGraph.new(['A','B','C','D','A','C'],false)
+    est, lower, upper, samples = g.motifs_randesu_adaptive(3,[0,0,0],nil,0.01,1)
+    assert_equal [0,0,2,0], est
+    assert_equal est, lower
+    assert_equal est, upper
+    assert_equal 4, samples
+    assert_raises(IGraphError){ g.motifs_randesu_adaptive(3,[0,0,0],nil,nil) }
+  end
 end
@@ -41,4 +41,34 @@ class TestGraph < Test::Unit::TestCase
     assert_equal 4, graph.girth.length
   end
 
+  def test_diameter_undirected
+    graph = IGraph.new(['A','B','B','C','C','D','B','E','F','G'],false)
+    m = graph.diameter(false,true)
+    assert_equal 4, m.length
+    assert m.include?('D')
+    graph = IGraph.new(['A','B','B','C','C','D','B','E'],false)
+    assert_equal 4, graph.diameter(false,false).length
+  end
+
+  def test_eccentricity_radius
+    graph = IGraph.new(['A','B','B','C','C','D','B','E','F','G'],false)
+    assert_equal [3,2,2,3,3,1], graph.eccentricity(['A','B','C','D','E','F'])
+    assert_equal 1, graph.radius
+    graph = IGraph.new(['A','B','B','C','C','D','B','E'],false)
+    assert_equal 2, graph.radius
+  end
+
+  def test_average_path_length_estimate
+    graph = IGraph.new(['A','B','A','C','B','D','C','D'],true)
+    est, lo, hi = graph.average_path_length_estimate(true,10,1)
+    assert_in_delta graph.average_path_length(true,true), est, 0.0001
+    assert_equal est, lo
+    assert_equal est, hi
+    graph = IGraph.new((0...99).map{|i| [i,i+1]}.flatten,false)
+    est, lo, hi = graph.average_path_length_estimate(false,30,1)
+    assert lo <= est && est <= hi
+    assert_in_delta 33.67, est, 10
+  end
+
+
 end
@@ -14,4 +14,19 @@ class TestGraph < Test::Unit::TestCase
     g = IGraph.new(['A','B','A','C','A','D','B','C'],true)
     assert_equal 0.6, g.transitivity
   end
+  def test_triangle_counts
+    g = IGraph.new(['A','B','A','C','A','D','B','C','C','D','D','E'],false)
+    assert_equal 2, g.triangle_count
+    assert_equal [2,1,2,1,0], g.local_triangle_count(['A','B','C','D','E'])
+    assert_equal [1,2,1,1,1,0], g.edge_triangle_count
+    assert_in_delta 2.0/3, g.transitivity_local(['A'])[0], 0.0001
+    assert g.transitivity_local(['E'])[0].nan?
+  end
+  def test_triangle_cache
+    g = IGraph.new(['A','B','A','C'],false)
+    assert_equal 0, g.triangle_count
+    g.add_edges(['B','C'])
+    assert_equal 1, g.triangle_count
+    assert_equal 1.0, g.transitivity
+  end
 end
@@ -26,4 +26,28 @@ class TestGraph < Test::Unit::TestCase
     assert_equal 2, graph.neighbourhood_graphs(['A'],2,IGraph::ALL)[0]['B','C']
     
   end
+  def test_approximate_neighbourhood_size
+    graph = IGraph.new(['A','B','B','C','C','D'],true)
+    sizes = graph.approximate_neighbourhood_size(['A','D'],3,IGraph::ALL,10)
+    [[1,2,3,4],[1,2,3,4]].flatten.zip(sizes.flatten).each do |exact,est|
+      assert_in_delta exact, est, 0.5
+    end
+    sizes = graph.approximate_neighbourhood_size(['A'],2,IGraph::OUT,10)[0]
+    assert_in_delta 3, sizes[2], 0.5
+    sizes = graph.approximate_neighbourhood_size(['A'],2,IGraph::IN,10)[0]
+    assert_in_delta 1, sizes[2], 0.5
+    sizes = graph.approximate_neighbourhood_size(['A','D','A'],3,IGraph::ALL,10)
+    assert_equal sizes[0], sizes[2]
+    assert_raises(IGraphError){
+      graph.approximate_neighbourhood_size(['A'],2,5,10)
+    }
+  end
+  def test_approximate_neighbourhood_function
+    graph = IGraph.new(['A','B','B','C','C','D'],false)
+    nf = graph.approximate_neighbourhood_function(3,IGraph::ALL,10)
+    assert_equal 4, nf.length
+    [4,10,14,16].zip(nf).each do |exact,est|
+      assert_in_delta exact, est, 1
+    end
+  end
 end